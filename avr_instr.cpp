@@ -0,0 +1,278 @@
+#include <string.h>
+#include "math_utils.h"
+#include "avr_instr.h"
+
+const MNEM_INFO_t mnem_info[MN_COUNT] = {
+    { "",       FMT_NONE,    "" },
+    { "nop",    FMT_NONE,    "" },
+    { "movw",   FMT_MOVW,    "" },
+    { "cpc",    FMT_RR,      "" },
+    { "cp",     FMT_RR,      "" },
+    { "sbc",    FMT_RR,      "" },
+    { "sub",    FMT_RR,      "" },
+    { "add",    FMT_RR,      "" },
+    { "adc",    FMT_RR,      "" },
+    { "lsl",    FMT_R,       "" },
+    { "rol",    FMT_R,       "" },
+    { "cpse",   FMT_RR,      "" },
+    { "and",    FMT_RR,      "" },
+    { "eor",    FMT_RR,      "" },
+    { "or",     FMT_RR,      "" },
+    { "mov",    FMT_RR,      "" },
+    { "cpi",    FMT_RK,      "" },
+    { "sbci",   FMT_RK,      "" },
+    { "subi",   FMT_RK,      "" },
+    { "ori",    FMT_RK,      "" },
+    { "andi",   FMT_RK,      "" },
+    { "ldd",    FMT_LDD,     "" },
+    { "std",    FMT_STD,     "" },
+    { "lds",    FMT_LDS,     "" },
+    { "sts",    FMT_STS,     "" },
+    { "ld",     FMT_LD,      "" },
+    { "st",     FMT_ST,      "" },
+    { "lpm",    FMT_LD,      "" },
+    { "elpm",   FMT_LD,      "" },
+    { "push",   FMT_R,       "" },
+    { "pop",    FMT_R,       "" },
+    { "com",    FMT_R,       "" },
+    { "neg",    FMT_R,       "" },
+    { "swap",   FMT_R,       "" },
+    { "inc",    FMT_R,       "" },
+    { "asr",    FMT_R,       "" },
+    { "lsr",    FMT_R,       "" },
+    { "ror",    FMT_R,       "" },
+    { "se",     FMT_SREG,    "" },
+    { "cl",     FMT_SREG,    "" },
+    { "ret",    FMT_NONE,    "" },
+    { "reti",   FMT_NONE,    "" },
+    { "sleep",  FMT_NONE,    "" },
+    { "break",  FMT_NONE,    "" },
+    { "wdr",    FMT_NONE,    "" },
+    { "lpm",    FMT_NONE,    "" },
+    { "elpm",   FMT_NONE,    "" },
+    { "spm",    FMT_NONE,    "" },
+    { "spm Z+", FMT_NONE,    "" },
+    { "ijmp",   FMT_NONE,    "" },
+    { "icall",  FMT_NONE,    "" },
+    { "eijmp",  FMT_NONE,    "" },
+    { "eicall", FMT_NONE,    "" },
+    { "dec",    FMT_R,       "" },
+    { "jmp",    FMT_TARGET,  "" },
+    { "call",   FMT_TARGET,  "" },
+    { "adiw",   FMT_PAIR_K,  "" },
+    { "sbiw",   FMT_PAIR_K,  "" },
+    { "cbi",    FMT_IO_BIT,  "" },
+    { "sbi",    FMT_IO_BIT,  "" },
+    { "sbic",   FMT_IO_BIT,  "" },
+    { "sbis",   FMT_IO_BIT,  "" },
+    { "mul",    FMT_RR,      "" },
+    { "in",     FMT_IN,      "" },
+    { "out",    FMT_OUT,     "" },
+    { "rjmp",   FMT_TARGET,  "" },
+    { "rcall",  FMT_TARGET,  "" },
+    { "ldi",    FMT_RK,      "" },
+    { "brlo",   FMT_TARGET,  "\t// brcs" },
+    { "breq",   FMT_TARGET,  "" },
+    { "brmi",   FMT_TARGET,  "" },
+    { "brvs",   FMT_TARGET,  "" },
+    { "brlt",   FMT_TARGET,  "" },
+    { "brhs",   FMT_TARGET,  "" },
+    { "brts",   FMT_TARGET,  "" },
+    { "brie",   FMT_TARGET,  "" },
+    { "brsh",   FMT_TARGET,  "\t// brcc" },
+    { "brne",   FMT_TARGET,  "" },
+    { "brpl",   FMT_TARGET,  "" },
+    { "brvc",   FMT_TARGET,  "" },
+    { "brge",   FMT_TARGET,  "" },
+    { "brhc",   FMT_TARGET,  "" },
+    { "brtc",   FMT_TARGET,  "" },
+    { "brid",   FMT_TARGET,  "" },
+    { "bld",    FMT_REG_BIT, "" },
+    { "bst",    FMT_REG_BIT, "" },
+    { "sbrc",   FMT_REG_BIT, "" },
+    { "sbrs",   FMT_REG_BIT, "" }
+};
+
+const char io_name[64][10] =
+ {"TWBR", "TWSR", "TWAR", "TWDR", "ADCL", "ADCH", "ADCSRA", "ADMUX", "ACSR", "UBRRL",
+  "UCSRB", "UCSRA", "UDR", "SPCR", "SPSR", "SPDR", "PIND",   "DDRD", "PORTD", "PINC",
+  "DDRC", "PORTC", "PINB", "DDRB", "PORTB", "$19", "$1A",    "$1B", "EECR", "EEDR",
+  "EEARL", "EEARH", "UBRRH", "WDTCR", "ASSR", "OCR2", "TCNT2", "TCCR2", "ICR1L", "ICR1H",
+  "OCR1BL", "OCR1BH", "OCR1AL", "OCR1AH", "TCNT1L", "TCNT1H", "TCCR1B", "TCCR1A", "SFIOR", "OSCCAL",
+  "TCNT0", "TCCR0", "MCUCSR", "MCUCR", "TWCR", "SPMCR", "TIFR", "TIMSK", "GIFR", "GICR",
+  "$3C", "SPL", "SPH", "SREG"};
+
+const char reg_name[32][4] =
+ {"r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8", "r9",
+  "r10", "r11", "r12", "r13", "r14", "r15", "r16", "r17", "r18", "r19",
+  "r20", "r21", "r22", "r23", "r24", "r25", "XL", "XH", "YL", "YH",
+  "ZL", "ZH" };
+
+static const char ptr_name[9][3] =
+ {"X", "X+", "-X", "Y", "Y+", "-Y", "Z", "Z+", "-Z"};
+
+static const char pair_name[4][6] =
+ {"W", "XH:XL", "YH:YL", "ZH:ZL"};
+
+static const char *status_bit = "cznvshti";
+
+//----------------------------------------------------------------------
+static char *put_str(char *p, const char *str)
+{
+    while( *str )
+        *p++ = *str++;
+    return p;
+}
+
+//----------------------------------------------------------------------
+// "a,b"
+static char *put_pair(char *p, const char *a, const char *b)
+{
+    p = put_str(p, a);
+    *p++ = ',';
+    return put_str(p, b);
+}
+
+//----------------------------------------------------------------------
+// Operand text of instr into buf, zero terminated, returns its length.
+// Numbers go through put_hex()/put_uint(), no printf and no locale.
+int format_instr(const INSTR_t *instr, char *buf)
+{
+    static const char *lower = "0123456789abcdef";
+    static const char *upper = "0123456789ABCDEF";
+    const MNEM_INFO_t *mi = &mnem_info[instr->mnem];
+    const char *rd = reg_name[instr->rd & 0x1F];
+    const char *rr = reg_name[instr->rr & 0x1F];
+    uint32_t k = instr->k;
+    char *p = put_str(buf, mi->name);
+    if( mi->fmt != FMT_NONE && mi->fmt != FMT_SREG )
+        *p++ = '\t';
+    switch( mi->fmt ) {
+    case FMT_RR:
+        p = put_pair(p, rd, rr);
+        break;
+    case FMT_R:
+        p = put_str(p, rd);
+        break;
+    case FMT_MOVW:
+        p = put_str(p, reg_name[instr->rd+1]);
+        *p++ = ':';
+        p = put_str(p, rd);
+        p = put_str(p, ", ");
+        p = put_str(p, reg_name[instr->rr+1]);
+        *p++ = ':';
+        p = put_str(p, rr);
+        break;
+    case FMT_RK:
+        p = put_str(p, rd);
+        *p++ = ',';
+        p = put_uint(p, k);
+        p = put_str(p, "\t// $");
+        p = put_hex(p, k, 2, lower);
+        break;
+    case FMT_LDD:
+    case FMT_STD:
+        if( mi->fmt == FMT_LDD )
+        {
+            p = put_pair(p, rd, ptr_name[instr->rr]);
+            p = put_str(p, "+$");
+            p = put_hex(p, k, 2, lower);
+        }
+        else
+        {
+            p = put_str(p, ptr_name[instr->rr]);
+            p = put_str(p, "+$");
+            p = put_hex(p, k, 2, lower);
+            *p++ = ',';
+            p = put_str(p, rd);
+        }
+        p = put_str(p, "\t// ");
+        p = put_uint(p, k);
+        break;
+    case FMT_LDS:
+        p = put_str(p, rd);
+        p = put_str(p, ",$");
+        p = put_hex(p, k, 4, lower);
+        p = put_str(p, "\t// ");
+        p = put_uint(p, k);
+        break;
+    case FMT_STS:
+        *p++ = '$';
+        p = put_hex(p, k, 4, lower);
+        *p++ = ',';
+        p = put_str(p, rd);
+        p = put_str(p, "\t// ");
+        p = put_uint(p, k);
+        break;
+    case FMT_LD:
+        p = put_pair(p, rd, ptr_name[instr->rr]);
+        break;
+    case FMT_ST:
+        p = put_pair(p, ptr_name[instr->rr], rd);
+        break;
+    case FMT_PAIR_K:
+        p = put_str(p, pair_name[(instr->rd - 24) / 2]);
+        *p++ = ',';
+        p = put_uint(p, k);
+        p = put_str(p, "\t// ");
+        p = put_hex(p, k, 2, upper);
+        break;
+    case FMT_IO_BIT:
+        p = put_str(p, io_name[instr->rd & 0x3F]);
+        *p++ = ',';
+        p = put_uint(p, instr->rr);
+        break;
+    case FMT_IN:
+        p = put_pair(p, rd, io_name[instr->rr & 0x3F]);
+        break;
+    case FMT_OUT:
+        p = put_pair(p, io_name[instr->rr & 0x3F], rd);
+        break;
+    case FMT_TARGET:
+        p = put_str(p, "L_");
+        p = put_hex(p, k, 1, upper);
+        p = put_str(p, mi->note);
+        break;
+    case FMT_REG_BIT:
+        p = put_str(p, rd);
+        *p++ = ',';
+        p = put_uint(p, instr->rr);
+        break;
+    case FMT_SREG:
+        *p++ = status_bit[instr->rr & 7];
+        break;
+    default:
+        break;
+    }
+    *p = 0;
+    return int(p - buf);
+}
+
+//----------------------------------------------------------------------
+bool instr_is_position_independent(const INSTR_t *instr)
+{
+    // Jump targets depend on the address, lds/sts on the following word
+    uint8_t fmt = mnem_info[instr->mnem].fmt;
+    return fmt != FMT_TARGET && fmt != FMT_LDS && fmt != FMT_STS;
+}
+
+//----------------------------------------------------------------------
+const char *render_instr(TEXT_CACHE_t *cache, const INSTR_t *instr, uint16_t opcode, char *buf)
+{
+    if( !instr_is_position_independent(instr) )
+    {
+        format_instr(instr, buf);
+        return buf;
+    }
+    if( cache->offset.empty() )
+        cache->offset.assign(0x10000, 0);
+    uint32_t offs = cache->offset[opcode];
+    if( offs == 0 )
+    {
+        int len = format_instr(instr, buf);
+        offs = uint32_t(cache->pool.size()) + 1;
+        cache->pool.insert(cache->pool.end(), buf, buf + len + 1);
+        cache->offset[opcode] = offs;
+    }
+    return &cache->pool[offs - 1];
+}
@@ -0,0 +1,102 @@
+#ifndef AVR_INSTR_H
+#define AVR_INSTR_H
+
+#include <stdint.h>
+#include <vector>
+
+// Operand layout of a mnemonic, selects the text template in render_instr()
+enum {
+    FMT_NONE,       // nop
+    FMT_RR,         // add   rd,rr
+    FMT_R,          // inc   rd
+    FMT_MOVW,       // movw  rd+1:rd, rr+1:rr
+    FMT_RK,         // ldi   rd,k
+    FMT_LDD,        // ldd   rd,Y+k
+    FMT_STD,        // std   Y+k,rd
+    FMT_LDS,        // lds   rd,k
+    FMT_STS,        // sts   k,rd
+    FMT_LD,         // ld    rd,X+
+    FMT_ST,         // st    X+,rd
+    FMT_PAIR_K,     // adiw  rd+1:rd,k
+    FMT_IO_BIT,     // sbi   io,bit
+    FMT_IN,         // in    rd,io
+    FMT_OUT,        // out   io,rd
+    FMT_TARGET,     // rjmp  L_k
+    FMT_REG_BIT,    // bst   rd,bit
+    FMT_SREG        // sei
+};
+
+enum {
+    MN_ERASED,      // 0xFFFF, not programmed
+    MN_NOP,
+    MN_MOVW,
+    MN_CPC, MN_CP,
+    MN_SBC, MN_SUB,
+    MN_ADD, MN_ADC, MN_LSL, MN_ROL,
+    MN_CPSE,
+    MN_AND, MN_EOR, MN_OR, MN_MOV,
+    MN_CPI, MN_SBCI, MN_SUBI, MN_ORI, MN_ANDI,
+    MN_LDD, MN_STD,
+    MN_LDS, MN_STS,
+    MN_LD, MN_ST,
+    MN_LPM, MN_ELPM,
+    MN_PUSH, MN_POP,
+    MN_COM, MN_NEG, MN_SWAP, MN_INC, MN_ASR, MN_LSR, MN_ROR,
+    MN_SE, MN_CL,
+    MN_RET, MN_RETI,
+    MN_SLEEP, MN_BREAK, MN_WDR, MN_LPM_R0, MN_ELPM_R0, MN_SPM, MN_SPM_ZP,
+    MN_IJMP, MN_ICALL, MN_EIJMP, MN_EICALL,
+    MN_DEC,
+    MN_JMP, MN_CALL,
+    MN_ADIW, MN_SBIW,
+    MN_CBI, MN_SBI, MN_SBIC, MN_SBIS,
+    MN_MUL,
+    MN_IN, MN_OUT,
+    MN_RJMP, MN_RCALL,
+    MN_LDI,
+    MN_BRLO, MN_BREQ, MN_BRMI, MN_BRVS, MN_BRLT, MN_BRHS, MN_BRTS, MN_BRIE,
+    MN_BRSH, MN_BRNE, MN_BRPL, MN_BRVC, MN_BRGE, MN_BRHC, MN_BRTC, MN_BRID,
+    MN_BLD, MN_BST, MN_SBRC, MN_SBRS,
+    MN_COUNT
+};
+
+// Pointer addressing modes of ld/st/ldd/std/lpm
+enum {
+    PTR_X, PTR_X_INC, PTR_X_DEC,
+    PTR_Y, PTR_Y_INC, PTR_Y_DEC,
+    PTR_Z, PTR_Z_INC, PTR_Z_DEC
+};
+
+// Decoded instruction, the field meaning depends on the mnemonic format
+typedef struct INSTR {
+    uint8_t  mnem;  // MN_*
+    uint8_t  rd;    // destination/source register
+    uint8_t  rr;    // second register, io register, bit number or PTR_* mode
+    uint8_t  pad;
+    uint32_t k;     // immediate, displacement, data address or jump target
+} INSTR_t;
+
+typedef struct MNEM_INFO {
+    const char *name;
+    uint8_t fmt;
+    const char *note;   // comment appended to the operands
+} MNEM_INFO_t;
+
+extern const MNEM_INFO_t mnem_info[MN_COUNT];
+extern const char io_name[64][10];
+extern const char reg_name[32][4];
+
+#define INSTR_TEXT_SIZE 48
+
+// Rendered text of opcodes that do not depend on their address, so each
+// distinct word is formatted only once per listing
+typedef struct TEXT_CACHE {
+    std::vector<uint32_t> offset;   // opcode -> pool offset + 1, 0 if not rendered yet
+    std::vector<char> pool;
+} TEXT_CACHE_t;
+
+int format_instr(const INSTR_t *instr, char *buf);
+bool instr_is_position_independent(const INSTR_t *instr);
+const char *render_instr(TEXT_CACHE_t *cache, const INSTR_t *instr, uint16_t opcode, char *buf);
+
+#endif
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include "batch.h"
+
+typedef std::chrono::steady_clock CLOCK_t;
+
+//----------------------------------------------------------------------
+const char *image_status_name(int status)
+{
+    static const char *name[5] =
+        { "ok", "can't open input", "invalid input", "decoding failed", "can't write output" };
+    if( status < 0 || status > IMAGE_NO_OUTPUT )
+        return "?";
+    return name[status];
+}
+
+//----------------------------------------------------------------------
+static size_t file_name_pos(const std::string &path)
+{
+    size_t pos = path.find_last_of("/\\");
+    return (pos == std::string::npos) ? 0 : pos + 1;
+}
+
+//----------------------------------------------------------------------
+std::string asm_file_name(const std::string &in_file, const char *out_dir)
+{
+    size_t name_pos = file_name_pos(in_file);
+    std::string name = in_file.substr(name_pos);
+    size_t dot = name.find_last_of('.');
+    if( dot != std::string::npos && dot > 0 )
+        name.erase(dot);
+    name += ".asm";
+    if( out_dir == nullptr )
+        return in_file.substr(0, name_pos) + name;
+    std::string dir = out_dir;
+    if( !dir.empty() && dir[dir.size()-1] != '/' && dir[dir.size()-1] != '\\' )
+        dir += '/';
+    return dir + name;
+}
+
+//----------------------------------------------------------------------
+static bool wildcard_match(const char *pattern, const char *name)
+{
+    for(; *pattern; pattern++, name++)
+    {
+        if( *pattern == '*' )
+        {
+            for(; *name; name++)
+                if( wildcard_match(pattern + 1, name) )
+                    return true;
+            return wildcard_match(pattern + 1, name);
+        }
+        if( *name == 0 || (*pattern != '?' && *pattern != *name) )
+            return false;
+    }
+    return *name == 0;
+}
+
+//----------------------------------------------------------------------
+// .hex, .bin or .elf
+static bool is_image_file(const char *name)
+{
+    static const char *ext[3] = { "hex", "bin", "elf" };
+    size_t len = strlen(name);
+    if( len < 4 || name[len-4] != '.' )
+        return false;
+    for( int i = 0; i < 3; i++ )
+        if(    tolower(name[len-3]) == ext[i][0]
+            && tolower(name[len-2]) == ext[i][1]
+            && tolower(name[len-1]) == ext[i][2] )
+            return true;
+    return false;
+}
+
+//----------------------------------------------------------------------
+static bool list_dir(const std::string &dir, const char *pattern, std::vector<std::string> &files)
+{
+    DIR *d = opendir(dir.empty() ? "." : dir.c_str());
+    if( d == nullptr )
+        return false;
+    std::vector<std::string> found;
+    struct dirent *entry;
+    while( (entry = readdir(d)) != nullptr )
+    {
+        const char *name = entry->d_name;
+        if( name[0] == '.' )
+            continue;
+        if( pattern ? wildcard_match(pattern, name) : is_image_file(name) )
+            found.push_back(dir + name);
+    }
+    closedir(d);
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+    return true;
+}
+
+//----------------------------------------------------------------------
+static bool read_list(const char *list_file, std::vector<std::string> &files)
+{
+    FILE *flist = fopen(list_file, "rt");
+    if( flist == nullptr )
+        return false;
+    char path[1024];
+    while( fgets(path, sizeof(path), flist) )
+    {
+        size_t len = strlen(path);
+        while( len > 0 && (path[len-1] == '\n' || path[len-1] == '\r' || path[len-1] == ' ') )
+            path[--len] = 0;
+        if( len > 0 )
+            files.push_back(path);
+    }
+    fclose(flist);
+    return true;
+}
+
+//----------------------------------------------------------------------
+// spec is a directory (all .hex, .bin and .elf files in it), @list_file (one path per
+// line), a wildcard pattern in the last path component, or a single file
+bool collect_inputs(const char *spec, std::vector<std::string> &files)
+{
+    if( spec[0] == '@' )
+        return read_list(spec + 1, files);
+    std::string path = spec;
+    size_t name_pos = file_name_pos(path);
+    if( path.find_first_of("*?", name_pos) != std::string::npos )
+        return list_dir(path.substr(0, name_pos), &spec[name_pos], files);
+    struct stat st;
+    if( stat(spec, &st) == 0 && S_ISDIR(st.st_mode) )
+    {
+        char last = path[path.size()-1];
+        if( last != '/' && last != '\\' )
+            path += '/';
+        return list_dir(path, nullptr, files);
+    }
+    files.push_back(path);
+    return true;
+}
+
+//----------------------------------------------------------------------
+// Listing of every input. Inputs that would share one, like fw.hex and
+// fw.elf or two fw.hex written to one out_dir, get a -2, -3... suffix in
+// input order after the first, so no two workers write the same file.
+static void out_file_names(const std::vector<std::string> &files, const char *out_dir,
+                           std::vector<std::string> &out)
+{
+    out.resize(files.size());
+    std::unordered_set<std::string> taken;
+    for( size_t i = 0; i < files.size(); i++ )
+    {
+        out[i] = asm_file_name(files[i], out_dir);
+        taken.insert(out[i]);
+    }
+    std::unordered_set<std::string> used;
+    for( size_t i = 0; i < files.size(); i++ )
+    {
+        if( used.insert(out[i]).second )
+            continue;
+        std::string stem = out[i].substr(0, out[i].size() - 4);
+        std::string name;
+        for( int n = 2; ; n++ )
+        {
+            name = stem + "-" + std::to_string(n) + ".asm";
+            if( taken.find(name) == taken.end() )
+                break;
+        }
+        out[i] = name;
+        taken.insert(name);
+        used.insert(name);
+    }
+}
+
+//----------------------------------------------------------------------
+int run_batch(const std::vector<std::string> &files, const BATCH_OPTIONS_t *opt, IMAGE_JOB_t job)
+{
+    int jobs = opt->jobs;
+    if( jobs <= 0 )
+        jobs = int(std::thread::hardware_concurrency());
+    if( size_t(jobs) > files.size() )
+        jobs = int(files.size());
+    if( jobs < 1 )
+        jobs = 1;
+
+    std::vector<std::string> out_files;
+    out_file_names(files, opt->out_dir, out_files);
+    std::atomic<size_t> next(0);
+    std::atomic<int> failed(0);
+    std::atomic<uint64_t> total_words(0);
+    std::mutex print_lock;
+    CLOCK_t::time_point start = CLOCK_t::now();
+
+    auto worker = [&]() {
+        size_t i;
+        while( (i = next++) < files.size() )
+        {
+            const char *in_file = files[i].c_str();
+            const std::string &out_file = out_files[i];
+            uint32_t words = 0;
+            CLOCK_t::time_point t0 = CLOCK_t::now();
+            int status = job(in_file, out_file.c_str(), &words);
+            double ms = std::chrono::duration<double, std::milli>(CLOCK_t::now() - t0).count();
+            if( status == IMAGE_OK )
+                total_words += words;
+            else
+                failed++;
+            std::lock_guard<std::mutex> lock(print_lock);
+            if( status == IMAGE_OK )
+                printf("[ok]    %s -> %s (%u words, %.2f ms)\n", in_file, out_file.c_str(), words, ms);
+            else
+                printf("[fail]  %s: %s\n", in_file, image_status_name(status));
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for( int t = 1; t < jobs; t++ )
+        pool.push_back(std::thread(worker));
+    worker();
+    for( size_t t = 0; t < pool.size(); t++ )
+        pool[t].join();
+
+    double sec = std::chrono::duration<double>(CLOCK_t::now() - start).count();
+    if( sec <= 0 )
+        sec = 1e-9;
+    printf("\n%u images, %d failed, %d threads, %.3f s: %.1f images/s, %.0f words/s\n",
+           unsigned(files.size()), int(failed), jobs, sec,
+           files.size() / sec, double(total_words) / sec);
+    return failed;
+}
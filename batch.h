@@ -0,0 +1,29 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+enum {
+    IMAGE_OK,
+    IMAGE_NO_INPUT,
+    IMAGE_BAD_INPUT,
+    IMAGE_DECODE_FAILED,
+    IMAGE_NO_OUTPUT
+};
+
+// Disassembles one image, returns IMAGE_* and the number of flash words
+typedef int (*IMAGE_JOB_t)(const char *in_file, const char *out_file, uint32_t *words);
+
+typedef struct BATCH_OPTIONS {
+    const char *out_dir;    // nullptr - write each listing next to its input
+    int jobs;               // worker threads, 0 - one per core
+} BATCH_OPTIONS_t;
+
+const char *image_status_name(int status);
+std::string asm_file_name(const std::string &in_file, const char *out_dir);
+bool collect_inputs(const char *spec, std::vector<std::string> &files);
+int run_batch(const std::vector<std::string> &files, const BATCH_OPTIONS_t *opt, IMAGE_JOB_t job);
+
+#endif
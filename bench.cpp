@@ -0,0 +1,458 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include "disasm.h"
+#include "loader.h"
+#include "listing.h"
+#include "bench.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+typedef std::chrono::steady_clock CLOCK_t;
+
+enum {
+    SLOT_PLAIN,     // non-control instruction, 1 or 2 words
+    SLOT_BRANCH,    // brne forward
+    SLOT_RJMP,      // rjmp forward
+    SLOT_CALL,      // rcall or call of another function
+    SLOT_RET,
+    SLOT_RETI,
+    SLOT_LOOP       // jump back to the first slot, ends main
+};
+
+typedef struct GEN_SLOT {
+    uint8_t kind;
+    uint8_t size;
+    uint16_t word[2];       // opcode of plain slots
+    uint32_t target;        // slot index of branches, function index of calls
+} GEN_SLOT_t;
+
+typedef struct GEN_FUNC {
+    int level;              // 0 - main and the interrupt stub
+    uint32_t addr;
+    uint32_t code_words;
+    uint32_t data_words;    // data island behind the function
+    std::vector<GEN_SLOT_t> slot;
+} GEN_FUNC_t;
+
+//----------------------------------------------------------------------
+void bench_defaults(BENCH_OPTIONS_t *opt, const DEVICE_t *device)
+{
+    opt->device = device;
+    opt->words = 0;
+    opt->seed = 1;
+    opt->branch_pct = 15;
+    opt->call_depth = 4;
+    opt->data_pct = 10;
+    opt->sweep = false;
+    opt->runs = 5;
+    opt->jobs = 0;
+    opt->work_dir = ".";
+}
+
+//----------------------------------------------------------------------
+// mt19937 output is fixed by the standard, the distributions are not,
+// so ranges are cut by hand to keep images the same on every library
+static uint32_t rnd_below(std::mt19937 &rng, uint32_t n)
+{
+    return n ? uint32_t(rng() % n) : 0;
+}
+
+//----------------------------------------------------------------------
+static void gen_plain(std::mt19937 &rng, GEN_SLOT_t *slot)
+{
+    static const uint16_t alu[8] =
+        { 0x0C00, 0x1C00, 0x1800, 0x2000, 0x2800, 0x2400, 0x2C00, 0x1400 };   // add adc sub and or eor mov cp
+    uint32_t d = rnd_below(rng, 32);
+    uint32_t r = rnd_below(rng, 32);
+    slot->kind = SLOT_PLAIN;
+    slot->size = 1;
+    switch( rnd_below(rng, 8) ) {
+    case 0: case 1: case 2:
+        slot->word[0] = uint16_t(alu[rnd_below(rng, 8)] | ((r & 0x10) << 5) | (d << 4) | (r & 0x0F));
+        break;
+    case 3:     // ldi, r is reused as the 8-bit constant
+        r = rnd_below(rng, 256);
+        slot->word[0] = uint16_t(0xE000 | ((r & 0xF0) << 4) | ((d & 0x0F) << 4) | (r & 0x0F));
+        break;
+    case 4:     // inc, dec
+        slot->word[0] = uint16_t((rnd_below(rng, 2) ? 0x9403 : 0x940A) | (d << 4));
+        break;
+    case 5:     // in, out, r is reused as the port
+        r = rnd_below(rng, 64);
+        slot->word[0] = uint16_t((rnd_below(rng, 2) ? 0xB000 : 0xB800) | ((r & 0x30) << 5) | (d << 4) | (r & 0x0F));
+        break;
+    case 6:     // ld rd,X+ / st X+,rr
+        slot->word[0] = uint16_t((rnd_below(rng, 2) ? 0x900D : 0x920D) | (d << 4));
+        break;
+    default:    // lds, sts
+        slot->size = 2;
+        slot->word[0] = uint16_t((rnd_below(rng, 2) ? 0x9000 : 0x9200) | (d << 4));
+        slot->word[1] = uint16_t(0x0060 + rnd_below(rng, 0x400));
+        break;
+    }
+}
+
+//----------------------------------------------------------------------
+static void put_long(std::vector<uint16_t> &image, uint32_t addr, uint16_t opcode, uint32_t target)
+{
+    image[addr] = uint16_t(opcode | (((target >> 17) & 0x1F) << 4) | ((target >> 16) & 1));
+    image[addr + 1] = uint16_t(target);
+}
+
+//----------------------------------------------------------------------
+// Builds a synthetic image that decodes cleanly: vectors jump to main or
+// to a reti stub, main runs until the size budget is used up and calls a
+// tree of functions call_depth levels deep. Branches only go forward to
+// instruction starts inside their function, and data islands with random
+// words follow the functions. Returns the number of data island words,
+// image is left empty when the result does not fit the device.
+uint32_t gen_firmware(const BENCH_OPTIONS_t *opt, std::vector<uint16_t> &image)
+{
+    const DEVICE_t *device = opt->device;
+    uint32_t words = opt->words;
+    if( words == 0 || words > device->flash_words )
+        words = device->flash_words;
+    int branch_pct = opt->branch_pct < 0 ? 0 : opt->branch_pct > 100 ? 100 : opt->branch_pct;
+    int data_pct = opt->data_pct < 0 ? 0 : opt->data_pct > 90 ? 90 : opt->data_pct;
+    int call_depth = opt->call_depth < 0 ? 0 : opt->call_depth;
+    bool long_jump = device->flash_words > 0x1000;
+    uint32_t vector_area = uint32_t(device->vector_count) * device->vector_words;
+    // words a new function is expected to add, code and data
+    uint32_t expect = 40 + 40 * uint32_t(data_pct) / uint32_t(100 - data_pct);
+    uint32_t budget = words > vector_area + 2 * expect ? words - vector_area - 2 * expect : 0;
+    std::mt19937 rng(opt->seed);
+
+    std::vector<GEN_FUNC_t> func(2);
+    std::vector<std::vector<uint32_t> > level_func(call_depth + 1);
+    GEN_SLOT_t slot;
+    memset(&slot, 0, sizeof(slot));
+    slot.kind = SLOT_RETI;
+    slot.size = 1;
+    func[0].slot.push_back(slot);
+    func[0].code_words = 1;
+    func[0].data_words = 0;
+    func[0].level = 0;
+    func[1].level = 0;
+    uint32_t used = 1;
+    uint32_t pending = 0;
+
+    for( size_t f = 1; f < func.size(); f++ )
+    {
+        bool is_main = f == 1;
+        if( !is_main )
+            pending--;
+        int level = func[f].level;
+        uint32_t length = 8 + rnd_below(rng, 56);
+        uint32_t code_words = 0;
+        std::vector<GEN_SLOT_t> body;
+        for( uint32_t s = 0; is_main ? used + code_words + pending * expect < budget || s < 8 : s < length; s++ )
+        {
+            memset(&slot, 0, sizeof(slot));
+            slot.size = 1;
+            bool control = int(rnd_below(rng, 100)) < branch_pct;
+            uint32_t kind = rnd_below(rng, 10);
+            if( control && kind < 7 )
+            {
+                slot.kind = kind < 5 ? SLOT_BRANCH : SLOT_RJMP;
+                slot.target = s + 1 + rnd_below(rng, 20);
+            }
+            else if( control && level < call_depth )
+            {
+                std::vector<uint32_t> &callee = level_func[level + 1];
+                bool room = used + code_words + (pending + 1) * expect < budget;
+                bool create = room && (callee.empty() || rnd_below(rng, 3) == 0);
+                if( create )
+                {
+                    callee.push_back(uint32_t(func.size()));
+                    func.push_back(GEN_FUNC_t());
+                    func.back().level = level + 1;
+                    pending++;
+                }
+                if( callee.empty() )
+                    gen_plain(rng, &slot);
+                else
+                {
+                    slot.kind = SLOT_CALL;
+                    slot.size = long_jump ? 2 : 1;
+                    slot.target = create ? callee.back() : callee[rnd_below(rng, uint32_t(callee.size()))];
+                }
+            }
+            else
+                gen_plain(rng, &slot);
+            code_words += slot.size;
+            body.push_back(slot);
+        }
+        for( size_t s = 0; s < body.size(); s++ )
+            if( (body[s].kind == SLOT_BRANCH || body[s].kind == SLOT_RJMP) && body[s].target > body.size() )
+                body[s].target = uint32_t(body.size());
+        memset(&slot, 0, sizeof(slot));
+        slot.kind = is_main ? SLOT_LOOP : SLOT_RET;
+        slot.size = is_main && long_jump ? 2 : 1;
+        code_words += slot.size;
+        body.push_back(slot);
+
+        uint32_t data_words = code_words * uint32_t(data_pct) / uint32_t(100 - data_pct);
+        data_words = data_words * (50 + rnd_below(rng, 101)) / 100;
+        func[f].slot.swap(body);
+        func[f].code_words = code_words;
+        func[f].data_words = data_words;
+        used += code_words + data_words;
+    }
+
+    // trim data islands from the end if the estimate overshot
+    uint32_t total = vector_area;
+    for( size_t f = 0; f < func.size(); f++ )
+        total += func[f].code_words + func[f].data_words;
+    for( size_t f = func.size(); f-- > 0 && total > device->flash_words; )
+    {
+        uint32_t cut = total - device->flash_words < func[f].data_words ? total - device->flash_words : func[f].data_words;
+        func[f].data_words -= cut;
+        total -= cut;
+    }
+    image.clear();
+    if( total > device->flash_words )
+        return 0;
+
+    uint32_t addr = vector_area;
+    uint32_t data_total = 0;
+    for( size_t f = 0; f < func.size(); f++ )
+    {
+        func[f].addr = addr;
+        addr += func[f].code_words + func[f].data_words;
+        data_total += func[f].data_words;
+    }
+    image.assign(total, 0xFFFF);
+    for( uint32_t v = 0; v < device->vector_count; v++ )
+    {
+        uint32_t at = v * device->vector_words;
+        uint32_t target = v == 0 ? func[1].addr : func[0].addr;
+        if( device->vector_words == 2 )
+            put_long(image, at, 0x940C, target);
+        else
+            image[at] = uint16_t(0xC000 | ((target - (at + 1)) & 0x0FFF));
+    }
+    std::vector<uint32_t> slot_addr;
+    for( size_t f = 0; f < func.size(); f++ )
+    {
+        const std::vector<GEN_SLOT_t> &body = func[f].slot;
+        slot_addr.resize(body.size());
+        addr = func[f].addr;
+        for( size_t s = 0; s < body.size(); s++ )
+        {
+            slot_addr[s] = addr;
+            addr += body[s].size;
+        }
+        for( size_t s = 0; s < body.size(); s++ )
+        {
+            const GEN_SLOT_t *sl = &body[s];
+            uint32_t at = slot_addr[s];
+            switch( sl->kind ) {
+            case SLOT_PLAIN:
+                image[at] = sl->word[0];
+                if( sl->size == 2 )
+                    image[at + 1] = sl->word[1];
+                break;
+            case SLOT_BRANCH:
+                image[at] = uint16_t(0xF401 | (((slot_addr[sl->target] - (at + 1)) & 0x7F) << 3));
+                break;
+            case SLOT_RJMP:
+                image[at] = uint16_t(0xC000 | ((slot_addr[sl->target] - (at + 1)) & 0x0FFF));
+                break;
+            case SLOT_CALL:
+                if( long_jump )
+                    put_long(image, at, 0x940E, func[sl->target].addr);
+                else
+                    image[at] = uint16_t(0xD000 | ((func[sl->target].addr - (at + 1)) & 0x0FFF));
+                break;
+            case SLOT_RET:
+                image[at] = 0x9508;
+                break;
+            case SLOT_RETI:
+                image[at] = 0x9518;
+                break;
+            case SLOT_LOOP:
+                if( long_jump )
+                    put_long(image, at, 0x940C, func[f].addr);
+                else
+                    image[at] = uint16_t(0xC000 | ((func[f].addr - (at + 1)) & 0x0FFF));
+                break;
+            }
+        }
+        for( uint32_t i = 0; i < func[f].data_words; i++ )
+            image[addr + i] = uint16_t(rng());
+    }
+    return data_total;
+}
+
+//----------------------------------------------------------------------
+static void put_hex_record(std::string &out, uint8_t type, uint32_t offset, const uint8_t *data, uint32_t size)
+{
+    static const char digit[] = "0123456789ABCDEF";
+    uint8_t rec[4 + 16];
+    rec[0] = uint8_t(size);
+    rec[1] = uint8_t(offset >> 8);
+    rec[2] = uint8_t(offset);
+    rec[3] = type;
+    if( size != 0 )
+        memcpy(&rec[4], data, size);
+    uint8_t sum = 0;
+    out.push_back(':');
+    for( uint32_t i = 0; i < 4 + size; i++ )
+    {
+        sum = uint8_t(sum + rec[i]);
+        out.push_back(digit[rec[i] >> 4]);
+        out.push_back(digit[rec[i] & 0x0F]);
+    }
+    sum = uint8_t(-sum);
+    out.push_back(digit[sum >> 4]);
+    out.push_back(digit[sum & 0x0F]);
+    out.push_back('\n');
+}
+
+//----------------------------------------------------------------------
+// Writes 16 byte data records with a linear address record at every
+// 64K boundary, returns the file size or 0 on error
+size_t write_hex(const std::vector<uint16_t> &image, const char *file_name)
+{
+    std::string out;
+    out.reserve(image.size() * 2 * 45 / 16 + 64);
+    uint32_t size = uint32_t(image.size() * 2);
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(image.data());
+    for( uint32_t addr = 0; addr < size; addr += 16 )
+    {
+        if( addr != 0 && (addr & 0xFFFF) == 0 )
+        {
+            uint8_t base[2] = { uint8_t(addr >> 24), uint8_t(addr >> 16) };
+            put_hex_record(out, 0x04, 0, base, 2);
+        }
+        put_hex_record(out, 0x00, addr & 0xFFFF, bytes + addr, size - addr < 16 ? size - addr : 16);
+    }
+    put_hex_record(out, 0x01, 0, nullptr, 0);
+    FILE *fhex = fopen(file_name, "wb");
+    if( fhex == nullptr )
+        return 0;
+    bool ok = fwrite(out.data(), 1, out.size(), fhex) == out.size();
+    if( fclose(fhex) != 0 || !ok )
+        return 0;
+    return out.size();
+}
+
+//----------------------------------------------------------------------
+static double peak_rss_mb()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if( GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)) )
+        return pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+    return 0;
+#else
+    struct rusage ru;
+    if( getrusage(RUSAGE_SELF, &ru) != 0 )
+        return 0;
+#ifdef __APPLE__
+    return ru.ru_maxrss / (1024.0 * 1024.0);
+#else
+    return ru.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+//----------------------------------------------------------------------
+static double elapsed_ms(CLOCK_t::time_point from, CLOCK_t::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+//----------------------------------------------------------------------
+// Generates an image, then times loading, decoding and printing it.
+// Each stage keeps its best time over opt->runs passes.
+int run_bench(const BENCH_OPTIONS_t *opt)
+{
+    std::vector<uint16_t> image;
+    uint32_t data_words = gen_firmware(opt, image);
+    if( image.empty() )
+    {
+        printf("Can't fit the image into %s\n", opt->device->name);
+        return 1;
+    }
+    std::string hex_file = std::string(opt->work_dir) + "/bench.hex";
+    std::string asm_file = std::string(opt->work_dir) + "/bench.asm";
+    size_t hex_size = write_hex(image, hex_file.c_str());
+    if( hex_size == 0 )
+    {
+        printf("Can't write %s\n", hex_file.c_str());
+        return 1;
+    }
+    printf("%s: %u words (%u data), seed %u, branches %d%%, call depth %d, data %d%%\n",
+           opt->device->name, unsigned(image.size()), data_words, opt->seed,
+           opt->branch_pct, opt->call_depth, opt->data_pct);
+
+    init_opcode_table();
+    DISASM_t *ctx = disasm_acquire();
+    double best[4] = { 1e30, 1e30, 1e30, 1e30 };
+    int runs = opt->runs > 0 ? opt->runs : 1;
+    int status = 0;
+    for( int r = 0; r < runs && status == 0; r++ )
+    {
+        CLOCK_t::time_point t0 = CLOCK_t::now();
+        int load_status = load_image(ctx, hex_file.c_str(), nullptr);
+        CLOCK_t::time_point t1 = CLOCK_t::now();
+        if( load_status != LOAD_OK )
+        {
+            printf("%s: %s\n", hex_file.c_str(), load_status_name(load_status));
+            status = 1;
+            break;
+        }
+        init_vars(ctx, opt->device);
+        bool decoded = decode_dump(ctx);
+        CLOCK_t::time_point t2 = CLOCK_t::now();
+        if( !decoded )
+        {
+            puts("Decoding failed");
+            status = 1;
+            break;
+        }
+        if( opt->sweep )
+            sweep_dump(ctx);
+        CLOCK_t::time_point t3 = CLOCK_t::now();
+        if( !print_code(ctx, asm_file.c_str(), opt->jobs) )
+        {
+            printf("Can't write %s\n", asm_file.c_str());
+            status = 1;
+            break;
+        }
+        CLOCK_t::time_point t4 = CLOCK_t::now();
+        double ms[4] = { elapsed_ms(t0, t1), elapsed_ms(t1, t2), elapsed_ms(t2, t3), elapsed_ms(t3, t4) };
+        for( int s = 0; s < 4; s++ )
+            if( ms[s] < best[s] )
+                best[s] = ms[s];
+    }
+    disasm_release(ctx);
+    if( status != 0 )
+        return status;
+
+    static const char *stage[4] = { "load", "decode", "sweep", "print" };
+    double words = double(image.size());
+    double total = 0;
+    printf("\n%-8s %10s %10s\n", "stage", "best ms", "ns/word");
+    for( int s = 0; s < 4; s++ )
+    {
+        if( s == 2 && !opt->sweep )
+            continue;
+        total += best[s];
+        printf("%-8s %10.3f %10.1f", stage[s], best[s], best[s] * 1e6 / words);
+        if( s == 0 )
+            printf("   %.1f MB/s", hex_size / (best[s] * 1e3));
+        puts("");
+    }
+    printf("total    %10.3f %10.1f\n", total, total * 1e6 / words);
+    printf("peak RSS %.1f MB, %d runs\n", peak_rss_mb(), runs);
+    return 0;
+}
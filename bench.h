@@ -0,0 +1,28 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "device.h"
+
+typedef struct BENCH_OPTIONS {
+    const DEVICE_t *device;
+    uint32_t words;         // image size, 0 - whole device flash
+    uint32_t seed;
+    int branch_pct;         // share of branches, jumps and calls in code
+    int call_depth;         // levels of the call tree below main
+    int data_pct;           // share of data islands between functions
+    bool sweep;             // also time sweep_dump()
+    int runs;               // each stage is timed this many times, best is kept
+    int jobs;               // listing threads, 0 - one per core
+    const char *work_dir;   // bench.hex and bench.asm are written here
+} BENCH_OPTIONS_t;
+
+void bench_defaults(BENCH_OPTIONS_t *opt, const DEVICE_t *device);
+uint32_t gen_firmware(const BENCH_OPTIONS_t *opt, std::vector<uint16_t> &image);
+size_t write_hex(const std::vector<uint16_t> &image, const char *file_name);
+int run_bench(const BENCH_OPTIONS_t *opt);
+
+#endif
@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <algorithm>
+#include "mapped_file.h"
+#include "listing.h"
+#include "cache.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#define CACHE_MAGIC         "MDCACHE"
+#define CACHE_EXT           ".dc"
+#define CACHE_TMP_EXT       ".tmp"
+#define CACHE_HEADER_SIZE   64
+#define CACHE_LINE_SIZE     8
+#define CACHE_INDIRECT_SIZE 8
+#define CACHE_NAME_SIZE     16
+// Seconds after which a temporary entry file is taken as left behind by
+// a process that died while storing
+#define CACHE_TMP_AGE       3600
+
+#define LINE_VISITED        0x01
+#define LINE_DECODED        0x02
+#define LINE_POINTED        0x04
+#define LINE_SWEPT          0x08
+#define LINE_DATA           0x10
+#define LINE_RESOLVED       0x20
+
+// Record flag of each stored plane, PLANE_ERASED follows from the words
+static const uint8_t line_bit[PLANE_RESOLVED + 1] = {
+    LINE_VISITED, LINE_DECODED, LINE_POINTED, LINE_SWEPT, LINE_DATA, LINE_RESOLVED
+};
+
+#define HASH_P1 0x9E3779B185EBCA87ULL
+#define HASH_P2 0xC2B2AE3D27D4EB4FULL
+#define HASH_P3 0x165667B19E3779F9ULL
+#define HASH_P4 0x27D4EB2F165667C5ULL
+
+// Entry file layout, all fields little endian:
+//   0  magic[8]         "MDCACHE\0"
+//   8  version          CACHE_VERSION
+//  12  indirect_count
+//  16  key lo, key hi
+//  32  device[16]       device name, zero padded
+//  48  code_words
+//  52  line_count
+//  56  text_size
+//  64  line_count records: flags, mnem, rd, rr, k
+//      indirect_count records: addr, target
+//      text_size bytes of listing text
+
+typedef struct CACHE_ENTRY {
+    std::string path;
+    uint64_t size;
+    long long mtime;        // nanoseconds where the file system keeps them
+    bool tmp;               // store still running or abandoned
+} CACHE_ENTRY_t;
+
+//----------------------------------------------------------------------
+static inline uint64_t rotl64(uint64_t value, int shift)
+{
+    return (value << shift) | (value >> (64 - shift));
+}
+
+//----------------------------------------------------------------------
+static inline uint64_t fmix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+//----------------------------------------------------------------------
+// Two independent multiply-rotate lanes over 8-byte words. Not meant to
+// stand up to an attacker, only to tell images apart.
+static void hash_bytes(CACHE_KEY_t *h, const void *data, size_t size)
+{
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    uint64_t lo = h->lo ^ (size * HASH_P3);
+    uint64_t hi = h->hi ^ (size * HASH_P4);
+    for( ; size >= 8; p += 8, size -= 8 )
+    {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        lo = rotl64(lo ^ (w * HASH_P2), 31) * HASH_P1;
+        hi = rotl64(hi + (w * HASH_P4), 27) * HASH_P3;
+    }
+    if( size > 0 )
+    {
+        uint64_t w = 0;
+        memcpy(&w, p, size);
+        lo = rotl64(lo ^ (w * HASH_P2), 31) * HASH_P1;
+        hi = rotl64(hi + (w * HASH_P4), 27) * HASH_P3;
+    }
+    h->lo = lo;
+    h->hi = hi;
+}
+
+//----------------------------------------------------------------------
+static void hash_u32(CACHE_KEY_t *h, uint32_t value)
+{
+    hash_bytes(h, &value, sizeof(value));
+}
+
+//----------------------------------------------------------------------
+static void put_u32(uint8_t *p, uint32_t value)
+{
+    p[0] = uint8_t(value);
+    p[1] = uint8_t(value >> 8);
+    p[2] = uint8_t(value >> 16);
+    p[3] = uint8_t(value >> 24);
+}
+
+//----------------------------------------------------------------------
+static void put_u64(uint8_t *p, uint64_t value)
+{
+    put_u32(p, uint32_t(value));
+    put_u32(p + 4, uint32_t(value >> 32));
+}
+
+//----------------------------------------------------------------------
+static uint32_t get_u32(const uint8_t *p)
+{
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+//----------------------------------------------------------------------
+static uint64_t get_u64(const uint8_t *p)
+{
+    return get_u32(p) | (uint64_t(get_u32(p + 4)) << 32);
+}
+
+//----------------------------------------------------------------------
+static std::string entry_path(const RESULT_CACHE_t *cache, const CACHE_KEY_t *key)
+{
+    char name[40];
+    snprintf(name, sizeof(name), "%016llx%016llx" CACHE_EXT,
+             (unsigned long long)key->hi, (unsigned long long)key->lo);
+    return cache->dir + name;
+}
+
+//----------------------------------------------------------------------
+static bool make_dir(const char *dir)
+{
+    struct stat st;
+    if( stat(dir, &st) == 0 )
+        return S_ISDIR(st.st_mode);
+#ifdef _WIN32
+    return _mkdir(dir) == 0;
+#else
+    return mkdir(dir, 0777) == 0;
+#endif
+}
+
+//----------------------------------------------------------------------
+static bool has_ext(const char *name, const char *ext)
+{
+    size_t len = strlen(name);
+    size_t ext_len = strlen(ext);
+    return len > ext_len && strcmp(&name[len - ext_len], ext) == 0;
+}
+
+//----------------------------------------------------------------------
+static void list_entries(const RESULT_CACHE_t *cache, std::vector<CACHE_ENTRY_t> &entries)
+{
+    entries.clear();
+    DIR *d = opendir(cache->dir.c_str());
+    if( d == nullptr )
+        return;
+    struct dirent *dent;
+    while( (dent = readdir(d)) != nullptr )
+    {
+        CACHE_ENTRY_t entry;
+        entry.tmp = has_ext(dent->d_name, CACHE_TMP_EXT);
+        if( !entry.tmp && !has_ext(dent->d_name, CACHE_EXT) )
+            continue;
+        entry.path = cache->dir + dent->d_name;
+        struct stat st;
+        if( stat(entry.path.c_str(), &st) != 0 )
+            continue;
+        entry.size = uint64_t(st.st_size);
+        entry.mtime = (long long)st.st_mtime * 1000000000;
+#ifdef __linux__
+        entry.mtime += (long long)st.st_mtim.tv_nsec;
+#endif
+        entries.push_back(entry);
+    }
+    closedir(d);
+}
+
+//----------------------------------------------------------------------
+// Counts the directory again and drops the oldest entries until the
+// cache is back under 90% of its limit, so eviction runs once per many
+// stores rather than on every one. Temporary files count toward the
+// limit too; those older than CACHE_TMP_AGE are removed, newer ones may
+// be a store in progress and are left alone.
+static void evict(RESULT_CACHE_t *cache)
+{
+    std::lock_guard<std::mutex> lock(cache->evict_lock);
+    std::vector<CACHE_ENTRY_t> entries;
+    list_entries(cache, entries);
+    long long stale = ((long long)time(nullptr) - CACHE_TMP_AGE) * 1000000000;
+    uint64_t total = 0;
+    for( size_t i = 0; i < entries.size(); i++ )
+        if( entries[i].tmp && entries[i].mtime < stale && remove(entries[i].path.c_str()) == 0 )
+            entries[i].size = 0;
+        else
+            total += entries[i].size;
+    if( total > cache->limit )
+    {
+        std::sort(entries.begin(), entries.end(),
+                  [](const CACHE_ENTRY_t &a, const CACHE_ENTRY_t &b) { return a.mtime < b.mtime; });
+        uint64_t target = cache->limit / 10 * 9;
+        for( size_t i = 0; i < entries.size() && total > target; i++ )
+            if( !entries[i].tmp && remove(entries[i].path.c_str()) == 0 )
+            {
+                total -= entries[i].size;
+                cache->evicted++;
+            }
+    }
+    cache->size = total;
+}
+
+//----------------------------------------------------------------------
+bool cache_open(RESULT_CACHE_t *cache, const char *dir, uint64_t limit)
+{
+    cache->dir = dir;
+    if( !cache->dir.empty() && cache->dir[cache->dir.size()-1] != '/' && cache->dir[cache->dir.size()-1] != '\\' )
+        cache->dir += '/';
+    cache->limit = limit;
+    cache->size = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->stores = 0;
+    cache->evicted = 0;
+    cache->tmp_seq = 0;
+    if( !make_dir(dir) )
+        return false;
+    evict(cache);
+    return true;
+}
+
+//----------------------------------------------------------------------
+// Covers the image words, the device, the options and the labels taken
+// from the input, which is all decode_dump() and print_code() look at.
+// The context must already be set up by init_vars().
+CACHE_KEY_t cache_key(const DISASM_t *ctx, uint32_t options)
+{
+    CACHE_KEY_t key = { 0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL };
+    hash_u32(&key, CACHE_VERSION);
+    hash_u32(&key, options);
+    hash_bytes(&key, ctx->device->name, strlen(ctx->device->name));
+    hash_u32(&key, uint32_t(ctx->dump_size));
+    hash_u32(&key, ctx->code_words);
+    hash_bytes(&key, ctx->code, size_t(ctx->code_words) * 2);
+    hash_u32(&key, uint32_t(ctx->labels.size()));
+    for( size_t i = 0; i < ctx->labels.size(); i++ )
+    {
+        const LABEL_t *label = &ctx->labels[i];
+        hash_u32(&key, label->addr | (label->code ? 0x80000000u : 0));
+        hash_bytes(&key, label->name.data(), label->name.size());
+    }
+    key.lo = fmix64(key.lo);
+    key.hi = fmix64(key.hi ^ key.lo);
+    return key;
+}
+
+//----------------------------------------------------------------------
+// Restores line[] from the entry and writes its listing to asm_file.
+// A missing, stale or damaged entry is a miss.
+bool cache_fetch(RESULT_CACHE_t *cache, const CACHE_KEY_t *key, DISASM_t *ctx, const char *asm_file)
+{
+    std::string path = entry_path(cache, key);
+    MAPPED_FILE_t mf;
+    bool hit = false;
+    if( map_file(&mf, path.c_str()) && mf.size >= CACHE_HEADER_SIZE )
+    {
+        const uint8_t *h = mf.data;
+        char device[CACHE_NAME_SIZE + 1];
+        memcpy(device, &h[32], CACHE_NAME_SIZE);
+        device[CACHE_NAME_SIZE] = 0;
+        uint32_t indirect_count = get_u32(&h[12]);
+        uint32_t line_count = get_u32(&h[52]);
+        uint64_t text_size = get_u64(&h[56]);
+        hit =    memcmp(h, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+              && get_u32(&h[8]) == CACHE_VERSION
+              && get_u64(&h[16]) == key->lo && get_u64(&h[24]) == key->hi
+              && strcmp(device, ctx->device->name) == 0
+              && get_u32(&h[48]) == ctx->code_words
+              && line_count >= ctx->line.size()
+              && mf.size ==   CACHE_HEADER_SIZE + uint64_t(line_count) * CACHE_LINE_SIZE
+                            + uint64_t(indirect_count) * CACHE_INDIRECT_SIZE + text_size;
+        if( hit )
+        {
+            grow_lines(ctx, line_count);
+            const uint8_t *rec = &h[CACHE_HEADER_SIZE];
+            for( uint32_t i = 0; i < line_count; i++, rec += CACHE_LINE_SIZE )
+            {
+                LINE_t *cline = &ctx->line[i];
+                for( int p = PLANE_VISITED; p <= PLANE_RESOLVED; p++ )
+                    if( rec[0] & line_bit[p] )
+                        line_set(ctx, p, i);
+                cline->instr.mnem = rec[1];
+                cline->instr.rd = rec[2];
+                cline->instr.rr = rec[3];
+                cline->instr.pad = 0;
+                cline->instr.k = get_u32(&rec[4]);
+            }
+            ctx->indirect.resize(indirect_count);
+            for( uint32_t i = 0; i < indirect_count; i++, rec += CACHE_INDIRECT_SIZE )
+            {
+                ctx->indirect[i].addr = get_u32(rec);
+                ctx->indirect[i].target = get_u32(&rec[4]);
+            }
+            std::vector<std::string> chunk(1);
+            chunk[0].assign(reinterpret_cast<const char*>(rec), size_t(text_size));
+            hit = write_listing(asm_file, chunk);
+        }
+    }
+    unmap_file(&mf);
+    if( hit )
+    {
+        // the entry's mtime is its last use, eviction goes by it
+#ifdef _WIN32
+        _utime(path.c_str(), nullptr);
+#else
+        utime(path.c_str(), nullptr);
+#endif
+        cache->hits++;
+    }
+    else
+        cache->misses++;
+    return hit;
+}
+
+//----------------------------------------------------------------------
+// Writes the entry under a temporary name and renames it into place, so
+// a reader in another thread or process never maps half an entry
+void cache_store(RESULT_CACHE_t *cache, const CACHE_KEY_t *key, const DISASM_t *ctx,
+                 const std::vector<std::string> &chunk)
+{
+    uint32_t line_count = uint32_t(ctx->line.size());
+    uint32_t indirect_count = uint32_t(ctx->indirect.size());
+    uint64_t text_size = 0;
+    for( size_t i = 0; i < chunk.size(); i++ )
+        text_size += chunk[i].size();
+    size_t head_size =   CACHE_HEADER_SIZE + size_t(line_count) * CACHE_LINE_SIZE
+                       + size_t(indirect_count) * CACHE_INDIRECT_SIZE;
+    uint64_t entry_size = head_size + text_size;
+    if( entry_size > cache->limit )
+        return;
+
+    std::vector<uint8_t> head(head_size, 0);
+    uint8_t *h = &head[0];
+    memcpy(h, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    put_u32(&h[8], CACHE_VERSION);
+    put_u32(&h[12], indirect_count);
+    put_u64(&h[16], key->lo);
+    put_u64(&h[24], key->hi);
+    strncpy(reinterpret_cast<char*>(&h[32]), ctx->device->name, CACHE_NAME_SIZE);
+    put_u32(&h[48], ctx->code_words);
+    put_u32(&h[52], line_count);
+    put_u64(&h[56], text_size);
+    uint8_t *rec = &h[CACHE_HEADER_SIZE];
+    for( uint32_t i = 0; i < line_count; i++, rec += CACHE_LINE_SIZE )
+    {
+        const LINE_t *cline = &ctx->line[i];
+        rec[0] = 0;
+        for( int p = PLANE_VISITED; p <= PLANE_RESOLVED; p++ )
+            if( line_is(ctx, p, i) )
+                rec[0] |= line_bit[p];
+        rec[1] = cline->instr.mnem;
+        rec[2] = cline->instr.rd;
+        rec[3] = cline->instr.rr;
+        put_u32(&rec[4], cline->instr.k);
+    }
+    for( uint32_t i = 0; i < indirect_count; i++, rec += CACHE_INDIRECT_SIZE )
+    {
+        put_u32(rec, ctx->indirect[i].addr);
+        put_u32(&rec[4], ctx->indirect[i].target);
+    }
+
+    std::string path = entry_path(cache, key);
+    char tmp_ext[32];
+#ifdef _WIN32
+    snprintf(tmp_ext, sizeof(tmp_ext), ".%d-%u" CACHE_TMP_EXT, _getpid(), unsigned(cache->tmp_seq++));
+#else
+    snprintf(tmp_ext, sizeof(tmp_ext), ".%d-%u" CACHE_TMP_EXT, int(getpid()), unsigned(cache->tmp_seq++));
+#endif
+    std::string tmp_path = path + tmp_ext;
+    FILE *fentry = fopen(tmp_path.c_str(), "wb");
+    if( fentry == nullptr )
+        return;
+    bool ok = fwrite(head.data(), 1, head.size(), fentry) == head.size();
+    for( size_t i = 0; i < chunk.size() && ok; i++ )
+        ok = fwrite(chunk[i].data(), 1, chunk[i].size(), fentry) == chunk[i].size();
+    ok = (fclose(fentry) == 0) && ok;
+#ifdef _WIN32
+    // rename does not replace an existing file here
+    if( ok )
+        remove(path.c_str());
+#endif
+    if( !ok || rename(tmp_path.c_str(), path.c_str()) != 0 )
+    {
+        remove(tmp_path.c_str());
+        return;
+    }
+    cache->stores++;
+    if( (cache->size += entry_size) > cache->limit )
+        evict(cache);
+}
+
+//----------------------------------------------------------------------
+void cache_print_stats(const RESULT_CACHE_t *cache)
+{
+    uint32_t hits = cache->hits;
+    uint32_t lookups = hits + cache->misses;
+    printf("Cache %s: %u hits, %u misses (%.0f%%), %u stored, %u evicted, %.1f of %.1f MB\n",
+           cache->dir.c_str(), hits, unsigned(cache->misses),
+           lookups ? 100.0 * hits / lookups : 0.0,
+           unsigned(cache->stores), unsigned(cache->evicted),
+           double(cache->size) / (1 << 20), double(cache->limit) / (1 << 20));
+}
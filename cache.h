@@ -0,0 +1,47 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "disasm.h"
+
+// Bump whenever decoding or the listing format changes, so older entries
+// stop matching
+#define CACHE_VERSION       2
+#define CACHE_DEFAULT_MB    256
+
+// Options that change the result and so are part of the key
+#define CACHE_OPT_SWEEP     0x01
+#define CACHE_OPT_POINTERS  0x02
+#define CACHE_OPT_CYCLES    0x04
+
+// 128-bit hash of everything the result depends on
+typedef struct CACHE_KEY {
+    uint64_t lo;
+    uint64_t hi;
+} CACHE_KEY_t;
+
+// On-disk results, one file per key in dir. Shared by all batch workers.
+typedef struct RESULT_CACHE {
+    std::string dir;
+    uint64_t limit;                 // bytes, least recently used entries go first
+    std::atomic<uint64_t> size;     // bytes on disk as last counted plus stores since
+    std::atomic<uint32_t> hits;
+    std::atomic<uint32_t> misses;
+    std::atomic<uint32_t> stores;
+    std::atomic<uint32_t> evicted;
+    std::atomic<uint32_t> tmp_seq;
+    std::mutex evict_lock;
+} RESULT_CACHE_t;
+
+bool cache_open(RESULT_CACHE_t *cache, const char *dir, uint64_t limit);
+CACHE_KEY_t cache_key(const DISASM_t *ctx, uint32_t options);
+bool cache_fetch(RESULT_CACHE_t *cache, const CACHE_KEY_t *key, DISASM_t *ctx, const char *asm_file);
+void cache_store(RESULT_CACHE_t *cache, const CACHE_KEY_t *key, const DISASM_t *ctx,
+                 const std::vector<std::string> &chunk);
+void cache_print_stats(const RESULT_CACHE_t *cache);
+
+#endif
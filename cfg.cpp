@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "cfg.h"
+#include "timing.h"
+
+//----------------------------------------------------------------------
+static bool is_code(const DISASM_t *ctx, uint32_t addr)
+{
+    return addr < ctx->line.size() && line_is(ctx, PLANE_DECODED, addr);
+}
+
+//----------------------------------------------------------------------
+// Successors of the decoded instruction at addr inside its function and
+// the address it calls, CFG_NONE if none. Unlike instr_successors() an
+// ijmp does not fall through, and a call is not a flow edge. ijmp and
+// icall go to their target if track_pointers() found it.
+static int flow_successors(const DISASM_t *ctx, uint32_t addr, uint32_t *succ, uint32_t *call)
+{
+    uint32_t next[2];
+    int count = instr_successors(ctx, addr, next);
+    int first = 0;
+    *call = CFG_NONE;
+    switch( ctx->line[addr].instr.mnem ) {
+    case MN_IJMP:
+        if( line_is(ctx, PLANE_RESOLVED, addr) && is_code(ctx, indirect_target(ctx, addr)) )
+        {
+            succ[0] = indirect_target(ctx, addr);
+            return 1;
+        }
+        return 0;
+    case MN_EIJMP:
+        return 0;
+    case MN_ICALL:
+        if( line_is(ctx, PLANE_RESOLVED, addr) )
+            *call = indirect_target(ctx, addr);
+        break;
+    case MN_RCALL:
+    case MN_CALL:
+        *call = next[0];
+        first = 1;
+        break;
+    }
+    int n = 0;
+    for( int i = first; i < count; i++ )
+        if( is_code(ctx, next[i]) )
+            succ[n++] = next[i];
+    return n;
+}
+
+//----------------------------------------------------------------------
+// Anything but a plain step to the next instruction ends a block
+static bool ends_block(const DISASM_t *ctx, uint32_t addr, const uint32_t *succ, int count)
+{
+    uint8_t mnem = ctx->line[addr].instr.mnem;
+    if( mnem == MN_IJMP || mnem == MN_EIJMP || mnem == MN_RET || mnem == MN_RETI )
+        return true;
+    return count != 1 || succ[0] != addr + instr_words(mnem);
+}
+
+//----------------------------------------------------------------------
+static void set_bit(std::vector<uint64_t> &bits, uint32_t index)
+{
+    bits[index >> 6] |= uint64_t(1) << (index & 63);
+}
+
+//----------------------------------------------------------------------
+static bool get_bit(const std::vector<uint64_t> &bits, uint32_t index)
+{
+    return (bits[index >> 6] >> (index & 63)) & 1;
+}
+
+//----------------------------------------------------------------------
+// Turns per-item lists into a CSR index and a flat array
+static void flatten(const std::vector<std::vector<uint32_t> > &lists,
+                    std::vector<uint32_t> &first, std::vector<uint32_t> &flat)
+{
+    first.resize(lists.size() + 1);
+    first[0] = 0;
+    for( size_t i = 0; i < lists.size(); i++ )
+        first[i + 1] = first[i] + uint32_t(lists[i].size());
+    flat.resize(first[lists.size()]);
+    for( size_t i = 0; i < lists.size(); i++ )
+        std::copy(lists[i].begin(), lists[i].end(), flat.begin() + first[i]);
+}
+
+//----------------------------------------------------------------------
+// Block holding addr, CFG_NONE if addr is not decoded code
+uint32_t cfg_find_block(const CFG_t *cfg, uint32_t addr)
+{
+    std::vector<uint32_t>::const_iterator it =
+        std::upper_bound(cfg->block_start.begin(), cfg->block_start.end(), addr);
+    if( it == cfg->block_start.begin() )
+        return CFG_NONE;
+    uint32_t b = uint32_t(it - cfg->block_start.begin()) - 1;
+    return addr <= cfg->block_last[b] ? b : CFG_NONE;
+}
+
+//----------------------------------------------------------------------
+// Runs fn(func, mark) for every function on jobs threads (0 - one per
+// core). mark is owned by the worker, has an entry per block and starts
+// out as CFG_NONE, a job can tag the blocks it has seen with its func.
+void for_each_function(const CFG_t *cfg, int jobs,
+                       const std::function<void(uint32_t, std::vector<uint32_t>&)> &fn)
+{
+    uint32_t count = cfg_func_count(cfg);
+    if( jobs <= 0 )
+        jobs = int(std::thread::hardware_concurrency());
+    if( jobs > int(count) )
+        jobs = int(count);
+    if( jobs < 1 )
+        jobs = 1;
+    std::atomic<uint32_t> next(0);
+    auto worker = [&]() {
+        std::vector<uint32_t> mark(cfg_block_count(cfg), CFG_NONE);
+        uint32_t f;
+        while( (f = next++) < count )
+            fn(f, mark);
+    };
+    std::vector<std::thread> pool;
+    for( int i = 1; i < jobs; i++ )
+        pool.push_back(std::thread(worker));
+    worker();
+    for( size_t i = 0; i < pool.size(); i++ )
+        pool[i].join();
+}
+
+//----------------------------------------------------------------------
+static void find_blocks(const DISASM_t *ctx, CFG_t *cfg, std::vector<uint32_t> &entries)
+{
+    uint32_t line_count = uint32_t(ctx->line.size());
+    std::vector<uint64_t> leader((line_count + 63) / 64, 0);
+    uint32_t succ[2];
+    uint32_t call;
+    for( size_t i = 0; i < entries.size(); i++ )
+        set_bit(leader, entries[i]);
+    for( uint32_t addr = next_line(ctx, PLANE_DECODED, 0, line_count); addr < line_count;
+         addr = next_line(ctx, PLANE_DECODED, addr + 1, line_count) )
+    {
+        int count = flow_successors(ctx, addr, succ, &call);
+        if( is_code(ctx, call) )
+        {
+            set_bit(leader, call);
+            entries.push_back(call);
+        }
+        if( ends_block(ctx, addr, succ, count) )
+            for( int i = 0; i < count; i++ )
+                set_bit(leader, succ[i]);
+    }
+
+    bool open = false;
+    uint32_t expect = 0;
+    for( uint32_t addr = next_line(ctx, PLANE_DECODED, 0, line_count); addr < line_count;
+         addr = next_line(ctx, PLANE_DECODED, addr + 1, line_count) )
+    {
+        if( !open || addr != expect || get_bit(leader, addr) )
+        {
+            cfg->block_start.push_back(addr);
+            cfg->block_last.push_back(addr);
+            cfg->block_flags.push_back(0);
+        }
+        uint8_t mnem = ctx->line[addr].instr.mnem;
+        uint8_t &flags = cfg->block_flags.back();
+        cfg->block_last.back() = addr;
+        if( mnem == MN_ICALL || mnem == MN_EICALL )
+            flags |= BLOCK_ICALL;
+        int count = flow_successors(ctx, addr, succ, &call);
+        open = !ends_block(ctx, addr, succ, count);
+        expect = addr + instr_words(mnem);
+        if( mnem == MN_RET || mnem == MN_RETI )
+            flags |= BLOCK_RETURN;
+        else if( (mnem == MN_IJMP || mnem == MN_EIJMP) && count == 0 )
+            flags |= BLOCK_INDIRECT;
+    }
+}
+
+//----------------------------------------------------------------------
+static void link_blocks(const DISASM_t *ctx, CFG_t *cfg)
+{
+    uint32_t block_count = cfg_block_count(cfg);
+    uint32_t succ[2];
+    uint32_t call;
+    cfg->succ_first.resize(block_count + 1);
+    cfg->succ.clear();
+    std::vector<uint32_t> pred_count(block_count + 1, 0);
+    for( uint32_t b = 0; b < block_count; b++ )
+    {
+        cfg->succ_first[b] = uint32_t(cfg->succ.size());
+        int count = flow_successors(ctx, cfg->block_last[b], succ, &call);
+        for( int i = 0; i < count; i++ )
+        {
+            uint32_t s = cfg_find_block(cfg, succ[i]);
+            if( s == CFG_NONE || cfg->block_start[s] != succ[i] )
+                continue;
+            if( i == 1 && cfg->succ.size() > cfg->succ_first[b] && cfg->succ.back() == s )
+                continue;
+            cfg->succ.push_back(s);
+            pred_count[s + 1]++;
+        }
+    }
+    cfg->succ_first[block_count] = uint32_t(cfg->succ.size());
+
+    cfg->pred_first.resize(block_count + 1);
+    cfg->pred_first[0] = 0;
+    for( uint32_t b = 0; b < block_count; b++ )
+        cfg->pred_first[b + 1] = cfg->pred_first[b] + pred_count[b + 1];
+    cfg->pred.resize(cfg->succ.size());
+    std::vector<uint32_t> fill(cfg->pred_first.begin(), cfg->pred_first.end() - 1);
+    for( uint32_t b = 0; b < block_count; b++ )
+        for( uint32_t e = cfg->succ_first[b]; e < cfg->succ_first[b + 1]; e++ )
+            cfg->pred[fill[cfg->succ[e]]++] = b;
+}
+
+//----------------------------------------------------------------------
+static void find_functions(const DISASM_t *ctx, CFG_t *cfg, std::vector<uint32_t> &entries, int jobs)
+{
+    uint32_t block_count = cfg_block_count(cfg);
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+    std::vector<uint32_t> func_of_block(block_count, CFG_NONE);
+    cfg->func_entry.clear();
+    for( size_t i = 0; i < entries.size(); i++ )
+    {
+        uint32_t b = cfg_find_block(cfg, entries[i]);
+        if( b == CFG_NONE || cfg->block_start[b] != entries[i] )
+            continue;
+        func_of_block[b] = cfg_func_count(cfg);
+        cfg->block_flags[b] |= BLOCK_ENTRY;
+        cfg->func_entry.push_back(b);
+    }
+
+    uint32_t func_count = cfg_func_count(cfg);
+    std::vector<std::vector<uint32_t> > blocks(func_count);
+    std::vector<std::vector<uint32_t> > callees(func_count);
+    for_each_function(cfg, jobs, [&](uint32_t f, std::vector<uint32_t> &mark) {
+        std::vector<uint32_t> &own = blocks[f];
+        std::vector<uint32_t> &calls = callees[f];
+        own.push_back(cfg->func_entry[f]);
+        mark[cfg->func_entry[f]] = f;
+        for( size_t n = 0; n < own.size(); n++ )
+        {
+            uint32_t b = own[n];
+            for( uint32_t addr = cfg->block_start[b]; addr <= cfg->block_last[b];
+                 addr += instr_words(ctx->line[addr].instr.mnem) )
+            {
+                uint32_t succ[2];
+                uint32_t call;
+                flow_successors(ctx, addr, succ, &call);
+                if( call == CFG_NONE )
+                    continue;
+                uint32_t target = cfg_find_block(cfg, call);
+                if( target != CFG_NONE && func_of_block[target] != CFG_NONE )
+                    calls.push_back(func_of_block[target]);
+            }
+            for( uint32_t e = cfg->succ_first[b]; e < cfg->succ_first[b + 1]; e++ )
+            {
+                uint32_t s = cfg->succ[e];
+                if( mark[s] == f )
+                    continue;
+                mark[s] = f;
+                if( func_of_block[s] != CFG_NONE )
+                    calls.push_back(func_of_block[s]);
+                else
+                    own.push_back(s);
+            }
+        }
+        std::sort(own.begin() + 1, own.end());
+        std::sort(calls.begin(), calls.end());
+        calls.erase(std::unique(calls.begin(), calls.end()), calls.end());
+    });
+    flatten(blocks, cfg->func_first, cfg->func_block);
+    flatten(callees, cfg->callee_first, cfg->callee);
+}
+
+//----------------------------------------------------------------------
+// Addresses build_cfg() makes functions of: decoded roots and every call
+// target, sorted
+void cfg_entries(const DISASM_t *ctx, std::vector<uint32_t> &entries)
+{
+    uint32_t line_count = uint32_t(ctx->line.size());
+    uint32_t succ[2];
+    uint32_t call;
+    std::vector<uint32_t> roots;
+    get_roots(ctx, roots);
+    entries.clear();
+    for( size_t i = 0; i < roots.size(); i++ )
+        if( is_code(ctx, roots[i]) )
+            entries.push_back(roots[i]);
+    for( uint32_t addr = next_line(ctx, PLANE_DECODED, 0, line_count); addr < line_count;
+         addr = next_line(ctx, PLANE_DECODED, addr + 1, line_count) )
+    {
+        flow_successors(ctx, addr, succ, &call);
+        if( is_code(ctx, call) )
+            entries.push_back(call);
+    }
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+}
+
+//----------------------------------------------------------------------
+// Builds the graph from the decoded lines in three linear passes:
+// leaders, blocks, edges. Function bodies are then traced in parallel.
+void build_cfg(const DISASM_t *ctx, CFG_t *cfg, int jobs)
+{
+    cfg->block_start.clear();
+    cfg->block_last.clear();
+    cfg->block_flags.clear();
+    std::vector<uint32_t> roots;
+    get_roots(ctx, roots);
+    std::vector<uint32_t> entries;
+    for( size_t i = 0; i < roots.size(); i++ )
+        if( is_code(ctx, roots[i]) )
+            entries.push_back(roots[i]);
+    find_blocks(ctx, cfg, entries);
+    link_blocks(ctx, cfg);
+    find_functions(ctx, cfg, entries, jobs);
+}
+
+//----------------------------------------------------------------------
+// Sizes, loop count and cyclomatic complexity of every function, one
+// depth-first walk each, spread over jobs threads
+void analyze_functions(const DISASM_t *ctx, const CFG_t *cfg, int jobs, std::vector<FUNC_INFO_t> &info)
+{
+    info.assign(cfg_func_count(cfg), FUNC_INFO_t());
+    for_each_function(cfg, jobs, [&](uint32_t f, std::vector<uint32_t> &mark) {
+        const uint32_t *own = &cfg->func_block[cfg->func_first[f]];
+        uint32_t n = cfg->func_first[f + 1] - cfg->func_first[f];
+        FUNC_INFO_t *fi = &info[f];
+        fi->blocks = n;
+        // mark holds the position in own[], checked against own[] since
+        // other functions leave their positions behind
+        for( uint32_t p = 0; p < n; p++ )
+        {
+            uint32_t b = own[p];
+            mark[b] = p;
+            fi->flags |= cfg->block_flags[b];
+            for( uint32_t addr = cfg->block_start[b]; addr <= cfg->block_last[b];
+                 addr += instr_words(ctx->line[addr].instr.mnem) )
+            {
+                uint8_t mnem = ctx->line[addr].instr.mnem;
+                fi->instrs++;
+                if( mnem == MN_RCALL || mnem == MN_CALL || mnem == MN_ICALL || mnem == MN_EICALL )
+                    fi->call_sites++;
+            }
+        }
+        auto position = [&](uint32_t b) {
+            uint32_t p = mark[b];
+            return (p < n && own[p] == b) ? p : CFG_NONE;
+        };
+
+        std::vector<uint8_t> state(n, 0);   // 0 - new, 1 - on the path, 2 - done
+        std::vector<uint32_t> path_pos;
+        std::vector<uint32_t> path_edge;
+        state[0] = 1;
+        path_pos.push_back(0);
+        path_edge.push_back(cfg->succ_first[own[0]]);
+        while( !path_pos.empty() )
+        {
+            uint32_t p = path_pos.back();
+            uint32_t &e = path_edge.back();
+            if( e == cfg->succ_first[own[p] + 1] )
+            {
+                state[p] = 2;
+                path_pos.pop_back();
+                path_edge.pop_back();
+                continue;
+            }
+            uint32_t q = position(cfg->succ[e++]);
+            if( q == CFG_NONE )
+                continue;
+            fi->edges++;
+            if( state[q] == 1 )
+                fi->back_edges++;
+            else if( state[q] == 0 )
+            {
+                state[q] = 1;
+                path_pos.push_back(q);
+                path_edge.push_back(cfg->succ_first[own[q]]);
+            }
+        }
+        fi->cyclomatic = int(fi->edges) - int(n) + 2;
+    });
+}
+
+//----------------------------------------------------------------------
+static void print_addr(FILE *f, const DISASM_t *ctx, uint32_t addr)
+{
+    std::vector<LABEL_t>::const_iterator it = std::lower_bound(
+        ctx->labels.begin(), ctx->labels.end(), addr,
+        [](const LABEL_t &label, uint32_t a) { return label.addr < a; });
+    if( it != ctx->labels.end() && it->addr == addr )
+        fprintf(f, "%s", it->name.c_str());
+    else
+        fprintf(f, "L_%X", addr);
+}
+
+//----------------------------------------------------------------------
+static void print_timing(FILE *f, const TIMING_t *timing, uint32_t func)
+{
+    uint8_t flags = timing->func_flags[func];
+    if( flags & TIMING_NO_RETURN )
+        fputs("  cycles=none noreturn", f);
+    else
+        fprintf(f, "  cycles=%u-%u", timing->func_min[func], timing->func_max[func]);
+    if( flags & TIMING_LOOPS )
+        fputs(" loops", f);
+    if( flags & TIMING_RECURSIVE )
+        fputs(" recursive", f);
+    if( flags & TIMING_INDIRECT )
+        fputs(" indirect", f);
+    fputc('\n', f);
+}
+
+//----------------------------------------------------------------------
+// Text dump for tools: one "func" record per function with its figures,
+// callees and blocks, then the blocks no function reaches. With timing
+// the records also carry their cycle counts.
+bool write_cfg(const DISASM_t *ctx, const CFG_t *cfg, const std::vector<FUNC_INFO_t> &info,
+               const TIMING_t *timing, const char *file_name)
+{
+    FILE *fcfg = fopen(file_name, "wt");
+    if( fcfg == nullptr )
+        return false;
+    uint32_t block_count = cfg_block_count(cfg);
+    fprintf(fcfg, "; %u functions, %u blocks, %u edges\n",
+            cfg_func_count(cfg), block_count, unsigned(cfg->succ.size()));
+    std::vector<uint8_t> owned(block_count, 0);
+    auto print_block = [&](uint32_t b) {
+        fprintf(fcfg, "  block L_%X L_%X", cfg->block_start[b], cfg->block_last[b]);
+        if( cfg->block_flags[b] & BLOCK_RETURN )
+            fputs(" ret", fcfg);
+        if( cfg->block_flags[b] & BLOCK_INDIRECT )
+            fputs(" ijmp", fcfg);
+        if( cfg->block_flags[b] & BLOCK_ICALL )
+            fputs(" icall", fcfg);
+        if( timing )
+            fprintf(fcfg, " cycles=%u-%u", timing->block_min[b], timing->block_max[b]);
+        if( cfg->succ_first[b] < cfg->succ_first[b + 1] )
+            fputs(" ->", fcfg);
+        for( uint32_t e = cfg->succ_first[b]; e < cfg->succ_first[b + 1]; e++ )
+            fprintf(fcfg, " L_%X", cfg->block_start[cfg->succ[e]]);
+        fputc('\n', fcfg);
+    };
+    for( uint32_t f = 0; f < cfg_func_count(cfg); f++ )
+    {
+        const FUNC_INFO_t *fi = &info[f];
+        fputs("func ", fcfg);
+        print_addr(fcfg, ctx, cfg->block_start[cfg->func_entry[f]]);
+        fprintf(fcfg, " blocks=%u instrs=%u edges=%u loops=%u calls=%u cyclomatic=%d\n",
+                fi->blocks, fi->instrs, fi->edges, fi->back_edges, fi->call_sites, fi->cyclomatic);
+        if( timing )
+            print_timing(fcfg, timing, f);
+        if( cfg->callee_first[f] < cfg->callee_first[f + 1] )
+        {
+            fputs("  calls", fcfg);
+            for( uint32_t c = cfg->callee_first[f]; c < cfg->callee_first[f + 1]; c++ )
+            {
+                fputc(' ', fcfg);
+                print_addr(fcfg, ctx, cfg->block_start[cfg->func_entry[cfg->callee[c]]]);
+            }
+            fputc('\n', fcfg);
+        }
+        for( uint32_t i = cfg->func_first[f]; i < cfg->func_first[f + 1]; i++ )
+        {
+            owned[cfg->func_block[i]] = 1;
+            print_block(cfg->func_block[i]);
+        }
+    }
+    bool header = false;
+    for( uint32_t b = 0; b < block_count; b++ )
+        if( !owned[b] )
+        {
+            if( !header )
+                fputs("unreached\n", fcfg);
+            header = true;
+            print_block(b);
+        }
+    return fclose(fcfg) == 0;
+}
@@ -0,0 +1,70 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include "disasm.h"
+
+#define CFG_NONE 0xFFFFFFFFu
+
+// block_flags
+#define BLOCK_RETURN    0x01    // ends in ret or reti
+#define BLOCK_INDIRECT  0x02    // ends in ijmp or eijmp, successors unknown
+#define BLOCK_ICALL     0x04    // holds an icall or eicall
+#define BLOCK_ENTRY     0x08    // entry of a function
+
+// Control flow graph of the decoded code. Blocks are numbered in address
+// order and every relation is stored CSR style: the successors of block b
+// are succ[succ_first[b] .. succ_first[b+1]), and the same goes for pred,
+// func_block and callee. Calls do not end a block, they are edges between
+// functions instead.
+typedef struct CFG {
+    std::vector<uint32_t> block_start;
+    std::vector<uint32_t> block_last;       // address of the last instruction
+    std::vector<uint8_t> block_flags;
+    std::vector<uint32_t> succ_first;
+    std::vector<uint32_t> succ;
+    std::vector<uint32_t> pred_first;
+    std::vector<uint32_t> pred;
+    // Functions start at vectors, code labels and call targets. A function
+    // owns the blocks its entry reaches without passing another entry, so
+    // a shared tail belongs to every function that reaches it.
+    std::vector<uint32_t> func_entry;       // entry block
+    std::vector<uint32_t> func_first;
+    std::vector<uint32_t> func_block;       // entry block first
+    std::vector<uint32_t> callee_first;
+    std::vector<uint32_t> callee;           // called or tail jumped into, sorted
+} CFG_t;
+
+// Result of analyze_functions() for one function
+typedef struct FUNC_INFO {
+    uint32_t blocks;
+    uint32_t instrs;
+    uint32_t edges;
+    uint32_t back_edges;    // loops
+    uint32_t call_sites;
+    int cyclomatic;         // edges - blocks + 2
+    uint8_t flags;          // BLOCK_* of all its blocks or'ed
+} FUNC_INFO_t;
+
+inline uint32_t cfg_block_count(const CFG_t *cfg)
+{
+    return uint32_t(cfg->block_start.size());
+}
+
+inline uint32_t cfg_func_count(const CFG_t *cfg)
+{
+    return uint32_t(cfg->func_entry.size());
+}
+
+void build_cfg(const DISASM_t *ctx, CFG_t *cfg, int jobs);
+void cfg_entries(const DISASM_t *ctx, std::vector<uint32_t> &entries);
+uint32_t cfg_find_block(const CFG_t *cfg, uint32_t addr);
+void for_each_function(const CFG_t *cfg, int jobs,
+                       const std::function<void(uint32_t, std::vector<uint32_t>&)> &fn);
+void analyze_functions(const DISASM_t *ctx, const CFG_t *cfg, int jobs, std::vector<FUNC_INFO_t> &info);
+bool write_cfg(const DISASM_t *ctx, const CFG_t *cfg, const std::vector<FUNC_INFO_t> &info,
+               const struct TIMING *timing, const char *file_name);
+
+#endif
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "device.h"
+
+static const DEVICE_t device[] = {
+    { "atmega8",    "m8def.inc",     0x01000,  32, 15, 1, 0x0460,  512, PERIPH_M8 },
+    { "atmega128",  "m128def.inc",   0x10000, 128, 35, 2, 0x1100, 4096, PERIPH_NONE },
+    { "atmega1284", "m1284pdef.inc", 0x10000, 128, 35, 2, 0x4100, 4096, PERIPH_NONE },
+    { "atmega2560", "m2560def.inc",  0x20000, 128, 57, 2, 0x2200, 4096, PERIPH_NONE }
+};
+#define DEVICE_COUNT (int(sizeof(device)/sizeof(DEVICE_t)))
+
+//----------------------------------------------------------------------
+static bool same_name(const char *a, const char *b)
+{
+    for(; *a && *b; a++, b++)
+        if( tolower(*a) != tolower(*b) )
+            return false;
+    return *a == *b;
+}
+
+//----------------------------------------------------------------------
+const DEVICE_t *find_device(const char *name)
+{
+    // "m1284" is accepted as well as "atmega1284"
+    if( (name[0] == 'm' || name[0] == 'M') && isdigit(name[1]) )
+        name++;
+    for( int i = 0; i < DEVICE_COUNT; i++ )
+        if( same_name(name, device[i].name) || same_name(name, device[i].name + 6) )
+            return &device[i];
+    return nullptr;
+}
+
+//----------------------------------------------------------------------
+const DEVICE_t *default_device()
+{
+    return &device[0];
+}
+
+//----------------------------------------------------------------------
+void list_devices()
+{
+    for( int i = 0; i < DEVICE_COUNT; i++ )
+        printf("  %-12s %4uK words flash\n", device[i].name, device[i].flash_words / 1024);
+}
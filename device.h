@@ -0,0 +1,28 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <stdint.h>
+
+// I/O register layouts the simulator has peripheral models for
+enum {
+    PERIPH_NONE,        // core only
+    PERIPH_M8           // ATmega8 Timer0/1/2, USART, ADC and EEPROM
+};
+
+typedef struct DEVICE {
+    const char *name;
+    const char *inc_file;   // assembler definitions included by the listing
+    uint32_t flash_words;   // program memory size, a power of two
+    uint32_t page_words;    // flash page size
+    uint8_t vector_count;   // interrupt vectors decoded as origins
+    uint8_t vector_words;   // size of one vector slot, 2 on parts with jmp
+    uint32_t data_size;     // data space: registers, I/O and SRAM up to RAMEND
+    uint32_t eeprom_size;   // bytes, a power of two
+    uint8_t periph_map;     // PERIPH_*
+} DEVICE_t;
+
+const DEVICE_t *find_device(const char *name);
+const DEVICE_t *default_device();
+void list_devices();
+
+#endif
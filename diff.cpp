@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include "diff.h"
+
+//----------------------------------------------------------------------
+static inline uint64_t mix(uint64_t h, uint64_t value)
+{
+    h ^= value * 0x9E3779B97F4A7C15ULL;
+    h = (h << 27) | (h >> 37);
+    return h * 0xC2B2AE3D27D4EB4FULL;
+}
+
+//----------------------------------------------------------------------
+static inline uint32_t func_addr(const CFG_t *cfg, uint32_t f)
+{
+    return cfg->block_start[cfg->func_entry[f]];
+}
+
+//----------------------------------------------------------------------
+static inline uint32_t func_blocks(const CFG_t *cfg, uint32_t f)
+{
+    return cfg->func_first[f + 1] - cfg->func_first[f];
+}
+
+//----------------------------------------------------------------------
+static const LABEL_t *label_at(const DISASM_t *ctx, uint32_t addr)
+{
+    std::vector<LABEL_t>::const_iterator it = std::lower_bound(
+        ctx->labels.begin(), ctx->labels.end(), addr,
+        [](const LABEL_t &label, uint32_t a) { return label.addr < a; });
+    return it != ctx->labels.end() && it->addr == addr ? &*it : nullptr;
+}
+
+//----------------------------------------------------------------------
+// Function entries are in address order, so this is a binary search
+static uint32_t find_func(const CFG_t *cfg, uint32_t addr)
+{
+    uint32_t lo = 0, hi = cfg_func_count(cfg);
+    while( lo < hi )
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if( func_addr(cfg, mid) < addr )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < cfg_func_count(cfg) && func_addr(cfg, lo) == addr ? lo : CFG_NONE;
+}
+
+//----------------------------------------------------------------------
+static uint64_t block_fingerprint(const DISASM_t *ctx, const CFG_t *cfg, uint32_t b, uint32_t *instrs)
+{
+    uint64_t h = mix(cfg->block_flags[b] & (BLOCK_RETURN | BLOCK_INDIRECT | BLOCK_ICALL),
+                     cfg->succ_first[b + 1] - cfg->succ_first[b]);
+    for( uint32_t addr = cfg->block_start[b]; addr <= cfg->block_last[b];
+         addr += instr_words(ctx->line[addr].instr.mnem) )
+    {
+        const INSTR_t *in = &ctx->line[addr].instr;
+        uint8_t mnem = in->mnem;
+        if( mnem == MN_JMP )
+            mnem = MN_RJMP;
+        else if( mnem == MN_CALL )
+            mnem = MN_RCALL;
+        uint64_t k = mnem_info[mnem].fmt == FMT_TARGET ? 0 : in->k;
+        h = mix(h, mnem | (uint32_t(in->rd) << 8) | (uint32_t(in->rr) << 16) | (k << 32));
+        (*instrs)++;
+    }
+    return h;
+}
+
+//----------------------------------------------------------------------
+// Edges are hashed as positions in the function's own block list, an
+// edge that leaves the function only as such
+static void fingerprint_image(const DISASM_t *ctx, const CFG_t *cfg, DIFF_IMAGE_t *img)
+{
+    uint32_t block_count = cfg_block_count(cfg);
+    uint32_t func_count = cfg_func_count(cfg);
+    std::vector<uint32_t> block_instrs(block_count, 0);
+    img->block_hash.resize(block_count);
+    for( uint32_t b = 0; b < block_count; b++ )
+        img->block_hash[b] = block_fingerprint(ctx, cfg, b, &block_instrs[b]);
+    img->func_hash.resize(func_count);
+    img->func_instrs.assign(func_count, 0);
+    std::vector<uint32_t> local(block_count, CFG_NONE);
+    for( uint32_t f = 0; f < func_count; f++ )
+    {
+        uint32_t first = cfg->func_first[f];
+        uint32_t last = cfg->func_first[f + 1];
+        for( uint32_t i = first; i < last; i++ )
+            local[cfg->func_block[i]] = i - first;
+        uint64_t h = mix(0, last - first);
+        for( uint32_t i = first; i < last; i++ )
+        {
+            uint32_t b = cfg->func_block[i];
+            h = mix(h, img->block_hash[b]);
+            for( uint32_t e = cfg->succ_first[b]; e < cfg->succ_first[b + 1]; e++ )
+                h = mix(h, local[cfg->succ[e]]);
+            img->func_instrs[f] += block_instrs[b];
+        }
+        for( uint32_t i = first; i < last; i++ )
+            local[cfg->func_block[i]] = CFG_NONE;
+        img->func_hash[f] = h;
+    }
+}
+
+//----------------------------------------------------------------------
+// Blocks of new function n with the same fingerprint as one of old o
+static uint32_t shared_blocks(const DIFF_t *diff, const CFG_t *old_cfg, uint32_t o, const CFG_t *new_cfg, uint32_t n)
+{
+    std::vector<uint64_t> hashes;
+    for( uint32_t i = old_cfg->func_first[o]; i < old_cfg->func_first[o + 1]; i++ )
+        hashes.push_back(diff->image[0].block_hash[old_cfg->func_block[i]]);
+    std::sort(hashes.begin(), hashes.end());
+    uint32_t shared = 0;
+    for( uint32_t i = new_cfg->func_first[n]; i < new_cfg->func_first[n + 1]; i++ )
+        if( std::binary_search(hashes.begin(), hashes.end(), diff->image[1].block_hash[new_cfg->func_block[i]]) )
+            shared++;
+    return shared;
+}
+
+//----------------------------------------------------------------------
+// Pairs the functions of the two images in four rounds, each only over
+// what the rounds before left unpaired:
+//  1. equal fingerprints, the same address first
+//  2. equal names from the input files
+//  3. most shared block fingerprints, if at least half of both
+//  4. the same entry address, or the same neighbours in address order
+// Every round is a hash lookup or a binary search per function, so the
+// whole diff stays close to linear in the size of the images.
+void diff_images(const DISASM_t *old_ctx, const CFG_t *old_cfg, const DISASM_t *new_ctx, const CFG_t *new_cfg,
+                 DIFF_t *diff)
+{
+    fingerprint_image(old_ctx, old_cfg, &diff->image[0]);
+    fingerprint_image(new_ctx, new_cfg, &diff->image[1]);
+    const DIFF_IMAGE_t *old_img = &diff->image[0];
+    const DIFF_IMAGE_t *new_img = &diff->image[1];
+    uint32_t old_count = cfg_func_count(old_cfg);
+    uint32_t new_count = cfg_func_count(new_cfg);
+    std::vector<uint32_t> old_match(old_count, CFG_NONE);
+    std::vector<uint32_t> new_match(new_count, CFG_NONE);
+    std::vector<uint8_t> kind(old_count, DIFF_REMOVED);
+    auto pair_up = [&](uint32_t o, uint32_t n, uint8_t k) {
+        old_match[o] = n;
+        new_match[n] = o;
+        kind[o] = k;
+    };
+
+    for( uint32_t n = 0; n < new_count; n++ )
+    {
+        uint32_t o = find_func(old_cfg, func_addr(new_cfg, n));
+        if( o != CFG_NONE && old_img->func_hash[o] == new_img->func_hash[n] )
+            pair_up(o, n, DIFF_SAME);
+    }
+    std::unordered_map<uint64_t, std::vector<uint32_t> > by_hash;
+    for( uint32_t o = 0; o < old_count; o++ )
+        if( old_match[o] == CFG_NONE )
+            by_hash[old_img->func_hash[o]].push_back(o);
+    std::unordered_map<uint64_t, size_t> taken;
+    for( uint32_t n = 0; n < new_count; n++ )
+    {
+        if( new_match[n] != CFG_NONE )
+            continue;
+        std::unordered_map<uint64_t, std::vector<uint32_t> >::const_iterator it = by_hash.find(new_img->func_hash[n]);
+        if( it == by_hash.end() )
+            continue;
+        size_t &next = taken[it->first];
+        if( next < it->second.size() )
+            pair_up(it->second[next++], n, DIFF_MOVED);
+    }
+
+    std::unordered_map<std::string, uint32_t> by_name;
+    for( uint32_t o = 0; o < old_count; o++ )
+    {
+        const LABEL_t *label = label_at(old_ctx, func_addr(old_cfg, o));
+        if( label && old_match[o] == CFG_NONE )
+            by_name[label->name] = o;
+    }
+    for( uint32_t n = 0; n < new_count && !by_name.empty(); n++ )
+    {
+        const LABEL_t *label = label_at(new_ctx, func_addr(new_cfg, n));
+        if( label == nullptr || new_match[n] != CFG_NONE )
+            continue;
+        std::unordered_map<std::string, uint32_t>::const_iterator it = by_name.find(label->name);
+        if( it != by_name.end() && old_match[it->second] == CFG_NONE )
+            pair_up(it->second, n, DIFF_CHANGED);
+    }
+
+    std::unordered_map<uint64_t, std::vector<uint32_t> > owners;
+    for( uint32_t o = 0; o < old_count; o++ )
+        if( old_match[o] == CFG_NONE )
+            for( uint32_t i = old_cfg->func_first[o]; i < old_cfg->func_first[o + 1]; i++ )
+            {
+                std::vector<uint32_t> &list = owners[old_img->block_hash[old_cfg->func_block[i]]];
+                if( list.empty() || list.back() != o )
+                    list.push_back(o);
+            }
+    std::vector<uint32_t> votes(old_count, 0);
+    std::vector<uint32_t> voted;
+    for( uint32_t n = 0; n < new_count; n++ )
+    {
+        if( new_match[n] != CFG_NONE )
+            continue;
+        for( uint32_t i = new_cfg->func_first[n]; i < new_cfg->func_first[n + 1]; i++ )
+        {
+            std::unordered_map<uint64_t, std::vector<uint32_t> >::const_iterator it =
+                owners.find(new_img->block_hash[new_cfg->func_block[i]]);
+            if( it == owners.end() || it->second.size() > DIFF_MAX_OWNERS )
+                continue;
+            for( size_t j = 0; j < it->second.size(); j++ )
+            {
+                uint32_t o = it->second[j];
+                if( old_match[o] != CFG_NONE )
+                    continue;
+                if( votes[o]++ == 0 )
+                    voted.push_back(o);
+            }
+        }
+        uint32_t best = CFG_NONE;
+        for( size_t j = 0; j < voted.size(); j++ )
+            if( best == CFG_NONE || votes[voted[j]] > votes[best] )
+                best = voted[j];
+        if( best != CFG_NONE )
+        {
+            uint32_t shared = std::min(votes[best], std::min(func_blocks(old_cfg, best), func_blocks(new_cfg, n)));
+            if( 2 * shared >= func_blocks(old_cfg, best) && 2 * shared >= func_blocks(new_cfg, n) )
+                pair_up(best, n, DIFF_CHANGED);
+        }
+        for( size_t j = 0; j < voted.size(); j++ )
+            votes[voted[j]] = 0;
+        voted.clear();
+    }
+
+    for( uint32_t n = 0; n < new_count; n++ )
+    {
+        if( new_match[n] != CFG_NONE )
+            continue;
+        uint32_t o = find_func(old_cfg, func_addr(new_cfg, n));
+        if( o == CFG_NONE || old_match[o] != CFG_NONE )
+        {
+            o = n > 0 && new_match[n - 1] != CFG_NONE ? new_match[n - 1] + 1 : CFG_NONE;
+            if( o >= old_count || old_match[o] != CFG_NONE )
+                continue;
+            bool last = n + 1 == new_count && o + 1 == old_count;
+            if( !last && (n + 1 == new_count || new_match[n + 1] != o + 1) )
+                continue;
+        }
+        pair_up(o, n, DIFF_CHANGED);
+    }
+
+    diff->pair.clear();
+    std::fill(diff->count, diff->count + DIFF_KINDS, 0);
+    for( uint32_t o = 0; o < old_count; o++ )
+    {
+        DIFF_PAIR_t pair = { o, old_match[o], kind[o], 0 };
+        if( pair.kind == DIFF_CHANGED )
+            pair.same_blocks = shared_blocks(diff, old_cfg, o, new_cfg, pair.new_func);
+        else if( pair.kind != DIFF_REMOVED )
+            pair.same_blocks = func_blocks(new_cfg, pair.new_func);
+        diff->pair.push_back(pair);
+        diff->count[pair.kind]++;
+    }
+    for( uint32_t n = 0; n < new_count; n++ )
+        if( new_match[n] == CFG_NONE )
+        {
+            DIFF_PAIR_t pair = { CFG_NONE, n, DIFF_ADDED, 0 };
+            diff->pair.push_back(pair);
+            diff->count[DIFF_ADDED]++;
+        }
+}
+
+//----------------------------------------------------------------------
+// name[L_X] when the input file named it, L_X otherwise
+static void print_func(FILE *f, const DISASM_t *ctx, const CFG_t *cfg, uint32_t func)
+{
+    uint32_t addr = func_addr(cfg, func);
+    const LABEL_t *label = label_at(ctx, addr);
+    if( label )
+        fprintf(f, "%s[L_%X]", label->name.c_str(), addr);
+    else
+        fprintf(f, "L_%X", addr);
+}
+
+//----------------------------------------------------------------------
+// One line per function that did not stay as it was, in the address
+// order of the old image, the added ones last
+bool write_diff(const DISASM_t *old_ctx, const CFG_t *old_cfg, const DISASM_t *new_ctx, const CFG_t *new_cfg,
+                const DIFF_t *diff, const char *old_file, const char *new_file, const char *file_name)
+{
+    FILE *fdiff = fopen(file_name, "wt");
+    if( fdiff == nullptr )
+        return false;
+    const uint32_t *count = diff->count;
+    fprintf(fdiff, "; %s -> %s\n", old_file, new_file);
+    fprintf(fdiff, "; %u functions before, %u after: %u same, %u moved, %u changed, %u removed, %u added\n",
+            cfg_func_count(old_cfg), cfg_func_count(new_cfg), count[DIFF_SAME], count[DIFF_MOVED],
+            count[DIFF_CHANGED], count[DIFF_REMOVED], count[DIFF_ADDED]);
+    const std::vector<uint32_t> &old_instrs = diff->image[0].func_instrs;
+    const std::vector<uint32_t> &new_instrs = diff->image[1].func_instrs;
+    for( size_t i = 0; i < diff->pair.size(); i++ )
+    {
+        const DIFF_PAIR_t *pair = &diff->pair[i];
+        switch( pair->kind )
+        {
+        case DIFF_MOVED:
+        case DIFF_CHANGED:
+            fputs(pair->kind == DIFF_MOVED ? "moved   " : "changed ", fdiff);
+            print_func(fdiff, old_ctx, old_cfg, pair->old_func);
+            fputs(" -> ", fdiff);
+            print_func(fdiff, new_ctx, new_cfg, pair->new_func);
+            if( pair->kind == DIFF_MOVED )
+                fprintf(fdiff, "  instrs=%u\n", new_instrs[pair->new_func]);
+            else
+                fprintf(fdiff, "  blocks=%u/%u same instrs=%u -> %u\n", pair->same_blocks,
+                        func_blocks(new_cfg, pair->new_func), old_instrs[pair->old_func],
+                        new_instrs[pair->new_func]);
+            break;
+        case DIFF_REMOVED:
+            fputs("removed ", fdiff);
+            print_func(fdiff, old_ctx, old_cfg, pair->old_func);
+            fprintf(fdiff, "  instrs=%u\n", old_instrs[pair->old_func]);
+            break;
+        case DIFF_ADDED:
+            fputs("added   ", fdiff);
+            print_func(fdiff, new_ctx, new_cfg, pair->new_func);
+            fprintf(fdiff, "  instrs=%u\n", new_instrs[pair->new_func]);
+            break;
+        }
+    }
+    return fclose(fdiff) == 0;
+}
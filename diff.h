@@ -0,0 +1,50 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stdint.h>
+#include <vector>
+#include "cfg.h"
+
+// What became of a function between the two images
+enum {
+    DIFF_SAME,          // same code at the same address
+    DIFF_MOVED,         // same code somewhere else
+    DIFF_CHANGED,       // paired by name, shared blocks or address, code differs
+    DIFF_REMOVED,
+    DIFF_ADDED,
+    DIFF_KINDS
+};
+
+// Blocks whose fingerprint more functions than this share, like a lone
+// ret, say nothing about which functions belong together
+#define DIFF_MAX_OWNERS 16
+
+typedef struct DIFF_PAIR {
+    uint32_t old_func;      // CFG_NONE - added
+    uint32_t new_func;      // CFG_NONE - removed
+    uint8_t kind;           // DIFF_*
+    uint32_t same_blocks;   // blocks of new_func with a twin in old_func
+} DIFF_PAIR_t;
+
+// Function fingerprints of one image. Blocks hash their instructions with
+// the jump and call targets masked out and long and short forms folded
+// together, so code that only moved or calls code that moved hashes the
+// same. A function hashes its blocks in order plus the edges between them.
+typedef struct DIFF_IMAGE {
+    std::vector<uint64_t> block_hash;
+    std::vector<uint64_t> func_hash;
+    std::vector<uint32_t> func_instrs;
+} DIFF_IMAGE_t;
+
+typedef struct DIFF {
+    DIFF_IMAGE_t image[2];          // old, new
+    std::vector<DIFF_PAIR_t> pair;  // old functions in address order, then the added ones
+    uint32_t count[DIFF_KINDS];
+} DIFF_t;
+
+void diff_images(const DISASM_t *old_ctx, const CFG_t *old_cfg, const DISASM_t *new_ctx, const CFG_t *new_cfg,
+                 DIFF_t *diff);
+bool write_diff(const DISASM_t *old_ctx, const CFG_t *old_cfg, const DISASM_t *new_ctx, const CFG_t *new_cfg,
+                const DIFF_t *diff, const char *old_file, const char *new_file, const char *file_name);
+
+#endif
@@ -0,0 +1,1376 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include "math_utils.h"
+#include "word_class.h"
+#include "disasm.h"
+
+typedef uint8_t (*COMMAND_t)(DISASM_t *ctx, uint16_t cmd, bool process);
+
+static uint8_t get_instruction_size(DISASM_t *ctx, uint32_t addr);
+static void mark_erased(DISASM_t *ctx);
+
+//----------------------------------------------------------------------
+// Makes line[addr] valid, growing the table towards the end of flash
+static void reserve_lines(DISASM_t *ctx, uint32_t addr)
+{
+    if( addr < ctx->line.size() )
+        return;
+    size_t size = ctx->line.size() * 2;
+    if( size < addr + 1 + LINE_GUARD )
+        size = addr + 1 + LINE_GUARD;
+    if( size > ctx->flash_mask + 1 + LINE_GUARD )
+        size = ctx->flash_mask + 1 + LINE_GUARD;
+    grow_lines(ctx, size);
+    ctx->origin_queued.resize((size + 63) / 64, 0);
+}
+
+//----------------------------------------------------------------------
+static void mark_pointed(DISASM_t *ctx, uint32_t addr)
+{
+    reserve_lines(ctx, addr);
+    line_set(ctx, PLANE_POINTED, addr);
+}
+
+//----------------------------------------------------------------------
+static void add_origin(DISASM_t *ctx, uint32_t addr)
+{
+    if( addr > ctx->flash_mask )
+        return;
+    reserve_lines(ctx, addr);
+    uint64_t mask = uint64_t(1) << (addr & 63);
+    uint64_t *queued = &ctx->origin_queued[addr >> 6];
+    if( (*queued & mask) || line_is(ctx, PLANE_DECODED, addr) )
+        return;
+    *queued |= mask;
+    ctx->origin.push_back(addr);
+}
+
+//----------------------------------------------------------------------
+// Jump target found outside the decode handlers, labelled and queued
+void add_code_target(DISASM_t *ctx, uint32_t addr)
+{
+    if( addr > ctx->flash_mask )
+        return;
+    mark_pointed(ctx, addr);
+    add_origin(ctx, addr);
+}
+
+//----------------------------------------------------------------------
+// Resolved address of the indirect instruction at addr, only valid when
+// its line is marked resolved
+uint32_t indirect_target(const DISASM_t *ctx, uint32_t addr)
+{
+    size_t lo = 0, hi = ctx->indirect.size();
+    while( lo < hi )
+    {
+        size_t mid = (lo + hi) / 2;
+        if( ctx->indirect[mid].addr < addr )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return ctx->indirect[lo].target;
+}
+
+//----------------------------------------------------------------------
+static void delete_first_origin(DISASM_t *ctx)
+{
+    if( ctx->origin_head < ctx->origin.size() )
+        ctx->origin_head++;
+}
+
+//----------------------------------------------------------------------
+static void set_instr(DISASM_t *ctx, uint8_t mnem, uint8_t rd = 0, uint8_t rr = 0, uint32_t k = 0)
+{
+    INSTR_t *instr = &ctx->line[ctx->pc].instr;
+    instr->mnem = mnem;
+    instr->rd = rd;
+    instr->rr = rr;
+    instr->k = k;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_nop(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( cmd != 0x0000)
+        return 0;
+    if( process )
+        set_instr(ctx, MN_NOP);
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_movw(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFF00) != 0x0100)
+        return 0;
+    if( process )
+    {
+        uint8_t dst = 2 * F16(cmd, 4, 4);
+        uint8_t src = 2 * F16(cmd, 0, 4);
+        set_instr(ctx, MN_MOVW, dst, src);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_cpc_cp(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xEC00) != 0x0400)
+        return 0;
+    if( process )
+    {
+        uint8_t dst = F16(cmd, 4, 5);
+        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
+        if( BIT(cmd, 12) )
+            set_instr(ctx, MN_CP, dst, src);
+        else
+            set_instr(ctx, MN_CPC, dst, src);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_sub_sbc(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xEC00) != 0x0800)
+        return 0;
+    if( process )
+    {
+        uint8_t dst = F16(cmd, 4, 5);
+        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
+        if( BIT(cmd, 12) )
+            set_instr(ctx, MN_SUB, dst, src);
+        else
+            set_instr(ctx, MN_SBC, dst, src);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_add_adc_lsl_rol(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xEC00) != 0x0C00)
+        return 0;
+    if( process )
+    {
+        uint8_t dst = F16(cmd, 4, 5);
+        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
+        if( BIT(cmd, 12) )
+        {
+            if( dst != src )
+                set_instr(ctx, MN_ADC, dst, src);
+            else
+                set_instr(ctx, MN_ROL, dst, src);
+        }
+        else
+        {
+            if( dst != src )
+                set_instr(ctx, MN_ADD, dst, src);
+            else
+                set_instr(ctx, MN_LSL, dst, src);
+        }
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_cpse(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFC00) != 0x1000)
+        return 0;
+    if( process )
+    {
+        uint8_t dst = F16(cmd, 4, 5);
+        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
+        set_instr(ctx, MN_CPSE, dst, src);
+        add_origin(ctx, ctx->pc + 1 + get_instruction_size(ctx, ctx->pc + 1));
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_and(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFC00) != 0x2000)
+        return 0;
+    if( process )
+    {
+        uint8_t dst = F16(cmd, 4, 5);
+        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
+        set_instr(ctx, MN_AND, dst, src);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_eor(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFC00) != 0x2400)
+        return 0;
+    if( process )
+    {
+        uint8_t dst = F16(cmd, 4, 5);
+        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
+        set_instr(ctx, MN_EOR, dst, src);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_or(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFC00) != 0x2800)
+        return 0;
+    if( process )
+    {
+        uint8_t dst = F16(cmd, 4, 5);
+        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
+        set_instr(ctx, MN_OR, dst, src);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_mov(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFC00) != 0x2C00)
+        return 0;
+    if( process )
+    {
+        uint8_t dst = F16(cmd, 4, 5);
+        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
+        set_instr(ctx, MN_MOV, dst, src);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_cpi(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xF000) != 0x3000)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = 16 + F16(cmd, 4, 4);
+        uint8_t val = (F16(cmd, 8, 4) << 4) + F16(cmd, 0, 4);
+        set_instr(ctx, MN_CPI, reg, 0, val);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_subi_sbci(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xE000) != 0x4000)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = 16 + F16(cmd, 4, 4);
+        uint8_t val = (F16(cmd, 8, 4) << 4) + F16(cmd, 0, 4);
+        if( BIT(cmd, 12) )
+            set_instr(ctx, MN_SUBI, reg, 0, val);
+        else
+            set_instr(ctx, MN_SBCI, reg, 0, val);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_ori(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xF000) != 0x6000)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = 16 + F16(cmd, 4, 4);
+        uint8_t val = (F16(cmd, 8, 4) << 4) + F16(cmd, 0, 4);
+        set_instr(ctx, MN_ORI, reg, 0, val);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_andi(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xF000) != 0x7000)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = 16 + F16(cmd, 4, 4);
+        uint8_t val = (F16(cmd, 8, 4) << 4) + F16(cmd, 0, 4);
+        set_instr(ctx, MN_ANDI, reg, 0, val);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_ldd_std(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xD000) != 0x8000)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 4, 5);
+        uint8_t offset = (F16(cmd, 13, 1) << 5) + (F16(cmd, 10, 2) << 3) + F16(cmd, 0, 3);
+        uint8_t ptr = BIT(cmd, 3) ? PTR_Y : PTR_Z;
+        if( BIT(cmd, 9) )
+            set_instr(ctx, MN_STD, reg, ptr, offset);
+        else
+            set_instr(ctx, MN_LDD, reg, ptr, offset);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_lds_sts(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFC0F) != 0x9000)
+        return 0;
+    if( process )
+    {
+        uint8_t  reg = F16(cmd, 4, 5);
+        uint16_t addr = code_word(ctx, ctx->pc+1);
+        line_set(ctx, PLANE_VISITED, ctx->pc+1);
+        if( BIT(cmd, 9) )
+            set_instr(ctx, MN_STS, reg, 0, addr);
+        else
+            set_instr(ctx, MN_LDS, reg, 0, addr);
+    }
+    return 2;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_ld_st_plus(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFC07) != 0x9001)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 4, 5);
+        uint8_t ptr = BIT(cmd, 3) ? PTR_Y_INC : PTR_Z_INC;
+        if( BIT(cmd, 9) )
+            set_instr(ctx, MN_ST, reg, ptr);
+        else
+            set_instr(ctx, MN_LD, reg, ptr);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_ld_st_minus(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFC07) != 0x9002)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 4, 5);
+        uint8_t ptr = BIT(cmd, 3) ? PTR_Y_DEC : PTR_Z_DEC;
+        if( BIT(cmd, 9) )
+            set_instr(ctx, MN_ST, reg, ptr);
+        else
+            set_instr(ctx, MN_LD, reg, ptr);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_e_lpm(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFE0D) != 0x9004)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 4, 5);
+        if( BIT(cmd, 1) )
+            set_instr(ctx, MN_ELPM, reg, PTR_Z);
+        else
+            set_instr(ctx, MN_LPM, reg, PTR_Z);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_e_lpm_plus(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFE0D) != 0x9005)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 4, 5);
+        if( BIT(cmd, 1) )
+            set_instr(ctx, MN_ELPM, reg, PTR_Z_INC);
+        else
+            set_instr(ctx, MN_LPM, reg, PTR_Z_INC);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_ld_st_x(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    static const uint8_t ptr_x[3] = { PTR_X, PTR_X_INC, PTR_X_DEC };
+    if( (cmd & 0xFC0C) != 0x900C)
+        return 0;
+    uint8_t type = F16(cmd, 0, 2);
+    if( type == 3 )
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 4, 5);
+        if( BIT(cmd, 9) )
+            set_instr(ctx, MN_ST, reg, ptr_x[type]);
+        else
+            set_instr(ctx, MN_LD, reg, ptr_x[type]);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_push_pop(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFC0F) != 0x900F)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 4, 5);
+        if( BIT(cmd, 9) )
+            set_instr(ctx, MN_PUSH, reg);
+        else
+            set_instr(ctx, MN_POP, reg);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_one_operand(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    static const uint8_t oo_instr[8] =
+        { MN_COM, MN_NEG, MN_SWAP, MN_INC, MN_ERASED, MN_ASR, MN_LSR, MN_ROR };
+    if( (cmd & 0xFE08) != 0x9400)
+        return 0;
+    uint8_t type = F16(cmd, 0, 3);
+    if( type == 4 )
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 4, 5);
+        set_instr(ctx, oo_instr[type], reg);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_sex_clx(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFF0F) != 0x9408)
+        return 0;
+    if( process )
+    {
+        uint8_t bit = F16(cmd, 4, 3);
+        if( BIT(cmd, 7) )
+            set_instr(ctx, MN_CL, 0, bit);
+        else
+            set_instr(ctx, MN_SE, 0, bit);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_ret_reti(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFFEF) != 0x9508 )
+        return 0;
+    if( process )
+    {
+        if( BIT(cmd, 4) )
+            set_instr(ctx, MN_RETI);
+        else
+            set_instr(ctx, MN_RET);
+        ctx->pc--;
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_misc(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    static const uint8_t instr[7] =
+        { MN_SLEEP, MN_BREAK, MN_WDR, MN_LPM_R0, MN_ELPM_R0, MN_SPM, MN_SPM_ZP };
+    static const uint8_t instr_code[7] =
+        {   0x8,      0x9,      0xA,    0xC,       0xD,        0xE,    0xF      };
+    if( (cmd & 0xFF0F) != 0x9508)
+        return 0;
+    uint8_t type = F16(cmd, 4, 4);
+    uint8_t i = 0;
+    for(; (i < 7) && (instr_code[i] != type); i++ );
+    if( i >= 7 )
+        return 0;
+    if( process )
+        set_instr(ctx, instr[i]);
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_ijmp_icall(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFEEF) != 0x9409)
+        return 0;
+    if( process )
+    {
+        if( BIT(cmd, 4) )
+        {
+            if( BIT(cmd, 8) )
+                set_instr(ctx, MN_EICALL);
+            else
+                set_instr(ctx, MN_EIJMP);
+        }
+        else
+        {
+            if( BIT(cmd, 8) )
+                set_instr(ctx, MN_ICALL);
+            else
+                set_instr(ctx, MN_IJMP);
+        }
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_dec(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFE0F) != 0x940A)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 4, 5);
+        set_instr(ctx, MN_DEC, reg);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_jmp_call(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFE0C) != 0x940C)
+        return 0;
+    if( process )
+    {
+        // 22-bit word address, the top 6 bits are in the opcode
+        uint32_t addr = (F16(cmd, 4, 5) << 17) + (F16(cmd, 0, 1) << 16) + code_word(ctx, ctx->pc+1);
+        addr &= ctx->flash_mask;
+        line_set(ctx, PLANE_VISITED, ctx->pc+1);
+        mark_pointed(ctx, addr);
+        if( BIT(cmd, 1) )
+        {
+            set_instr(ctx, MN_CALL, 0, 0, addr);
+            add_origin(ctx, ctx->pc+2);
+        }
+        else
+            set_instr(ctx, MN_JMP, 0, 0, addr);
+        ctx->pc = addr - 2;
+    }
+    return 2;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_adiw_subiw(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFE00) != 0x9600)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = 24 + 2 * F16(cmd, 4, 2);
+        uint8_t val = (F16(cmd, 6, 2) << 4) + F16(cmd, 0, 4);
+        if( BIT(cmd, 8) )
+            set_instr(ctx, MN_SBIW, reg, 0, val);
+        else
+            set_instr(ctx, MN_ADIW, reg, 0, val);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_cbi_sbi(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFD00) != 0x9800)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 3, 5);
+        uint8_t bit = F16(cmd, 0, 3);
+        if( BIT(cmd, 9) )
+            set_instr(ctx, MN_SBI, reg, bit);
+        else
+            set_instr(ctx, MN_CBI, reg, bit);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_sbis_sbic(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFD00) != 0x9900)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 3, 5);
+        uint8_t bit = F16(cmd, 0, 3);
+        if( BIT(cmd, 9) )
+            set_instr(ctx, MN_SBIS, reg, bit);
+        else
+            set_instr(ctx, MN_SBIC, reg, bit);
+        add_origin(ctx, ctx->pc + 1 + get_instruction_size(ctx, ctx->pc + 1));
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_mul(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFC00) != 0x9C00)
+        return 0;
+    if( process )
+    {
+        uint8_t dst = F16(cmd, 4, 5);
+        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
+        set_instr(ctx, MN_MUL, dst, src);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_in_out(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xF000) != 0xB000)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 4, 5);
+        uint8_t io_reg = 16 * F16(cmd, 9, 2) + F16(cmd, 0, 4);
+        if( BIT(cmd, 11) )
+            set_instr(ctx, MN_OUT, reg, io_reg);
+        else
+            set_instr(ctx, MN_IN, reg, io_reg);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_rjmp_rcall(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xE000) != 0xC000)
+        return 0;
+    if( process )
+    {
+        uint32_t addr;
+        if( BIT(cmd, 11) )
+            addr = (ctx->pc + 1 - (0x1000 - F16(cmd, 0, 12) )) & ctx->flash_mask;
+        else
+            addr = (ctx->pc + 1 + F16(cmd, 0, 12)) & ctx->flash_mask;
+        mark_pointed(ctx, addr);
+        if( BIT(cmd, 12) )
+        {
+            set_instr(ctx, MN_RCALL, 0, 0, addr);
+            add_origin(ctx, ctx->pc+1);
+        }
+        else
+            set_instr(ctx, MN_RJMP, 0, 0, addr);
+        ctx->pc = addr - 1;
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_ldi(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xF000) != 0xE000)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = 16 + F16(cmd, 4, 4);
+        uint8_t val = (F16(cmd, 8, 4) << 4) + F16(cmd, 0, 4);
+        set_instr(ctx, MN_LDI, reg, 0, val);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_cond_branch(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xF800) != 0xF000)
+        return 0;
+    if( process )
+    {
+        uint8_t bit = F16(cmd, 0, 3);
+        uint8_t offs = F16(cmd, 3, 7);
+        uint32_t addr;
+        if( BIT(offs, 6) )
+            addr = (ctx->pc + 1 - (0x80 - offs)) & ctx->flash_mask;
+        else
+            addr = (ctx->pc + 1 + offs) & ctx->flash_mask;
+        if( BIT(cmd, 10) )
+            set_instr(ctx, MN_BRSH + bit, 0, bit, addr);
+        else
+            set_instr(ctx, MN_BRLO + bit, 0, bit, addr);
+        add_origin(ctx, addr);
+        mark_pointed(ctx, addr);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_bld_bst(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFC08) != 0xF800)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 4, 5);
+        uint8_t bit = F16(cmd, 0, 3);
+        if( BIT(cmd, 9) )
+            set_instr(ctx, MN_BST, reg, bit);
+        else
+            set_instr(ctx, MN_BLD, reg, bit);
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_sbrs_sbrc(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( (cmd & 0xFC08) != 0xFC00)
+        return 0;
+    if( process )
+    {
+        uint8_t reg = F16(cmd, 4, 5);
+        uint8_t bit = F16(cmd, 0, 3);
+        if( BIT(cmd, 9) )
+            set_instr(ctx, MN_SBRS, reg, bit);
+        else
+            set_instr(ctx, MN_SBRC, reg, bit);
+        add_origin(ctx, ctx->pc + 1 + get_instruction_size(ctx, ctx->pc + 1));
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static uint8_t cmd_not_programmed(DISASM_t *ctx, uint16_t cmd, bool process)
+{
+    if( cmd != 0xFFFF)
+        return 0;
+    if( process )
+    {
+        set_instr(ctx, MN_ERASED);
+        ctx->pc--;
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+static COMMAND_t command[] = {
+    cmd_nop,
+    cmd_movw,
+    cmd_cpc_cp,
+    cmd_sub_sbc,
+    cmd_add_adc_lsl_rol,
+    cmd_cpse,
+    cmd_and,
+    cmd_eor,
+    cmd_or,
+    cmd_mov,
+    cmd_cpi,
+    cmd_subi_sbci,
+    cmd_ori,
+    cmd_andi,
+    cmd_ldd_std,
+    cmd_lds_sts,
+    cmd_ld_st_plus,
+    cmd_ld_st_minus,
+    cmd_e_lpm,
+    cmd_e_lpm_plus,
+    cmd_ld_st_x,
+    cmd_push_pop,
+    cmd_one_operand,
+    cmd_sex_clx,
+    cmd_ret_reti,
+    cmd_misc,
+    cmd_ijmp_icall,
+    cmd_dec,
+    cmd_jmp_call,
+    cmd_adiw_subiw,
+    cmd_cbi_sbi,
+    cmd_sbis_sbic,
+    cmd_mul,
+    cmd_in_out,
+    cmd_rjmp_rcall,
+    cmd_ldi,
+    cmd_cond_branch,
+    cmd_bld_bst,
+    cmd_sbrs_sbrc,
+    cmd_not_programmed
+};
+#define COMMAND_COUNT (int(sizeof(command)/sizeof(COMMAND_t)))
+
+// Opcode -> command[] index and instruction size, so decoding a word
+// takes one lookup instead of trying every handler in turn
+#define NO_COMMAND 0xFF
+static uint8_t opcode_cmd[0x10000];
+static uint8_t opcode_size[0x10000];
+static std::once_flag opcode_table_once;
+
+//----------------------------------------------------------------------
+static void build_opcode_table()
+{
+    for( uint32_t op = 0; op < 0x10000; op++ )
+    {
+        opcode_cmd[op] = NO_COMMAND;
+        opcode_size[op] = 0;
+        for( int i = 0; i < COMMAND_COUNT; i++ )
+        {
+            uint8_t size = command[i](nullptr, uint16_t(op), false);
+            if( size != 0 )
+            {
+                opcode_cmd[op] = uint8_t(i);
+                opcode_size[op] = size;
+                break;
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+void init_opcode_table()
+{
+    std::call_once(opcode_table_once, build_opcode_table);
+}
+
+//----------------------------------------------------------------------
+// Decodes every flash word as if an instruction started there, for the
+// simulator. The handlers run on a scratch context, so the labels and
+// origins they add do not touch ctx, and with every origin marked queued
+// they add none at all. Words that are no instruction get MN_COUNT.
+void predecode_flash(const DISASM_t *ctx, std::vector<INSTR_t> &instr)
+{
+    init_opcode_table();
+    uint32_t words = ctx->flash_mask + 1;
+    DISASM_t scratch;
+    scratch.device = ctx->device;
+    scratch.flash_mask = ctx->flash_mask;
+    scratch.code = ctx->code;
+    scratch.code_words = ctx->code_words;
+    grow_lines(&scratch, words + LINE_GUARD);
+    scratch.origin_queued.assign((scratch.line.size() + 63) / 64, ~uint64_t(0));
+    scratch.origin_head = 0;
+    instr.resize(words);
+    for( uint32_t addr = 0; addr < words; addr++ )
+    {
+        uint16_t cmd = code_word(ctx, addr);
+        uint8_t i = opcode_cmd[cmd];
+        if( i == NO_COMMAND )
+        {
+            instr[addr] = INSTR_t();
+            instr[addr].mnem = MN_COUNT;
+            continue;
+        }
+        scratch.pc = addr;
+        command[i](&scratch, cmd, true);
+        instr[addr] = scratch.line[addr].instr;
+    }
+}
+
+//----------------------------------------------------------------------
+static bool decode_instruction(DISASM_t *ctx)
+{
+    if( line_is(ctx, PLANE_VISITED, ctx->pc) )
+        return false;
+    uint32_t addr = ctx->pc;
+    uint16_t cmd = code_word(ctx, ctx->pc);
+    uint8_t i = opcode_cmd[cmd];
+    if( i == NO_COMMAND )
+        return false;
+    uint8_t size = command[i](ctx, cmd, true);
+    line_set(ctx, PLANE_DECODED, addr);
+    line_set(ctx, PLANE_VISITED, addr);
+    ctx->pc += size;
+    return true;
+}
+
+//----------------------------------------------------------------------
+static uint8_t get_instruction_size(DISASM_t *ctx, uint32_t addr)
+{
+    return opcode_size[code_word(ctx, addr)];
+}
+
+//----------------------------------------------------------------------
+static bool decode_chain(DISASM_t *ctx)
+{
+    ctx->pc = ctx->origin[ctx->origin_head];
+    while( !line_is(ctx, PLANE_DECODED, ctx->pc) )
+        if(!decode_instruction(ctx))
+            return false;
+    delete_first_origin(ctx);
+    return true;
+}
+
+//----------------------------------------------------------------------
+bool decode_dump(DISASM_t *ctx)
+{
+    while( ctx->origin_head < ctx->origin.size() )
+        if( !decode_chain(ctx) )
+            return false;
+    return true;
+}
+
+//----------------------------------------------------------------------
+// decode_dump() that drops a failing chain and goes on with the next one,
+// returns the number of chains dropped. What a dropped chain decoded
+// before it failed stays decoded.
+uint32_t decode_queued(DISASM_t *ctx)
+{
+    uint32_t failed = 0;
+    while( ctx->origin_head < ctx->origin.size() )
+        if( !decode_chain(ctx) )
+        {
+            failed++;
+            delete_first_origin(ctx);
+        }
+    return failed;
+}
+
+//----------------------------------------------------------------------
+// Lines that show up in the listing with a label: decoded code or a
+// .dw word
+static bool line_has_label(DISASM_t *ctx, uint32_t addr)
+{
+    if( addr >= ctx->line.size() )
+        return false;
+    return    line_is(ctx, PLANE_DECODED, addr)
+           || !(line_is(ctx, PLANE_VISITED, addr) || line_is(ctx, PLANE_ERASED, addr));
+}
+
+//----------------------------------------------------------------------
+// Linear sweep over the words decode_dump() left alone. Erased words and
+// 2-word prefixes are classified in bulk first, then every remaining
+// word with a valid opcode is decoded in address order, skipping erased,
+// visited and table words 64 at a time. Recursive descent
+// wins wherever the two disagree: the sweep never touches visited lines
+// or lpm tables and does not follow the flow of what it decodes, and a
+// swept branch whose target would have no label is dropped back to .dw.
+// Returns the number of instructions added.
+uint32_t sweep_dump(DISASM_t *ctx)
+{
+    uint32_t count = ctx->code_words < ctx->flash_mask + 1 ? ctx->code_words : ctx->flash_mask + 1;
+    std::vector<uint64_t> erased((count + 63) / 64);
+    std::vector<uint64_t> wide((count + 63) / 64);
+    classify_words(ctx->code, count, erased.data(), wide.data());
+    reserve_lines(ctx, count);
+
+    size_t origin_count = ctx->origin.size();
+    std::vector<uint32_t> swept;
+    uint32_t addr = 0;
+    while( addr < count )
+    {
+        uint32_t w = addr >> 6;
+        uint64_t live = ~(erased[w] | ctx->plane[PLANE_VISITED][w] | ctx->plane[PLANE_DATA][w]) >> (addr & 63);
+        if( live == 0 )
+        {
+            addr = (addr | 63) + 1;
+            continue;
+        }
+        addr += ctz64(live);
+        if( addr >= count )
+            break;
+        bool is_wide = (wide[addr >> 6] >> (addr & 63)) & 1;
+        uint16_t cmd = ctx->code[addr];
+        uint8_t i = opcode_cmd[cmd];
+        if(    i == NO_COMMAND
+            || (   is_wide
+                && (   addr + 1 >= count || line_is(ctx, PLANE_VISITED, addr + 1)
+                    || line_is(ctx, PLANE_DATA, addr + 1))) )
+        {
+            addr++;
+            continue;
+        }
+        ctx->pc = addr;
+        command[i](ctx, cmd, true);
+        line_set(ctx, PLANE_DECODED, addr);
+        line_set(ctx, PLANE_VISITED, addr);
+        line_set(ctx, PLANE_SWEPT, addr);
+        swept.push_back(addr);
+        addr += is_wide ? 2 : 1;
+    }
+    // origins queued by swept branches are not followed
+    ctx->origin.resize(origin_count);
+    ctx->origin_head = uint32_t(origin_count);
+
+    uint32_t added = 0;
+    for( size_t n = 0; n < swept.size(); n++ )
+    {
+        const INSTR_t *instr = &ctx->line[swept[n]].instr;
+        if( mnem_info[instr->mnem].fmt == FMT_TARGET && !line_has_label(ctx, instr->k) )
+        {
+            line_clear(ctx, PLANE_DECODED, swept[n]);
+            line_clear(ctx, PLANE_VISITED, swept[n]);
+            line_clear(ctx, PLANE_SWEPT, swept[n]);
+            if( opcode_size[code_word(ctx, swept[n])] == 2 )
+                line_clear(ctx, PLANE_VISITED, swept[n] + 1);
+        }
+        else
+            added++;
+    }
+    return added;
+}
+
+//----------------------------------------------------------------------
+// Chain starts every decode begins with: the interrupt vectors and code
+// labels of the input file
+void get_roots(const DISASM_t *ctx, std::vector<uint32_t> &roots)
+{
+    roots.clear();
+    for( int i = 0; i < ctx->device->vector_count; i++ )
+        roots.push_back(uint32_t(i) * ctx->device->vector_words);
+    for( size_t i = 0; i < ctx->labels.size(); i++ )
+        if( ctx->labels[i].code )
+            roots.push_back(ctx->labels[i].addr);
+}
+
+//----------------------------------------------------------------------
+uint32_t instr_words(uint8_t mnem)
+{
+    return (mnem == MN_LDS || mnem == MN_STS || mnem == MN_JMP || mnem == MN_CALL) ? 2 : 1;
+}
+
+//----------------------------------------------------------------------
+static bool instr_is_skip(uint8_t mnem)
+{
+    return    mnem == MN_CPSE || mnem == MN_SBIC || mnem == MN_SBIS
+           || mnem == MN_SBRC || mnem == MN_SBRS;
+}
+
+//----------------------------------------------------------------------
+// Where decoding goes on after the decoded instruction at addr, the same
+// way the handlers move pc and queue origins. Returns the count, at most
+// 2 addresses are stored in succ.
+int instr_successors(const DISASM_t *ctx, uint32_t addr, uint32_t *succ)
+{
+    const INSTR_t *instr = &ctx->line[addr].instr;
+    uint8_t mnem = instr->mnem;
+    uint32_t next = addr + instr_words(mnem);
+    int count = 0;
+    switch( mnem ) {
+    case MN_RET:
+    case MN_RETI:
+    case MN_ERASED:
+        return 0;
+    case MN_RJMP:
+    case MN_JMP:
+        succ[count++] = instr->k;
+        return count;
+    case MN_RCALL:
+    case MN_CALL:
+        succ[count++] = instr->k;
+        if( next <= ctx->flash_mask )
+            succ[count++] = next;
+        return count;
+    }
+    succ[count++] = next;
+    if( mnem >= MN_BRLO && mnem <= MN_BRID )
+        succ[count++] = instr->k;
+    else if( instr_is_skip(mnem) )
+    {
+        uint32_t skip = addr + 1 + opcode_size[code_word(ctx, addr + 1)];
+        if( skip <= ctx->flash_mask && skip != next )
+            succ[count++] = skip;
+    }
+    return count;
+}
+
+//----------------------------------------------------------------------
+// Drops the decode of line[addr] and the operand word it covered
+static void clear_line(DISASM_t *ctx, uint32_t addr)
+{
+    if( instr_words(ctx->line[addr].instr.mnem) == 2 && !line_is(ctx, PLANE_DECODED, addr + 1) )
+        line_clear(ctx, PLANE_VISITED, addr + 1);
+    line_clear(ctx, PLANE_DECODED, addr);
+    line_clear(ctx, PLANE_VISITED, addr);
+    line_clear(ctx, PLANE_SWEPT, addr);
+}
+
+//----------------------------------------------------------------------
+static bool same_words(const DISASM_t *ctx, const uint16_t *prev_code, uint32_t prev_words,
+                       uint32_t from, uint32_t to)
+{
+    if( to <= prev_words && to <= ctx->code_words )
+        return memcmp(prev_code + from, ctx->code + from, (to - from) * sizeof(uint16_t)) == 0;
+    for( uint32_t i = from; i < to; i++ )
+        if( (i < prev_words ? prev_code[i] : 0xFFFF) != code_word(ctx, i) )
+            return false;
+    return true;
+}
+
+//----------------------------------------------------------------------
+// Brings the decode of the previous image up to date with the image now
+// loaded in ctx. Flash is compared page by page, decoded lines that
+// touch a changed page are dropped and queued again, and the worklist
+// runs from those origins only. When one of them lost a successor it
+// had before, lines no path from the roots reaches any more are removed.
+// Branch target marks are rebuilt at the end. Sweep results are dropped,
+// run sweep_dump() again if wanted. On false the image does not decode,
+// call init_vars() and decode_dump() for the same result a fresh run
+// gives.
+bool redecode_dump(DISASM_t *ctx, const uint16_t *prev_code, uint32_t prev_words, REDECODE_STATS_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if( ctx->code_words > ctx->flash_mask + 1 )
+        ctx->code_words = ctx->flash_mask + 1;
+    if( ctx->code_words > 0 )
+        reserve_lines(ctx, ctx->code_words - 1);
+    mark_erased(ctx);
+    uint32_t line_count = uint32_t(ctx->line.size());
+    for( uint32_t i = next_line(ctx, PLANE_SWEPT, 0, line_count); i < line_count;
+         i = next_line(ctx, PLANE_SWEPT, i + 1, line_count) )
+        clear_line(ctx, i);
+
+    // decoded lines in changed pages and the one just before each page,
+    // its operand or skip target may be the first changed word
+    uint32_t page_words = ctx->device->page_words;
+    uint32_t words = prev_words > ctx->code_words ? prev_words : ctx->code_words;
+    std::vector<uint32_t> affected;
+    for( uint32_t from = 0; from < words; from += page_words )
+    {
+        uint32_t to = from + page_words < words ? from + page_words : words;
+        if( same_words(ctx, prev_code, prev_words, from, to) )
+            continue;
+        stats->dirty_pages++;
+        uint32_t addr = from ? from - 1 : 0;
+        if( !affected.empty() && affected.back() >= addr )
+            addr = affected.back() + 1;
+        uint32_t end = to < line_count ? to : line_count;
+        for( addr = next_line(ctx, PLANE_DECODED, addr, end); addr < end;
+             addr = next_line(ctx, PLANE_DECODED, addr + 1, end) )
+            affected.push_back(addr);
+    }
+    if( stats->dirty_pages == 0 )
+        return true;
+    stats->invalidated = uint32_t(affected.size());
+
+    // successors as decoded from the old words, skips look at the next one
+    const uint16_t *code = ctx->code;
+    uint32_t code_words = ctx->code_words;
+    ctx->code = prev_code;
+    ctx->code_words = prev_words;
+    std::vector<uint32_t> old_succ(affected.size() * 3);
+    for( size_t i = 0; i < affected.size(); i++ )
+        old_succ[i * 3] = uint32_t(instr_successors(ctx, affected[i], &old_succ[i * 3 + 1]));
+    ctx->code = code;
+    ctx->code_words = code_words;
+
+    for( size_t i = 0; i < affected.size(); i++ )
+        clear_line(ctx, affected[i]);
+    ctx->origin.clear();
+    ctx->origin_head = 0;
+    ctx->origin_queued.assign((ctx->line.size() + 63) / 64, 0);
+    for( size_t i = 0; i < affected.size(); i++ )
+        add_origin(ctx, affected[i]);
+    // some of them may be dead now, so a failing chain is only an error
+    // if the roots still reach it
+    bool lost = decode_queued(ctx) > 0;
+    for( size_t i = 0; i < affected.size() && !lost; i++ )
+    {
+        uint32_t succ[2];
+        int count = line_is(ctx, PLANE_DECODED, affected[i]) ? instr_successors(ctx, affected[i], succ) : 0;
+        for( uint32_t n = 0; n < old_succ[i * 3] && !lost; n++ )
+        {
+            uint32_t old = old_succ[i * 3 + 1 + n];
+            lost = !((count > 0 && succ[0] == old) || (count > 1 && succ[1] == old));
+        }
+    }
+
+    line_count = uint32_t(ctx->line.size());
+    if( lost )
+    {
+        std::vector<uint64_t> live((line_count + 63) / 64, 0);
+        std::vector<uint32_t> roots, stack;
+        get_roots(ctx, roots);
+        for( size_t i = 0; i < roots.size(); i++ )
+            if( roots[i] <= ctx->flash_mask )
+                stack.push_back(roots[i]);
+        while( !stack.empty() )
+        {
+            uint32_t addr = stack.back();
+            stack.pop_back();
+            if( addr > ctx->flash_mask + LINE_GUARD || addr >= line_count )
+                continue;
+            uint64_t bit = uint64_t(1) << (addr & 63);
+            if( live[addr >> 6] & bit )
+                continue;
+            live[addr >> 6] |= bit;
+            if( !line_is(ctx, PLANE_DECODED, addr) )
+                return false;
+            uint32_t succ[2];
+            int count = instr_successors(ctx, addr, succ);
+            for( int n = 0; n < count; n++ )
+                stack.push_back(succ[n]);
+        }
+        // decoded lines the roots do not reach, 64 at a time
+        for( size_t w = 0; w < live.size(); w++ )
+            for( uint64_t dead = ctx->plane[PLANE_DECODED][w] & ~live[w]; dead != 0; dead &= dead - 1 )
+            {
+                clear_line(ctx, uint32_t(w * 64 + ctz64(dead)));
+                stats->collected++;
+            }
+    }
+
+    std::fill(ctx->plane[PLANE_POINTED].begin(), ctx->plane[PLANE_POINTED].end(), 0);
+    for( uint32_t i = next_line(ctx, PLANE_DECODED, 0, line_count); i < line_count;
+         i = next_line(ctx, PLANE_DECODED, i + 1, line_count) )
+        if( mnem_info[ctx->line[i].instr.mnem].fmt == FMT_TARGET )
+            mark_pointed(ctx, ctx->line[i].instr.k);
+    return true;
+}
+
+//----------------------------------------------------------------------
+void print_dump(DISASM_t *ctx)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(ctx->code);
+    for( int i = 0; i < ctx->dump_size; i++ )
+    {
+        printf("%02X", bytes[i]);
+        if( i % 16 == 15 || i == ctx->dump_size - 1) puts("");
+    }
+}
+
+
+//----------------------------------------------------------------------
+// Sets plane bits from..to-1
+static void set_lines(std::vector<uint64_t> &plane, size_t from, size_t to)
+{
+    for( size_t i = from; i < to; )
+    {
+        size_t n = 64 - (i & 63) < to - i ? 64 - (i & 63) : to - i;
+        plane[i >> 6] |= (n == 64 ? ~uint64_t(0) : ((uint64_t(1) << n) - 1)) << (i & 63);
+        i += n;
+    }
+}
+
+//----------------------------------------------------------------------
+// Grows line[] and its planes to size lines. New lines lie past the
+// loaded image, so the only bit they get is the erased one.
+void grow_lines(DISASM_t *ctx, size_t size)
+{
+    size_t old = ctx->line.size();
+    if( size <= old )
+        return;
+    ctx->line.resize(size, LINE_t());
+    for( int p = 0; p < PLANE_COUNT; p++ )
+        ctx->plane[p].resize((size + 63) / 64, 0);
+    set_lines(ctx->plane[PLANE_ERASED], old > ctx->code_words ? old : ctx->code_words, size);
+}
+
+//----------------------------------------------------------------------
+// Rebuilds the erased plane from the words of the loaded image
+static void mark_erased(DISASM_t *ctx)
+{
+    std::vector<uint64_t> &erased = ctx->plane[PLANE_ERASED];
+    std::fill(erased.begin(), erased.end(), 0);
+    std::vector<uint64_t> wide(erased.size());
+    classify_words(ctx->code, ctx->code_words, erased.data(), wide.data());
+    set_lines(erased, ctx->code_words, ctx->line.size());
+}
+
+//----------------------------------------------------------------------
+// First line in from..end-1 with its plane bit set, end if none
+uint32_t next_line(const DISASM_t *ctx, int plane, uint32_t from, uint32_t end)
+{
+    const std::vector<uint64_t> &bits = ctx->plane[plane];
+    if( from >= end )
+        return end;
+    uint32_t w = from >> 6;
+    uint64_t word = bits[w] & (~uint64_t(0) << (from & 63));
+    uint32_t last = (end - 1) >> 6;
+    while( word == 0 )
+    {
+        if( ++w > last )
+            return end;
+        word = bits[w];
+    }
+    uint32_t addr = w * 64 + uint32_t(ctz64(word));
+    return addr < end ? addr : end;
+}
+
+//----------------------------------------------------------------------
+uint32_t count_lines(const DISASM_t *ctx, int plane)
+{
+    uint32_t count = 0;
+    for( size_t w = 0; w < ctx->plane[plane].size(); w++ )
+        count += uint32_t(popcount64(ctx->plane[plane][w]));
+    return count;
+}
+
+//----------------------------------------------------------------------
+void init_vars(DISASM_t *ctx, const DEVICE_t *device)
+{
+    init_opcode_table();
+    ctx->device = device;
+    ctx->flash_mask = device->flash_words - 1;
+    if( ctx->code_words > device->flash_words )
+        ctx->code_words = device->flash_words;
+    ctx->line.clear();
+    for( int p = 0; p < PLANE_COUNT; p++ )
+        ctx->plane[p].clear();
+    grow_lines(ctx, ctx->code_words + LINE_GUARD);
+    mark_erased(ctx);
+    ctx->origin_queued.assign((ctx->line.size() + 63) / 64, 0);
+    ctx->indirect.clear();
+    ctx->origin.clear();
+    ctx->origin_head = 0;
+    ctx->pc = 0;
+    std::vector<uint32_t> roots;
+    get_roots(ctx, roots);
+    for( size_t i = 0; i < roots.size(); i++ )
+        add_origin(ctx, roots[i]);
+}
+
+// Released contexts are kept for the next image instead of being freed,
+// so a batch run allocates at most one context per worker thread
+static std::mutex pool_lock;
+static std::vector<DISASM_t*> pool;
+
+//----------------------------------------------------------------------
+DISASM_t *disasm_acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(pool_lock);
+        if( !pool.empty() )
+        {
+            DISASM_t *ctx = pool.back();
+            pool.pop_back();
+            return ctx;
+        }
+    }
+    DISASM_t *ctx = new DISASM_t;
+    ctx->device = default_device();
+    ctx->flash_mask = ctx->device->flash_words - 1;
+    ctx->dump_size = 0;
+    ctx->mapping.data = nullptr;
+    ctx->mapping.size = 0;
+    ctx->code = nullptr;
+    ctx->code_words = 0;
+    ctx->pc = 0;
+    ctx->origin_head = 0;
+    return ctx;
+}
+
+//----------------------------------------------------------------------
+void disasm_release(DISASM_t *ctx)
+{
+    unmap_file(&ctx->mapping);
+    ctx->code = nullptr;
+    ctx->code_words = 0;
+    std::lock_guard<std::mutex> lock(pool_lock);
+    pool.push_back(ctx);
+}
@@ -0,0 +1,125 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "avr_instr.h"
+#include "device.h"
+#include "mapped_file.h"
+
+// Lines past the end of flash, so a 2-word instruction in the last word
+// can still look at its operand
+#define LINE_GUARD 2
+
+typedef struct LINE {
+    INSTR_t instr;
+} LINE_t;
+
+// Flags of line[], each a bitset with one bit per line so scans for gaps,
+// code or data go 64 lines at a time
+enum {
+    PLANE_VISITED,      // decoded, or the operand word of a 2-word instruction
+    PLANE_DECODED,
+    PLANE_POINTED,      // branch target, printed with a label
+    PLANE_SWEPT,        // decoded by sweep_dump(), no path from the roots
+    PLANE_DATA,         // read by lpm, never decoded by sweep_dump()
+    PLANE_RESOLVED,     // address of the indirect access is in ctx->indirect
+    PLANE_ERASED,       // the word reads as 0xFFFF, follows the loaded image
+    PLANE_COUNT
+};
+
+// Named address from the input file, printed in the listing
+typedef struct LABEL {
+    uint32_t addr;
+    bool code;          // also decoded as an origin
+    std::string name;
+} LABEL_t;
+
+// Address an indirect instruction uses, worked out by track_pointers():
+// the code target of icall/ijmp, the flash byte of lpm or the data
+// address of ld/st/ldd/std
+typedef struct INDIRECT {
+    uint32_t addr;
+    uint32_t target;
+} INDIRECT_t;
+
+// Everything the disassembler knows about one image. Contexts are
+// independent of each other, so several images can be decoded in
+// parallel threads, each with its own context.
+//
+// line[] covers the loaded image and only grows past it when code
+// jumps into the erased space behind, so memory and reset time follow
+// the image size rather than the flash size of the device.
+typedef struct DISASM {
+    const DEVICE_t *device;
+    uint32_t flash_mask;            // device flash_words - 1
+    std::vector<uint8_t> mem_byte;
+    MAPPED_FILE_t mapping;          // input file when code points straight into it
+    int dump_size;
+    const uint16_t *code;           // mem_byte or mapping
+    uint32_t code_words;            // words behind code, the rest reads as erased
+    std::vector<LABEL_t> labels;    // sorted by address
+    std::vector<LINE_t> line;
+    std::vector<uint64_t> plane[PLANE_COUNT];   // (line.size() + 63) / 64 words each
+    std::vector<INDIRECT_t> indirect;   // sorted by addr
+    uint32_t pc;
+    // Decode worklist: a FIFO of chain start addresses. Every address is
+    // queued at most once, so it never holds more entries than line[].
+    std::vector<uint32_t> origin;
+    uint32_t origin_head;
+    std::vector<uint64_t> origin_queued;
+} DISASM_t;
+
+// What redecode_dump() had to redo
+typedef struct REDECODE_STATS {
+    uint32_t dirty_pages;
+    uint32_t invalidated;   // decoded lines whose words changed
+    uint32_t collected;     // lines no path reaches any more
+} REDECODE_STATS_t;
+
+//----------------------------------------------------------------------
+inline uint16_t code_word(const DISASM_t *ctx, uint32_t addr)
+{
+    return addr < ctx->code_words ? ctx->code[addr] : 0xFFFF;
+}
+
+//----------------------------------------------------------------------
+inline bool line_is(const DISASM_t *ctx, int plane, uint32_t addr)
+{
+    return (ctx->plane[plane][addr >> 6] >> (addr & 63)) & 1;
+}
+
+//----------------------------------------------------------------------
+inline void line_set(DISASM_t *ctx, int plane, uint32_t addr)
+{
+    ctx->plane[plane][addr >> 6] |= uint64_t(1) << (addr & 63);
+}
+
+//----------------------------------------------------------------------
+inline void line_clear(DISASM_t *ctx, int plane, uint32_t addr)
+{
+    ctx->plane[plane][addr >> 6] &= ~(uint64_t(1) << (addr & 63));
+}
+
+DISASM_t *disasm_acquire();
+void disasm_release(DISASM_t *ctx);
+
+void init_opcode_table();
+void init_vars(DISASM_t *ctx, const DEVICE_t *device);
+bool decode_dump(DISASM_t *ctx);
+uint32_t decode_queued(DISASM_t *ctx);
+void predecode_flash(const DISASM_t *ctx, std::vector<INSTR_t> &instr);
+uint32_t sweep_dump(DISASM_t *ctx);
+bool redecode_dump(DISASM_t *ctx, const uint16_t *prev_code, uint32_t prev_words, REDECODE_STATS_t *stats);
+void add_code_target(DISASM_t *ctx, uint32_t addr);
+uint32_t indirect_target(const DISASM_t *ctx, uint32_t addr);
+void get_roots(const DISASM_t *ctx, std::vector<uint32_t> &roots);
+uint32_t instr_words(uint8_t mnem);
+int instr_successors(const DISASM_t *ctx, uint32_t addr, uint32_t *succ);
+void print_dump(DISASM_t *ctx);
+void grow_lines(DISASM_t *ctx, size_t size);
+uint32_t next_line(const DISASM_t *ctx, int plane, uint32_t from, uint32_t end);
+uint32_t count_lines(const DISASM_t *ctx, int plane);
+
+#endif
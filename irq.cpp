@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <algorithm>
+#include "irq.h"
+
+#define IO_RAMPZ    0x3B
+#define IO_EIND     0x3C
+#define IO_SREG     0x3F
+#define SREG_I      7
+
+//----------------------------------------------------------------------
+static bool is_code(const DISASM_t *ctx, uint32_t addr)
+{
+    return addr < ctx->line.size() && line_is(ctx, PLANE_DECODED, addr);
+}
+
+//----------------------------------------------------------------------
+// Follows the rjmp/jmp chain of a vector slot and adds its cycles
+static uint32_t follow_vector(const DISASM_t *ctx, uint32_t addr, uint32_t *cycles)
+{
+    for( int hop = 0; hop < IRQ_MAX_HOPS && is_code(ctx, addr); hop++ )
+    {
+        const INSTR_t *instr = &ctx->line[addr].instr;
+        if( instr->mnem != MN_RJMP && instr->mnem != MN_JMP )
+            break;
+        uint32_t min, max;
+        instr_cycles(ctx, addr, &min, &max);
+        *cycles += max;
+        addr = instr->k;
+    }
+    return addr;
+}
+
+//----------------------------------------------------------------------
+// Handler prologue: register pushes, SREG/RAMPZ/EIND read for saving and
+// the clear of the gcc zero register r1
+static bool is_prologue(const INSTR_t *instr)
+{
+    switch( instr->mnem ) {
+    case MN_PUSH:
+        return true;
+    case MN_IN:
+        return instr->rr == IO_SREG || instr->rr == IO_RAMPZ || instr->rr == IO_EIND;
+    case MN_EOR:
+        return instr->rd == 1 && instr->rr == 1;
+    }
+    return false;
+}
+
+//----------------------------------------------------------------------
+// sei, an SREG restore or reti end a critical section
+static bool ends_critical(const INSTR_t *instr)
+{
+    return    (instr->mnem == MN_SE && instr->rr == SREG_I)
+           || (instr->mnem == MN_OUT && instr->rr == IO_SREG)
+           || instr->mnem == MN_RETI;
+}
+
+//----------------------------------------------------------------------
+static void analyze_isr(const DISASM_t *ctx, const TIMING_t *timing, uint32_t vector, ISR_INFO_t *isr)
+{
+    uint32_t addr = vector * ctx->device->vector_words;
+    isr->vector = vector;
+    isr->entry = ctx->device->flash_words > 0x10000 ? IRQ_RESPONSE_PC22 : IRQ_RESPONSE;
+    isr->handler = follow_vector(ctx, addr, &isr->entry);
+    isr->prologue = 0;
+    for( addr = isr->handler; is_code(ctx, addr) && is_prologue(&ctx->line[addr].instr);
+         addr += instr_words(ctx->line[addr].instr.mnem) )
+    {
+        uint32_t min, max;
+        instr_cycles(ctx, addr, &min, &max);
+        isr->prologue += max;
+    }
+    uint32_t b = cfg_find_block(timing->cfg, vector * ctx->device->vector_words);
+    uint32_t f = b == CFG_NONE ? CFG_NONE : timing->entry_func[b];
+    isr->body_min = f == CFG_NONE ? 0 : timing->func_min[f];
+    isr->body_max = f == CFG_NONE ? 0 : timing->func_max[f];
+    isr->flags = f == CFG_NONE ? TIMING_NO_RETURN : timing->func_flags[f];
+}
+
+//----------------------------------------------------------------------
+// Adds every function the marked ones reach through calls and tail jumps
+static void mark_callees(const CFG_t *cfg, std::vector<uint8_t> &mark)
+{
+    std::vector<uint32_t> todo;
+    for( uint32_t f = 0; f < cfg_func_count(cfg); f++ )
+        if( mark[f] )
+            todo.push_back(f);
+    while( !todo.empty() )
+    {
+        uint32_t f = todo.back();
+        todo.pop_back();
+        for( uint32_t c = cfg->callee_first[f]; c < cfg->callee_first[f + 1]; c++ )
+            if( !mark[cfg->callee[c]] )
+            {
+                mark[cfg->callee[c]] = 1;
+                todo.push_back(cfg->callee[c]);
+            }
+    }
+}
+
+//----------------------------------------------------------------------
+// Functions the interrupt vectors reach
+static void mark_isr_code(const TIMING_t *timing, const IRQ_REPORT_t *report, uint32_t vector_words,
+                          std::vector<uint8_t> &in_isr)
+{
+    const CFG_t *cfg = timing->cfg;
+    in_isr.assign(cfg_func_count(cfg), 0);
+    for( size_t i = 0; i < report->isr.size(); i++ )
+    {
+        uint32_t b = cfg_find_block(cfg, report->isr[i].vector * vector_words);
+        if( b != CFG_NONE && timing->entry_func[b] != CFG_NONE )
+            in_isr[timing->entry_func[b]] = 1;
+    }
+    mark_callees(cfg, in_isr);
+}
+
+//----------------------------------------------------------------------
+// Functions mainline code may run: the reset entry, every function no
+// vector reaches and all they call, which takes in helpers an interrupt
+// handler shares with mainline code
+static void mark_main_code(const TIMING_t *timing, const std::vector<uint8_t> &in_isr,
+                           std::vector<uint8_t> &in_main)
+{
+    const CFG_t *cfg = timing->cfg;
+    in_main.assign(cfg_func_count(cfg), 0);
+    for( uint32_t f = 0; f < cfg_func_count(cfg); f++ )
+        in_main[f] = !in_isr[f];
+    uint32_t b = cfg_find_block(cfg, 0);
+    if( b != CFG_NONE && timing->entry_func[b] != CFG_NONE )
+        in_main[timing->entry_func[b]] = 1;
+    mark_callees(cfg, in_main);
+}
+
+//----------------------------------------------------------------------
+// Times every interrupt handler from its vector, then every cli in code
+// mainline may run up to where interrupts are enabled again. The worst
+// latency of a handler adds the instruction in progress and the longest
+// time interrupts are off, in a critical section or another handler, to
+// its own entry and prologue.
+void analyze_irq(const DISASM_t *ctx, const TIMING_t *timing, IRQ_REPORT_t *report)
+{
+    const CFG_t *cfg = timing->cfg;
+    report->isr.clear();
+    report->critical.clear();
+    report->longest_instr = 0;
+    report->blocked = 0;
+    uint32_t response = ctx->device->flash_words > 0x10000 ? IRQ_RESPONSE_PC22 : IRQ_RESPONSE;
+    for( uint32_t v = 1; v < ctx->device->vector_count; v++ )
+    {
+        if( !is_code(ctx, v * ctx->device->vector_words) )
+            continue;
+        ISR_INFO_t isr;
+        analyze_isr(ctx, timing, v, &isr);
+        report->isr.push_back(isr);
+    }
+
+    std::vector<uint8_t> in_isr, in_main;
+    std::vector<uint8_t> seen(ctx->line.size(), 0);
+    mark_isr_code(timing, report, ctx->device->vector_words, in_isr);
+    mark_main_code(timing, in_isr, in_main);
+    auto stop = [&](uint32_t addr) { return ends_critical(&ctx->line[addr].instr); };
+    for( uint32_t f = 0; f < cfg_func_count(cfg); f++ )
+    {
+        if( !in_main[f] )
+            continue;
+        for( uint32_t i = cfg->func_first[f]; i < cfg->func_first[f + 1]; i++ )
+        {
+            uint32_t b = cfg->func_block[i];
+            for( uint32_t addr = cfg->block_start[b]; addr <= cfg->block_last[b];
+                 addr += instr_words(ctx->line[addr].instr.mnem) )
+            {
+                const INSTR_t *instr = &ctx->line[addr].instr;
+                if( instr->mnem != MN_CL || instr->rr != SREG_I || seen[addr] )
+                    continue;
+                seen[addr] = 1;
+                CRITICAL_t section;
+                section.addr = addr;
+                section.func = f;
+                region_cycles(ctx, timing, f, addr, stop, &section.min, &section.max, &section.flags);
+                report->critical.push_back(section);
+            }
+        }
+    }
+    std::sort(report->critical.begin(), report->critical.end(),
+              [](const CRITICAL_t &a, const CRITICAL_t &b) { return a.addr < b.addr; });
+
+    uint32_t line_count = uint32_t(ctx->line.size());
+    for( uint32_t i = next_line(ctx, PLANE_DECODED, 0, line_count); i < line_count;
+         i = next_line(ctx, PLANE_DECODED, i + 1, line_count) )
+    {
+        uint32_t min, max;
+        instr_cycles(ctx, i, &min, &max);
+        report->longest_instr = std::max(report->longest_instr, max);
+    }
+    uint32_t critical_max = 0;
+    for( size_t i = 0; i < report->critical.size(); i++ )
+        critical_max = std::max(critical_max, report->critical[i].max);
+    report->blocked = critical_max;
+    for( size_t i = 0; i < report->isr.size(); i++ )
+        report->blocked = std::max(report->blocked, response + report->isr[i].body_max);
+    for( size_t i = 0; i < report->isr.size(); i++ )
+    {
+        ISR_INFO_t *isr = &report->isr[i];
+        uint32_t blocked = critical_max;
+        for( size_t j = 0; j < report->isr.size(); j++ )
+            if( j != i )
+                blocked = std::max(blocked, response + report->isr[j].body_max);
+        isr->latency = report->longest_instr + blocked + isr->entry + isr->prologue;
+    }
+}
+
+//----------------------------------------------------------------------
+static void print_addr(FILE *f, const DISASM_t *ctx, uint32_t addr)
+{
+    std::vector<LABEL_t>::const_iterator it = std::lower_bound(
+        ctx->labels.begin(), ctx->labels.end(), addr,
+        [](const LABEL_t &label, uint32_t a) { return label.addr < a; });
+    if( it != ctx->labels.end() && it->addr == addr )
+        fprintf(f, "%s", it->name.c_str());
+    else
+        fprintf(f, "L_%X", addr);
+}
+
+//----------------------------------------------------------------------
+static void print_flags(FILE *f, uint8_t flags)
+{
+    if( flags & TIMING_NO_RETURN )
+        fputs(" noreturn", f);
+    if( flags & TIMING_OPEN )
+        fputs(" open", f);
+    if( flags & TIMING_LOOPS )
+        fputs(" loops", f);
+    if( flags & TIMING_RECURSIVE )
+        fputs(" recursive", f);
+    if( flags & TIMING_INDIRECT )
+        fputs(" indirect", f);
+    fputc('\n', f);
+}
+
+//----------------------------------------------------------------------
+// Text report: one "isr" record per used vector, one "critical" record
+// per cli. The flags say why a max is an estimate: loops counted once,
+// recursion or unresolved indirect calls, and "open" for a section that
+// returns with interrupts still disabled.
+bool write_irq(const DISASM_t *ctx, const TIMING_t *timing, const IRQ_REPORT_t *report,
+               const char *file_name)
+{
+    FILE *firq = fopen(file_name, "wt");
+    if( firq == nullptr )
+        return false;
+    fprintf(firq, "; %u handlers, %u critical sections, longest instruction %u cycles,"
+                  " interrupts disabled up to %u cycles\n",
+            unsigned(report->isr.size()), unsigned(report->critical.size()),
+            report->longest_instr, report->blocked);
+    for( size_t i = 0; i < report->isr.size(); i++ )
+    {
+        const ISR_INFO_t *isr = &report->isr[i];
+        fprintf(firq, "isr %u ", isr->vector);
+        print_addr(firq, ctx, isr->handler);
+        fprintf(firq, " entry=%u prologue=%u body=%u-%u latency=%u",
+                isr->entry, isr->prologue, isr->body_min, isr->body_max, isr->latency);
+        print_flags(firq, isr->flags);
+    }
+    for( size_t i = 0; i < report->critical.size(); i++ )
+    {
+        const CRITICAL_t *section = &report->critical[i];
+        fputs("critical ", firq);
+        print_addr(firq, ctx, section->addr);
+        fputs(" in ", firq);
+        print_addr(firq, ctx, timing->cfg->block_start[timing->cfg->func_entry[section->func]]);
+        fprintf(firq, " cycles=%u-%u", section->min, section->max);
+        print_flags(firq, section->flags);
+    }
+    return fclose(firq) == 0;
+}
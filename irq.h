@@ -0,0 +1,48 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+#include <vector>
+#include "timing.h"
+
+// Cycles from accepting an interrupt to the first vector instruction,
+// spent pushing the 2 or 3 byte return address
+#define IRQ_RESPONSE        4
+#define IRQ_RESPONSE_PC22   5
+
+// Longest vector jump chain followed to the handler
+#define IRQ_MAX_HOPS        4
+
+// One interrupt vector and the handler behind it
+typedef struct ISR_INFO {
+    uint32_t vector;        // vector number, 1 is the first after reset
+    uint32_t handler;       // first instruction past the vector jumps
+    uint32_t entry;         // response and vector jumps
+    uint32_t prologue;      // pushes and SREG save up to the first real work
+    uint32_t body_min;      // vector to reti, callees included
+    uint32_t body_max;
+    uint32_t latency;       // worst case from the request to the first real work
+    uint8_t flags;          // TIMING_* of the body
+} ISR_INFO_t;
+
+// cli in mainline code up to the sei, SREG restore or reti that ends it
+typedef struct CRITICAL {
+    uint32_t addr;          // the cli
+    uint32_t func;          // CFG function it was found in
+    uint32_t min;
+    uint32_t max;
+    uint8_t flags;          // TIMING_*, TIMING_OPEN - still disabled at a return
+} CRITICAL_t;
+
+typedef struct IRQ_REPORT {
+    std::vector<ISR_INFO_t> isr;
+    std::vector<CRITICAL_t> critical;   // by address
+    uint32_t longest_instr;             // cycles an interrupt may wait for the instruction in progress
+    uint32_t blocked;                   // longest time with interrupts disabled
+} IRQ_REPORT_t;
+
+void analyze_irq(const DISASM_t *ctx, const TIMING_t *timing, IRQ_REPORT_t *report);
+bool write_irq(const DISASM_t *ctx, const TIMING_t *timing, const IRQ_REPORT_t *report,
+               const char *file_name);
+
+#endif
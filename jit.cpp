@@ -0,0 +1,928 @@
+#include <string.h>
+#include "jit.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+#define JIT_X64
+#endif
+
+#define FLAGS_ALL   0xFF
+#define FLAGS_ARITH (SREG_H | SREG_S | SREG_V | SREG_N | SREG_Z | SREG_C)
+#define FLAGS_LOGIC (SREG_S | SREG_V | SREG_N | SREG_Z)
+#define FLAGS_WORD  (SREG_S | SREG_V | SREG_N | SREG_Z | SREG_C)
+
+// Longest instruction a helper runs, call/ret on 3 byte pc
+#define HELPER_MAX_CYCLES   5
+
+// How an instruction is translated
+enum {
+    KIND_INLINE,    // host code, falls through
+    KIND_MEMORY,    // ld/st/ldd/std: host code, the helper for hooked addresses
+    KIND_HELPER,    // interpreter handler, falls through
+    KIND_EXIT,      // interpreter handler that may go anywhere, ends the block
+    KIND_SPM,       // as KIND_EXIT, then the cache is flushed
+    KIND_BRANCH,    // brbs/brbc, ends the block
+    KIND_JUMP       // rjmp/jmp, ends the block
+};
+
+typedef struct JIT_INSN {
+    uint32_t addr;
+    uint8_t kind;
+    uint8_t reads;      // SREG bits it needs up to date
+    uint8_t writes;     // SREG bits it sets from the host flags
+    uint8_t cycles;     // inline: exact, otherwise the most it can take
+} JIT_INSN_t;
+
+#ifdef JIT_X64
+
+// Host registers while translated code runs
+//   rbx sim, rbp hook[], r12 data[], r13 cycles, r14 flag_table, r15 jit
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI };
+
+typedef struct EMIT {
+    uint8_t *p;
+    JIT_t *jit;
+    SIM_t *sim;
+    int32_t sim_pc;         // field offsets from rbx
+    int32_t sim_cycles;
+    int32_t sim_instrs;
+    int32_t sim_stop;
+    int32_t jit_link;       // field offsets from r15
+    int32_t jit_refused;
+    int32_t jit_spm;
+    uint32_t pending;       // cycles not added to r13 yet
+    uint8_t *stub_field[JIT_MAX_BLOCK * 2];     // rel32 to an exit stub emitted behind the block
+    uint32_t stub_pc[JIT_MAX_BLOCK * 2];
+    uint32_t stub_count[JIT_MAX_BLOCK * 2];     // instructions run at that exit
+    uint8_t stub_chain[JIT_MAX_BLOCK * 2];      // exit may be chained to the block at stub_pc
+    uint32_t stubs;
+} EMIT_t;
+
+//----------------------------------------------------------------------
+static inline void emit8(EMIT_t *e, uint32_t value)
+{
+    *e->p++ = uint8_t(value);
+}
+
+//----------------------------------------------------------------------
+static inline void emit32(EMIT_t *e, uint32_t value)
+{
+    memcpy(e->p, &value, 4);
+    e->p += 4;
+}
+
+//----------------------------------------------------------------------
+static inline void emit64(EMIT_t *e, uint64_t value)
+{
+    memcpy(e->p, &value, 8);
+    e->p += 8;
+}
+
+//----------------------------------------------------------------------
+static inline void patch_rel32(uint8_t *field, const uint8_t *target)
+{
+    int32_t rel = int32_t(target - (field + 4));
+    memcpy(field, &rel, 4);
+}
+
+//----------------------------------------------------------------------
+// ModRM and displacement of [r12 + disp], the REX.B is the caller's
+static void modrm_data(EMIT_t *e, int reg, uint32_t disp)
+{
+    if( disp < 0x80 )
+    {
+        emit8(e, 0x44 | (reg & 7) << 3);
+        emit8(e, 0x24);
+        emit8(e, disp);
+    }
+    else
+    {
+        emit8(e, 0x84 | (reg & 7) << 3);
+        emit8(e, 0x24);
+        emit32(e, disp);
+    }
+}
+
+//----------------------------------------------------------------------
+// Byte op between the host register or opcode extension reg and the data
+// space byte at addr
+static void op_data(EMIT_t *e, uint8_t opcode, int reg, uint32_t addr)
+{
+    emit8(e, 0x41);
+    emit8(e, opcode);
+    modrm_data(e, reg, addr);
+}
+
+//----------------------------------------------------------------------
+// Same on the register pair at addr
+static void op_data16(EMIT_t *e, uint8_t opcode, int reg, uint32_t addr)
+{
+    emit8(e, 0x66);
+    op_data(e, opcode, reg, addr);
+}
+
+//----------------------------------------------------------------------
+// ModRM of [rbx + disp32] or, with r15, [r15 + disp32]
+static void op_field(EMIT_t *e, uint8_t rex, uint8_t opcode, int reg, int32_t disp, bool r15 = false)
+{
+    if( rex || r15 )
+        emit8(e, rex | 0x40 | (r15 ? 1 : 0));
+    emit8(e, opcode);
+    emit8(e, 0x80 | (reg & 7) << 3 | (r15 ? 7 : RBX));
+    emit32(e, uint32_t(disp));
+}
+
+//----------------------------------------------------------------------
+// add r13, n
+static void add_cycles(EMIT_t *e, uint32_t n)
+{
+    if( n == 0 )
+        return;
+    emit8(e, 0x49);
+    emit8(e, 0x81);
+    emit8(e, 0xC5);
+    emit32(e, n);
+}
+
+//----------------------------------------------------------------------
+static void flush_cycles(EMIT_t *e)
+{
+    add_cycles(e, e->pending);
+    e->pending = 0;
+}
+
+//----------------------------------------------------------------------
+// cl = SREG, C into the host carry
+static void load_carry(EMIT_t *e)
+{
+    op_data(e, 0x8A, RCX, SIM_SREG);
+    emit8(e, 0xD0);
+    emit8(e, 0xE9);
+}
+
+//----------------------------------------------------------------------
+// Host flags of the last op into the SREG bits of mask. sticky_z keeps Z
+// clear once it is, force sets bits regardless. OF is only fetched when
+// V or S is wanted.
+static void capture_flags(EMIT_t *e, uint8_t mask, bool sticky_z, uint8_t force)
+{
+    emit8(e, 0x9F);                                     // lahf
+    if( mask & (SREG_V | SREG_S) )
+    {
+        emit8(e, 0x0F); emit8(e, 0x90); emit8(e, 0xC0); // seto al
+        emit8(e, 0x66); emit8(e, 0xC1); emit8(e, 0xC0); // rol ax, 8       OF -> bit 8
+        emit8(e, 0x08);
+        emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0xC0); // movzx eax, ax
+    }
+    else
+    {
+        emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC4); // movzx eax, ah
+    }
+    emit8(e, 0x41); emit8(e, 0x0F); emit8(e, 0xB6);     // movzx eax, byte [r14 + rax]
+    emit8(e, 0x04); emit8(e, 0x06);
+    if( sticky_z && (mask & SREG_Z) )
+    {
+        op_data(e, 0x8A, RDX, SIM_SREG);                // mov dl, SREG
+        emit8(e, 0x80); emit8(e, 0xCA); emit8(e, uint8_t(~SREG_Z));
+        emit8(e, 0x20); emit8(e, 0xD0);                 // and al, dl
+    }
+    if( force )
+    {
+        emit8(e, 0x0C);                                 // or al, force
+        emit8(e, force);
+    }
+    op_data(e, 0x8A, RCX, SIM_SREG);
+    emit8(e, 0x80); emit8(e, 0xE1); emit8(e, uint8_t(~mask));
+    emit8(e, 0x24); emit8(e, mask);
+    emit8(e, 0x08); emit8(e, 0xC8);                     // or al, cl
+    op_data(e, 0x88, RAX, SIM_SREG);
+}
+
+//----------------------------------------------------------------------
+// Runs the interpreter handler of the word at addr with pc and cycles
+// written back, r13 reloaded after
+static void emit_helper(EMIT_t *e, uint32_t addr)
+{
+    flush_cycles(e);
+    op_field(e, 0x0C, 0x89, 5, e->sim_cycles);          // mov [rbx + cycles], r13
+    op_field(e, 0, 0xC7, 0, e->sim_pc);                 // mov dword [rbx + pc], addr
+    emit32(e, addr);
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDF);     // mov rdi, rbx
+    emit8(e, 0x48); emit8(e, 0xBE);                     // mov rsi, op
+    emit64(e, uint64_t(uintptr_t(&e->sim->op[addr])));
+    emit8(e, 0x48); emit8(e, 0xB8);                     // mov rax, exec
+    emit64(e, uint64_t(reinterpret_cast<uintptr_t>(e->sim->op[addr].exec)));
+    emit8(e, 0xFF); emit8(e, 0xD0);                     // call rax
+    op_field(e, 0x0C, 0x8B, 5, e->sim_cycles);          // mov r13, [rbx + cycles]
+}
+
+//----------------------------------------------------------------------
+// Jump to an exit stub, emitted once the block body is done
+static void jump_stub(EMIT_t *e, uint8_t cond, uint32_t pc, uint32_t count, bool chain)
+{
+    if( cond )
+    {
+        emit8(e, 0x0F);
+        emit8(e, cond);
+    }
+    else
+        emit8(e, 0xE9);
+    e->stub_field[e->stubs] = e->p;
+    e->stub_pc[e->stubs] = pc;
+    e->stub_count[e->stubs] = count;
+    e->stub_chain[e->stubs] = chain;
+    e->stubs++;
+    emit32(e, 0);
+}
+
+//----------------------------------------------------------------------
+// Leaves through a stub if the next rest cycles may reach stop_cycles.
+// pc is already up to date, the helper set it.
+static void check_rest(EMIT_t *e, uint32_t rest, uint32_t count)
+{
+    emit8(e, 0x49); emit8(e, 0x8D); emit8(e, 0x85);     // lea rax, [r13 + rest]
+    emit32(e, rest);
+    op_field(e, 0x08, 0x3B, RAX, e->sim_stop);          // cmp rax, [rbx + stop]
+    jump_stub(e, 0x83, 0xFFFFFFFF, count, false);       // jae
+}
+
+//----------------------------------------------------------------------
+// Leaves the block to the dispatcher after count instructions, pc set by
+// the handler. A chained exit sets pc in its stub and records its own jmp
+// so the dispatcher can point it at the next block.
+static void emit_exit(EMIT_t *e, uint32_t count)
+{
+    flush_cycles(e);
+    jump_stub(e, 0, 0xFFFFFFFF, count, false);
+}
+
+//----------------------------------------------------------------------
+static void emit_stubs(EMIT_t *e)
+{
+    for( uint32_t i = 0; i < e->stubs; i++ )
+    {
+        uint8_t *stub = e->p;
+        if( e->stub_chain[i] )
+        {
+            // The jmp stays in the block, it is what gets patched, and
+            // the counts were added in front of it
+            uint8_t *site = e->stub_field[i] - 1;
+            patch_rel32(e->stub_field[i], stub);
+            op_field(e, 0, 0xC7, 0, e->sim_pc);
+            emit32(e, e->stub_pc[i]);
+            emit8(e, 0x48); emit8(e, 0xB8);             // mov rax, site
+            emit64(e, uint64_t(uintptr_t(site)));
+            op_field(e, 0x08, 0x89, RAX, e->jit_link, true);
+        }
+        else
+        {
+            patch_rel32(e->stub_field[i], stub);
+            op_field(e, 0x08, 0x81, 0, e->sim_instrs);  // add qword [rbx + instrs], count
+            emit32(e, e->stub_count[i]);
+        }
+        emit8(e, 0xE9);
+        patch_rel32(e->p, e->jit->epilogue);
+        e->p += 4;
+    }
+}
+
+//----------------------------------------------------------------------
+// A chained exit adds the counts in front of its jmp, once patched the jmp
+// skips the stub
+static void emit_chain_exit(EMIT_t *e, uint32_t count, uint32_t pc)
+{
+    flush_cycles(e);
+    op_field(e, 0x08, 0x81, 0, e->sim_instrs);
+    emit32(e, count);
+    jump_stub(e, 0, pc, 0, true);
+}
+
+//----------------------------------------------------------------------
+// Data space address an lds/sts/in/out can reach without the helper
+static bool plain_address(const SIM_t *sim, uint32_t addr, uint8_t hook)
+{
+    return addr < sim->data.size() && !(sim->hook[addr] & hook);
+}
+
+//----------------------------------------------------------------------
+static void classify(const JIT_t *jit, const SIM_t *sim, uint32_t addr, JIT_INSN_t *insn)
+{
+    insn->addr = addr;
+    insn->kind = KIND_EXIT;
+    insn->reads = FLAGS_ALL;
+    insn->writes = 0;
+    insn->cycles = HELPER_MAX_CYCLES;
+    if( addr >= jit->instr.size() )
+        return;
+    const INSTR_t *instr = &jit->instr[addr];
+    uint8_t mnem = instr->mnem;
+    if( mnem >= MN_BRLO && mnem <= MN_BRID )
+    {
+        insn->kind = KIND_BRANCH;
+        insn->reads = uint8_t(1 << instr->rr);
+        insn->cycles = 2;
+        return;
+    }
+    uint8_t kind = KIND_INLINE, reads = 0, writes = 0, cycles = 1;
+    switch( mnem ) {
+    case MN_NOP:
+    case MN_MOV:
+    case MN_MOVW:
+    case MN_LDI:
+        break;
+    case MN_ADD:
+    case MN_LSL:
+    case MN_SUB:
+    case MN_CP:
+    case MN_SUBI:
+    case MN_CPI:
+    case MN_NEG:
+        writes = FLAGS_ARITH;
+        break;
+    case MN_ADC:
+    case MN_ROL:
+        reads = SREG_C;
+        writes = FLAGS_ARITH;
+        break;
+    case MN_SBC:
+    case MN_SBCI:
+    case MN_CPC:
+        reads = SREG_C | SREG_Z;
+        writes = FLAGS_ARITH;
+        break;
+    case MN_AND:
+    case MN_OR:
+    case MN_EOR:
+    case MN_ANDI:
+    case MN_ORI:
+    case MN_INC:
+    case MN_DEC:
+        writes = FLAGS_LOGIC;
+        break;
+    case MN_COM:
+        writes = FLAGS_LOGIC | SREG_C;
+        break;
+    case MN_ADIW:
+    case MN_SBIW:
+        writes = FLAGS_WORD;
+        cycles = 2;
+        break;
+    case MN_LDS:
+    case MN_STS:
+    case MN_IN:
+    case MN_OUT:
+    {
+        bool load = mnem == MN_LDS || mnem == MN_IN;
+        uint32_t data = (mnem == MN_LDS || mnem == MN_STS) ? instr->k : 0x20u + instr->rr;
+        if( mnem == MN_LDS || mnem == MN_STS )
+            cycles = 2;
+        if( !plain_address(sim, data, load ? HOOK_READ : HOOK_WRITE) )
+            kind = KIND_HELPER;
+        if( kind == KIND_HELPER || (load && data == SIM_SREG) )
+            reads = FLAGS_ALL;
+        break;
+    }
+    case MN_LD:
+        kind = KIND_MEMORY;
+        reads = FLAGS_ALL;
+        cycles = (instr->rr == PTR_X_DEC || instr->rr == PTR_Y_DEC || instr->rr == PTR_Z_DEC) ? 3 : 2;
+        break;
+    case MN_ST:
+    case MN_LDD:
+    case MN_STD:
+        kind = KIND_MEMORY;
+        reads = FLAGS_ALL;
+        cycles = 2;
+        break;
+    case MN_RJMP:
+        kind = KIND_JUMP;
+        cycles = 2;
+        break;
+    case MN_JMP:
+        kind = KIND_JUMP;
+        cycles = 3;
+        break;
+    case MN_SPM:
+    case MN_SPM_ZP:
+        kind = KIND_SPM;
+        reads = FLAGS_ALL;
+        cycles = HELPER_MAX_CYCLES;
+        break;
+    case MN_SWAP:
+    case MN_ASR:
+    case MN_LSR:
+    case MN_ROR:
+    case MN_MUL:
+    case MN_BST:
+    case MN_BLD:
+    case MN_SE:
+    case MN_CL:
+    case MN_PUSH:
+    case MN_POP:
+    case MN_LPM:
+    case MN_ELPM:
+    case MN_LPM_R0:
+    case MN_ELPM_R0:
+    case MN_CBI:
+    case MN_SBI:
+    case MN_WDR:
+        kind = KIND_HELPER;
+        reads = FLAGS_ALL;
+        cycles = HELPER_MAX_CYCLES;
+        break;
+    default:
+        return;     // calls, returns, indirect jumps, skips, sleep, break, bad words
+    }
+    insn->kind = kind;
+    insn->reads = reads;
+    insn->writes = writes;
+    insn->cycles = cycles;
+}
+
+//----------------------------------------------------------------------
+// Host code of a KIND_INLINE instruction, flags captured for live
+static void emit_inline(EMIT_t *e, const INSTR_t *instr, uint8_t live)
+{
+    uint8_t rd = instr->rd, rr = instr->rr;
+    uint8_t k = uint8_t(instr->k);
+    bool sticky_z = false;
+    uint8_t force = 0;
+    switch( instr->mnem ) {
+    case MN_NOP:
+        return;
+    case MN_MOV:
+        op_data(e, 0x8A, RAX, rr);
+        op_data(e, 0x88, RAX, rd);
+        return;
+    case MN_MOVW:
+        op_data16(e, 0x8B, RAX, rr);
+        op_data16(e, 0x89, RAX, rd);
+        return;
+    case MN_LDI:
+        op_data(e, 0xC6, 0, rd);
+        emit8(e, k);
+        return;
+    case MN_LDS:
+    case MN_STS:
+    case MN_IN:
+    case MN_OUT:
+    {
+        uint32_t data = (instr->mnem == MN_LDS || instr->mnem == MN_STS) ? instr->k : 0x20u + rr;
+        bool load = instr->mnem == MN_LDS || instr->mnem == MN_IN;
+        op_data(e, 0x8A, RAX, load ? data : rd);
+        op_data(e, 0x88, RAX, load ? rd : data);
+        if( !load && data >= SIM_TRACKED_FROM )
+        {
+            emit8(e, 0x48); emit8(e, 0xB8);                 // mov rax, &dirty[page]
+            emit64(e, uint64_t(uintptr_t(&e->sim->dirty[data >> SIM_PAGE_SHIFT])));
+            emit8(e, 0xC6); emit8(e, 0x00); emit8(e, 0x01); // mov byte [rax], 1
+        }
+        return;
+    }
+    case MN_ADD:
+    case MN_LSL:
+        op_data(e, 0x8A, RAX, rr);
+        op_data(e, 0x00, RAX, rd);
+        break;
+    case MN_ADC:
+    case MN_ROL:
+        op_data(e, 0x8A, RAX, rr);
+        load_carry(e);
+        op_data(e, 0x10, RAX, rd);
+        break;
+    case MN_SUB:
+        op_data(e, 0x8A, RAX, rr);
+        op_data(e, 0x28, RAX, rd);
+        break;
+    case MN_SBC:
+        op_data(e, 0x8A, RAX, rr);
+        load_carry(e);
+        op_data(e, 0x18, RAX, rd);
+        sticky_z = true;
+        break;
+    case MN_CP:
+        op_data(e, 0x8A, RAX, rr);
+        op_data(e, 0x38, RAX, rd);
+        break;
+    case MN_CPC:
+        op_data(e, 0x8A, RAX, rd);
+        load_carry(e);
+        op_data(e, 0x1A, RAX, rr);                      // sbb al, rr
+        sticky_z = true;
+        break;
+    case MN_AND:
+        op_data(e, 0x8A, RAX, rr);
+        op_data(e, 0x20, RAX, rd);
+        break;
+    case MN_OR:
+        op_data(e, 0x8A, RAX, rr);
+        op_data(e, 0x08, RAX, rd);
+        break;
+    case MN_EOR:
+        op_data(e, 0x8A, RAX, rr);
+        op_data(e, 0x30, RAX, rd);
+        break;
+    case MN_SUBI:
+        op_data(e, 0x80, 5, rd);
+        emit8(e, k);
+        break;
+    case MN_SBCI:
+        load_carry(e);
+        op_data(e, 0x80, 3, rd);
+        emit8(e, k);
+        sticky_z = true;
+        break;
+    case MN_CPI:
+        op_data(e, 0x80, 7, rd);
+        emit8(e, k);
+        break;
+    case MN_ANDI:
+        op_data(e, 0x80, 4, rd);
+        emit8(e, k);
+        break;
+    case MN_ORI:
+        op_data(e, 0x80, 1, rd);
+        emit8(e, k);
+        break;
+    case MN_COM:
+        op_data(e, 0x80, 6, rd);                        // xor 0xFF, not leaves the flags alone
+        emit8(e, 0xFF);
+        force = SREG_C;
+        break;
+    case MN_NEG:
+        op_data(e, 0xF6, 3, rd);
+        break;
+    case MN_INC:
+        op_data(e, 0xFE, 0, rd);
+        break;
+    case MN_DEC:
+        op_data(e, 0xFE, 1, rd);
+        break;
+    case MN_ADIW:
+        op_data16(e, 0x83, 0, rd);
+        emit8(e, k);
+        break;
+    case MN_SBIW:
+        op_data16(e, 0x83, 5, rd);
+        emit8(e, k);
+        break;
+    }
+    if( live )
+        capture_flags(e, live, sticky_z, force & live);
+}
+
+//----------------------------------------------------------------------
+// ld/st/ldd/std straight on data[] when the address is inside it and not
+// hooked, else through the handler
+static void emit_memory(EMIT_t *e, const INSTR_t *instr, uint32_t addr, uint32_t cycles,
+                        uint32_t rest, uint32_t count, bool last)
+{
+    static const uint8_t ptr_reg[9] = { 26, 26, 26, 28, 28, 28, 30, 30, 30 };
+    bool load = instr->mnem == MN_LD || instr->mnem == MN_LDD;
+    uint8_t mode = instr->rr;
+    uint8_t ptr = ptr_reg[mode];
+    uint32_t disp = (instr->mnem == MN_LDD || instr->mnem == MN_STD) ? instr->k : 0;
+    bool inc = (instr->mnem == MN_LD || instr->mnem == MN_ST) && mode % 3 == 1;
+    bool dec = (instr->mnem == MN_LD || instr->mnem == MN_ST) && mode % 3 == 2;
+
+    flush_cycles(e);
+    emit8(e, 0x41); emit8(e, 0x0F); emit8(e, 0xB7);     // movzx eax, word ptr
+    modrm_data(e, RAX, ptr);
+    if( dec )
+    {
+        emit8(e, 0xFF); emit8(e, 0xC8);                 // dec eax
+        emit8(e, 0x25); emit32(e, 0xFFFF);              // and eax, 0xFFFF
+    }
+    if( disp )
+    {
+        emit8(e, 0x05);                                 // add eax, disp
+        emit32(e, disp);
+    }
+    emit8(e, 0x3D);                                     // cmp eax, data size
+    emit32(e, uint32_t(e->sim->data.size()));
+    emit8(e, 0x0F); emit8(e, 0x83);                     // jae slow
+    uint8_t *slow1 = e->p;
+    emit32(e, 0);
+    emit8(e, 0xF6); emit8(e, 0x44); emit8(e, 0x05); emit8(e, 0x00);     // test byte [rbp + rax], hook
+    emit8(e, load ? HOOK_READ : HOOK_WRITE);
+    emit8(e, 0x0F); emit8(e, 0x85);                     // jnz slow
+    uint8_t *slow2 = e->p;
+    emit32(e, 0);
+    // The pointer is updated before the access, which may hit the pointer
+    // itself; st takes its value before either
+    if( !load )
+        op_data(e, 0x8A, RDX, instr->rd);
+    if( inc || dec )
+        op_data16(e, 0xFF, dec ? 1 : 0, ptr);
+    if( load )
+    {
+        emit8(e, 0x41); emit8(e, 0x8A); emit8(e, 0x0C); emit8(e, 0x04);     // mov cl, [r12 + rax]
+        op_data(e, 0x88, RCX, instr->rd);
+    }
+    else
+    {
+        emit8(e, 0x41); emit8(e, 0x88); emit8(e, 0x14); emit8(e, 0x04);     // mov [r12 + rax], dl
+        emit8(e, 0xC1); emit8(e, 0xE8); emit8(e, SIM_PAGE_SHIFT);           // shr eax, page shift
+        emit8(e, 0x48); emit8(e, 0xB9);                                     // mov rcx, dirty
+        emit64(e, uint64_t(uintptr_t(e->sim->dirty.data())));
+        emit8(e, 0xC6); emit8(e, 0x04); emit8(e, 0x01); emit8(e, 0x01);     // mov byte [rcx + rax], 1
+    }
+    add_cycles(e, cycles);
+    emit8(e, 0xE9);                                     // jmp done
+    uint8_t *done = e->p;
+    emit32(e, 0);
+    patch_rel32(slow1, e->p);
+    patch_rel32(slow2, e->p);
+    emit_helper(e, addr);
+    if( !last )
+        check_rest(e, rest, count);
+    patch_rel32(done, e->p);
+}
+
+//----------------------------------------------------------------------
+// Translates the block at pc, returns its code
+static uint8_t *translate(JIT_t *jit, SIM_t *sim, uint32_t pc)
+{
+    if( jit->used + JIT_BLOCK_ROOM > JIT_CODE_SIZE )
+        jit_flush(jit);
+    JIT_INSN_t insn[JIT_MAX_BLOCK];
+    uint32_t n = 0;
+    for( uint32_t addr = pc; n < JIT_MAX_BLOCK && addr < sim->op.size(); )
+    {
+        classify(jit, sim, addr, &insn[n]);
+        uint8_t kind = insn[n++].kind;
+        if( kind >= KIND_EXIT )
+            break;
+        addr += sim->op[addr].words;
+    }
+
+    // Flag liveness backwards, everything is live behind the block
+    uint8_t live[JIT_MAX_BLOCK];
+    uint32_t rest[JIT_MAX_BLOCK + 1];
+    uint8_t after = FLAGS_ALL;
+    rest[n] = 0;
+    for( uint32_t i = n; i-- > 0; )
+    {
+        live[i] = after & insn[i].writes;
+        after = uint8_t((after & ~insn[i].writes) | insn[i].reads);
+        rest[i] = rest[i + 1] + (i + 1 < n ? insn[i].cycles : 0);
+    }
+
+    EMIT_t e;
+    e.jit = jit;
+    e.sim = sim;
+    e.p = jit->code + jit->used;
+    e.sim_pc = int32_t((uint8_t*)&sim->pc - (uint8_t*)sim);
+    e.sim_cycles = int32_t((uint8_t*)&sim->cycles - (uint8_t*)sim);
+    e.sim_instrs = int32_t((uint8_t*)&sim->instrs - (uint8_t*)sim);
+    e.sim_stop = int32_t((uint8_t*)&sim->stop_cycles - (uint8_t*)sim);
+    e.jit_link = int32_t((uint8_t*)&jit->link - (uint8_t*)jit);
+    e.jit_refused = int32_t((uint8_t*)&jit->refused - (uint8_t*)jit);
+    e.jit_spm = int32_t((uint8_t*)&jit->spm - (uint8_t*)jit);
+    e.pending = 0;
+    e.stubs = 0;
+    uint8_t *start = e.p;
+
+    // Refused when the cycles before the last instruction may reach the stop
+    emit8(&e, 0x49); emit8(&e, 0x8D); emit8(&e, 0x85);     // lea rax, [r13 + rest]
+    emit32(&e, rest[0]);
+    op_field(&e, 0x08, 0x3B, RAX, e.sim_stop);              // cmp rax, [rbx + stop]
+    emit8(&e, 0x0F); emit8(&e, 0x83);                       // jae refuse
+    uint8_t *refuse = e.p;
+    emit32(&e, 0);
+
+    bool open = true;
+    for( uint32_t i = 0; i < n && open; i++ )
+    {
+        uint32_t addr = insn[i].addr;
+        const INSTR_t *instr = addr < jit->instr.size() ? &jit->instr[addr] : nullptr;
+        bool last = i + 1 == n;
+        switch( insn[i].kind ) {
+        case KIND_INLINE:
+            emit_inline(&e, instr, live[i]);
+            e.pending += insn[i].cycles;
+            break;
+        case KIND_MEMORY:
+            emit_memory(&e, instr, addr, insn[i].cycles, rest[i + 1], i + 1, last);
+            break;
+        case KIND_HELPER:
+            emit_helper(&e, addr);
+            if( !last )
+                check_rest(&e, rest[i + 1], i + 1);
+            break;
+        case KIND_EXIT:
+        case KIND_SPM:
+            emit_helper(&e, addr);
+            if( insn[i].kind == KIND_SPM )
+            {
+                op_field(&e, 0, 0xC6, 0, e.jit_spm, true);  // mov byte [r15 + spm], 1
+                emit8(&e, 1);
+            }
+            emit_exit(&e, i + 1);
+            open = false;
+            break;
+        case KIND_BRANCH:
+        {
+            uint8_t bit = uint8_t(1 << instr->rr);
+            bool if_set = instr->mnem <= MN_BRIE;
+            e.pending += 1;
+            flush_cycles(&e);
+            op_data(&e, 0xF6, 0, SIM_SREG);                 // test SREG, bit
+            emit8(&e, bit);
+            emit8(&e, 0x0F); emit8(&e, if_set ? 0x85 : 0x84);
+            uint8_t *taken = e.p;
+            emit32(&e, 0);
+            emit_chain_exit(&e, i + 1, (addr + 1) & sim->flash_mask);
+            patch_rel32(taken, e.p);
+            e.pending = 1;
+            emit_chain_exit(&e, i + 1, instr->k & sim->flash_mask);
+            open = false;
+            break;
+        }
+        case KIND_JUMP:
+            e.pending += insn[i].cycles;
+            emit_chain_exit(&e, i + 1, instr->k & sim->flash_mask);
+            open = false;
+            break;
+        }
+    }
+    if( open )
+        emit_chain_exit(&e, n, insn[n - 1].addr + sim->op[insn[n - 1].addr].words);
+
+    patch_rel32(refuse, e.p);
+    op_field(&e, 0, 0xC7, 0, e.sim_pc);
+    emit32(&e, pc);
+    op_field(&e, 0, 0xC6, 0, e.jit_refused, true);
+    emit8(&e, 1);
+    emit8(&e, 0xE9);
+    patch_rel32(e.p, jit->epilogue);
+    e.p += 4;
+    emit_stubs(&e);
+
+    jit->used = size_t(e.p - jit->code);
+    jit->entry[pc] = start;
+    jit->length[pc] = uint8_t(n);
+    jit->blocks++;
+    return start;
+}
+
+//----------------------------------------------------------------------
+// flag_table[] index: host flags low byte, OF in bit 8
+static void build_flag_table(JIT_t *jit)
+{
+    for( uint32_t i = 0; i < 512; i++ )
+    {
+        uint8_t flags = 0;
+        if( i & 0x01 )
+            flags |= SREG_C;
+        if( i & 0x10 )
+            flags |= SREG_H;
+        if( i & 0x40 )
+            flags |= SREG_Z;
+        if( i & 0x80 )
+            flags |= SREG_N;
+        if( i & 0x100 )
+            flags |= SREG_V;
+        if( ((flags & SREG_N) != 0) != ((flags & SREG_V) != 0) )
+            flags |= SREG_S;
+        jit->flag_table[i] = flags;
+    }
+}
+
+//----------------------------------------------------------------------
+// Entry thunk: saves the callee-saved registers, loads the fixed ones and
+// jumps to the block; the epilogue stores the cycles and returns
+static void emit_thunk(JIT_t *jit, const SIM_t *sim)
+{
+    EMIT_t e;
+    e.p = jit->code;
+    int32_t cycles = int32_t((const uint8_t*)&sim->cycles - (const uint8_t*)sim);
+    static const uint8_t enter[] = {
+        0x53,                   // push rbx
+        0x55,                   // push rbp
+        0x41, 0x54,             // push r12
+        0x41, 0x55,             // push r13
+        0x41, 0x56,             // push r14
+        0x41, 0x57,             // push r15
+        0x48, 0x83, 0xEC, 0x08, // sub rsp, 8
+        0x48, 0x89, 0xFB,       // mov rbx, rdi
+        0x49, 0x89, 0xF7,       // mov r15, rsi
+        0x49, 0x89, 0xCC,       // mov r12, rcx
+        0x4C, 0x89, 0xC5,       // mov rbp, r8
+        0x4D, 0x89, 0xCE        // mov r14, r9
+    };
+    memcpy(e.p, enter, sizeof(enter));
+    e.p += sizeof(enter);
+    op_field(&e, 0x0C, 0x8B, 5, cycles);                // mov r13, [rbx + cycles]
+    emit8(&e, 0xFF); emit8(&e, 0xE2);                   // jmp rdx
+    jit->epilogue = e.p;
+    op_field(&e, 0x0C, 0x89, 5, cycles);                // mov [rbx + cycles], r13
+    static const uint8_t leave[] = {
+        0x48, 0x83, 0xC4, 0x08, // add rsp, 8
+        0x41, 0x5F,             // pop r15
+        0x41, 0x5E,             // pop r14
+        0x41, 0x5D,             // pop r13
+        0x41, 0x5C,             // pop r12
+        0x5D,                   // pop rbp
+        0x5B,                   // pop rbx
+        0xC3                    // ret
+    };
+    memcpy(e.p, leave, sizeof(leave));
+    e.p += sizeof(leave);
+    jit->enter = reinterpret_cast<JIT_ENTER_t>(jit->code);
+    jit->fixed = jit->used = size_t(e.p - jit->code);
+}
+
+#endif
+
+//----------------------------------------------------------------------
+// Sets up the translation cache for sim, false if this host cannot run
+// translated code
+bool jit_init(JIT_t *jit, const SIM_t *sim, const DISASM_t *ctx)
+{
+    jit->code = nullptr;
+    jit->fixed = jit->used = 0;
+    jit->link = nullptr;
+    jit->link_pc = 0;
+    jit->refused = 0;
+    jit->spm = 0;
+    jit->generation = 0;
+    jit->blocks = 0;
+#ifdef JIT_X64
+    void *mem = mmap(nullptr, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if( mem == MAP_FAILED )
+        return false;
+    jit->code = (uint8_t*)mem;
+    predecode_flash(ctx, jit->instr);
+    jit->entry.assign(sim->op.size(), nullptr);
+    jit->length.assign(sim->op.size(), 0);
+    build_flag_table(jit);
+    emit_thunk(jit, sim);
+    return true;
+#else
+    (void)sim;
+    (void)ctx;
+    return false;
+#endif
+}
+
+//----------------------------------------------------------------------
+void jit_free(JIT_t *jit)
+{
+#ifdef JIT_X64
+    if( jit->code )
+        munmap(jit->code, JIT_CODE_SIZE);
+#endif
+    jit->code = nullptr;
+}
+
+//----------------------------------------------------------------------
+// Drops every block, the entry thunk stays
+void jit_flush(JIT_t *jit)
+{
+    jit->used = jit->fixed;
+    std::fill(jit->entry.begin(), jit->entry.end(), nullptr);
+    jit->link = nullptr;
+    jit->generation++;
+}
+
+//----------------------------------------------------------------------
+// Runs translated blocks from sim->pc until one leaves to the dispatcher.
+// Returns false if the block at pc may cross stop_cycles, then
+// refused_length instructions must be interpreted, the block cannot tell
+// where to stop.
+bool jit_step(JIT_t *jit, SIM_t *sim, uint32_t *refused_length)
+{
+#ifdef JIT_X64
+    uint32_t pc = sim->pc;
+    uint8_t *site = jit->link;
+    uint32_t generation = jit->generation;
+    uint8_t *code = jit->entry[pc];
+    if( code == nullptr )
+        code = translate(jit, sim, pc);
+    // Not chained if an interrupt or the caller moved pc since the exit
+    if( site && generation == jit->generation && pc == jit->link_pc )
+        patch_rel32(site + 1, code);
+    jit->link = nullptr;
+    jit->refused = 0;
+    jit->enter(sim, jit, code, sim->data.data(), sim->hook.data(), jit->flag_table);
+    jit->link_pc = sim->pc;
+    if( jit->spm )
+    {
+        jit->spm = 0;
+        jit_flush(jit);
+    }
+    if( jit->refused )
+    {
+        *refused_length = jit->length[sim->pc];
+        return false;
+    }
+    return true;
+#else
+    (void)jit;
+    (void)sim;
+    *refused_length = 1;
+    return false;
+#endif
+}
@@ -0,0 +1,52 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <vector>
+#include "sim.h"
+
+// Translated code buffer, flushed whole when full
+#define JIT_CODE_SIZE   (16u << 20)
+// Instructions per translated block
+#define JIT_MAX_BLOCK   64
+// Code one instruction may take at most: an st with its fast path and
+// dirty page mark, the handler call of the slow path, the exit check and
+// its stub come to about 165 bytes
+#define JIT_INSN_ROOM   192
+// Room a block may take, checked before translating it
+#define JIT_BLOCK_ROOM  (JIT_MAX_BLOCK * JIT_INSN_ROOM + 256)
+
+typedef void (*JIT_ENTER_t)(SIM_t *sim, struct JIT *jit, uint8_t *code, uint8_t *data,
+                            const uint8_t *hook, const uint8_t *flag_table);
+
+// Translation cache of AVR basic blocks as x86-64 code. Blocks come from
+// the decoder's own predecode of the flash. Register moves, ALU ops,
+// loads, stores and branches become host instructions. Anything else
+// calls the interpreter handler of that word. SREG bits are computed from
+// the host flags only where a later instruction or the block exit may
+// read them. Block exits jump straight into the next block once it is
+// translated.
+typedef struct JIT {
+    uint8_t *code;                  // RWX buffer, nullptr - not available on this host
+    size_t fixed;                   // entry and exit code at its start, kept over flushes
+    size_t used;
+    uint8_t *epilogue;
+    JIT_ENTER_t enter;
+    std::vector<INSTR_t> instr;     // predecoded flash
+    std::vector<uint8_t *> entry;   // per flash word, translated block or nullptr
+    std::vector<uint8_t> length;    // per flash word, instructions in that block
+    uint8_t *link;                  // jmp of the exit just taken, to chain to the next block
+    uint32_t link_pc;               // where that exit went
+    uint8_t refused;                // the block might cross stop_cycles, interpret it
+    uint8_t spm;                    // spm ran, translations may be stale
+    uint32_t generation;            // flushes so far
+    uint64_t blocks;                // translated so far
+    uint8_t flag_table[512];        // host flags -> SREG bits
+} JIT_t;
+
+bool jit_init(JIT_t *jit, const SIM_t *sim, const DISASM_t *ctx);
+void jit_free(JIT_t *jit);
+void jit_flush(JIT_t *jit);
+bool jit_step(JIT_t *jit, SIM_t *sim, uint32_t *refused_length);
+
+#endif
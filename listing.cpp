@@ -0,0 +1,490 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "math_utils.h"
+#include "listing.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+//----------------------------------------------------------------------
+static void append_str(std::string &out, const char *str)
+{
+    out.append(str, strlen(str));
+}
+
+//----------------------------------------------------------------------
+static void append_hex(std::string &out, uint32_t value, int min_digits, const char *digits)
+{
+    char buf[8];
+    out.append(buf, put_hex(buf, value, min_digits, digits));
+}
+
+//----------------------------------------------------------------------
+static void append_label_name(std::string &out, uint32_t addr)
+{
+    out.append("L_", 2);
+    append_hex(out, addr, 1, "0123456789ABCDEF");
+}
+
+//----------------------------------------------------------------------
+static void append_label(std::string &out, uint32_t addr)
+{
+    append_label_name(out, addr);
+    out.append(":\t", 2);
+}
+
+//----------------------------------------------------------------------
+static void append_uint(std::string &out, uint64_t value)
+{
+    char buf[20];
+    out.append(buf, put_uint(buf, value));
+}
+
+//----------------------------------------------------------------------
+// "3" or "1-2"
+static void append_range(std::string &out, uint32_t min, uint32_t max)
+{
+    append_uint(out, min);
+    if( max != min )
+    {
+        out.push_back('-');
+        append_uint(out, max);
+    }
+}
+
+//----------------------------------------------------------------------
+// Opens a comment behind an instruction, or goes on with the one it has
+static void append_comment(std::string &out, bool *open)
+{
+    if( *open )
+        out.push_back(' ');
+    else
+        out.append("\t// ", 4);
+    *open = true;
+}
+
+//----------------------------------------------------------------------
+// Comment with the address track_pointers() found for an indirect access:
+// the code target, the flash word and byte half of an lpm, or the data
+// address of a load or store
+static void append_access(std::string &out, const DISASM_t *ctx, uint32_t addr)
+{
+    uint32_t target = indirect_target(ctx, addr);
+    switch( ctx->line[addr].instr.mnem ) {
+    case MN_ICALL:
+    case MN_IJMP:
+        out.append("-> ", 3);
+        append_label_name(out, target);
+        break;
+    case MN_LPM:
+    case MN_LPM_R0:
+        append_label_name(out, target >> 1);
+        out.append((target & 1) ? " hi" : " lo", 3);
+        break;
+    default:
+        out.append("[$", 2);
+        append_hex(out, target, 4, "0123456789abcdef");
+        out.push_back(']');
+        break;
+    }
+}
+
+//----------------------------------------------------------------------
+// Comment lines ahead of a block with its cycles, and of the function
+// it is the entry of
+static void append_block_timing(std::string &out, const TIMING_t *timing, uint32_t b)
+{
+    uint32_t f = timing->entry_func[b];
+    if( f != CFG_NONE )
+    {
+        uint8_t flags = timing->func_flags[f];
+        out.append("// function ", 12);
+        append_label_name(out, timing->cfg->block_start[b]);
+        if( flags & TIMING_NO_RETURN )
+            out.append(": does not return", 17);
+        else
+        {
+            out.append(": ", 2);
+            append_range(out, timing->func_min[f], timing->func_max[f]);
+            append_str(out, timing->func_max[f] == 1 ? " cycle" : " cycles");
+        }
+        if( flags & TIMING_LOOPS )
+            out.append(", loop bodies counted once", 26);
+        if( flags & TIMING_RECURSIVE )
+            out.append(", recursion not counted", 23);
+        if( flags & TIMING_INDIRECT )
+            out.append(", unresolved icall/ijmp not counted", 35);
+        out.push_back('\n');
+    }
+    out.append("// block: ", 10);
+    append_range(out, timing->block_min[b], timing->block_max[b]);
+    append_str(out, timing->block_max[b] == 1 ? " cycle\n" : " cycles\n");
+}
+
+//----------------------------------------------------------------------
+// Lines that produce text, 64 from line w * 64 on: decoded code, and data
+// that is neither erased nor the operand of a 2-word instruction. Bits
+// past the last line are set too, callers stop at their end.
+static uint64_t printed_bits(const DISASM_t *ctx, uint32_t w)
+{
+    return ctx->plane[PLANE_DECODED][w] | ~(ctx->plane[PLANE_VISITED][w] | ctx->plane[PLANE_ERASED][w]);
+}
+
+//----------------------------------------------------------------------
+// First printed line in from..end-1, end if none
+static uint32_t next_printed(const DISASM_t *ctx, uint32_t from, uint32_t end)
+{
+    if( from >= end )
+        return end;
+    uint32_t w = from >> 6;
+    uint64_t bits = printed_bits(ctx, w) & (~uint64_t(0) << (from & 63));
+    uint32_t last = (end - 1) >> 6;
+    while( bits == 0 )
+    {
+        if( ++w > last )
+            return end;
+        bits = printed_bits(ctx, w);
+    }
+    uint32_t addr = w * 64 + uint32_t(ctz64(bits));
+    return addr < end ? addr : end;
+}
+
+//----------------------------------------------------------------------
+// Last printed line before start, flash_mask if none as the serial
+// listing starts with that
+static uint32_t last_printed(const DISASM_t *ctx, uint32_t start)
+{
+    if( start == 0 )
+        return ctx->flash_mask;
+    uint32_t w = (start - 1) >> 6;
+    uint64_t bits = printed_bits(ctx, w) & (~uint64_t(0) >> (63 - ((start - 1) & 63)));
+    while( bits == 0 )
+    {
+        if( w == 0 )
+            return ctx->flash_mask;
+        bits = printed_bits(ctx, --w);
+    }
+    return w * 64 + uint32_t(msb64(bits));
+}
+
+//----------------------------------------------------------------------
+static void render_chunk(const DISASM_t *ctx, const TIMING_t *timing, const PROFILE_t *profile,
+                         uint32_t start, uint32_t end, TEXT_CACHE_t *text_cache, std::string &out)
+{
+    uint32_t line_count = uint32_t(ctx->line.size());
+    // last printed address before the chunk, as the serial listing saw it
+    uint32_t bak_addr = last_printed(ctx, start);
+    size_t lo = 0, hi = ctx->labels.size();
+    while( lo < hi )
+    {
+        size_t mid = (lo + hi) / 2;
+        if( ctx->labels[mid].addr < start )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    size_t next_label = lo;
+    uint32_t next_block = 0;
+    if( timing )
+        next_block = uint32_t(std::lower_bound(timing->cfg->block_start.begin(),
+                                               timing->cfg->block_start.end(), start)
+                              - timing->cfg->block_start.begin());
+
+    char text[INSTR_TEXT_SIZE];
+    out.clear();
+    out.reserve(size_t(end - start) * 24);
+    // printed lines 64 at a time, the gaps between them cost nothing
+    uint32_t last_word = (end - 1) >> 6;
+    for( uint32_t w = start >> 6; w <= last_word; w++ )
+    {
+        uint64_t printed = printed_bits(ctx, w);
+        if( w == start >> 6 )
+            printed &= ~uint64_t(0) << (start & 63);
+        if( w == last_word && (end & 63) != 0 )
+            printed &= (uint64_t(1) << (end & 63)) - 1;
+        for( ; printed != 0; printed &= printed - 1 )
+        {
+            uint32_t i = w * 64 + uint32_t(ctz64(printed));
+            const LINE_t *cline = &ctx->line[i];
+            uint16_t word = code_word(ctx, i);
+            while( next_label < ctx->labels.size() && ctx->labels[next_label].addr < i )
+                next_label++;
+            uint32_t prev = (i - 1) & ctx->flash_mask;
+            uint32_t prev_prev = (i - 2) & ctx->flash_mask;
+            if(    (bak_addr != prev)
+               && (   (bak_addr != prev_prev) || prev_prev >= line_count
+                   || !line_is(ctx, PLANE_VISITED, prev_prev)) )
+            {
+                out.append(".ORG\t$", 6);
+                append_hex(out, i, 1, "0123456789ABCDEF");
+                out.push_back('\n');
+            }
+            bak_addr = i;
+            if( timing && next_block < cfg_block_count(timing->cfg) && timing->cfg->block_start[next_block] == i )
+                append_block_timing(out, timing, next_block++);
+            for( ; next_label < ctx->labels.size() && ctx->labels[next_label].addr == i; next_label++ )
+            {
+                out.append(ctx->labels[next_label].name);
+                out.append(":\n", 2);
+            }
+            if( line_is(ctx, PLANE_DECODED, i) )
+            {
+                if( line_is(ctx, PLANE_POINTED, i) )
+                    append_label(out, i);
+                else
+                    out.push_back('\t');
+                const char *instr_text = render_instr(text_cache, &cline->instr, word, text);
+                append_str(out, instr_text);
+                bool comment = strstr(instr_text, "//") != nullptr;
+                if( line_is(ctx, PLANE_RESOLVED, i) )
+                {
+                    append_comment(out, &comment);
+                    append_access(out, ctx, i);
+                }
+                if( timing )
+                {
+                    uint32_t min, max;
+                    instr_cycles(ctx, i, &min, &max);
+                    append_comment(out, &comment);
+                    append_range(out, min, max);
+                    out.push_back('c');
+                }
+                if( profile && i < profile->count.size() && profile->count[i] )
+                {
+                    append_comment(out, &comment);
+                    append_uint(out, profile->count[i]);
+                    out.append("x/", 2);
+                    append_uint(out, profile->cycles[i]);
+                    out.push_back('c');
+                }
+                out.push_back('\n');
+            }
+            else
+            {
+                append_label(out, i);
+                out.append(".dw\t$", 5);
+                append_hex(out, word, 4, "0123456789abcdef");
+                out.push_back('\n');
+            }
+        }
+    }
+}
+
+#ifdef _WIN32
+
+//----------------------------------------------------------------------
+// Text mode keeps the CRLF line ends the listing always had on Windows
+bool write_listing(const char *file_name, const std::vector<std::string> &chunk)
+{
+    FILE *fasm = fopen(file_name, "wt");
+    if( fasm == nullptr )
+        return false;
+    bool ok = true;
+    for( size_t i = 0; i < chunk.size() && ok; i++ )
+        ok = fwrite(chunk[i].data(), 1, chunk[i].size(), fasm) == chunk[i].size();
+    return (fclose(fasm) == 0) && ok;
+}
+
+#else
+
+//----------------------------------------------------------------------
+// One writev for the whole listing, repeated only for short writes or
+// more chunks than IOV_MAX
+bool write_listing(const char *file_name, const std::vector<std::string> &chunk)
+{
+    int fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if( fd < 0 )
+        return false;
+    std::vector<struct iovec> iov;
+    for( size_t i = 0; i < chunk.size(); i++ )
+        if( !chunk[i].empty() )
+        {
+            struct iovec v;
+            v.iov_base = const_cast<char*>(chunk[i].data());
+            v.iov_len = chunk[i].size();
+            iov.push_back(v);
+        }
+    size_t first = 0;
+    while( first < iov.size() )
+    {
+        int count = int(iov.size() - first < IOV_MAX ? iov.size() - first : IOV_MAX);
+        ssize_t written = writev(fd, &iov[first], count);
+        if( written < 0 )
+        {
+            close(fd);
+            return false;
+        }
+        size_t left = size_t(written);
+        while( first < iov.size() && left >= iov[first].iov_len )
+            left -= iov[first++].iov_len;
+        if( left > 0 )
+        {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + left;
+            iov[first].iov_len -= left;
+        }
+    }
+    return close(fd) == 0;
+}
+
+#endif
+
+//----------------------------------------------------------------------
+static bool same_line(const LINE_t *a, const LINE_t *b)
+{
+    return    a->instr.mnem == b->instr.mnem && a->instr.rd == b->instr.rd
+           && a->instr.rr == b->instr.rr && a->instr.k == b->instr.k;
+}
+
+//----------------------------------------------------------------------
+// Planes the text of a line depends on, besides its word and instruction
+static const int listed_plane[] = { PLANE_VISITED, PLANE_DECODED, PLANE_POINTED, PLANE_RESOLVED };
+
+//----------------------------------------------------------------------
+// Compares the listed planes of lines from..to-1, 64 lines at a time.
+// from is a multiple of 64, to is a multiple of 64 or the last line, and
+// both tables cover to.
+static bool same_planes(const DISASM_t *ctx, const LISTING_CACHE_t *cache, uint32_t from, uint32_t to)
+{
+    uint32_t words = (to - from + 63) / 64;
+    for( size_t p = 0; p < sizeof(listed_plane) / sizeof(listed_plane[0]); p++ )
+        if( memcmp(&ctx->plane[listed_plane[p]][from >> 6], &cache->plane[listed_plane[p]][from >> 6],
+                   words * sizeof(uint64_t)) != 0 )
+            return false;
+    return true;
+}
+
+//----------------------------------------------------------------------
+static bool same_labels(const std::vector<LABEL_t> &a, const std::vector<LABEL_t> &b)
+{
+    if( a.size() != b.size() )
+        return false;
+    for( size_t i = 0; i < a.size(); i++ )
+        if( a[i].addr != b[i].addr || a[i].name != b[i].name )
+            return false;
+    return true;
+}
+
+//----------------------------------------------------------------------
+static bool same_indirect(const std::vector<INDIRECT_t> &a, const std::vector<INDIRECT_t> &b)
+{
+    if( a.size() != b.size() )
+        return false;
+    for( size_t i = 0; i < a.size(); i++ )
+        if( a[i].addr != b[i].addr || a[i].target != b[i].target )
+            return false;
+    return true;
+}
+
+//----------------------------------------------------------------------
+static bool chunk_has_text(const DISASM_t *ctx, uint32_t start, uint32_t end)
+{
+    return next_printed(ctx, start, end) < end;
+}
+
+//----------------------------------------------------------------------
+// Marks the chunks whose lines differ from the cached ones. A chunk also
+// depends on the last printed line before it, so a change carries on to
+// the next chunk, and further through chunks that print nothing.
+static void find_changed_chunks(const DISASM_t *ctx, const LISTING_CACHE_t *cache,
+                                std::vector<uint8_t> &dirty)
+{
+    uint32_t line_count = uint32_t(ctx->line.size());
+    uint32_t cached = uint32_t(cache->line.size());
+    bool carry = false;
+    for( size_t c = 0; c < dirty.size(); c++ )
+    {
+        uint32_t start = uint32_t(c * LISTING_CHUNK_LINES);
+        uint32_t end = start + LISTING_CHUNK_LINES < line_count ? start + LISTING_CHUNK_LINES : line_count;
+        bool changed = c + 1 >= cache->chunk.size() || end > cached || !same_planes(ctx, cache, start, end);
+        for( uint32_t i = start; i < end && !changed; i++ )
+            changed = cache->word[i] != code_word(ctx, i) || !same_line(&cache->line[i], &ctx->line[i]);
+        dirty[c] = changed || carry;
+        carry = changed || (carry && !chunk_has_text(ctx, start, end));
+    }
+}
+
+//----------------------------------------------------------------------
+// Renders the listing in address chunks on jobs threads (0 - one per
+// core), chunk[0] is the .include line. Each chunk finds the .ORG and
+// label state of the lines before it, so the text is the same as a
+// serial pass would make. With a cache, chunk must be cache->chunk and
+// only chunks whose lines changed since the last call are rendered. With
+// timing every instruction, block and function gets its cycles; they
+// depend on the whole graph, so the cache is then not used to skip chunks.
+// With a profile every executed instruction gets its run count and the
+// cycles they took as "// 12x/24c", and the cache is not used either.
+void render_code(DISASM_t *ctx, int jobs, std::vector<std::string> &chunk, LISTING_CACHE_t *cache,
+                 const TIMING_t *timing, const PROFILE_t *profile)
+{
+    uint32_t line_count = uint32_t(ctx->line.size());
+    size_t chunk_count = (line_count + LISTING_CHUNK_LINES - 1) / LISTING_CHUNK_LINES;
+    std::vector<uint8_t> dirty(chunk_count, 1);
+    if(    cache && !timing && !profile && cache->device == ctx->device && same_labels(cache->labels, ctx->labels)
+        && same_indirect(cache->indirect, ctx->indirect) )
+        find_changed_chunks(ctx, cache, dirty);
+    std::vector<size_t> todo;
+    for( size_t c = 0; c < chunk_count; c++ )
+        if( dirty[c] )
+            todo.push_back(c);
+    chunk.resize(chunk_count + 1);
+    chunk[0] = ".include \"";
+    chunk[0] += ctx->device->inc_file;
+    chunk[0] += "\"\n";
+
+    if( jobs <= 0 )
+        jobs = int(std::thread::hardware_concurrency());
+    if( jobs > int(todo.size()) )
+        jobs = int(todo.size());
+    if( jobs < 1 )
+        jobs = 1;
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        TEXT_CACHE_t text_cache;
+        size_t n;
+        while( (n = next++) < todo.size() )
+        {
+            size_t c = todo[n];
+            uint32_t start = uint32_t(c * LISTING_CHUNK_LINES);
+            uint32_t end = start + LISTING_CHUNK_LINES < line_count ? start + LISTING_CHUNK_LINES : line_count;
+            render_chunk(ctx, timing, profile, start, end, &text_cache, chunk[c + 1]);
+        }
+    };
+    std::vector<std::thread> pool;
+    for( int i = 1; i < jobs; i++ )
+        pool.push_back(std::thread(worker));
+    worker();
+    for( size_t i = 0; i < pool.size(); i++ )
+        pool[i].join();
+
+    if( cache )
+    {
+        cache->device = ctx->device;
+        cache->labels = ctx->labels;
+        cache->indirect = ctx->indirect;
+        cache->line = ctx->line;
+        for( int p = 0; p < PLANE_COUNT; p++ )
+            cache->plane[p] = ctx->plane[p];
+        cache->word.resize(line_count);
+        for( uint32_t i = 0; i < line_count; i++ )
+            cache->word[i] = code_word(ctx, i);
+    }
+}
+
+//----------------------------------------------------------------------
+bool print_code(DISASM_t *ctx, const char *file_name, int jobs, LISTING_CACHE_t *cache,
+                const TIMING_t *timing, const PROFILE_t *profile)
+{
+    std::vector<std::string> local;
+    std::vector<std::string> &chunk = cache ? cache->chunk : local;
+    render_code(ctx, jobs, chunk, cache, timing, profile);
+    return write_listing(file_name, chunk);
+}
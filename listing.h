@@ -0,0 +1,30 @@
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <string>
+#include <vector>
+#include "disasm.h"
+#include "timing.h"
+#include "sim.h"
+
+// Lines rendered by one worker at a time
+#define LISTING_CHUNK_LINES 8192
+
+// Rendered chunks of the last listing and the lines they came from
+typedef struct LISTING_CACHE {
+    const DEVICE_t *device = nullptr;
+    std::vector<LABEL_t> labels;
+    std::vector<INDIRECT_t> indirect;
+    std::vector<LINE_t> line;
+    std::vector<uint64_t> plane[PLANE_COUNT];
+    std::vector<uint16_t> word;
+    std::vector<std::string> chunk;     // [0] is the .include line
+} LISTING_CACHE_t;
+
+void render_code(DISASM_t *ctx, int jobs, std::vector<std::string> &chunk, LISTING_CACHE_t *cache = nullptr,
+                 const TIMING_t *timing = nullptr, const PROFILE_t *profile = nullptr);
+bool write_listing(const char *file_name, const std::vector<std::string> &chunk);
+bool print_code(DISASM_t *ctx, const char *file_name, int jobs, LISTING_CACHE_t *cache = nullptr,
+                const TIMING_t *timing = nullptr, const PROFILE_t *profile = nullptr);
+
+#endif
@@ -0,0 +1,359 @@
+#include <string.h>
+#include <algorithm>
+#include "math_utils.h"
+#include "mapped_file.h"
+#include "loader.h"
+
+#define HEX_DATA            0x00
+#define HEX_EOF             0x01
+#define HEX_EXT_SEGMENT     0x02
+#define HEX_EXT_LINEAR      0x04
+
+#define ELF_HEADER_SIZE     52
+#define ELF_PHDR_SIZE       32
+#define ELF_SHDR_SIZE       40
+#define ELF_SYM_SIZE        16
+#define ELF_MACHINE_AVR     83
+#define ELF_PT_LOAD         1
+#define ELF_SHT_PROGBITS    1
+#define ELF_SHT_SYMTAB      2
+#define ELF_SHF_ALLOC       0x2
+#define ELF_SHF_EXECINSTR   0x4
+#define ELF_STT_FUNC        2
+#define ELF_SHN_LORESERVE   0xff00
+
+// Allocated ELF section that ends up in flash
+typedef struct FLASH_SECTION {
+    uint32_t index;
+    uint32_t lma;           // flash byte address
+    uint32_t offset;        // file offset
+    uint32_t size;
+    bool exec;
+} FLASH_SECTION_t;
+
+//----------------------------------------------------------------------
+const char *load_status_name(int status)
+{
+    static const char *name[5] =
+        { "ok", "can't open", "malformed record", "checksum error", "malformed ELF" };
+    if( status < 0 || status > LOAD_BAD_ELF )
+        return "?";
+    return name[status];
+}
+
+//----------------------------------------------------------------------
+// Decodes count hex digit pairs, returns false on a non-hex character
+static bool decode_hex_bytes(const uint8_t *hex, uint8_t *out, size_t count)
+{
+    uint8_t bad = 0;
+    for( size_t i = 0; i < count; i++, hex += 2 )
+    {
+        uint8_t hi = hex_digit[hex[0]];
+        uint8_t lo = hex_digit[hex[1]];
+        bad |= hi | lo;
+        out[i] = uint8_t((hi << 4) | lo);
+    }
+    return (bad & 0xF0) == 0;
+}
+
+//----------------------------------------------------------------------
+// Parses a whole Intel HEX file held in memory. Lines that do not start
+// with ':' are skipped, every record is checksum verified, and extended
+// segment (02) and linear (04) address records move the load base.
+int parse_hex(const uint8_t *data, size_t size, std::vector<uint8_t> &mem, uint32_t *error_line)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = data + size;
+    uint32_t base = 0;
+    uint32_t line_no = 0;
+    uint8_t rec[5 + 255];
+    mem.clear();
+    while( p < end )
+    {
+        line_no++;
+        const uint8_t *eol = static_cast<const uint8_t*>(memchr(p, '\n', size_t(end - p)));
+        if( eol == nullptr )
+            eol = end;
+        const uint8_t *hex = p;
+        p = eol + 1;
+        while( eol > hex && (eol[-1] == '\r' || eol[-1] == ' ' || eol[-1] == '\t') )
+            eol--;
+        if( eol == hex || hex[0] != ':' )
+            continue;
+        hex++;
+        size_t len = size_t(eol - hex);
+        if( error_line )
+            *error_line = line_no;
+        if( len < 10 || (len & 1) || !decode_hex_bytes(hex, rec, 1) || len != 2 * (rec[0] + 5u) )
+            return LOAD_BAD_RECORD;
+        size_t count = len / 2;
+        if( !decode_hex_bytes(hex + 2, rec + 1, count - 1) )
+            return LOAD_BAD_RECORD;
+        uint8_t sum = 0;
+        for( size_t i = 0; i < count; i++ )
+            sum = uint8_t(sum + rec[i]);
+        if( sum != 0 )
+            return LOAD_BAD_CHECKSUM;
+
+        uint8_t data_size = rec[0];
+        uint32_t offset = (uint32_t(rec[1]) << 8) | rec[2];
+        const uint8_t *rec_data = &rec[4];
+        switch( rec[3] ) {
+        case HEX_DATA:
+        {
+            uint32_t addr = base + offset;
+            if( addr >= LOAD_ADDR_LIMIT || addr + data_size > LOAD_ADDR_LIMIT )
+                break;
+            if( mem.size() < addr + data_size )
+                mem.resize(addr + data_size, 0xff);
+            memcpy(&mem[addr], rec_data, data_size);
+            break;
+        }
+        case HEX_EOF:
+            p = end;
+            break;
+        case HEX_EXT_SEGMENT:
+            if( data_size != 2 )
+                return LOAD_BAD_RECORD;
+            base = ((uint32_t(rec_data[0]) << 8) | rec_data[1]) << 4;
+            break;
+        case HEX_EXT_LINEAR:
+            if( data_size != 2 )
+                return LOAD_BAD_RECORD;
+            base = ((uint32_t(rec_data[0]) << 8) | rec_data[1]) << 16;
+            break;
+        default:    // start address records
+            break;
+        }
+    }
+    if( error_line )
+        *error_line = 0;
+    return LOAD_OK;
+}
+
+//----------------------------------------------------------------------
+// Drops whatever the previous image left in the context
+static void reset_image(DISASM_t *ctx)
+{
+    unmap_file(&ctx->mapping);
+    ctx->mem_byte.clear();
+    ctx->labels.clear();
+    ctx->dump_size = 0;
+    ctx->code = nullptr;
+    ctx->code_words = 0;
+}
+
+//----------------------------------------------------------------------
+// Points the decoder at mem_byte
+static void use_mem_byte(DISASM_t *ctx)
+{
+    ctx->dump_size = int(ctx->mem_byte.size());
+    if( ctx->mem_byte.size() & 1 )
+        ctx->mem_byte.push_back(0xff);
+    ctx->code = reinterpret_cast<const uint16_t*>(ctx->mem_byte.data());
+    ctx->code_words = uint32_t(ctx->mem_byte.size() / 2);
+}
+
+//----------------------------------------------------------------------
+// Points the decoder at size bytes of the mapped file. An odd tail byte
+// can not be reached through a word pointer, so those images are copied.
+static void use_mapping(DISASM_t *ctx, MAPPED_FILE_t *mf, const uint8_t *data, size_t size)
+{
+    if( (size & 1) || (reinterpret_cast<uintptr_t>(data) & 1) )
+    {
+        ctx->mem_byte.assign(data, data + size);
+        unmap_file(mf);
+        use_mem_byte(ctx);
+        return;
+    }
+    ctx->mapping = *mf;
+    mf->data = nullptr;
+    mf->size = 0;
+    ctx->dump_size = int(size);
+    ctx->code = reinterpret_cast<const uint16_t*>(data);
+    ctx->code_words = uint32_t(size / 2);
+}
+
+//----------------------------------------------------------------------
+static uint32_t get16(const uint8_t *p)
+{
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8);
+}
+
+//----------------------------------------------------------------------
+static uint32_t get32(const uint8_t *p)
+{
+    return get16(p) | (get16(p + 2) << 16);
+}
+
+//----------------------------------------------------------------------
+static bool in_file(const MAPPED_FILE_t *mf, uint32_t offset, uint32_t size)
+{
+    return offset <= mf->size && size <= mf->size - offset;
+}
+
+//----------------------------------------------------------------------
+// Reads the symbol table into labels. Functions become decode origins,
+// other symbols in code sections are only named.
+static void load_elf_symbols(DISASM_t *ctx, const MAPPED_FILE_t *mf, uint32_t shoff,
+                             uint32_t shnum, const std::vector<FLASH_SECTION_t> &flash)
+{
+    const uint8_t *d = mf->data;
+    for( uint32_t i = 0; i < shnum; i++ )
+    {
+        const uint8_t *sh = d + shoff + i * ELF_SHDR_SIZE;
+        if( get32(sh + 4) != ELF_SHT_SYMTAB )
+            continue;
+        uint32_t sym_off = get32(sh + 16);
+        uint32_t sym_size = get32(sh + 20);
+        uint32_t link = get32(sh + 24);
+        if( link >= shnum || !in_file(mf, sym_off, sym_size) )
+            continue;
+        const uint8_t *str_sh = d + shoff + link * ELF_SHDR_SIZE;
+        uint32_t str_off = get32(str_sh + 16);
+        uint32_t str_size = get32(str_sh + 20);
+        if( !in_file(mf, str_off, str_size) )
+            continue;
+        for( uint32_t s = ELF_SYM_SIZE; s + ELF_SYM_SIZE <= sym_size; s += ELF_SYM_SIZE )
+        {
+            const uint8_t *sym = d + sym_off + s;
+            uint32_t name = get32(sym);
+            uint32_t value = get32(sym + 4);
+            uint32_t type = sym[12] & 0x0F;
+            uint32_t shndx = get16(sym + 14);
+            if( name == 0 || name >= str_size || shndx >= ELF_SHN_LORESERVE )
+                continue;
+            const FLASH_SECTION_t *sec = nullptr;
+            for( size_t k = 0; k < flash.size(); k++ )
+                if( flash[k].index == shndx )
+                    sec = &flash[k];
+            if( sec == nullptr || !sec->exec )
+                continue;
+            const char *str = reinterpret_cast<const char*>(d + str_off + name);
+            size_t len = strnlen(str, str_size - name);
+            if( len == 0 || str[0] == '.' || (value & 1) )
+                continue;
+            LABEL_t label;
+            label.addr = value / 2;
+            label.code = type == ELF_STT_FUNC;
+            label.name.assign(str, len);
+            ctx->labels.push_back(label);
+        }
+    }
+    std::stable_sort(ctx->labels.begin(), ctx->labels.end(),
+                     [](const LABEL_t &a, const LABEL_t &b) { return a.addr < b.addr; });
+}
+
+//----------------------------------------------------------------------
+// ELF32 little endian AVR object. Allocated PROGBITS sections below
+// LOAD_ADDR_LIMIT (by load address, so .data lands behind .text) form the
+// flash image. When they lie back to back in the file starting at flash
+// address 0, the decoder reads them straight from the mapping.
+static int load_elf(DISASM_t *ctx, MAPPED_FILE_t *mf)
+{
+    const uint8_t *d = mf->data;
+    if(    mf->size < ELF_HEADER_SIZE || d[4] != 1 || d[5] != 1
+        || get16(d + 18) != ELF_MACHINE_AVR )
+        return LOAD_BAD_ELF;
+    uint32_t phoff = get32(d + 28);
+    uint32_t shoff = get32(d + 32);
+    uint32_t phnum = get16(d + 44);
+    uint32_t shnum = get16(d + 48);
+    if(    (phnum && get16(d + 42) != ELF_PHDR_SIZE)
+        || (shnum && get16(d + 46) != ELF_SHDR_SIZE)
+        || !in_file(mf, phoff, phnum * ELF_PHDR_SIZE)
+        || !in_file(mf, shoff, shnum * ELF_SHDR_SIZE) )
+        return LOAD_BAD_ELF;
+
+    std::vector<FLASH_SECTION_t> flash;
+    for( uint32_t i = 0; i < shnum; i++ )
+    {
+        const uint8_t *sh = d + shoff + i * ELF_SHDR_SIZE;
+        uint32_t flags = get32(sh + 8);
+        FLASH_SECTION_t sec;
+        sec.index = i;
+        sec.lma = get32(sh + 12);
+        sec.offset = get32(sh + 16);
+        sec.size = get32(sh + 20);
+        sec.exec = (flags & ELF_SHF_EXECINSTR) != 0;
+        if( get32(sh + 4) != ELF_SHT_PROGBITS || !(flags & ELF_SHF_ALLOC) || sec.size == 0 )
+            continue;
+        if( !in_file(mf, sec.offset, sec.size) )
+            return LOAD_BAD_ELF;
+        for( uint32_t p = 0; p < phnum; p++ )
+        {
+            const uint8_t *ph = d + phoff + p * ELF_PHDR_SIZE;
+            uint32_t p_offset = get32(ph + 4);
+            if(    get32(ph) == ELF_PT_LOAD && sec.offset >= p_offset
+                && sec.offset - p_offset < get32(ph + 16) )
+            {
+                sec.lma = get32(ph + 12) + sec.offset - p_offset;
+                break;
+            }
+        }
+        if( sec.lma < LOAD_ADDR_LIMIT && sec.size <= LOAD_ADDR_LIMIT - sec.lma )
+            flash.push_back(sec);
+    }
+    std::sort(flash.begin(), flash.end(),
+              [](const FLASH_SECTION_t &a, const FLASH_SECTION_t &b) { return a.lma < b.lma; });
+    load_elf_symbols(ctx, mf, shoff, shnum, flash);
+
+    bool contiguous = !flash.empty() && flash[0].lma == 0;
+    for( size_t i = 1; contiguous && i < flash.size(); i++ )
+        contiguous =    flash[i].lma == flash[i - 1].lma + flash[i - 1].size
+                     && flash[i].offset == flash[i - 1].offset + flash[i - 1].size;
+    if( contiguous )
+    {
+        const FLASH_SECTION_t &last = flash.back();
+        use_mapping(ctx, mf, d + flash[0].offset, last.lma + last.size);
+        return LOAD_OK;
+    }
+    for( size_t i = 0; i < flash.size(); i++ )
+    {
+        if( ctx->mem_byte.size() < flash[i].lma + flash[i].size )
+            ctx->mem_byte.resize(flash[i].lma + flash[i].size, 0xff);
+        memcpy(&ctx->mem_byte[flash[i].lma], d + flash[i].offset, flash[i].size);
+    }
+    unmap_file(mf);
+    use_mem_byte(ctx);
+    return LOAD_OK;
+}
+
+//----------------------------------------------------------------------
+// Loads an Intel HEX file, an AVR ELF file or a raw flash image. The
+// format is told by the file contents, not by the name. Raw and ELF
+// images are decoded in place from the mapped file, which stays mapped
+// until the next load or disasm_release().
+int load_image(DISASM_t *ctx, const char *file_name, uint32_t *error_line)
+{
+    reset_image(ctx);
+    if( error_line )
+        *error_line = 0;
+    MAPPED_FILE_t mf;
+    if( !map_file(&mf, file_name) )
+        return LOAD_NO_FILE;
+    size_t first = 0;
+    while( first < mf.size && (mf.data[first] == ' ' || mf.data[first] == '\t'
+                            || mf.data[first] == '\r' || mf.data[first] == '\n') )
+        first++;
+    int status;
+    if( mf.size >= 4 && memcmp(mf.data, "\x7f" "ELF", 4) == 0 )
+    {
+        status = load_elf(ctx, &mf);
+    }
+    else if( first < mf.size && mf.data[first] == ':' )
+    {
+        status = parse_hex(mf.data, mf.size, ctx->mem_byte, error_line);
+        unmap_file(&mf);
+        use_mem_byte(ctx);
+    }
+    else
+    {
+        use_mapping(ctx, &mf, mf.data, mf.size);
+        status = LOAD_OK;
+    }
+    unmap_file(&mf);
+    if( status != LOAD_OK )
+        reset_image(ctx);
+    return status;
+}
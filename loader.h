@@ -0,0 +1,25 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "disasm.h"
+
+enum {
+    LOAD_OK,
+    LOAD_NO_FILE,
+    LOAD_BAD_RECORD,
+    LOAD_BAD_CHECKSUM,
+    LOAD_BAD_ELF
+};
+
+// Highest byte address taken from an image, avr-gcc places SRAM and
+// EEPROM sections at 0x800000 and up
+#define LOAD_ADDR_LIMIT 0x800000
+
+const char *load_status_name(int status);
+int parse_hex(const uint8_t *data, size_t size, std::vector<uint8_t> &mem, uint32_t *error_line);
+int load_image(DISASM_t *ctx, const char *file_name, uint32_t *error_line);
+
+#endif
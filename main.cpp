@@ -1,1038 +1,627 @@
 #include <stdio.h>
 #include <string.h>
-#include "math_utils.h"
-
-#define FLASH_END   0xFFF
-#define FLASH_SIZE  (FLASH_END+1)
-
-#define MEM_SIZE (FLASH_SIZE*2)
-#define MAX_LINES FLASH_SIZE
-#define MAX_ORIGINS FLASH_SIZE
-
-typedef struct LINE {
-    bool visited;
-    bool decoded;
-    bool pointed;
-    char text[32];
-} LINE_t;
-
-static uint8_t mem_byte[MEM_SIZE];
-static int dump_size;
-static uint16_t *code = reinterpret_cast<uint16_t*>(mem_byte);
-static LINE_t line[MAX_LINES];
-static uint16_t pc;
-static uint16_t origin[MAX_ORIGINS];
-static uint16_t origin_cnt;
-
-typedef uint8_t (*COMMAND_t)(bool process);
-
-static const char io_name[64][10] =
- {"TWBR", "TWSR", "TWAR", "TWDR", "ADCL", "ADCH", "ADCSRA", "ADMUX", "ACSR", "UBRRL",
-  "UCSRB", "UCSRA", "UDR", "SPCR", "SPSR", "SPDR", "PIND",   "DDRD", "PORTD", "PINC",
-  "DDRC", "PORTC", "PINB", "DDRB", "PORTB", "$19", "$1A",    "$1B", "EECR", "EEDR",
-  "EEARL", "EEARH", "UBRRH", "WDTCR", "ASSR", "OCR2", "TCNT2", "TCCR2", "ICR1L", "ICR1H",
-  "OCR1BL", "OCR1BH", "OCR1AL", "OCR1AH", "TCNT1L", "TCNT1H", "TCCR1B", "TCCR1A", "SFIOR", "OSCCAL",
-  "TCNT0", "TCCR0", "MCUCSR", "MCUCR", "TWCR", "SPMCR", "TIFR", "TIMSK", "GIFR", "GICR",
-  "$3C", "SPL", "SPH", "SREG"};
-
-static const char reg_name[32][4] =
- {"r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8", "r9",
-  "r10", "r11", "r12", "r13", "r14", "r15", "r16", "r17", "r18", "r19",
-  "r20", "r21", "r22", "r23", "r24", "r25", "XL", "XH", "YL", "YH",
-  "ZL", "ZH" };
-
-static uint8_t get_instruction_size();
-
-//----------------------------------------------------------------------
-static void add_origin(uint16_t addr)
-{
-    origin[origin_cnt++] = addr;
-}
-
-//----------------------------------------------------------------------
-static void delete_first_origin()
-{
-    if( origin_cnt > 0 )
-    {
-        origin_cnt--;
-        memmove(origin, &origin[1], origin_cnt*sizeof(int) );
-    }
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_nop(bool process)
-{
-    if( code[pc] != 0x0000)
-        return 0;
-    if( process )
-        sprintf(line[pc].text, "nop");
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_movw(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFF00) != 0x0100)
-        return 0;
-    if( process )
-    {
-        uint8_t dst = 2 * F16(cmd, 4, 4);
-        uint8_t src = 2 * F16(cmd, 0, 4);
-        sprintf(line[pc].text, "movw\t%s:%s, %s:%s",
-                reg_name[dst+1], reg_name[dst],
-                reg_name[src+1], reg_name[src]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_cpc_cp(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xEC00) != 0x0400)
-        return 0;
-    if( process )
-    {
-        uint8_t dst = F16(cmd, 4, 5);
-        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
-        if( BIT(cmd, 12) )
-            sprintf(line[pc].text, "cp\t%s,%s", reg_name[dst], reg_name[src]);
-        else
-            sprintf(line[pc].text, "cpc\t%s,%s", reg_name[dst], reg_name[src]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_sub_sbc(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xEC00) != 0x0800)
-        return 0;
-    if( process )
-    {
-        uint8_t dst = F16(cmd, 4, 5);
-        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
-        if( BIT(cmd, 12) )
-            sprintf(line[pc].text, "sub\t%s,%s", reg_name[dst], reg_name[src]);
-        else
-            sprintf(line[pc].text, "sbc\t%s,%s", reg_name[dst], reg_name[src]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_add_adc_lsl_rol(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xEC00) != 0x0C00)
-        return 0;
-    if( process )
+#include <stdlib.h>
+#include <chrono>
+#include "disasm.h"
+#include "loader.h"
+#include "listing.h"
+#include "batch.h"
+#include "bench.h"
+#include "watch.h"
+#include "cache.h"
+#include "cfg.h"
+#include "pointers.h"
+#include "timing.h"
+#include "irq.h"
+#include "sim.h"
+#include "profile.h"
+#include "jit.h"
+#include "snapshot.h"
+#include "diff.h"
+#include "signature.h"
+
+static const DEVICE_t *target_device;
+static bool linear_sweep;
+static RESULT_CACHE_t *result_cache;
+static bool write_graph;
+static bool track_ptrs;
+static bool count_cycles;
+static bool irq_report;
+static bool simulate;
+static uint64_t sim_cycles;     // -e budget, 0 - no limit
+static uint64_t sim_instrs;
+static uint32_t sim_vector;     // -v, 0 - from reset
+static std::vector<const char*> stimulus_files;
+static uint64_t checkpoint_cycles;  // -q, 0 - no replay
+static bool translate;          // -f
+static const SIG_DB_t *signatures;  // -h
+
+// What decode_image() did besides the plain decode
+typedef struct IMAGE_STATS {
+    uint32_t swept;             // instructions the linear sweep added
+    uint32_t named;             // functions -h signatures named
+    POINTER_STATS_t pointers;
+    uint32_t handlers;          // interrupt report
+    uint32_t critical;
+    uint32_t blocked;
+    int sim_status;             // -e run
+    uint32_t sim_pc;
+    uint64_t sim_cycles;
+    uint64_t sim_instrs;
+    double sim_mips;
+    uint32_t uart_bytes;        // sent by the simulated USART
+    uint32_t variants;          // -q replays
+    double restore_us;          // average restore time
+} IMAGE_STATS_t;
+
+//----------------------------------------------------------------------
+// file.asm -> file<ext>
+static std::string report_file_name(const char *asm_file, const char *ext)
+{
+    std::string name = asm_file;
+    size_t dot = name.find_last_of('.');
+    size_t slash = name.find_last_of("/\\");
+    if( dot != std::string::npos && (slash == std::string::npos || dot > slash) )
+        name.erase(dot);
+    return name + ext;
+}
+
+//----------------------------------------------------------------------
+// Builds the CFG when -g, -y, -a or -e need it, and the cycle counts for
+// -y and -a
+static void analyze_image(const DISASM_t *ctx, CFG_t *cfg, TIMING_t *timing, int jobs)
+{
+    if( write_graph || count_cycles || irq_report || simulate )
+        build_cfg(ctx, cfg, jobs);
+    if( count_cycles || irq_report )
+        analyze_timing(ctx, cfg, timing);
+}
+
+//----------------------------------------------------------------------
+// file.cfg for -g and file.irq for -a
+static int write_reports(const DISASM_t *ctx, const CFG_t *cfg, const TIMING_t *timing,
+                         const char *asm_file, int jobs, IMAGE_STATS_t *stats)
+{
+    if( write_graph )
+    {
+        std::vector<FUNC_INFO_t> info;
+        analyze_functions(ctx, cfg, jobs, info);
+        if( !write_cfg(ctx, cfg, info, count_cycles ? timing : nullptr, report_file_name(asm_file, ".cfg").c_str()) )
+            return IMAGE_NO_OUTPUT;
+    }
+    if( irq_report )
+    {
+        IRQ_REPORT_t report;
+        analyze_irq(ctx, timing, &report);
+        stats->handlers = uint32_t(report.isr.size());
+        stats->critical = uint32_t(report.critical.size());
+        stats->blocked = report.blocked;
+        if( !write_irq(ctx, timing, &report, report_file_name(asm_file, ".irq").c_str()) )
+            return IMAGE_NO_OUTPUT;
+    }
+    return IMAGE_OK;
+}
+
+//----------------------------------------------------------------------
+static bool write_uart(const SIM_t *sim, const std::string &file_name)
+{
+    FILE *f = fopen(file_name.c_str(), "wb");
+    bool ok = f && fwrite(sim->periph.tx_data.data(), 1, sim->periph.tx_data.size(), f) == sim->periph.tx_data.size();
+    if( f && fclose(f) != 0 )
+        ok = false;
+    return ok;
+}
+
+//----------------------------------------------------------------------
+// -q: runs the boot path once up to the checkpoint, then every -u
+// stimulus from a restore of it. One "variant" line per stimulus goes to
+// file.var, its USART output to file.N.uart.
+static int replay_variants(SIM_t *sim, const char *asm_file, IMAGE_STATS_t *stats)
+{
+    sim_run(sim, checkpoint_cycles, 0);
+    SNAPSHOT_t boot;
+    snapshot_take(&boot, sim, nullptr);
+    FILE *fvar = fopen(report_file_name(asm_file, ".var").c_str(), "wt");
+    if( fvar == nullptr )
+    {
+        snapshot_free(&boot);
+        return IMAGE_NO_OUTPUT;
+    }
+    fprintf(fvar, "; checkpoint at L_%X after %llu cycles, %u pages\n",
+            boot.pc, (unsigned long long)boot.cycles, unsigned(boot.page.size()));
+    int status = IMAGE_OK;
+    double restore_sec = 0;
+    for( size_t i = 0; i < stimulus_files.size() && status == IMAGE_OK; i++ )
     {
-        uint8_t dst = F16(cmd, 4, 5);
-        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
-        if( BIT(cmd, 12) )
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        uint32_t written = snapshot_restore(&boot, sim);
+        restore_sec += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        uint32_t error_line;
+        if( !sim_load_stimulus(sim, stimulus_files[i], &error_line) )
         {
-            if( dst != src )
-                sprintf(line[pc].text, "adc\t%s,%s", reg_name[dst], reg_name[src]);
-            else
-                sprintf(line[pc].text, "rol\t%s", reg_name[dst]);
+            printf("%s:%u: bad stimulus\n", stimulus_files[i], error_line);
+            status = IMAGE_BAD_INPUT;
+            break;
         }
-        else
+        int run = sim_run(sim, sim_cycles, sim_instrs);
+        fprintf(fvar, "variant %s %s at L_%X cycles=%llu instrs=%llu uart=%u restored=%u\n",
+                stimulus_files[i], sim_status_name(run), sim->pc, (unsigned long long)(sim->cycles - boot.cycles),
+                (unsigned long long)(sim->instrs - boot.instrs), unsigned(sim->periph.tx_data.size()), written);
+        std::string uart_file = report_file_name(asm_file, ("." + std::to_string(i + 1) + ".uart").c_str());
+        if( !sim->periph.tx_data.empty() && !write_uart(sim, uart_file) )
+            status = IMAGE_NO_OUTPUT;
+        stats->variants++;
+    }
+    if( fclose(fvar) != 0 && status == IMAGE_OK )
+        status = IMAGE_NO_OUTPUT;
+    stats->restore_us = stats->variants ? restore_sec * 1e6 / stats->variants : 0.0;
+    snapshot_free(&boot);
+    return status;
+}
+
+//----------------------------------------------------------------------
+// -e: runs the image from reset or the -v vector with the -u stimulus
+// until the budget is used up or it stops, and writes the hot functions
+// and blocks to file.prof and what the USART sent to file.uart. With -f
+// the run uses translated code and counts nothing per word, with -q it
+// replays every stimulus from a checkpoint instead.
+static int profile_image(const DISASM_t *ctx, const CFG_t *cfg, PROFILE_t *profile, const char *asm_file,
+                         IMAGE_STATS_t *stats)
+{
+    SIM_t sim;
+    sim_init(&sim, ctx);
+    uint32_t error_line;
+    for( size_t i = 0; i < stimulus_files.size() && checkpoint_cycles == 0; i++ )
+        if( !sim_load_stimulus(&sim, stimulus_files[i], &error_line) )
         {
-            if( dst != src )
-                sprintf(line[pc].text, "add\t%s,%s", reg_name[dst], reg_name[src]);
-            else
-                sprintf(line[pc].text, "lsl\t%s", reg_name[dst]);
+            printf("%s:%u: bad stimulus\n", stimulus_files[i], error_line);
+            return IMAGE_BAD_INPUT;
+        }
+    if( sim_vector )
+        sim_start_vector(&sim, sim_vector);
+    uint32_t start = sim.pc;
+    JIT_t jit;
+    bool translated = translate && sim_instrs == 0 && jit_init(&jit, &sim, ctx);
+    if( translated )
+        sim.jit = &jit;
+    else
+        sim_set_profile(&sim, profile);
+    int status = IMAGE_OK;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    if( checkpoint_cycles )
+        status = replay_variants(&sim, asm_file, stats);
+    else
+        sim_run(&sim, sim_cycles, sim_instrs);
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if( translated )
+        jit_free(&jit);
+    if( status != IMAGE_OK )
+        return status;
+    stats->sim_status = sim.status;
+    stats->sim_pc = sim.pc;
+    stats->sim_cycles = sim.cycles;
+    stats->sim_instrs = sim.instrs;
+    stats->sim_mips = sec > 0 ? sim.instrs / sec / 1e6 : 0.0;
+    stats->uart_bytes = uint32_t(sim.periph.tx_data.size());
+    if( checkpoint_cycles == 0 && !sim.periph.tx_data.empty() && !write_uart(&sim, report_file_name(asm_file, ".uart")) )
+        return IMAGE_NO_OUTPUT;
+    if( !translated && !write_profile(ctx, cfg, profile, &sim, start, report_file_name(asm_file, ".prof").c_str()) )
+        return IMAGE_NO_OUTPUT;
+    return IMAGE_OK;
+}
+
+//----------------------------------------------------------------------
+// Decodes a loaded image and writes its listing, or takes both from the
+// result cache. Returns IMAGE_*.
+static int decode_image(DISASM_t *ctx, const char *asm_file, int jobs, IMAGE_STATS_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    init_vars(ctx, target_device);
+    CFG_t cfg;
+    TIMING_t timing;
+    CACHE_KEY_t key;
+    if( result_cache && !simulate )
+    {
+        key = cache_key(ctx,   (linear_sweep ? CACHE_OPT_SWEEP : 0) | (track_ptrs ? CACHE_OPT_POINTERS : 0)
+                             | (count_cycles ? CACHE_OPT_CYCLES : 0));
+        if( cache_fetch(result_cache, &key, ctx, asm_file) )
+        {
+            stats->swept = count_lines(ctx, PLANE_SWEPT);
+            count_pointers(ctx, &stats->pointers);
+            analyze_image(ctx, &cfg, &timing, jobs);
+            return write_reports(ctx, &cfg, &timing, asm_file, jobs, stats);
         }
     }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_cpse(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFC00) != 0x1000)
-        return 0;
-    if( process )
-    {
-        uint8_t dst = F16(cmd, 4, 5);
-        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
-        sprintf(line[pc].text, "cpse\t%s,%s", reg_name[dst], reg_name[src]);
-        pc++;
-        add_origin(pc + get_instruction_size());
-        pc--;
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_and(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFC00) != 0x2000)
-        return 0;
-    if( process )
-    {
-        uint8_t dst = F16(cmd, 4, 5);
-        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
-        sprintf(line[pc].text, "and\t%s,%s", reg_name[dst], reg_name[src]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_eor(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFC00) != 0x2400)
-        return 0;
-    if( process )
-    {
-        uint8_t dst = F16(cmd, 4, 5);
-        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
-        sprintf(line[pc].text, "eor\t%s,%s", reg_name[dst], reg_name[src]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_or(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFC00) != 0x2800)
-        return 0;
-    if( process )
-    {
-        uint8_t dst = F16(cmd, 4, 5);
-        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
-        sprintf(line[pc].text, "or\t%s,%s", reg_name[dst], reg_name[src]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_mov(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFC00) != 0x2C00)
-        return 0;
-    if( process )
-    {
-        uint8_t dst = F16(cmd, 4, 5);
-        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
-        sprintf(line[pc].text, "mov\t%s,%s", reg_name[dst], reg_name[src]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_cpi(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xF000) != 0x3000)
-        return 0;
-    if( process )
+    if( !decode_dump(ctx) )
+        return IMAGE_DECODE_FAILED;
+    if( track_ptrs )
+        track_pointers(ctx, jobs, &stats->pointers);
+    if( linear_sweep )
+        stats->swept = sweep_dump(ctx);
+    if( signatures )
+        stats->named = match_signatures(signatures, ctx);
+    analyze_image(ctx, &cfg, &timing, jobs);
+    PROFILE_t profile;
+    if( simulate )
+    {
+        int status = profile_image(ctx, &cfg, &profile, asm_file, stats);
+        if( status != IMAGE_OK )
+            return status;
+    }
+    std::vector<std::string> chunk;
+    render_code(ctx, jobs, chunk, nullptr, count_cycles ? &timing : nullptr, profile.count.empty() ? nullptr : &profile);
+    if( !write_listing(asm_file, chunk) )
+        return IMAGE_NO_OUTPUT;
+    if( result_cache && !simulate )
+        cache_store(result_cache, &key, ctx, chunk);
+    return write_reports(ctx, &cfg, &timing, asm_file, jobs, stats);
+}
+
+//----------------------------------------------------------------------
+// Batch job, the listing is rendered on the calling worker only since the
+// batch pool already keeps every core busy
+static int disasm_image(const char *in_file, const char *asm_file, uint32_t *words)
+{
+    DISASM_t *ctx = disasm_acquire();
+    int status = IMAGE_OK;
+    int load_status = load_image(ctx, in_file, nullptr);
+    if( load_status == LOAD_NO_FILE )
+        status = IMAGE_NO_INPUT;
+    else if( load_status != LOAD_OK )
+        status = IMAGE_BAD_INPUT;
+    else
     {
-        uint8_t reg = 16 + F16(cmd, 4, 4);
-        uint8_t val = (F16(cmd, 8, 4) << 4) + F16(cmd, 0, 4);
-        sprintf(line[pc].text, "cpi\t%s,%d\t// $%02x", reg_name[reg], val, val);
+        IMAGE_STATS_t stats;
+        *words = uint32_t(ctx->dump_size / 2);
+        status = decode_image(ctx, asm_file, 1, &stats);
     }
-    return 1;
+    disasm_release(ctx);
+    return status;
 }
 
 //----------------------------------------------------------------------
-static uint8_t cmd_subi_sbci(bool process)
+// Loads and decodes one side of a -z diff and builds its CFG
+static bool decode_for_diff(DISASM_t *ctx, const char *in_file, CFG_t *cfg)
 {
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xE000) != 0x4000)
-        return 0;
-    if( process )
+    uint32_t error_line;
+    int load_status = load_image(ctx, in_file, &error_line);
+    if( load_status != LOAD_OK )
     {
-        uint8_t reg = 16 + F16(cmd, 4, 4);
-        uint8_t val = (F16(cmd, 8, 4) << 4) + F16(cmd, 0, 4);
-        if( BIT(cmd, 12) )
-            sprintf(line[pc].text, "subi\t%s,%d\t// $%02x", reg_name[reg], val, val);
+        if( load_status == LOAD_NO_FILE )
+            printf("Can't open  %s\n", in_file);
         else
-            sprintf(line[pc].text, "sbci\t%s,%d\t// $%02x", reg_name[reg], val, val);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_ori(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xF000) != 0x6000)
-        return 0;
-    if( process )
-    {
-        uint8_t reg = 16 + F16(cmd, 4, 4);
-        uint8_t val = (F16(cmd, 8, 4) << 4) + F16(cmd, 0, 4);
-        sprintf(line[pc].text, "ori\t%s,%d\t// $%02x", reg_name[reg], val, val);
+            printf("%s:%u: %s\n", in_file, error_line, load_status_name(load_status));
+        return false;
     }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_andi(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xF000) != 0x7000)
-        return 0;
-    if( process )
+    init_vars(ctx, target_device);
+    if( !decode_dump(ctx) )
     {
-        uint8_t reg = 16 + F16(cmd, 4, 4);
-        uint8_t val = (F16(cmd, 8, 4) << 4) + F16(cmd, 0, 4);
-        sprintf(line[pc].text, "andi\t%s,%d\t// $%02x", reg_name[reg], val, val);
+        printf("%s: decoding failed\n", in_file);
+        return false;
     }
-    return 1;
+    POINTER_STATS_t pointers;
+    if( track_ptrs )
+        track_pointers(ctx, 0, &pointers);
+    if( linear_sweep )
+        sweep_dump(ctx);
+    if( signatures )
+        match_signatures(signatures, ctx);
+    build_cfg(ctx, cfg, 0);
+    return true;
 }
 
 //----------------------------------------------------------------------
-static uint8_t cmd_ldd_std(bool process)
+// -z: pairs the functions of two images and writes what moved, changed,
+// went or came to file.diff, named after the new image by default
+static int run_diff(const char *old_file, const char *new_file, const char *diff_file)
 {
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xD000) != 0x8000)
-        return 0;
-    if( process )
+    DISASM_t *old_ctx = disasm_acquire();
+    DISASM_t *new_ctx = disasm_acquire();
+    CFG_t old_cfg, new_cfg;
+    int result = 1;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    if( decode_for_diff(old_ctx, old_file, &old_cfg) && decode_for_diff(new_ctx, new_file, &new_cfg) )
     {
-        uint8_t reg = F16(cmd, 4, 5);
-        uint8_t offset = (F16(cmd, 13, 1) << 5) + (F16(cmd, 10, 2) << 3) + F16(cmd, 0, 3);
-        if( BIT(cmd, 9) )
+        DIFF_t diff;
+        diff_images(old_ctx, &old_cfg, new_ctx, &new_cfg, &diff);
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        std::string out_file = diff_file ? diff_file : report_file_name(asm_file_name(new_file, nullptr).c_str(), ".diff");
+        if( write_diff(old_ctx, &old_cfg, new_ctx, &new_cfg, &diff, old_file, new_file, out_file.c_str()) )
         {
-            if( BIT(cmd, 3) )
-                sprintf(line[pc].text, "std\tY+$%02x,%s\t// %d", offset, reg_name[reg], offset);
-            else
-                sprintf(line[pc].text, "std\tZ+$%02x,%s\t// %d", offset, reg_name[reg], offset);
+            const uint32_t *count = diff.count;
+            printf("%u functions before, %u after: %u same, %u moved, %u changed, %u removed, %u added (%.1f ms)\n",
+                   cfg_func_count(&old_cfg), cfg_func_count(&new_cfg), count[DIFF_SAME], count[DIFF_MOVED],
+                   count[DIFF_CHANGED], count[DIFF_REMOVED], count[DIFF_ADDED], sec * 1e3);
+            result = 0;
         }
         else
-        {
-            if( BIT(cmd, 3) )
-                sprintf(line[pc].text, "ldd\t%s,Y+$%02x\t// %d", reg_name[reg], offset, offset);
-            else
-                sprintf(line[pc].text, "ldd\t%s,Z+$%02x\t// %d", reg_name[reg], offset, offset);
-        }
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_lds_sts(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFC0F) != 0x9000)
-        return 0;
-    if( process )
-    {
-        uint8_t  reg = F16(cmd, 4, 5);
-        uint16_t addr = code[pc+1];
-        line[pc+1].visited = true;
-        if( BIT(cmd, 9) )
-            sprintf(line[pc].text, "sts\t$%04x,%s\t// %d", addr, reg_name[reg], addr);
+            printf("Can't write %s\n", out_file.c_str());
+    }
+    disasm_release(new_ctx);
+    disasm_release(old_ctx);
+    return result;
+}
+
+//----------------------------------------------------------------------
+static void usage()
+{
+    puts("Usage: MegaDisasm [-d device] [-l] [-p] [-g] [-y] [-a] [-e budget [-v vector] [-u stimulus]... [-q cycles] [-f]] [-h signatures] [-w] [-k cache_dir [-m MB]] <file.hex | file.elf | file.bin> [file.asm]\n"
+         "       MegaDisasm -b [-d device] [-l] [-p] [-g] [-y] [-a] [-h signatures] [-j jobs] [-o out_dir] [-k cache_dir [-m MB]] <dir | @list | glob | file>...\n"
+         "       MegaDisasm -z [-d device] [-l] [-p] [-h signatures] <old image> <new image> [file.diff]\n"
+         "       MegaDisasm -t [-d device] [-l] [-n words] [-s seed] [-x branch%] [-c depth] [-i data%]\n"
+         "                     [-r runs] [-j jobs] [-o work_dir]\n"
+         "\n"
+         "  -d device   target part, atmega8 by default\n"
+         "  -l          linear sweep, also decode code that no path from the vectors reaches\n"
+         "  -p          track pointer registers to resolve icall/ijmp targets and lpm tables\n"
+         "  -g          also write the control flow graph to file.cfg\n"
+         "  -y          annotate instructions, blocks and functions with their cycles\n"
+         "  -a          write interrupt latencies and critical sections to file.irq\n"
+         "  -e budget   simulate from reset for budget cycles, or instructions with an i suffix\n"
+         "              (0: until break, an invalid opcode or sleep nothing can wake), counts go\n"
+         "              to the listing, the hottest functions and blocks to file.prof; on atmega8\n"
+         "              timers, USART and ADC are modelled and USART output goes to file.uart\n"
+         "  -v vector   simulate the handler of an interrupt vector up to its reti\n"
+         "  -u file     stimulus: \"address value\" presets data space, \"uart byte...\" feeds the\n"
+         "              USART receiver, \"adc channel value\" sets conversion results,\n"
+         "              \"eeprom address byte...\" EEPROM contents; more -u files load in order\n"
+         "  -q cycles   run cycles from reset once, checkpoint, then run each -u stimulus\n"
+         "              from a restore of the checkpoint; results to file.var, file.N.uart\n"
+         "  -f          run the simulation as translated x86-64 code, no counts or file.prof;\n"
+         "              instruction budgets and other hosts still interpret\n"
+         "  -h file     name library routines: one \"name word...\" line per routine, words\n"
+         "              as 4 hex digits of the opcode, '.' for any digit; skips -k, not with -w\n"
+         "  -w          watch the input and update the listing whenever it changes\n"
+         "  -b          batch mode, disassemble every input on a worker pool\n"
+         "  -j jobs     number of worker threads (default: one per core)\n"
+         "  -o out_dir  write listings to out_dir instead of next to the inputs; inputs that\n"
+         "              would share a listing name get a -2, -3... suffix\n"
+         "  -k dir      keep results in dir and reuse them for identical inputs\n"
+         "  -m MB       size limit of the result cache (default 256)\n"
+         "  -z          diff the functions of two images: moved, changed, removed and added\n"
+         "  -t          benchmark on a generated image, times load, decode and print\n"
+         "  -n words    image size (default: device flash)\n"
+         "  -s seed     generator seed (default 1)\n"
+         "  -x branch%  share of branches and calls in code (default 15)\n"
+         "  -c depth    call tree depth (default 4)\n"
+         "  -i data%    share of data islands (default 10)\n"
+         "  -r runs     timed passes, the best one is reported (default 5)\n"
+         "\n"
+         "Devices:");
+    list_devices();
+}
+
+//----------------------------------------------------------------------
+static int run_single(const char *in_file, const char *asm_file)
+{
+    DISASM_t *ctx = disasm_acquire();
+    uint32_t error_line;
+    int load_status = load_image(ctx, in_file, &error_line);
+    if( load_status != LOAD_OK )
+    {
+        if( load_status == LOAD_NO_FILE )
+            printf("Can't open  %s\n", in_file);
         else
-            sprintf(line[pc].text, "lds\t%s,$%04x\t// %d", reg_name[reg], addr, addr);
+            printf("%s:%u: %s\n", in_file, error_line, load_status_name(load_status));
+        disasm_release(ctx);
+        return 1;
+    }
+    printf("%s opened\n\n", in_file);
+    std::string out_file = asm_file ? asm_file : asm_file_name(in_file, nullptr);
+    IMAGE_STATS_t stats;
+    int status = decode_image(ctx, out_file.c_str(), 0, &stats);
+    if( status == IMAGE_OK )
+    {
+        const POINTER_STATS_t *ps = &stats.pointers;
+        if( track_ptrs )
+            printf("Pointer tracking resolved %u icall/ijmp and %u loads, %u table words"
+                   " (%u rounds, %u chains dropped)\n",
+                   ps->jumps, ps->accesses, ps->table_words, ps->rounds, ps->dropped);
+        if( linear_sweep )
+            printf("Linear sweep added %u instructions\n", stats.swept);
+        if( signatures )
+            printf("Signatures named %u functions\n", stats.named);
+        if( irq_report )
+            printf("%u interrupt handlers, %u critical sections, interrupts disabled up to %u cycles\n",
+                   stats.handlers, stats.critical, stats.blocked);
+        if( simulate )
+            printf("Simulation: %s at L_%X after %llu cycles, %llu instructions (%.1f MIPS)\n",
+                   sim_status_name(stats.sim_status), stats.sim_pc, (unsigned long long)stats.sim_cycles,
+                   (unsigned long long)stats.sim_instrs, stats.sim_mips);
+        if( stats.variants )
+            printf("Replayed %u stimulus variants from the checkpoint, %.1f us per restore\n",
+                   stats.variants, stats.restore_us);
+        else if( stats.uart_bytes )
+            printf("USART sent %u bytes\n", stats.uart_bytes);
+        puts("\nDecoding Ok");
     }
-    return 2;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_ld_st_plus(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFC07) != 0x9001)
-        return 0;
-    if( process )
+    else if( status == IMAGE_NO_OUTPUT )
+        printf("Can't write %s\n", out_file.c_str());
+    else if( status == IMAGE_DECODE_FAILED )
     {
-        uint8_t reg = F16(cmd, 4, 5);
-        if( BIT(cmd, 9) )
+        puts("\nDecoding failed\n");
+        print_dump(ctx);
+    }
+    disasm_release(ctx);
+    return status == IMAGE_OK ? 0 : 1;
+}
+
+//----------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    bool batch = false;
+    bool bench = false;
+    bool watch = false;
+    bool diff = false;
+    BATCH_OPTIONS_t opt = { nullptr, 0 };
+    BENCH_OPTIONS_t bench_opt;
+    bench_defaults(&bench_opt, nullptr);
+    const char *cache_dir = nullptr;
+    const char *signature_file = nullptr;
+    uint32_t cache_mb = CACHE_DEFAULT_MB;
+    std::vector<const char*> args;
+    target_device = default_device();
+    for( int i = 1; i < argc; i++ )
+    {
+        if( strcmp(argv[i], "-b") == 0 )
+            batch = true;
+        else if( strcmp(argv[i], "-t") == 0 )
+            bench = true;
+        else if( strcmp(argv[i], "-z") == 0 )
+            diff = true;
+        else if( strcmp(argv[i], "-l") == 0 )
+            linear_sweep = true;
+        else if( strcmp(argv[i], "-w") == 0 )
+            watch = true;
+        else if( strcmp(argv[i], "-g") == 0 )
+            write_graph = true;
+        else if( strcmp(argv[i], "-p") == 0 )
+            track_ptrs = true;
+        else if( strcmp(argv[i], "-y") == 0 )
+            count_cycles = true;
+        else if( strcmp(argv[i], "-a") == 0 )
+            irq_report = true;
+        else if( strcmp(argv[i], "-e") == 0 && i + 1 < argc )
         {
-            if( BIT(cmd, 3) )
-                sprintf(line[pc].text, "st\tY+,%s", reg_name[reg]);
+            char *end;
+            uint64_t budget = strtoull(argv[++i], &end, 0);
+            simulate = true;
+            if( *end == 'i' )
+                sim_instrs = budget;
             else
-                sprintf(line[pc].text, "st\tZ+,%s", reg_name[reg]);
+                sim_cycles = budget;
         }
-        else
+        else if( strcmp(argv[i], "-v") == 0 && i + 1 < argc )
+            sim_vector = uint32_t(strtoul(argv[++i], nullptr, 0));
+        else if( strcmp(argv[i], "-u") == 0 && i + 1 < argc )
+            stimulus_files.push_back(argv[++i]);
+        else if( strcmp(argv[i], "-q") == 0 && i + 1 < argc )
+            checkpoint_cycles = strtoull(argv[++i], nullptr, 0);
+        else if( strcmp(argv[i], "-f") == 0 )
+            translate = true;
+        else if( strcmp(argv[i], "-h") == 0 && i + 1 < argc )
+            signature_file = argv[++i];
+        else if( strcmp(argv[i], "-d") == 0 && i + 1 < argc )
         {
-            if( BIT(cmd, 3) )
-                sprintf(line[pc].text, "ld\t%s,Y+", reg_name[reg]);
-            else
-                sprintf(line[pc].text, "ld\t%s,Z+", reg_name[reg]);
+            target_device = find_device(argv[++i]);
+            if( target_device == nullptr )
+            {
+                printf("Unknown device %s\n", argv[i]);
+                usage();
+                return 2;
+            }
         }
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_ld_st_minus(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFC07) != 0x9002)
-        return 0;
-    if( process )
-    {
-        uint8_t reg = F16(cmd, 4, 5);
-        if( BIT(cmd, 9) )
+        else if( strcmp(argv[i], "-j") == 0 && i + 1 < argc )
+            opt.jobs = atoi(argv[++i]);
+        else if( strcmp(argv[i], "-o") == 0 && i + 1 < argc )
+            opt.out_dir = argv[++i];
+        else if( strcmp(argv[i], "-k") == 0 && i + 1 < argc )
+            cache_dir = argv[++i];
+        else if( strcmp(argv[i], "-m") == 0 && i + 1 < argc )
+            cache_mb = uint32_t(strtoul(argv[++i], nullptr, 0));
+        else if( strcmp(argv[i], "-n") == 0 && i + 1 < argc )
+            bench_opt.words = uint32_t(strtoul(argv[++i], nullptr, 0));
+        else if( strcmp(argv[i], "-s") == 0 && i + 1 < argc )
+            bench_opt.seed = uint32_t(strtoul(argv[++i], nullptr, 0));
+        else if( strcmp(argv[i], "-x") == 0 && i + 1 < argc )
+            bench_opt.branch_pct = atoi(argv[++i]);
+        else if( strcmp(argv[i], "-c") == 0 && i + 1 < argc )
+            bench_opt.call_depth = atoi(argv[++i]);
+        else if( strcmp(argv[i], "-i") == 0 && i + 1 < argc )
+            bench_opt.data_pct = atoi(argv[++i]);
+        else if( strcmp(argv[i], "-r") == 0 && i + 1 < argc )
+            bench_opt.runs = atoi(argv[++i]);
+        else if( argv[i][0] == '-' && argv[i][1] != 0 )
         {
-            if( BIT(cmd, 3) )
-                sprintf(line[pc].text, "st\t-Y,%s", reg_name[reg]);
-            else
-                sprintf(line[pc].text, "st\t-Z,%s", reg_name[reg]);
+            usage();
+            return 2;
         }
         else
-        {
-            if( BIT(cmd, 3) )
-                sprintf(line[pc].text, "ld\t%s,-Y", reg_name[reg]);
-            else
-                sprintf(line[pc].text, "ld\t%s,-Z", reg_name[reg]);
-        }
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_e_lpm(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFE0D) != 0x9004)
-        return 0;
-    if( process )
-    {
-        uint8_t reg = F16(cmd, 4, 5);
-        if( BIT(cmd, 1) )
-            sprintf(line[pc].text, "elpm\t%s,Z", reg_name[reg]);
-        else
-            sprintf(line[pc].text, "lpm\t%s,Z", reg_name[reg]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_e_lpm_plus(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFE0D) != 0x9005)
-        return 0;
-    if( process )
-    {
-        uint8_t reg = F16(cmd, 4, 5);
-        if( BIT(cmd, 1) )
-            sprintf(line[pc].text, "elpm\t%s,Z+", reg_name[reg]);
-        else
-            sprintf(line[pc].text, "lpm\t%s,Z+", reg_name[reg]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_ld_st_x(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFC0C) != 0x900C)
-        return 0;
-    uint8_t type = F16(cmd, 0, 2);
-    if( type == 3 )
-        return 0;
-    if( process )
-    {
-        uint8_t reg = F16(cmd, 4, 5);
-        if( BIT(cmd, 9) )
-            switch( type ) {
-            case 0:
-                sprintf(line[pc].text, "st\tX,%s", reg_name[reg]);
-                break;
-            case 1:
-                sprintf(line[pc].text, "st\tX+,%s", reg_name[reg]);
-                break;
-            default:
-                sprintf(line[pc].text, "st\t-X,%s", reg_name[reg]);
-            }
-        else
-            switch( type ) {
-            case 0:
-                sprintf(line[pc].text, "ld\t%s,X", reg_name[reg]);
-                break;
-            case 1:
-                sprintf(line[pc].text, "ld\t%s,X+", reg_name[reg]);
-                break;
-            default:
-                sprintf(line[pc].text, "ld\t%s,-X", reg_name[reg]);
-            }
+            args.push_back(argv[i]);
     }
-    return 1;
-}
 
-//----------------------------------------------------------------------
-static uint8_t cmd_push_pop(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFC0F) != 0x900F)
-        return 0;
-    if( process )
+    if( bench )
     {
-        uint8_t reg = F16(cmd, 4, 5);
-        if( BIT(cmd, 9) )
-            sprintf(line[pc].text, "push\t%s", reg_name[reg]);
-        else
-            sprintf(line[pc].text, "pop\t%s", reg_name[reg]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_one_operand(bool process)
-{
-    static const char oo_instr[8][5] =
-        { "com", "neg", "swap", "inc", "", "asr", "lsr", "ror" };
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFE08) != 0x9400)
-        return 0;
-    uint8_t type = F16(cmd, 0, 3);
-    if( type == 4 )
-        return 0;
-    if( process )
-    {
-        uint8_t reg = F16(cmd, 4, 5);
-        sprintf(line[pc].text, "%s\t%s", oo_instr[type], reg_name[reg]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_sex_clx(bool process)
-{
-    static const char *status_bit = "cznvshti";
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFF0F) != 0x9408)
-        return 0;
-    if( process )
-    {
-        uint8_t bit = F16(cmd, 4, 3);
-        if( BIT(cmd, 7) )
-            sprintf(line[pc].text, "cl%c", status_bit[bit]);
-        else
-            sprintf(line[pc].text, "se%c", status_bit[bit]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_ret_reti(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFFEF) != 0x9508 )
-        return 0;
-    if( process )
-    {
-        if( BIT(cmd, 4) )
-            sprintf(line[pc].text, "reti");
-        else
-            sprintf(line[pc].text, "ret");
-        pc--;
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_misc(bool process)
-{
-    static const char instr[7][8] =
-        { "sleep", "break", "wdr", "lpm", "elpm", "spm", "spm Z+" };
-    static const uint8_t instr_code[7] =
-        {   0x8,     0x9,     0xA,  0xC,    0xD,   0xE,    0xF    };
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFF0F) != 0x9508)
-        return 0;
-    uint8_t type = F16(cmd, 4, 4);
-    uint8_t i = 0;
-    for(; (i < 7) && (instr_code[i] != type); i++ );
-    if( i >= 7 )
-        return 0;
-    if( process )
-        sprintf(line[pc].text, instr[i]);
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_ijmp_icall(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFEEF) != 0x9409)
-        return 0;
-    if( process )
-    {
-        if( BIT(cmd, 8) )
-            sprintf(line[pc].text, "icall");
-        else
-            sprintf(line[pc].text, "ijmp");
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_dec(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFE0F) != 0x940A)
-        return 0;
-    if( process )
-    {
-        uint8_t reg = F16(cmd, 4, 5);
-        sprintf(line[pc].text, "dec\t%s", reg_name[reg]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_jmp_call(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFE0C) != 0x940C)
-        return 0;
-    if( process )
-    {
-        uint16_t addr = code[pc+1];
-        line[addr].pointed = true;
-        line[pc+1].visited = true;
-        if( BIT(cmd, 1) )
-            sprintf(line[pc].text, "call\tL_%X", addr);
-        else
-            sprintf(line[pc].text, "jmp\tL_%X", addr);
-        pc = addr - 2;
-    }
-    return 2;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_adiw_subiw(bool process)
-{
-    static const char reg_apir[4][16] =
-        { "W", "XH:XL", "YH:YL", "ZH:ZL" };
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFE00) != 0x9600)
-        return 0;
-    if( process )
-    {
-        uint16_t pair = F16(cmd, 4, 2);
-        uint8_t val = (F16(cmd, 6, 2) << 4) + F16(cmd, 0, 4);
-        if( BIT(cmd, 8) )
-            sprintf(line[pc].text, "sbiw\t%s,%d\t// %02X", reg_apir[pair], val, val);
-        else
-            sprintf(line[pc].text, "adiw\t%s,%d\t// %02X", reg_apir[pair], val, val);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_cbi_sbi(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFD00) != 0x9800)
-        return 0;
-    if( process )
-    {
-        uint8_t reg = F16(cmd, 3, 5);
-        uint8_t bit = F16(cmd, 0, 3);
-        if( BIT(cmd, 9) )
-            sprintf(line[pc].text, "sbi\t%s,%d", io_name[reg], bit);
-        else
-            sprintf(line[pc].text, "cbi\t%s,%d", io_name[reg], bit);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_sbis_sbic(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFD00) != 0x9900)
-        return 0;
-    if( process )
-    {
-        uint8_t reg = F16(cmd, 3, 5);
-        uint8_t bit = F16(cmd, 0, 3);
-        if( BIT(cmd, 9) )
-            sprintf(line[pc].text, "sbis\t%s,%d", io_name[reg], bit);
-        else
-            sprintf(line[pc].text, "sbic\t%s,%d", io_name[reg], bit);
-        pc++;
-        add_origin(pc + get_instruction_size());
-        pc--;
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_mul(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFC00) != 0x9C00)
-        return 0;
-    if( process )
-    {
-        uint8_t dst = F16(cmd, 4, 5);
-        uint8_t src = 16 * F16(cmd, 9, 1) + F16(cmd, 0, 4);
-        sprintf(line[pc].text, "mul\t%s,%s", reg_name[dst], reg_name[src]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_in_out(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xF000) != 0xB000)
-        return 0;
-    if( process )
-    {
-        uint8_t reg = F16(cmd, 4, 5);
-        uint8_t io_reg = 16 * F16(cmd, 9, 2) + F16(cmd, 0, 4);
-        if( BIT(cmd, 11) )
-            sprintf(line[pc].text, "out\t%s,%s", io_name[io_reg], reg_name[reg]);
-        else
-            sprintf(line[pc].text, "in\t%s,%s", reg_name[reg], io_name[io_reg]);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_rjmp_rcall(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xE000) != 0xC000)
-        return 0;
-    if( process )
-    {
-        uint16_t addr;
-        if( BIT(cmd, 11) )
-            addr = (pc + 1 - (0x1000 - F16(cmd, 0, 12) )) & FLASH_END;
-        else
-            addr = (pc + 1 + F16(cmd, 0, 12)) & FLASH_END;
-        line[addr].pointed = true;
-        if( BIT(cmd, 12) )
+        if( !args.empty() )
         {
-            sprintf(line[pc].text, "rcall\tL_%X", addr);
-            add_origin(pc+1);
+            usage();
+            return 2;
         }
-        else
-            sprintf(line[pc].text, "rjmp\tL_%X", addr);
-        pc = addr - 1;
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_ldi(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xF000) != 0xE000)
-        return 0;
-    if( process )
-    {
-        uint8_t reg = 16 + F16(cmd, 4, 4);
-        uint8_t val = (F16(cmd, 8, 4) << 4) + F16(cmd, 0, 4);
-        sprintf(line[pc].text, "ldi\t%s,%d\t// $%02x", reg_name[reg], val, val);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_cond_branch(bool process)
-{
-    static const char brbs[8][5] =
-        { "brlo", "breq", "brmi", "brvs", "brlt", "brhs", "brts", "brie" };
-    static const char brbc[8][5] =
-        { "brsh", "brne", "brpl", "brvc", "brge", "brhc", "brtc", "brid" };
-    static const char alter_set[8][10] =
-        { "\t// brcs", "", "", "", "", "", "", "" };
-    static const char alter_clr[8][10] =
-        { "\t// brcc", "", "", "", "", "", "", "" };
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xF800) != 0xF000)
-        return 0;
-    if( process )
-    {
-        uint8_t bit = F16(cmd, 0, 3);
-        uint8_t offs = F16(cmd, 3, 7);
-        uint16_t addr;
-        if( BIT(offs, 6) )
-            addr = (pc + 1 - (0x80 - offs)) & FLASH_END;
-        else
-            addr = (pc + 1 + offs) & FLASH_END;
-        if( BIT(cmd, 10) )
-            sprintf(line[pc].text, "%s\tL_%X%s", brbc[bit], addr, alter_clr[bit]);
-        else
-            sprintf(line[pc].text, "%s\tL_%X%s", brbs[bit], addr, alter_set[bit]);
-        add_origin(addr);
-        line[addr].pointed = true;
+        bench_opt.device = target_device;
+        bench_opt.sweep = linear_sweep;
+        bench_opt.jobs = opt.jobs;
+        if( opt.out_dir )
+            bench_opt.work_dir = opt.out_dir;
+        return run_bench(&bench_opt);
     }
-    return 1;
-}
 
-//----------------------------------------------------------------------
-static uint8_t cmd_bld_bst(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFC08) != 0xF800)
-        return 0;
-    if( process )
-    {
-        uint8_t reg = F16(cmd, 4, 5);
-        uint8_t bit = F16(cmd, 0, 3);
-        if( BIT(cmd, 9) )
-            sprintf(line[pc].text, "bst\t%s,%d", reg_name[reg], bit);
-        else
-            sprintf(line[pc].text, "bld\t%s,%d", reg_name[reg], bit);
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_sbrs_sbrc(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( (cmd & 0xFC08) != 0xFC00)
-        return 0;
-    if( process )
+    static SIG_DB_t sig_db;
+    if( signature_file )
     {
-        uint8_t reg = F16(cmd, 4, 5);
-        uint8_t bit = F16(cmd, 0, 3);
-        if( BIT(cmd, 9) )
-            sprintf(line[pc].text, "sbrs\t%s,%d", reg_name[reg], bit);
-        else
-            sprintf(line[pc].text, "sbrc\t%s,%d", reg_name[reg], bit);
-        pc++;
-        add_origin(pc + get_instruction_size());
-        pc--;
-    }
-    return 1;
-}
-
-//----------------------------------------------------------------------
-static uint8_t cmd_not_programmed(bool process)
-{
-    uint16_t cmd = code[pc];
-    if( cmd != 0xFFFF)
-        return 0;
-    if( process )
-        pc--;
-    return 1;
-}
-
-
-//----------------------------------------------------------------------
-static COMMAND_t command[] = {
-    cmd_nop,
-    cmd_movw,
-    cmd_cpc_cp,
-    cmd_sub_sbc,
-    cmd_add_adc_lsl_rol,
-    cmd_cpse,
-    cmd_and,
-    cmd_eor,
-    cmd_or,
-    cmd_mov,
-    cmd_cpi,
-    cmd_subi_sbci,
-    cmd_ori,
-    cmd_andi,
-    cmd_ldd_std,
-    cmd_lds_sts,
-    cmd_ld_st_plus,
-    cmd_ld_st_minus,
-    cmd_e_lpm,
-    cmd_e_lpm_plus,
-    cmd_ld_st_x,
-    cmd_push_pop,
-    cmd_one_operand,
-    cmd_sex_clx,
-    cmd_ret_reti,
-    cmd_misc,
-    cmd_ijmp_icall,
-    cmd_dec,
-    cmd_jmp_call,
-    cmd_adiw_subiw,
-    cmd_cbi_sbi,
-    cmd_sbis_sbic,
-    cmd_mul,
-    cmd_in_out,
-    cmd_rjmp_rcall,
-    cmd_ldi,
-    cmd_cond_branch,
-    cmd_bld_bst,
-    cmd_sbrs_sbrc,
-    cmd_not_programmed
-};
-#define COMMAND_COUNT (int(sizeof(command)/sizeof(COMMAND_t)))
-
-//----------------------------------------------------------------------
-static bool decode_instruction()
-{
-    if( line[pc].visited )
-        return false;
-    int addr = pc;
-    for(int i = 0; i < COMMAND_COUNT; i++)
-    {
-        uint8_t size = command[i](true);
-        if( size != 0 )
+        uint32_t error_line;
+        if( !load_signatures(&sig_db, signature_file, &error_line) )
         {
-            line[addr].decoded = true;
-            line[addr].visited = true;
-            pc += size;
-            return true;
+            if( error_line == 0 )
+                printf("Can't open  %s\n", signature_file);
+            else
+                printf("%s:%u: bad signature\n", signature_file, error_line);
+            return 2;
         }
+        signatures = &sig_db;
     }
-    return false;
-}
 
-//----------------------------------------------------------------------
-static uint8_t get_instruction_size()
-{
-    for(int i = 0; i < COMMAND_COUNT; i++)
+    if( diff )
     {
-        uint8_t size = command[i](false);
-        if( size != 0 )
-            return size;
-    }
-    return 0;
-}
-
-//----------------------------------------------------------------------
-static bool decode_chain()
-{
-    pc = origin[0];
-    while( !line[pc].decoded )
-        if(!decode_instruction())
-            return false;
-    delete_first_origin();
-    return true;
-}
-
-//----------------------------------------------------------------------
-static bool decode_dump()
-{
-    while( origin_cnt > 0 )
-        if( !decode_chain() )
-            return false;
-    return true;
-}
-
-//----------------------------------------------------------------------
-static void print_dump()
-{
-    for( int i = 0; i < dump_size; i++ )
-    {
-        printf("%02X", mem_byte[i]);
-        if( i % 16 == 15 || i == dump_size - 1) puts("");
-    }
-}
-
-//----------------------------------------------------------------------
-static void print_code(const char *file_name)
-{
-    FILE *fasm;
-    fasm = fopen(file_name, "wt");
-    fprintf(fasm,".include \"m8def.inc\"\n");
-    uint16_t bak_addr = FLASH_END;
-    for( int i = 0; i < MAX_LINES; i++ )
-    {
-        LINE_t *cline = &line[i];
-        if( cline->decoded || (!cline->visited && (code[i] != 0xffff)) )
+        if( args.size() < 2 || args.size() > 3 )
         {
-            uint16_t prev = (i - 1) & FLASH_END;
-            uint16_t prev_prev = (i - 2) & FLASH_END;
-            if(    (bak_addr != prev)
-               && ((bak_addr != prev_prev) || !line[prev_prev].visited) )
-                fprintf(fasm,".ORG\t$%X\n", i);
-            bak_addr = i;
-        }
-        if( cline->decoded )
-        {
-            if( cline->pointed )
-                fprintf(fasm, "L_%X:\t%s\n", i, cline->text);
-            else
-                fprintf(fasm, "\t%s\n", cline->text);
-        }
-        else if( !cline->visited && (code[i] != 0xffff) )
-        {
-            fprintf(fasm, "L_%X:\t.dw\t$%04x\n", i, code[i]);
+            usage();
+            return 2;
         }
+        return run_diff(args[0], args[1], args.size() > 2 ? args[2] : nullptr);
     }
-    fclose(fasm);
-}
 
-//----------------------------------------------------------------------
-static bool load_hex(const char *file_name)
-{
-    FILE *fhex;
-    fhex = fopen(file_name, "rt");
-    if( fhex != nullptr )
+    static RESULT_CACHE_t cache;
+    if( cache_dir && !watch && !signatures )
     {
-        printf("%s opened\n\n", file_name);
-        char hex_line[256];
-        memset(mem_byte, 0xff, MEM_SIZE );
-        dump_size = 0;
-        while( fgets(hex_line, 255, fhex) )
+        if( !cache_open(&cache, cache_dir, uint64_t(cache_mb) << 20) )
         {
-            int hex_len = int(strlen(hex_line)) - 1;
-            hex_line[hex_len] = 0;
-            if(   hex_line[0] == ':'
-               && hex_len > 11
-               && (hex_len & 1)
-               && hex2byte(&hex_line[7]) == 0 )
-            {
-                uint8_t  size = hex2byte(&hex_line[1]);
-                uint16_t addr = hex2word(&hex_line[3]);
-                for( uint8_t i = 0; i < size; i++ )
-                    mem_byte[addr+i] = hex2byte(&hex_line[9+i*2]);
-                if( dump_size < addr + size )
-                    dump_size = addr + size;
-            }
+            printf("Can't use cache directory %s\n", cache_dir);
+            return 2;
         }
-        fclose(fhex);
-        return true;
-    }
-    else
-    {
-        printf("Can't open  %s\n", file_name);
-        return false;
+        result_cache = &cache;
     }
-}
 
-#define IRQ_TABLE_SIZE 15
-
-void init_vars()
-{
-    pc = 0;
-    origin[0] = 0;
-    for(int i = 0; i < IRQ_TABLE_SIZE; i++)
-        origin[i] = i;
-    origin_cnt = IRQ_TABLE_SIZE;
-}
-
-//#define HEX_FILE "D:\\Proj2019\\Other\\AVR_disasm\\GPig\\GPig.hex"
-#define HEX_FILE "D:\\Proj2019\\Other\\AVR_disasm\\MegaDisasm\\heater_dump.hex"
-#define ASM_FILE "D:\\Proj2019\\Other\\AVR_disasm\\MegaDisasm\\heater.asm"
-
-//----------------------------------------------------------------------
-int main()
-{
-    if (!load_hex(HEX_FILE) )
-        return 0;
-    init_vars();
-    bool result = decode_dump();
-    if( result )
+    if( !batch )
     {
-        print_code(ASM_FILE);
-        puts("\nDecoding Ok");
-    }
-    else
-    {
-        puts("\nDecoding failed\n");
-        print_dump();
-    }
-
-    return 0;
+        if( args.empty() || args.size() > 2 )
+        {
+            usage();
+            return 2;
+        }
+        if( watch )
+        {
+            std::string out_file = args.size() > 1 ? args[1] : asm_file_name(args[0], nullptr);
+            return watch_image(args[0], out_file.c_str(), target_device, linear_sweep, track_ptrs,
+                               count_cycles);
+        }
+        int result = run_single(args[0], args.size() > 1 ? args[1] : nullptr);
+        if( result_cache )
+            cache_print_stats(result_cache);
+        return result;
+    }
+
+    std::vector<std::string> files;
+    for( size_t i = 0; i < args.size(); i++ )
+        if( !collect_inputs(args[i], files) )
+            printf("Can't read %s\n", args[i]);
+    if( files.empty() )
+    {
+        usage();
+        return 2;
+    }
+    init_opcode_table();
+    int failed = run_batch(files, &opt, disasm_image);
+    if( result_cache )
+        cache_print_stats(result_cache);
+    return failed ? 1 : 0;
 }
@@ -0,0 +1,98 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+
+//----------------------------------------------------------------------
+bool map_file(MAPPED_FILE_t *mf, const char *file_name)
+{
+    mf->data = nullptr;
+    mf->size = 0;
+    HANDLE file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if( file == INVALID_HANDLE_VALUE )
+        return false;
+    LARGE_INTEGER size;
+    if( !GetFileSizeEx(file, &size) )
+    {
+        CloseHandle(file);
+        return false;
+    }
+    if( size.QuadPart > 0 )
+    {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if( mapping != nullptr )
+        {
+            mf->data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            CloseHandle(mapping);
+        }
+        if( mf->data == nullptr )
+        {
+            CloseHandle(file);
+            return false;
+        }
+        mf->size = size_t(size.QuadPart);
+    }
+    CloseHandle(file);
+    return true;
+}
+
+//----------------------------------------------------------------------
+void unmap_file(MAPPED_FILE_t *mf)
+{
+    if( mf->data != nullptr )
+        UnmapViewOfFile(mf->data);
+    mf->data = nullptr;
+    mf->size = 0;
+}
+
+#else
+
+//----------------------------------------------------------------------
+bool map_file(MAPPED_FILE_t *mf, const char *file_name)
+{
+    mf->data = nullptr;
+    mf->size = 0;
+    int fd = open(file_name, O_RDONLY);
+    if( fd < 0 )
+        return false;
+    struct stat st;
+    if( fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) )
+    {
+        close(fd);
+        return false;
+    }
+    if( st.st_size > 0 )
+    {
+        void *data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if( data == MAP_FAILED )
+        {
+            close(fd);
+            return false;
+        }
+        madvise(data, size_t(st.st_size), MADV_SEQUENTIAL);
+        mf->data = static_cast<const uint8_t*>(data);
+        mf->size = size_t(st.st_size);
+    }
+    close(fd);
+    return true;
+}
+
+//----------------------------------------------------------------------
+void unmap_file(MAPPED_FILE_t *mf)
+{
+    if( mf->data != nullptr )
+        munmap(const_cast<uint8_t*>(mf->data), mf->size);
+    mf->data = nullptr;
+    mf->size = 0;
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Read-only view of a whole file
+typedef struct MAPPED_FILE {
+    const uint8_t *data;
+    size_t size;
+} MAPPED_FILE_t;
+
+bool map_file(MAPPED_FILE_t *mf, const char *file_name);
+void unmap_file(MAPPED_FILE_t *mf);
+
+#endif
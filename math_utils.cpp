@@ -1,13 +1,31 @@
 #include "math_utils.h"
 
+#define X HEX_INVALID
+const uint8_t hex_digit[256] = {
+     X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  X,  X,  X,  X,  X,  X,
+     X, 10, 11, 12, 13, 14, 15,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     X, 10, 11, 12, 13, 14, 15,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+     X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X
+};
+#undef X
+
 //----------------------------------------------------------------------
 char hex2val(char c)
 {
-    if( c >= '0' && c <= '9' )
-        return c - '0';
-    else if( c >= 'A' && c <= 'F' )
-        return 0x0A + c - 'A';
-    return 0;
+    uint8_t val = hex_digit[uint8_t(c)];
+    return val == HEX_INVALID ? 0 : char(val);
 }
 
 //----------------------------------------------------------------------
@@ -23,3 +41,36 @@ uint16_t hex2word(const char *hex)
 }
 
 //
+
+//----------------------------------------------------------------------
+// Hex without leading zeros below min_digits, no locale and no printf.
+// Writes at most 8 characters at p, no terminator, returns the end.
+char *put_hex(char *p, uint32_t value, int min_digits, const char *digits)
+{
+    char buf[8];
+    int len = 0;
+    do {
+        buf[7 - len++] = digits[value & 0xF];
+        value >>= 4;
+    } while( value != 0 );
+    while( len < min_digits )
+        buf[7 - len++] = '0';
+    for( int i = 8 - len; i < 8; i++ )
+        *p++ = buf[i];
+    return p;
+}
+
+//----------------------------------------------------------------------
+// Decimal, at most 20 characters, like put_hex()
+char *put_uint(char *p, uint64_t value)
+{
+    char buf[20];
+    int len = 0;
+    do {
+        buf[19 - len++] = char('0' + value % 10);
+        value /= 10;
+    } while( value != 0 );
+    for( int i = 20 - len; i < 20; i++ )
+        *p++ = buf[i];
+    return p;
+}
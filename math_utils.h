@@ -2,12 +2,55 @@
 #define HEX_UTILS_H
 
 #include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #define BIT(VAL,BIT) (VAL & (1 << BIT))
 #define F16(VAL,BIT,WIDTH) ((VAL >> BIT) & ( 0xffff >> (16 - WIDTH) ))
 
+// Value of a hex digit character, HEX_INVALID for anything else
+#define HEX_INVALID 0xFF
+extern const uint8_t hex_digit[256];
+
+// Index of the lowest set bit, value must not be 0
+inline int ctz64(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return int(index);
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+// Index of the highest set bit, value must not be 0
+inline int msb64(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return int(index);
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+// Number of set bits
+inline int popcount64(uint64_t value)
+{
+#ifdef _MSC_VER
+    return int(__popcnt64(value));
+#else
+    return __builtin_popcountll(value);
+#endif
+}
+
 char hex2val(char c);
 uint8_t hex2byte(const char *hex);
 uint16_t hex2word(const char *hex);
+char *put_hex(char *p, uint32_t value, int min_digits, const char *digits);
+char *put_uint(char *p, uint64_t value);
 
 #endif
@@ -0,0 +1,578 @@
+#include <string.h>
+#include "sim.h"
+
+// Interrupt sources of the ATmega8, by vector: a flag and its enable bit
+typedef struct IRQ_SOURCE {
+    uint8_t vector;
+    uint8_t flag_addr;
+    uint8_t flag;
+    uint8_t enable_addr;
+    uint8_t enable;
+    bool auto_clear;        // the flag clears when the vector is taken
+} IRQ_SOURCE_t;
+
+static const IRQ_SOURCE_t m8_irq[] = {
+    {  3, M8_TIFR,   0x80, M8_TIMSK,  0x80, true  },    // TIMER2_COMP
+    {  4, M8_TIFR,   0x40, M8_TIMSK,  0x40, true  },    // TIMER2_OVF
+    {  5, M8_TIFR,   0x20, M8_TIMSK,  0x20, true  },    // TIMER1_CAPT
+    {  6, M8_TIFR,   0x10, M8_TIMSK,  0x10, true  },    // TIMER1_COMPA
+    {  7, M8_TIFR,   0x08, M8_TIMSK,  0x08, true  },    // TIMER1_COMPB
+    {  8, M8_TIFR,   0x04, M8_TIMSK,  0x04, true  },    // TIMER1_OVF
+    {  9, M8_TIFR,   0x01, M8_TIMSK,  0x01, true  },    // TIMER0_OVF
+    { 11, M8_UCSRA,  0x80, M8_UCSRB,  0x80, false },    // USART_RXC, cleared by reading UDR
+    { 12, M8_UCSRA,  0x20, M8_UCSRB,  0x20, false },    // USART_UDRE, cleared by writing UDR
+    { 13, M8_UCSRA,  0x40, M8_UCSRB,  0x40, true  },    // USART_TXC
+    { 14, M8_ADCSRA, 0x10, M8_ADCSRA, 0x08, true  }     // ADC
+};
+#define M8_IRQ_COUNT (int(sizeof(m8_irq)/sizeof(IRQ_SOURCE_t)))
+
+// UCSRA bits
+#define UCSRA_RXC   0x80
+#define UCSRA_TXC   0x40
+#define UCSRA_UDRE  0x20
+#define UCSRA_DOR   0x08
+#define UCSRA_U2X   0x02
+#define UCSRA_MPCM  0x01
+
+// UCSRB bits
+#define UCSRB_RXEN  0x10
+#define UCSRB_TXEN  0x08
+#define UCSRB_UCSZ2 0x04
+
+// ADCSRA bits
+#define ADCSRA_ADEN 0x80
+#define ADCSRA_ADSC 0x40
+#define ADCSRA_ADFR 0x20
+#define ADCSRA_ADIF 0x10
+
+// ADMUX bits
+#define ADMUX_ADLAR 0x20
+
+// EECR bits
+#define EECR_EERIE  0x08
+#define EECR_EEMWE  0x04
+#define EECR_EEWE   0x02
+#define EECR_EERE   0x01
+
+// EE_RDY: no flag, pending while EERIE is set and no write runs
+#define M8_EE_RDY_VECTOR    15
+
+// EEPROM write time, 8.5 ms at 8 MHz. The part times it from its own RC
+// oscillator, so it does not follow the CPU clock.
+#define M8_EE_WRITE_CYCLES  68000
+
+// EEMWE clears this many cycles after it was set
+#define M8_EE_MASTER_CYCLES 4
+
+// EEPROM read halts the CPU
+#define M8_EE_READ_CYCLES   4
+
+static const uint16_t timer01_prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+static const uint16_t timer2_prescale[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+static const uint8_t adc_prescale[8] = { 2, 2, 4, 8, 16, 32, 64, 128 };
+
+//----------------------------------------------------------------------
+// Count at cycle now
+static uint32_t timer_count(const SIM_TIMER_t *t, uint64_t now)
+{
+    if( t->prescale == 0 )
+        return t->count;
+    uint64_t ticks = (now - t->base) / t->prescale;
+    uint64_t first = (t->count <= t->top ? t->top : t->max) - t->count + 1;
+    if( ticks < first )
+        return uint32_t(t->count + ticks);
+    return uint32_t((ticks - first) % (uint64_t(t->top) + 1));
+}
+
+//----------------------------------------------------------------------
+// Timer clock steps from the base count to value, on its way through
+// the wrap if it has to. A count above top first runs up to max.
+static uint64_t ticks_to(const SIM_TIMER_t *t, uint32_t value)
+{
+    uint64_t first = (t->count <= t->top ? t->top : t->max) - t->count + 1;
+    if( value > t->count && (t->count > t->top || value <= t->top) )
+        return value - t->count;
+    return first + value;
+}
+
+//----------------------------------------------------------------------
+// Takes the count at now as the new base and queues the wrap and compare
+// events from there, after a register write changed the timer
+static void timer_rebase(SIM_t *sim, SIM_TIMER_t *t)
+{
+    EVENT_WHEEL_t *wheel = &sim->periph.wheel;
+    if( t->prescale )
+    {
+        uint64_t ticks = (sim->cycles - t->base) / t->prescale;
+        t->count = timer_count(t, sim->cycles);
+        t->base += ticks * t->prescale;
+    }
+    else
+        t->base = sim->cycles;
+    if( t->prescale == 0 )
+    {
+        wheel_cancel(wheel, t->wrap_event);
+        for( int i = 0; i < t->compares; i++ )
+            wheel_cancel(wheel, t->compare_event + i);
+        return;
+    }
+    wheel_schedule(wheel, t->wrap_event, t->base + ((t->count <= t->top ? t->top : t->max) - t->count + 1) * t->prescale);
+    for( int i = 0; i < t->compares; i++ )
+        if( t->ocr[i] <= t->top )
+            wheel_schedule(wheel, t->compare_event + i, t->base + ticks_to(t, t->ocr[i]) * t->prescale);
+        else
+            wheel_cancel(wheel, t->compare_event + i);
+}
+
+//----------------------------------------------------------------------
+// Takes the timer modes from TCCRx. Dual-slope PWM modes count as their
+// single-slope counterpart.
+static void timer_setup(SIM_t *sim, int index)
+{
+    SIM_TIMER_t *t = &sim->periph.timer[index];
+    uint8_t *data = sim->data.data();
+    t->count = timer_count(t, sim->cycles);
+    t->base = sim->cycles;
+    t->wrap_flag = index == 0 ? 0x01 : index == 1 ? 0x04 : 0x40;
+    if( index == 0 )
+    {
+        t->prescale = timer01_prescale[data[M8_TCCR0] & 7];
+        t->top = 0xFF;
+    }
+    else if( index == 2 )
+    {
+        uint8_t tccr = data[M8_TCCR2];
+        t->prescale = timer2_prescale[tccr & 7];
+        t->ocr[0] = data[M8_OCR2];
+        bool ctc = (tccr & 0x48) == 0x08;
+        t->top = ctc ? t->ocr[0] : 0xFF;
+        if( ctc )
+            t->wrap_flag = 0;
+    }
+    else
+    {
+        static const uint32_t fixed_top[16] = {
+            0xFFFF, 0xFF, 0x1FF, 0x3FF, 0, 0xFF, 0x1FF, 0x3FF, 0, 0, 0, 0, 0, 0xFFFF, 0, 0
+        };
+        uint8_t wgm = uint8_t(((data[M8_TCCR1B] >> 1) & 0x0C) | (data[M8_TCCR1A] & 3));
+        t->prescale = timer01_prescale[data[M8_TCCR1B] & 7];
+        t->ocr[0] = data[M8_OCR1AL] | (data[M8_OCR1AH] << 8);
+        t->ocr[1] = data[M8_OCR1BL] | (data[M8_OCR1BH] << 8);
+        uint32_t icr = data[M8_ICR1L] | (data[M8_ICR1H] << 8);
+        switch( wgm ) {
+        case 4:
+        case 9:
+        case 11:
+        case 15:
+            t->top = t->ocr[0];
+            break;
+        case 8:
+        case 10:
+        case 12:
+        case 14:
+            t->top = icr;
+            break;
+        default:
+            t->top = fixed_top[wgm];
+            break;
+        }
+        if( wgm == 4 )
+            t->wrap_flag = 0;
+        else if( wgm == 12 )
+            t->wrap_flag = 0x20;
+    }
+    timer_rebase(sim, t);
+}
+
+//----------------------------------------------------------------------
+// Wrap or compare match: sets the flag and queues the same event one
+// timer period later
+static void timer_event(SIM_t *sim, SIM_TIMER_t *t, uint32_t id, uint64_t due)
+{
+    uint8_t flag = id == t->wrap_event ? t->wrap_flag : t->ocf[id - t->compare_event];
+    sim->data[M8_TIFR] |= flag;
+    wheel_schedule(&sim->periph.wheel, id, due + (uint64_t(t->top) + 1) * t->prescale);
+}
+
+//----------------------------------------------------------------------
+// Cycles per USART frame: start bit, data bits, parity and stop bits at
+// the UBRR baud rate
+static uint64_t uart_frame(const SIM_t *sim)
+{
+    static const uint8_t data_bits[8] = { 5, 6, 7, 8, 8, 8, 8, 9 };
+    const uint8_t *data = sim->data.data();
+    uint8_t ucsrc = sim->periph.ucsrc;
+    uint32_t ubrr = ((data[M8_UBRRH] & 0x0F) << 8) | data[M8_UBRRL];
+    uint32_t bits = 1 + data_bits[((ucsrc >> 1) & 3) | (data[M8_UCSRB] & UCSRB_UCSZ2)]
+                  + ((ucsrc & 0x20) ? 1 : 0) + ((ucsrc & 0x08) ? 2 : 1);
+    return uint64_t(ubrr + 1) * ((data[M8_UCSRA] & UCSRA_U2X) ? 8 : 16) * bits;
+}
+
+//----------------------------------------------------------------------
+static void uart_schedule_rx(SIM_t *sim)
+{
+    PERIPH_t *p = &sim->periph;
+    if(    (sim->data[M8_UCSRB] & UCSRB_RXEN) && p->rx_next < p->rx_data.size()
+        && !p->wheel.event[EV_UART_RX].queued )
+        wheel_schedule(&p->wheel, EV_UART_RX, sim->cycles + uart_frame(sim));
+}
+
+//----------------------------------------------------------------------
+static void uart_write_udr(SIM_t *sim, uint8_t value)
+{
+    PERIPH_t *p = &sim->periph;
+    if( !(sim->data[M8_UCSRB] & UCSRB_TXEN) )
+        return;
+    if( !p->tx_busy )
+    {
+        p->tx_shift = value;
+        p->tx_busy = true;
+        wheel_schedule(&p->wheel, EV_UART_TX, sim->cycles + uart_frame(sim));
+    }
+    else if( sim->data[M8_UCSRA] & UCSRA_UDRE )
+    {
+        p->tx_buffer = value;
+        sim->data[M8_UCSRA] &= ~UCSRA_UDRE;
+    }
+}
+
+//----------------------------------------------------------------------
+static void uart_event(SIM_t *sim, uint32_t id, uint64_t due)
+{
+    PERIPH_t *p = &sim->periph;
+    uint8_t *ucsra = &sim->data[M8_UCSRA];
+    if( id == EV_UART_TX )
+    {
+        p->tx_data.push_back(char(p->tx_shift));
+        if( !(*ucsra & UCSRA_UDRE) )
+        {
+            p->tx_shift = p->tx_buffer;
+            *ucsra |= UCSRA_UDRE;
+            wheel_schedule(&p->wheel, EV_UART_TX, due + uart_frame(sim));
+        }
+        else
+        {
+            p->tx_busy = false;
+            *ucsra |= UCSRA_TXC;
+        }
+        return;
+    }
+    // a byte nobody read yet is overwritten
+    if( *ucsra & UCSRA_RXC )
+        *ucsra |= UCSRA_DOR;
+    p->rx_udr = p->rx_data[p->rx_next++];
+    *ucsra |= UCSRA_RXC;
+    if( p->rx_next < p->rx_data.size() )
+        wheel_schedule(&p->wheel, EV_UART_RX, due + uart_frame(sim));
+}
+
+//----------------------------------------------------------------------
+static uint64_t adc_conversion(SIM_t *sim)
+{
+    uint32_t clocks = sim->periph.adc_first ? 25 : 13;
+    sim->periph.adc_first = false;
+    return uint64_t(clocks) * adc_prescale[sim->data[M8_ADCSRA] & 7];
+}
+
+//----------------------------------------------------------------------
+static void adc_write_adcsra(SIM_t *sim, uint8_t value)
+{
+    PERIPH_t *p = &sim->periph;
+    uint8_t old = sim->data[M8_ADCSRA];
+    uint8_t adif = (old & ADCSRA_ADIF) & ~(value & ADCSRA_ADIF);
+    uint8_t adsc = (old & ADCSRA_ADSC) | (value & ADCSRA_ADSC);
+    if( !(value & ADCSRA_ADEN) )
+    {
+        adsc = 0;
+        p->adc_first = true;
+        wheel_cancel(&p->wheel, EV_ADC);
+    }
+    sim->data[M8_ADCSRA] = uint8_t((value & ~(ADCSRA_ADIF | ADCSRA_ADSC)) | adif | adsc);
+    if( adsc && !p->wheel.event[EV_ADC].queued )
+        wheel_schedule(&p->wheel, EV_ADC, sim->cycles + adc_conversion(sim));
+}
+
+//----------------------------------------------------------------------
+static void adc_event(SIM_t *sim, uint64_t due)
+{
+    uint8_t *data = sim->data.data();
+    uint32_t result = sim->periph.adc_in[data[M8_ADMUX] & 0x0F] & 0x3FF;
+    if( data[M8_ADMUX] & ADMUX_ADLAR )
+        result <<= 6;
+    data[M8_ADCL] = uint8_t(result);
+    data[M8_ADCH] = uint8_t(result >> 8);
+    data[M8_ADCSRA] |= ADCSRA_ADIF;
+    if( data[M8_ADCSRA] & ADCSRA_ADFR )
+        wheel_schedule(&sim->periph.wheel, EV_ADC, due + adc_conversion(sim));
+    else
+        data[M8_ADCSRA] &= ~ADCSRA_ADSC;
+}
+
+//----------------------------------------------------------------------
+// EERE reads the byte at EEAR into EEDR at once, EEWE within 4 cycles of
+// EEMWE stores EEDR there and stays set while the write takes
+static void eeprom_write_eecr(SIM_t *sim, uint8_t value)
+{
+    PERIPH_t *p = &sim->periph;
+    uint8_t *data = sim->data.data();
+    uint8_t old = data[M8_EECR];
+    uint32_t addr = ((data[M8_EEARH] << 8) | data[M8_EEARL]) & uint32_t(sim->eeprom.size() - 1);
+    bool master = (old & EECR_EEMWE) && sim->cycles < p->ee_master_end;
+    uint8_t eecr = uint8_t((value & (EECR_EERIE | EECR_EEMWE)) | (old & EECR_EEWE));
+    if( (value & EECR_EEMWE) && !(old & EECR_EEMWE && master) )
+        p->ee_master_end = sim->cycles + M8_EE_MASTER_CYCLES;
+    if( (value & EECR_EEWE) && !(old & EECR_EEWE) && master )
+    {
+        sim->eeprom[addr] = data[M8_EEDR];
+        sim_mark_eeprom(sim, addr);
+        eecr = uint8_t((eecr | EECR_EEWE) & ~EECR_EEMWE);
+        wheel_schedule(&p->wheel, EV_EEPROM, sim->cycles + M8_EE_WRITE_CYCLES);
+    }
+    if( (value & EECR_EERE) && !(eecr & EECR_EEWE) )
+    {
+        data[M8_EEDR] = sim->eeprom[addr];
+        sim->cycles += M8_EE_READ_CYCLES;
+    }
+    data[M8_EECR] = eecr;
+}
+
+//----------------------------------------------------------------------
+// Hooks the modelled registers of the device, if it has models
+void periph_init(SIM_t *sim)
+{
+    static const uint8_t m8_read[] = { M8_UDR, M8_TCNT0, M8_TCNT1L, M8_TCNT1H, M8_TCNT2, M8_EECR };
+    static const uint8_t m8_write[] = {
+        M8_ADCSRA, M8_UBRRL, M8_UCSRB, M8_UCSRA, M8_UDR, M8_UBRRH, M8_OCR2, M8_TCNT2, M8_TCCR2,
+        M8_ICR1L, M8_ICR1H, M8_OCR1BL, M8_OCR1BH, M8_OCR1AL, M8_OCR1AH, M8_TCNT1L, M8_TCNT1H,
+        M8_TCCR1B, M8_TCCR1A, M8_TCNT0, M8_TCCR0, M8_TIFR, M8_TIMSK, M8_EECR, SIM_SREG
+    };
+    PERIPH_t *p = &sim->periph;
+    sim->hook.assign(sim->data.size(), 0);
+    wheel_init(&p->wheel, EV_COUNT);
+    p->rx_data.clear();
+    memset(p->adc_in, 0, sizeof(p->adc_in));
+    if( sim->device->periph_map != PERIPH_M8 )
+        return;
+    for( size_t i = 0; i < sizeof(m8_read); i++ )
+        sim->hook[m8_read[i]] |= HOOK_READ;
+    for( size_t i = 0; i < sizeof(m8_write); i++ )
+        sim->hook[m8_write[i]] |= HOOK_WRITE;
+}
+
+//----------------------------------------------------------------------
+// Power-on state, data[] is cleared already
+void periph_reset(SIM_t *sim)
+{
+    PERIPH_t *p = &sim->periph;
+    wheel_init(&p->wheel, EV_COUNT);
+    memset(p->timer, 0, sizeof(p->timer));
+    for( int i = 0; i < 3; i++ )
+    {
+        SIM_TIMER_t *t = &p->timer[i];
+        t->max = i == 1 ? 0xFFFF : 0xFF;
+        t->top = t->max;
+        t->wrap_event = i == 0 ? EV_TIMER0_WRAP : i == 1 ? EV_TIMER1_WRAP : EV_TIMER2_WRAP;
+        t->compare_event = i == 1 ? EV_TIMER1_COMPA : EV_TIMER2_COMP;
+        t->compares = i == 0 ? 0 : i == 1 ? 2 : 1;
+    }
+    p->timer[1].ocf[0] = 0x10;
+    p->timer[1].ocf[1] = 0x08;
+    p->timer[2].ocf[0] = 0x80;
+    p->temp = 0;
+    p->ucsrc = 0x86;
+    p->tx_busy = false;
+    p->rx_udr = 0;
+    p->rx_next = 0;
+    p->tx_data.clear();
+    p->adc_first = true;
+    p->ee_master_end = 0;
+    if( sim->device->periph_map == PERIPH_M8 )
+        sim->data[M8_UCSRA] = UCSRA_UDRE;
+}
+
+//----------------------------------------------------------------------
+// Read of a HOOK_READ register
+uint8_t periph_read(SIM_t *sim, uint32_t addr)
+{
+    PERIPH_t *p = &sim->periph;
+    switch( addr ) {
+    case M8_UDR:
+        sim->data[M8_UCSRA] &= ~(UCSRA_RXC | UCSRA_DOR);
+        return p->rx_udr;
+    case M8_TCNT0:
+        return uint8_t(timer_count(&p->timer[0], sim->cycles));
+    case M8_TCNT2:
+        return uint8_t(timer_count(&p->timer[2], sim->cycles));
+    case M8_TCNT1L:
+    {
+        uint32_t count = timer_count(&p->timer[1], sim->cycles);
+        p->temp = uint8_t(count >> 8);
+        return uint8_t(count);
+    }
+    case M8_TCNT1H:
+        return p->temp;
+    case M8_EECR:
+        if( sim->cycles >= p->ee_master_end )
+            sim->data[M8_EECR] &= ~EECR_EEMWE;
+        break;
+    }
+    return sim->data[addr];
+}
+
+//----------------------------------------------------------------------
+// Write of a HOOK_WRITE register. Anything that may make an interrupt
+// pending or enabled ends the run loop after this instruction, so the
+// scheduler gets to look at it.
+void periph_write(SIM_t *sim, uint32_t addr, uint8_t value)
+{
+    PERIPH_t *p = &sim->periph;
+    uint8_t *data = sim->data.data();
+    switch( addr ) {
+    case M8_TIFR:
+        data[addr] &= uint8_t(~value);
+        return;
+    case M8_UCSRA:
+        data[addr] = uint8_t((data[addr] & ~(UCSRA_TXC | UCSRA_U2X | UCSRA_MPCM) & ~(value & UCSRA_TXC))
+                             | (value & (UCSRA_U2X | UCSRA_MPCM)));
+        return;
+    case M8_UDR:
+        uart_write_udr(sim, value);
+        break;
+    case M8_UBRRH:
+        if( value & 0x80 )
+            p->ucsrc = value;
+        else
+            data[addr] = value;
+        return;
+    case M8_ADCSRA:
+        adc_write_adcsra(sim, value);
+        break;
+    case M8_EECR:
+        eeprom_write_eecr(sim, value);
+        break;
+    case M8_TCNT0:
+        data[addr] = value;
+        p->timer[0].count = value;
+        p->timer[0].base = sim->cycles;
+        timer_rebase(sim, &p->timer[0]);
+        return;
+    case M8_TCNT2:
+        data[addr] = value;
+        p->timer[2].count = value;
+        p->timer[2].base = sim->cycles;
+        timer_rebase(sim, &p->timer[2]);
+        return;
+    case M8_TCCR0:
+        data[addr] = value;
+        timer_setup(sim, 0);
+        return;
+    case M8_TCCR2:
+    case M8_OCR2:
+        data[addr] = value;
+        timer_setup(sim, 2);
+        return;
+    case M8_TCNT1H:
+    case M8_OCR1AH:
+    case M8_OCR1BH:
+    case M8_ICR1H:
+        p->temp = value;
+        return;
+    case M8_TCNT1L:
+        p->timer[1].count = uint32_t(value | (p->temp << 8));
+        p->timer[1].base = sim->cycles;
+        timer_rebase(sim, &p->timer[1]);
+        return;
+    case M8_OCR1AL:
+    case M8_OCR1BL:
+    case M8_ICR1L:
+        data[addr] = value;
+        data[addr + 1] = p->temp;
+        timer_setup(sim, 1);
+        return;
+    case M8_TCCR1A:
+    case M8_TCCR1B:
+        data[addr] = value;
+        timer_setup(sim, 1);
+        return;
+    default:
+        data[addr] = value;
+        break;
+    }
+    if( addr == M8_UCSRB )
+        uart_schedule_rx(sim);
+    sim_request_update(sim);
+}
+
+//----------------------------------------------------------------------
+// Fires every event due by now, then returns the vector of the pending
+// interrupt to take, 0 if none or interrupts are disabled
+uint32_t periph_update(SIM_t *sim)
+{
+    PERIPH_t *p = &sim->periph;
+    uint32_t id;
+    while( (id = wheel_pop(&p->wheel, sim->cycles)) != WHEEL_NONE )
+    {
+        uint64_t due = p->wheel.event[id].due;
+        switch( id ) {
+        case EV_TIMER0_WRAP:
+            timer_event(sim, &p->timer[0], id, due);
+            break;
+        case EV_TIMER1_WRAP:
+        case EV_TIMER1_COMPA:
+        case EV_TIMER1_COMPB:
+            timer_event(sim, &p->timer[1], id, due);
+            break;
+        case EV_TIMER2_WRAP:
+        case EV_TIMER2_COMP:
+            timer_event(sim, &p->timer[2], id, due);
+            break;
+        case EV_UART_TX:
+        case EV_UART_RX:
+            uart_event(sim, id, due);
+            break;
+        case EV_ADC:
+            adc_event(sim, due);
+            break;
+        case EV_EEPROM:
+            sim->data[M8_EECR] &= ~EECR_EEWE;
+            break;
+        }
+    }
+    if( sim->device->periph_map != PERIPH_M8 || !(sim->data[SIM_SREG] & SREG_I) )
+        return 0;
+    for( int i = 0; i < M8_IRQ_COUNT; i++ )
+    {
+        const IRQ_SOURCE_t *irq = &m8_irq[i];
+        if( (sim->data[irq->flag_addr] & irq->flag) && (sim->data[irq->enable_addr] & irq->enable) )
+        {
+            if( irq->auto_clear )
+                sim->data[irq->flag_addr] &= uint8_t(~irq->flag);
+            return irq->vector;
+        }
+    }
+    if( (sim->data[M8_EECR] & (EECR_EERIE | EECR_EEWE)) == EECR_EERIE )
+        return M8_EE_RDY_VECTOR;
+    return 0;
+}
+
+//----------------------------------------------------------------------
+// Whether sleep can end: interrupts on and a queued event whose interrupt
+// is enabled or may become so in a handler it leads to
+bool periph_can_wake(const SIM_t *sim)
+{
+    if( sim->device->periph_map != PERIPH_M8 || !(sim->data[SIM_SREG] & SREG_I) || sim->periph.wheel.queued == 0 )
+        return false;
+    for( int i = 0; i < M8_IRQ_COUNT; i++ )
+        if( sim->data[m8_irq[i].enable_addr] & m8_irq[i].enable )
+            return true;
+    return (sim->data[M8_EECR] & EECR_EERIE) != 0;
+}
+
+//----------------------------------------------------------------------
+// After sim_load_stimulus() mid-run: new USART bytes arrive from now on
+// if the receiver is on
+void periph_stimulus(SIM_t *sim)
+{
+    if( sim->device->periph_map == PERIPH_M8 )
+        uart_schedule_rx(sim);
+}
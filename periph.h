@@ -0,0 +1,100 @@
+#ifndef PERIPH_H
+#define PERIPH_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "wheel.h"
+
+// ATmega8 data space addresses of the modelled registers
+#define M8_ADCL     0x24
+#define M8_ADCH     0x25
+#define M8_ADCSRA   0x26
+#define M8_ADMUX    0x27
+#define M8_UBRRL    0x29
+#define M8_UCSRB    0x2A
+#define M8_UCSRA    0x2B
+#define M8_UDR      0x2C
+#define M8_EECR     0x3C
+#define M8_EEDR     0x3D
+#define M8_EEARL    0x3E
+#define M8_EEARH    0x3F
+#define M8_UBRRH    0x40    // UCSRC when written with bit 7 set
+#define M8_OCR2     0x43
+#define M8_TCNT2    0x44
+#define M8_TCCR2    0x45
+#define M8_ICR1L    0x46
+#define M8_ICR1H    0x47
+#define M8_OCR1BL   0x48
+#define M8_OCR1BH   0x49
+#define M8_OCR1AL   0x4A
+#define M8_OCR1AH   0x4B
+#define M8_TCNT1L   0x4C
+#define M8_TCNT1H   0x4D
+#define M8_TCCR1B   0x4E
+#define M8_TCCR1A   0x4F
+#define M8_TCNT0    0x52
+#define M8_TCCR0    0x53
+#define M8_TIFR     0x58
+#define M8_TIMSK    0x59
+
+// SIM_t hook[] bits
+#define HOOK_READ   0x01
+#define HOOK_WRITE  0x02
+
+// Wheel events
+enum {
+    EV_TIMER0_WRAP,
+    EV_TIMER1_WRAP, EV_TIMER1_COMPA, EV_TIMER1_COMPB,
+    EV_TIMER2_WRAP, EV_TIMER2_COMP,
+    EV_UART_TX,     // the byte in the shift register is out
+    EV_UART_RX,     // the next stimulus byte has arrived
+    EV_ADC,         // conversion done
+    EV_EEPROM,      // EEPROM write done
+    EV_COUNT
+};
+
+// Timer/counter. The count is not stepped, it follows from the cycles
+// since base; the wheel only holds the wrap and compare match events.
+typedef struct SIM_TIMER {
+    uint32_t prescale;      // cycles per count, 0 - stopped
+    uint32_t top;           // counts 0..top, then wraps to 0
+    uint32_t max;           // 0xFF or 0xFFFF, where a count above top wraps
+    uint32_t count;         // count at base
+    uint64_t base;          // cycle of a count step
+    uint32_t ocr[2];        // compare values
+    uint8_t compares;       // compare units
+    uint8_t wrap_flag;      // TIFR bit set on wrap, 0 - none (CTC)
+    uint8_t ocf[2];         // TIFR bits of the compare units
+    uint8_t wrap_event;     // EV_*
+    uint8_t compare_event;  // EV_* of unit 0, unit 1 follows
+} SIM_TIMER_t;
+
+typedef struct PERIPH {
+    EVENT_WHEEL_t wheel;
+    SIM_TIMER_t timer[3];
+    uint8_t temp;           // 16-bit register access latch of Timer1
+    uint8_t ucsrc;
+    uint8_t tx_shift;       // byte being sent
+    uint8_t tx_buffer;      // byte waiting in UDR, valid while UDRE is clear
+    bool tx_busy;
+    uint8_t rx_udr;         // received byte
+    std::vector<uint8_t> rx_data;   // stimulus bytes, arriving one frame apart
+    size_t rx_next;
+    std::string tx_data;    // bytes sent
+    uint16_t adc_in[16];    // stimulus per ADMUX channel
+    bool adc_first;         // next conversion is the 25 clock first one
+    uint64_t ee_master_end; // EEMWE reads as set up to this cycle
+} PERIPH_t;
+
+struct SIM;
+
+void periph_init(struct SIM *sim);
+void periph_reset(struct SIM *sim);
+uint8_t periph_read(struct SIM *sim, uint32_t addr);
+void periph_write(struct SIM *sim, uint32_t addr, uint8_t value);
+uint32_t periph_update(struct SIM *sim);
+bool periph_can_wake(const struct SIM *sim);
+void periph_stimulus(struct SIM *sim);
+
+#endif
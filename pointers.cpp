@@ -0,0 +1,486 @@
+#include <string.h>
+#include "math_utils.h"
+#include "cfg.h"
+#include "pointers.h"
+
+#define CARRY_UNKNOWN   (-1)
+
+#define REG_X           26
+#define REG_Y           28
+#define REG_Z           30
+
+// Constant state of r0..r31 and the carry flag. A register is either a
+// known constant or unknown, there is nothing in between, so merging two
+// paths only ever clears bits in known and a block can change state at
+// most 33 times.
+typedef struct REG_STATE {
+    uint32_t known;         // bit r set - value[r] is what r holds
+    int8_t carry;           // 0, 1 or CARRY_UNKNOWN
+    uint8_t value[32];
+} REG_STATE_t;
+
+//----------------------------------------------------------------------
+static void set_unknown(REG_STATE_t *s)
+{
+    s->known = 0;
+    s->carry = CARRY_UNKNOWN;
+}
+
+//----------------------------------------------------------------------
+static bool is_known(const REG_STATE_t *s, uint8_t reg)
+{
+    return (s->known >> reg) & 1;
+}
+
+//----------------------------------------------------------------------
+static void set_reg(REG_STATE_t *s, uint8_t reg, uint8_t value)
+{
+    s->known |= uint32_t(1) << reg;
+    s->value[reg] = value;
+}
+
+//----------------------------------------------------------------------
+static void clobber(REG_STATE_t *s, uint8_t reg)
+{
+    s->known &= ~(uint32_t(1) << reg);
+}
+
+//----------------------------------------------------------------------
+static void copy_reg(REG_STATE_t *s, uint8_t dst, uint8_t src)
+{
+    if( is_known(s, src) )
+        set_reg(s, dst, s->value[src]);
+    else
+        clobber(s, dst);
+}
+
+//----------------------------------------------------------------------
+static bool get_pair(const REG_STATE_t *s, uint8_t reg, uint16_t *value)
+{
+    if( ((s->known >> reg) & 3) != 3 )
+        return false;
+    *value = uint16_t(s->value[reg] | (s->value[reg + 1] << 8));
+    return true;
+}
+
+//----------------------------------------------------------------------
+static void set_pair(REG_STATE_t *s, uint8_t reg, uint16_t value)
+{
+    set_reg(s, reg, uint8_t(value));
+    set_reg(s, reg + 1, uint8_t(value >> 8));
+}
+
+//----------------------------------------------------------------------
+// Moves X, Y or Z by delta when it is known
+static void step_pair(REG_STATE_t *s, uint8_t reg, int delta)
+{
+    uint16_t value;
+    if( get_pair(s, reg, &value) )
+        set_pair(s, reg, uint16_t(value + delta));
+}
+
+//----------------------------------------------------------------------
+static uint8_t ptr_reg(uint8_t mode)
+{
+    return uint8_t(REG_X + 2 * (mode / 3));
+}
+
+//----------------------------------------------------------------------
+// Merges src into dst, returns true if dst lost anything
+static bool merge_state(REG_STATE_t *dst, const REG_STATE_t *src)
+{
+    uint32_t known = dst->known & src->known;
+    for( uint64_t both = known; both != 0; both &= both - 1 )
+    {
+        int reg = ctz64(both);
+        if( dst->value[reg] != src->value[reg] )
+            known &= ~(uint32_t(1) << reg);
+    }
+    int8_t carry = dst->carry == src->carry ? dst->carry : int8_t(CARRY_UNKNOWN);
+    bool changed = known != dst->known || carry != dst->carry;
+    dst->known = known;
+    dst->carry = carry;
+    return changed;
+}
+
+//----------------------------------------------------------------------
+// Effect of one instruction on the state. Only the arithmetic that
+// pointer setup uses is worked out, everything else that writes a
+// register makes it unknown. Calls may change any register.
+static void step(REG_STATE_t *s, const INSTR_t *instr)
+{
+    uint8_t d = instr->rd & 0x1F;
+    uint8_t r = instr->rr & 0x1F;
+    uint8_t k = uint8_t(instr->k);
+    int8_t carry = s->carry;
+    bool both = is_known(s, d) && is_known(s, r);
+    uint8_t a = s->value[d];
+    uint8_t b = s->value[r];
+    uint16_t pair;
+    s->carry = CARRY_UNKNOWN;
+    switch( instr->mnem ) {
+    case MN_LDI:
+        set_reg(s, d, k);
+        s->carry = carry;
+        break;
+    case MN_MOV:
+        copy_reg(s, d, r);
+        s->carry = carry;
+        break;
+    case MN_MOVW:
+        copy_reg(s, d, r);
+        copy_reg(s, d + 1, r + 1);
+        s->carry = carry;
+        break;
+    case MN_EOR:
+    case MN_AND:
+    case MN_OR:
+        if( instr->mnem == MN_EOR && d == r )
+            set_reg(s, d, 0);
+        else if( both )
+            set_reg(s, d, instr->mnem == MN_EOR ? a ^ b : instr->mnem == MN_AND ? a & b : a | b);
+        else
+            clobber(s, d);
+        s->carry = carry;
+        break;
+    case MN_SUB:
+    case MN_SBC:
+        if( d == r && instr->mnem == MN_SUB )
+        {
+            set_reg(s, d, 0);
+            s->carry = 0;
+        }
+        else if( both && (instr->mnem == MN_SUB || carry != CARRY_UNKNOWN) )
+        {
+            int c = instr->mnem == MN_SBC ? carry : 0;
+            set_reg(s, d, uint8_t(a - b - c));
+            s->carry = int8_t(a < b + c);
+        }
+        else
+            clobber(s, d);
+        break;
+    case MN_ADD:
+    case MN_ADC:
+        if( both && (instr->mnem == MN_ADD || carry != CARRY_UNKNOWN) )
+        {
+            int c = instr->mnem == MN_ADC ? carry : 0;
+            set_reg(s, d, uint8_t(a + b + c));
+            s->carry = int8_t(a + b + c > 0xFF);
+        }
+        else
+            clobber(s, d);
+        break;
+    case MN_SUBI:
+    case MN_SBCI:
+        if( is_known(s, d) && (instr->mnem == MN_SUBI || carry != CARRY_UNKNOWN) )
+        {
+            int c = instr->mnem == MN_SBCI ? carry : 0;
+            set_reg(s, d, uint8_t(a - k - c));
+            s->carry = int8_t(a < k + c);
+        }
+        else
+            clobber(s, d);
+        break;
+    case MN_ORI:
+    case MN_ANDI:
+        if( is_known(s, d) )
+            set_reg(s, d, instr->mnem == MN_ORI ? a | k : a & k);
+        s->carry = carry;
+        break;
+    case MN_ADIW:
+    case MN_SBIW:
+        if( get_pair(s, d, &pair) )
+        {
+            uint32_t value = instr->mnem == MN_ADIW ? pair + k : pair - k;
+            set_pair(s, d, uint16_t(value));
+            s->carry = int8_t(value > 0xFFFF);
+        }
+        else
+        {
+            clobber(s, d);
+            clobber(s, d + 1);
+        }
+        break;
+    case MN_INC:
+    case MN_DEC:
+    case MN_SWAP:
+        if( is_known(s, d) )
+        {
+            if( instr->mnem == MN_SWAP )
+                set_reg(s, d, uint8_t((a << 4) | (a >> 4)));
+            else
+                set_reg(s, d, instr->mnem == MN_INC ? a + 1 : a - 1);
+        }
+        s->carry = carry;
+        break;
+    case MN_COM:
+    case MN_NEG:
+        if( is_known(s, d) )
+        {
+            set_reg(s, d, instr->mnem == MN_COM ? uint8_t(~a) : uint8_t(-a));
+            s->carry = int8_t(instr->mnem == MN_COM || a != 0);
+        }
+        else
+            clobber(s, d);
+        break;
+    case MN_LD:
+    case MN_ST:
+        if( instr->rr % 3 == 1 )
+            step_pair(s, ptr_reg(instr->rr), 1);
+        else if( instr->rr % 3 == 2 )
+            step_pair(s, ptr_reg(instr->rr), -1);
+        if( instr->mnem == MN_LD )
+            clobber(s, d);
+        s->carry = carry;
+        break;
+    case MN_LPM:
+    case MN_ELPM:
+        if( instr->rr == PTR_Z_INC )
+            step_pair(s, REG_Z, 1);
+        clobber(s, d);
+        s->carry = carry;
+        break;
+    case MN_LDD:
+    case MN_LDS:
+    case MN_IN:
+    case MN_POP:
+    case MN_BLD:
+        clobber(s, d);
+        s->carry = carry;
+        break;
+    case MN_LPM_R0:
+    case MN_ELPM_R0:
+        clobber(s, 0);
+        s->carry = carry;
+        break;
+    case MN_MUL:
+        clobber(s, 0);
+        clobber(s, 1);
+        break;
+    case MN_SPM_ZP:
+        clobber(s, REG_Z);
+        clobber(s, REG_Z + 1);
+        s->carry = carry;
+        break;
+    case MN_SE:
+    case MN_CL:
+        // sec and clc, any other flag leaves the carry as it was
+        if( instr->rr == 0 )
+            s->carry = instr->mnem == MN_SE ? 1 : 0;
+        else
+            s->carry = carry;
+        break;
+    case MN_RCALL:
+    case MN_CALL:
+    case MN_ICALL:
+    case MN_EICALL:
+        set_unknown(s);
+        break;
+    case MN_LSL:
+    case MN_ROL:
+    case MN_ASR:
+    case MN_LSR:
+    case MN_ROR:
+        clobber(s, d);
+        break;
+    case MN_STD:
+    case MN_STS:
+    case MN_OUT:
+    case MN_PUSH:
+    case MN_SBI:
+    case MN_CBI:
+    case MN_NOP:
+    case MN_WDR:
+        s->carry = carry;
+        break;
+    }
+}
+
+//----------------------------------------------------------------------
+// Address the instruction at addr reads, writes or jumps to in state s,
+// false if it has none or it is not known
+static bool access_target(const DISASM_t *ctx, uint32_t addr, const REG_STATE_t *s, uint32_t *target)
+{
+    const INSTR_t *instr = &ctx->line[addr].instr;
+    uint16_t ptr;
+    switch( instr->mnem ) {
+    case MN_ICALL:
+    case MN_IJMP:
+    case MN_LPM:
+    case MN_LPM_R0:
+        if( !get_pair(s, REG_Z, &ptr) )
+            return false;
+        *target = ptr;
+        return true;
+    case MN_LD:
+    case MN_ST:
+        if( !get_pair(s, ptr_reg(instr->rr), &ptr) )
+            return false;
+        *target = uint16_t(instr->rr % 3 == 2 ? ptr - 1 : ptr);
+        return true;
+    case MN_LDD:
+    case MN_STD:
+        if( !get_pair(s, ptr_reg(instr->rr), &ptr) )
+            return false;
+        *target = uint16_t(ptr + instr->k);
+        return true;
+    }
+    return false;
+}
+
+//----------------------------------------------------------------------
+// Runs the block from state s, collecting the known accesses when found
+// is given
+static void walk_block(const DISASM_t *ctx, const CFG_t *cfg, uint32_t b, REG_STATE_t *s,
+                       std::vector<INDIRECT_t> *found)
+{
+    for( uint32_t addr = cfg->block_start[b]; addr <= cfg->block_last[b];
+         addr += instr_words(ctx->line[addr].instr.mnem) )
+    {
+        INDIRECT_t access;
+        if( found && access_target(ctx, addr, s, &access.target) )
+        {
+            access.addr = addr;
+            found->push_back(access);
+        }
+        step(s, &ctx->line[addr].instr);
+    }
+}
+
+//----------------------------------------------------------------------
+// Forward dataflow to a fixed point. Function entries and blocks nothing
+// jumps to start with every register unknown. Pending blocks sit in a
+// bitset that is swept in address order, which is close to reverse post
+// order for compiled code, so most blocks settle in one or two visits.
+static void propagate(const DISASM_t *ctx, const CFG_t *cfg, std::vector<REG_STATE_t> &in,
+                      std::vector<uint8_t> &reached)
+{
+    uint32_t block_count = cfg_block_count(cfg);
+    in.resize(block_count);
+    reached.assign(block_count, 0);
+    std::vector<uint64_t> pending((block_count + 63) / 64, 0);
+    bool any = false;
+    for( uint32_t b = 0; b < block_count; b++ )
+        if( (cfg->block_flags[b] & BLOCK_ENTRY) || cfg->pred_first[b] == cfg->pred_first[b + 1] )
+        {
+            set_unknown(&in[b]);
+            reached[b] = 1;
+            pending[b >> 6] |= uint64_t(1) << (b & 63);
+            any = true;
+        }
+    while( any )
+    {
+        any = false;
+        for( size_t w = 0; w < pending.size(); w++ )
+            while( pending[w] != 0 )
+            {
+                uint32_t b = uint32_t(w * 64 + ctz64(pending[w]));
+                pending[w] &= pending[w] - 1;
+                REG_STATE_t out = in[b];
+                walk_block(ctx, cfg, b, &out, nullptr);
+                for( uint32_t e = cfg->succ_first[b]; e < cfg->succ_first[b + 1]; e++ )
+                {
+                    uint32_t next = cfg->succ[e];
+                    bool changed;
+                    if( !reached[next] )
+                    {
+                        in[next] = out;
+                        reached[next] = 1;
+                        changed = true;
+                    }
+                    else
+                        changed = merge_state(&in[next], &out);
+                    if( changed )
+                    {
+                        pending[next >> 6] |= uint64_t(1) << (next & 63);
+                        any = true;
+                    }
+                }
+            }
+    }
+}
+
+//----------------------------------------------------------------------
+// Marks the lpm table at flash byte address table as data: from its
+// first word up to the next code, erased word or branch target
+static void mark_table(DISASM_t *ctx, uint32_t table)
+{
+    uint32_t end = ctx->code_words < ctx->flash_mask + 1 ? ctx->code_words : ctx->flash_mask + 1;
+    for( uint32_t addr = table >> 1; addr < end; addr++ )
+    {
+        if(    line_is(ctx, PLANE_VISITED, addr) || line_is(ctx, PLANE_DATA, addr)
+            || line_is(ctx, PLANE_ERASED, addr) || (line_is(ctx, PLANE_POINTED, addr) && addr != table >> 1) )
+            break;
+        line_set(ctx, PLANE_DATA, addr);
+    }
+}
+
+//----------------------------------------------------------------------
+// Constant propagation of the pointer registers over the CFG. Known Z at
+// an icall or ijmp queues the target as code, and the code it leads to
+// is decoded and analysed in the next round, until a round finds nothing
+// new or POINTER_MAX_ROUNDS is reached. The known addresses of the last
+// round go to ctx->indirect and lpm tables are marked as data. Chains
+// from resolved targets that run into a bad word are dropped.
+void track_pointers(DISASM_t *ctx, int jobs, POINTER_STATS_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    ctx->indirect.clear();
+    std::vector<INDIRECT_t> found;
+    std::vector<REG_STATE_t> in;
+    std::vector<uint8_t> reached;
+    CFG_t cfg;
+    for(;;)
+    {
+        build_cfg(ctx, &cfg, jobs);
+        propagate(ctx, &cfg, in, reached);
+        found.clear();
+        for( uint32_t b = 0; b < cfg_block_count(&cfg); b++ )
+            if( reached[b] )
+                walk_block(ctx, &cfg, b, &in[b], &found);
+        stats->rounds++;
+        for( size_t i = 0; i < found.size(); i++ )
+        {
+            uint8_t mnem = ctx->line[found[i].addr].instr.mnem;
+            uint32_t target = found[i].target;
+            if(    (mnem == MN_ICALL || mnem == MN_IJMP)
+                && (target >= ctx->line.size() || !line_is(ctx, PLANE_DECODED, target)) )
+                add_code_target(ctx, target);
+        }
+        if( ctx->origin_head == ctx->origin.size() )
+            break;
+        stats->dropped += decode_queued(ctx);
+        if( stats->rounds == POINTER_MAX_ROUNDS )
+            break;
+    }
+
+    for( size_t i = 0; i < found.size(); i++ )
+    {
+        uint8_t mnem = ctx->line[found[i].addr].instr.mnem;
+        if( (mnem == MN_ICALL || mnem == MN_IJMP) && found[i].target > ctx->flash_mask )
+            continue;
+        ctx->indirect.push_back(found[i]);
+        line_set(ctx, PLANE_RESOLVED, found[i].addr);
+        if( mnem == MN_LPM || mnem == MN_LPM_R0 )
+            mark_table(ctx, found[i].target);
+    }
+    count_pointers(ctx, stats);
+}
+
+//----------------------------------------------------------------------
+// Counts what track_pointers() left in ctx, also after a result cache
+// hit. rounds and dropped are not touched.
+void count_pointers(const DISASM_t *ctx, POINTER_STATS_t *stats)
+{
+    stats->jumps = 0;
+    stats->accesses = 0;
+    for( size_t i = 0; i < ctx->indirect.size(); i++ )
+    {
+        uint8_t mnem = ctx->line[ctx->indirect[i].addr].instr.mnem;
+        if( mnem == MN_ICALL || mnem == MN_IJMP )
+            stats->jumps++;
+        else
+            stats->accesses++;
+    }
+    stats->table_words = count_lines(ctx, PLANE_DATA);
+}
@@ -0,0 +1,22 @@
+#ifndef POINTERS_H
+#define POINTERS_H
+
+#include <stdint.h>
+#include "disasm.h"
+
+// Decode rounds track_pointers() runs at most, each one decodes the code
+// that newly resolved icall/ijmp targets lead to
+#define POINTER_MAX_ROUNDS 16
+
+typedef struct POINTER_STATS {
+    uint32_t rounds;
+    uint32_t jumps;         // icall/ijmp with a known target
+    uint32_t accesses;      // ld/st/ldd/std/lpm with a known address
+    uint32_t table_words;   // flash words marked as lpm data
+    uint32_t dropped;       // chains from resolved targets that did not decode
+} POINTER_STATS_t;
+
+void track_pointers(DISASM_t *ctx, int jobs, POINTER_STATS_t *stats);
+void count_pointers(const DISASM_t *ctx, POINTER_STATS_t *stats);
+
+#endif
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <algorithm>
+#include "profile.h"
+
+//----------------------------------------------------------------------
+static void block_totals(const DISASM_t *ctx, const CFG_t *cfg, const PROFILE_t *profile, uint32_t b,
+                         HOT_SPOT_t *spot)
+{
+    spot->index = b;
+    spot->count = profile->count[cfg->block_start[b]];
+    spot->instrs = 0;
+    spot->cycles = 0;
+    for( uint32_t addr = cfg->block_start[b]; addr <= cfg->block_last[b];
+         addr += instr_words(ctx->line[addr].instr.mnem) )
+    {
+        spot->instrs += profile->count[addr];
+        spot->cycles += profile->cycles[addr];
+    }
+}
+
+//----------------------------------------------------------------------
+// Executed functions and blocks, most cycles first. A function adds up
+// its own blocks, so a shared tail counts in every function that owns it.
+void find_hot_spots(const DISASM_t *ctx, const CFG_t *cfg, const PROFILE_t *profile,
+                    std::vector<HOT_SPOT_t> &funcs, std::vector<HOT_SPOT_t> &blocks)
+{
+    std::vector<HOT_SPOT_t> all(cfg_block_count(cfg));
+    blocks.clear();
+    for( uint32_t b = 0; b < cfg_block_count(cfg); b++ )
+    {
+        block_totals(ctx, cfg, profile, b, &all[b]);
+        if( all[b].instrs )
+            blocks.push_back(all[b]);
+    }
+    funcs.clear();
+    for( uint32_t f = 0; f < cfg_func_count(cfg); f++ )
+    {
+        HOT_SPOT_t spot;
+        spot.index = f;
+        spot.count = all[cfg->func_entry[f]].count;
+        spot.instrs = 0;
+        spot.cycles = 0;
+        for( uint32_t i = cfg->func_first[f]; i < cfg->func_first[f + 1]; i++ )
+        {
+            spot.instrs += all[cfg->func_block[i]].instrs;
+            spot.cycles += all[cfg->func_block[i]].cycles;
+        }
+        if( spot.instrs )
+            funcs.push_back(spot);
+    }
+    auto hotter = [](const HOT_SPOT_t &a, const HOT_SPOT_t &b) {
+        return a.cycles != b.cycles ? a.cycles > b.cycles : a.index < b.index;
+    };
+    std::sort(funcs.begin(), funcs.end(), hotter);
+    std::sort(blocks.begin(), blocks.end(), hotter);
+}
+
+//----------------------------------------------------------------------
+static void print_addr(FILE *f, const DISASM_t *ctx, uint32_t addr)
+{
+    std::vector<LABEL_t>::const_iterator it = std::lower_bound(
+        ctx->labels.begin(), ctx->labels.end(), addr,
+        [](const LABEL_t &label, uint32_t a) { return label.addr < a; });
+    if( it != ctx->labels.end() && it->addr == addr )
+        fprintf(f, "%s", it->name.c_str());
+    else
+        fprintf(f, "L_%X", addr);
+}
+
+//----------------------------------------------------------------------
+static void print_spot(FILE *f, const HOT_SPOT_t *spot, const char *count_name, uint64_t total)
+{
+    fprintf(f, " %s=%llu instrs=%llu cycles=%llu share=%.2f%%\n", count_name,
+            (unsigned long long)spot->count, (unsigned long long)spot->instrs,
+            (unsigned long long)spot->cycles, total ? 100.0 * spot->cycles / total : 0.0);
+}
+
+//----------------------------------------------------------------------
+// Text report of a profile run: a summary line, then one "func" record
+// per executed function and one "block" record per executed block, both
+// hottest first. start is where the run began.
+bool write_profile(const DISASM_t *ctx, const CFG_t *cfg, const PROFILE_t *profile, const SIM_t *sim,
+                   uint32_t start, const char *file_name)
+{
+    std::vector<HOT_SPOT_t> funcs, blocks;
+    find_hot_spots(ctx, cfg, profile, funcs, blocks);
+    FILE *fprof = fopen(file_name, "wt");
+    if( fprof == nullptr )
+        return false;
+    fprintf(fprof, "; %llu cycles, %llu instructions from ",
+            (unsigned long long)sim->cycles, (unsigned long long)sim->instrs);
+    print_addr(fprof, ctx, start);
+    fprintf(fprof, ", %s at ", sim_status_name(sim->status));
+    print_addr(fprof, ctx, sim->pc);
+    fputc('\n', fprof);
+    for( size_t i = 0; i < funcs.size(); i++ )
+    {
+        fputs("func ", fprof);
+        print_addr(fprof, ctx, cfg->block_start[cfg->func_entry[funcs[i].index]]);
+        print_spot(fprof, &funcs[i], "entries", sim->cycles);
+    }
+    for( size_t i = 0; i < blocks.size(); i++ )
+    {
+        fputs("block ", fprof);
+        print_addr(fprof, ctx, cfg->block_start[blocks[i].index]);
+        print_spot(fprof, &blocks[i], "runs", sim->cycles);
+    }
+    return fclose(fprof) == 0;
+}
@@ -0,0 +1,21 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include "cfg.h"
+#include "sim.h"
+
+// Executed block or function of a profile run
+typedef struct HOT_SPOT {
+    uint32_t index;         // CFG block or function
+    uint64_t count;         // runs of the block, entries of the function
+    uint64_t instrs;
+    uint64_t cycles;        // own instructions only, a call is the call instruction
+} HOT_SPOT_t;
+
+void find_hot_spots(const DISASM_t *ctx, const CFG_t *cfg, const PROFILE_t *profile,
+                    std::vector<HOT_SPOT_t> &funcs, std::vector<HOT_SPOT_t> &blocks);
+bool write_profile(const DISASM_t *ctx, const CFG_t *cfg, const PROFILE_t *profile, const SIM_t *sim,
+                   uint32_t start, const char *file_name);
+
+#endif
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "cfg.h"
+#include "signature.h"
+
+//----------------------------------------------------------------------
+static int hex_digit(char c)
+{
+    if( c >= '0' && c <= '9' )
+        return c - '0';
+    if( c >= 'a' && c <= 'f' )
+        return c - 'a' + 10;
+    if( c >= 'A' && c <= 'F' )
+        return c - 'A' + 10;
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// "name word word ...", see SIGNATURE_t for the words
+static bool parse_signature(char *p, SIGNATURE_t *sig)
+{
+    const char *space = " \t";
+    char *tok = strtok(p, space);
+    sig->name = tok;
+    while( (tok = strtok(nullptr, space)) != nullptr )
+    {
+        if( strlen(tok) != 4 || sig->word.size() == SIG_MAX_WORDS )
+            return false;
+        uint16_t word = 0, mask = 0;
+        for( int i = 0; i < 4; i++ )
+        {
+            word <<= 4;
+            mask <<= 4;
+            if( tok[i] == '.' )
+                continue;
+            int digit = hex_digit(tok[i]);
+            if( digit < 0 )
+                return false;
+            word |= uint16_t(digit);
+            mask |= 0xF;
+        }
+        sig->word.push_back(word);
+        sig->mask.push_back(mask);
+    }
+    sig->anchor = 0;
+    sig->anchor_words = 0;
+    for( uint32_t i = 0, run = 0; i < sig->word.size(); i++ )
+    {
+        run = sig->mask[i] == 0xFFFF ? run + 1 : 0;
+        if( run > sig->anchor_words )
+        {
+            sig->anchor = i + 1 - run;
+            sig->anchor_words = run;
+        }
+    }
+    return sig->anchor_words > 0;
+}
+
+//----------------------------------------------------------------------
+// Transition of the trie only, 0 if there is none as no edge leads back
+// to the root
+static uint32_t child(const SIG_DB_t *db, uint32_t s, uint16_t w)
+{
+    if( s == 0 )
+        return db->root_next[w];
+    std::unordered_map<uint64_t, uint32_t>::const_iterator it = db->next.find((uint64_t(s) << 16) | w);
+    return it == db->next.end() ? 0 : it->second;
+}
+
+//----------------------------------------------------------------------
+static uint32_t step(const SIG_DB_t *db, uint32_t s, uint16_t w)
+{
+    for( ;; )
+    {
+        uint32_t t = child(db, s, w);
+        if( t != 0 || s == 0 )
+            return t;
+        s = db->fail[s];
+    }
+}
+
+//----------------------------------------------------------------------
+// Trie of the anchors, then failure and dictionary links breadth first
+static void build_automaton(SIG_DB_t *db)
+{
+    db->root_next.assign(0x10000, 0);
+    db->next.clear();
+    std::vector<std::vector<uint32_t> > matches(1);
+    std::vector<std::vector<std::pair<uint16_t, uint32_t> > > children(1);
+    for( uint32_t i = 0; i < db->sig.size(); i++ )
+    {
+        const SIGNATURE_t *sig = &db->sig[i];
+        uint32_t s = 0;
+        for( uint32_t j = sig->anchor; j < sig->anchor + sig->anchor_words; j++ )
+        {
+            uint16_t w = sig->word[j];
+            uint32_t t = child(db, s, w);
+            if( t == 0 )
+            {
+                t = uint32_t(matches.size());
+                matches.resize(t + 1);
+                children.resize(t + 1);
+                children[s].push_back(std::make_pair(w, t));
+                if( s == 0 )
+                    db->root_next[w] = t;
+                else
+                    db->next[(uint64_t(s) << 16) | w] = t;
+            }
+            s = t;
+        }
+        matches[s].push_back(i);
+    }
+
+    uint32_t states = uint32_t(matches.size());
+    db->fail.assign(states, 0);
+    db->dict.assign(states, 0);
+    std::vector<uint32_t> queue(1, 0);
+    for( size_t head = 0; head < queue.size(); head++ )
+    {
+        uint32_t s = queue[head];
+        for( size_t c = 0; c < children[s].size(); c++ )
+        {
+            uint16_t w = children[s][c].first;
+            uint32_t t = children[s][c].second;
+            uint32_t f = s == 0 ? 0 : step(db, db->fail[s], w);
+            db->fail[t] = f;
+            db->dict[t] = matches[f].empty() ? db->dict[f] : f;
+            queue.push_back(t);
+        }
+    }
+
+    db->match_first.assign(1, 0);
+    db->match.clear();
+    for( uint32_t s = 0; s < states; s++ )
+    {
+        db->match.insert(db->match.end(), matches[s].begin(), matches[s].end());
+        db->match_first.push_back(uint32_t(db->match.size()));
+    }
+}
+
+//----------------------------------------------------------------------
+// Reads a signature file, one signature per line, ';' and '#' start a
+// comment. On failure error_line is the bad line, 0 if the file can't
+// be read.
+bool load_signatures(SIG_DB_t *db, const char *file_name, uint32_t *error_line)
+{
+    FILE *f = fopen(file_name, "rt");
+    *error_line = 0;
+    if( f == nullptr )
+        return false;
+    db->sig.clear();
+    std::vector<char> line(SIG_MAX_WORDS * 5 + 256);
+    char *buf = line.data();
+    bool ok = true;
+    while( ok && fgets(buf, int(line.size()), f) )
+    {
+        (*error_line)++;
+        size_t len = strlen(buf);
+        if( len == line.size() - 1 && buf[len - 1] != '\n' )
+            ok = false;
+        buf[strcspn(buf, ";#\r\n")] = 0;
+        char *p = buf + strspn(buf, " \t");
+        if( ok && *p != 0 )
+        {
+            db->sig.push_back(SIGNATURE_t());
+            ok = parse_signature(p, &db->sig.back());
+        }
+    }
+    fclose(f);
+    if( ok )
+        build_automaton(db);
+    return ok;
+}
+
+//----------------------------------------------------------------------
+// Runs the automaton once over the flash and names every unnamed
+// function entry where a full pattern matches, the longest one if
+// several do. A match inside a function is likely inlined code and is
+// left alone, as a code label there would split the function in two.
+// Returns the labels added.
+uint32_t match_signatures(const SIG_DB_t *db, DISASM_t *ctx)
+{
+    std::vector<std::pair<uint32_t, uint32_t> > found;     // start, signature
+    uint32_t s = 0;
+    for( uint32_t addr = 0; addr < ctx->code_words; addr++ )
+    {
+        s = step(db, s, ctx->code[addr]);
+        for( uint32_t m = db->match_first[s] < db->match_first[s + 1] ? s : db->dict[s]; m != 0; m = db->dict[m] )
+            for( uint32_t i = db->match_first[m]; i < db->match_first[m + 1]; i++ )
+            {
+                const SIGNATURE_t *sig = &db->sig[db->match[i]];
+                uint32_t before = sig->anchor + sig->anchor_words - 1;
+                if( addr < before )
+                    continue;
+                uint32_t start = addr - before;
+                bool same = true;
+                for( uint32_t j = 0; j < sig->word.size() && same; j++ )
+                    same = ((code_word(ctx, start + j) ^ sig->word[j]) & sig->mask[j]) == 0;
+                if( same )
+                    found.push_back(std::make_pair(start, db->match[i]));
+            }
+    }
+
+    std::sort(found.begin(), found.end(),
+              [db](const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b) {
+                  if( a.first != b.first )
+                      return a.first < b.first;
+                  if( db->sig[a.second].word.size() != db->sig[b.second].word.size() )
+                      return db->sig[a.second].word.size() > db->sig[b.second].word.size();
+                  return a.second < b.second;
+              });
+    std::vector<uint32_t> entries;
+    cfg_entries(ctx, entries);
+    size_t named = ctx->labels.size();
+    size_t old_label = 0;
+    for( size_t i = 0; i < found.size(); i++ )
+    {
+        uint32_t start = found[i].first;
+        if( i > 0 && found[i - 1].first == start )
+            continue;
+        if( !std::binary_search(entries.begin(), entries.end(), start) )
+            continue;
+        while( old_label < named && ctx->labels[old_label].addr < start )
+            old_label++;
+        if( old_label < named && ctx->labels[old_label].addr == start )
+            continue;
+        LABEL_t label;
+        label.addr = start;
+        label.code = true;
+        label.name = db->sig[found[i].second].name;
+        ctx->labels.push_back(label);
+    }
+    uint32_t added = uint32_t(ctx->labels.size() - named);
+    std::stable_sort(ctx->labels.begin(), ctx->labels.end(),
+                     [](const LABEL_t &a, const LABEL_t &b) { return a.addr < b.addr; });
+    return added;
+}
@@ -0,0 +1,41 @@
+#ifndef SIGNATURE_H
+#define SIGNATURE_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "disasm.h"
+
+// Longest pattern a signature file may hold, in words
+#define SIG_MAX_WORDS   512
+
+// Library routine as a masked word pattern. Each word is written as four
+// hex digits of the opcode value, a '.' digit matches anything there,
+// e.g. "940E ...." is a call to anywhere.
+typedef struct SIGNATURE {
+    std::string name;
+    std::vector<uint16_t> word;
+    std::vector<uint16_t> mask;     // bits that must match
+    uint32_t anchor;                // longest run of unmasked words, the automaton key
+    uint32_t anchor_words;
+} SIGNATURE_t;
+
+// Aho-Corasick automaton over flash words built from the signature
+// anchors. One pass over the image finds every anchor, only those hits
+// are checked against the full masked pattern. Root transitions are a
+// flat table since most words of an image start nothing.
+typedef struct SIG_DB {
+    std::vector<SIGNATURE_t> sig;
+    std::vector<uint32_t> root_next;                // word -> state
+    std::unordered_map<uint64_t, uint32_t> next;    // state << 16 | word -> state, below the root
+    std::vector<uint32_t> fail;
+    std::vector<uint32_t> dict;                     // nearest suffix state with matches, 0 - none
+    std::vector<uint32_t> match_first;              // CSR: signatures whose anchor ends in a state
+    std::vector<uint32_t> match;
+} SIG_DB_t;
+
+bool load_signatures(SIG_DB_t *db, const char *file_name, uint32_t *error_line);
+uint32_t match_signatures(const SIG_DB_t *db, DISASM_t *ctx);
+
+#endif
@@ -0,0 +1,1203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "sim.h"
+#include "jit.h"
+
+#define SREG_ARITH  (SREG_H | SREG_S | SREG_V | SREG_N | SREG_Z | SREG_C)
+#define SREG_LOGIC  (SREG_S | SREG_V | SREG_N | SREG_Z)
+
+//----------------------------------------------------------------------
+static inline uint8_t *reg(SIM_t *sim)
+{
+    return sim->data.data();
+}
+
+//----------------------------------------------------------------------
+static inline uint8_t &sreg(SIM_t *sim)
+{
+    return sim->data[SIM_SREG];
+}
+
+//----------------------------------------------------------------------
+static inline void set_flags(SIM_t *sim, uint8_t mask, uint8_t flags)
+{
+    sreg(sim) = uint8_t((sreg(sim) & ~mask) | flags);
+}
+
+//----------------------------------------------------------------------
+// Addresses past RAMEND read as 0 and ignore writes
+static inline uint8_t read_data(SIM_t *sim, uint32_t addr)
+{
+    if( addr >= sim->data.size() )
+        return 0;
+    return (sim->hook[addr] & HOOK_READ) ? periph_read(sim, addr) : sim->data[addr];
+}
+
+//----------------------------------------------------------------------
+static inline void write_data(SIM_t *sim, uint32_t addr, uint8_t value)
+{
+    if( addr >= sim->data.size() )
+        return;
+    sim_mark_data(sim, addr);
+    if( sim->hook[addr] & HOOK_WRITE )
+        periph_write(sim, addr, value);
+    else
+        sim->data[addr] = value;
+}
+
+//----------------------------------------------------------------------
+// I/O space of in/out/cbi/sbi/sbic/sbis, always inside data[]
+static inline uint8_t read_io(SIM_t *sim, uint8_t io)
+{
+    uint32_t addr = 0x20u + io;
+    return (sim->hook[addr] & HOOK_READ) ? periph_read(sim, addr) : sim->data[addr];
+}
+
+//----------------------------------------------------------------------
+static inline void write_io(SIM_t *sim, uint8_t io, uint8_t value)
+{
+    uint32_t addr = 0x20u + io;
+    if( sim->hook[addr] & HOOK_WRITE )
+        periph_write(sim, addr, value);
+    else
+        sim->data[addr] = value;
+}
+
+//----------------------------------------------------------------------
+static inline uint8_t read_flash(SIM_t *sim, uint32_t byte_addr)
+{
+    uint32_t word = byte_addr >> 1;
+    uint16_t value = word < sim->flash_words ? sim->flash[word] : 0xFFFF;
+    return uint8_t((byte_addr & 1) ? value >> 8 : value);
+}
+
+//----------------------------------------------------------------------
+static inline uint16_t get_pair(SIM_t *sim, uint8_t r)
+{
+    return uint16_t(reg(sim)[r] | (reg(sim)[r + 1] << 8));
+}
+
+//----------------------------------------------------------------------
+static inline void set_pair(SIM_t *sim, uint8_t r, uint16_t value)
+{
+    reg(sim)[r] = uint8_t(value);
+    reg(sim)[r + 1] = uint8_t(value >> 8);
+}
+
+//----------------------------------------------------------------------
+static inline void push8(SIM_t *sim, uint8_t value)
+{
+    uint16_t sp = get_pair(sim, SIM_SPL);
+    write_data(sim, sp, value);
+    set_pair(sim, SIM_SPL, uint16_t(sp - 1));
+}
+
+//----------------------------------------------------------------------
+static inline uint8_t pop8(SIM_t *sim)
+{
+    uint16_t sp = uint16_t(get_pair(sim, SIM_SPL) + 1);
+    set_pair(sim, SIM_SPL, sp);
+    return read_data(sim, sp);
+}
+
+//----------------------------------------------------------------------
+// Return address, low byte pushed first so it ends up big endian
+static inline void push_pc(SIM_t *sim, uint32_t pc)
+{
+    push8(sim, uint8_t(pc));
+    push8(sim, uint8_t(pc >> 8));
+    if( sim->pc22 )
+        push8(sim, uint8_t(pc >> 16));
+}
+
+//----------------------------------------------------------------------
+static inline uint32_t pop_pc(SIM_t *sim)
+{
+    uint32_t pc = 0;
+    if( sim->pc22 )
+        pc = uint32_t(pop8(sim)) << 16;
+    pc |= uint32_t(pop8(sim)) << 8;
+    pc |= pop8(sim);
+    return pc & sim->flash_mask;
+}
+
+//----------------------------------------------------------------------
+static inline uint8_t sign_flag(uint8_t flags)
+{
+    return ((flags & SREG_N) != 0) != ((flags & SREG_V) != 0) ? SREG_S : 0;
+}
+
+//----------------------------------------------------------------------
+static inline uint8_t add_flags(uint8_t d, uint8_t r, uint8_t res)
+{
+    uint8_t carry = uint8_t((d & r) | (r & ~res) | (~res & d));
+    uint8_t flags = 0;
+    if( carry & 0x08 )
+        flags |= SREG_H;
+    if( carry & 0x80 )
+        flags |= SREG_C;
+    if( (d & r & ~res & 0x80) || (~d & ~r & res & 0x80) )
+        flags |= SREG_V;
+    if( res & 0x80 )
+        flags |= SREG_N;
+    if( res == 0 )
+        flags |= SREG_Z;
+    return flags | sign_flag(flags);
+}
+
+//----------------------------------------------------------------------
+// With keep_z (sbc, sbci, cpc) Z only stays set, so multi-byte compares
+// work
+static inline uint8_t sub_flags(SIM_t *sim, uint8_t d, uint8_t r, uint8_t res, bool keep_z)
+{
+    uint8_t borrow = uint8_t((~d & r) | (r & res) | (res & ~d));
+    uint8_t flags = 0;
+    if( borrow & 0x08 )
+        flags |= SREG_H;
+    if( borrow & 0x80 )
+        flags |= SREG_C;
+    if( (d & ~r & ~res & 0x80) || (~d & r & res & 0x80) )
+        flags |= SREG_V;
+    if( res & 0x80 )
+        flags |= SREG_N;
+    if( res == 0 && (!keep_z || (sreg(sim) & SREG_Z)) )
+        flags |= SREG_Z;
+    return flags | sign_flag(flags);
+}
+
+//----------------------------------------------------------------------
+static inline uint8_t logic_flags(uint8_t res)
+{
+    uint8_t flags = 0;
+    if( res & 0x80 )
+        flags |= SREG_N | SREG_S;
+    if( res == 0 )
+        flags |= SREG_Z;
+    return flags;
+}
+
+//----------------------------------------------------------------------
+static inline void next(SIM_t *sim, const SIM_OP_t *op, uint32_t cycles)
+{
+    sim->pc += op->words;
+    sim->cycles += cycles;
+}
+
+//----------------------------------------------------------------------
+static inline void jump(SIM_t *sim, uint32_t pc, uint32_t cycles)
+{
+    sim->pc = pc & sim->flash_mask;
+    sim->cycles += cycles;
+}
+
+//----------------------------------------------------------------------
+static inline void stop(SIM_t *sim, int status)
+{
+    sim->status = status;
+    sim->stop_cycles = 0;
+}
+
+//----------------------------------------------------------------------
+// Not an instruction: stops with pc on the word, which does not count
+static void exec_bad(SIM_t *sim, const SIM_OP_t *)
+{
+    sim->instrs--;
+    stop(sim, SIM_BAD_OPCODE);
+}
+
+//----------------------------------------------------------------------
+// Behind the last flash word, running on wraps to 0
+static void exec_wrap(SIM_t *sim, const SIM_OP_t *)
+{
+    sim->instrs--;
+    sim->pc -= sim->flash_mask + 1;
+}
+
+//----------------------------------------------------------------------
+static void exec_nop(SIM_t *sim, const SIM_OP_t *op)
+{
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_movw(SIM_t *sim, const SIM_OP_t *op)
+{
+    reg(sim)[op->rd] = reg(sim)[op->rr];
+    reg(sim)[op->rd + 1] = reg(sim)[op->rr + 1];
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_add(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t d = reg(sim)[op->rd];
+    uint8_t r = reg(sim)[op->rr];
+    uint8_t res = uint8_t(d + r);
+    reg(sim)[op->rd] = res;
+    set_flags(sim, SREG_ARITH, add_flags(d, r, res));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_adc(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t d = reg(sim)[op->rd];
+    uint8_t r = reg(sim)[op->rr];
+    uint8_t res = uint8_t(d + r + (sreg(sim) & SREG_C));
+    reg(sim)[op->rd] = res;
+    set_flags(sim, SREG_ARITH, add_flags(d, r, res));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_sub(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t d = reg(sim)[op->rd];
+    uint8_t r = reg(sim)[op->rr];
+    uint8_t res = uint8_t(d - r);
+    reg(sim)[op->rd] = res;
+    set_flags(sim, SREG_ARITH, sub_flags(sim, d, r, res, false));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_sbc(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t d = reg(sim)[op->rd];
+    uint8_t r = reg(sim)[op->rr];
+    uint8_t res = uint8_t(d - r - (sreg(sim) & SREG_C));
+    reg(sim)[op->rd] = res;
+    set_flags(sim, SREG_ARITH, sub_flags(sim, d, r, res, true));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_cp(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t d = reg(sim)[op->rd];
+    uint8_t r = reg(sim)[op->rr];
+    set_flags(sim, SREG_ARITH, sub_flags(sim, d, r, uint8_t(d - r), false));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_cpc(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t d = reg(sim)[op->rd];
+    uint8_t r = reg(sim)[op->rr];
+    uint8_t res = uint8_t(d - r - (sreg(sim) & SREG_C));
+    set_flags(sim, SREG_ARITH, sub_flags(sim, d, r, res, true));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_subi(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t d = reg(sim)[op->rd];
+    uint8_t k = uint8_t(op->k);
+    uint8_t res = uint8_t(d - k);
+    reg(sim)[op->rd] = res;
+    set_flags(sim, SREG_ARITH, sub_flags(sim, d, k, res, false));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_sbci(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t d = reg(sim)[op->rd];
+    uint8_t k = uint8_t(op->k);
+    uint8_t res = uint8_t(d - k - (sreg(sim) & SREG_C));
+    reg(sim)[op->rd] = res;
+    set_flags(sim, SREG_ARITH, sub_flags(sim, d, k, res, true));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_cpi(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t d = reg(sim)[op->rd];
+    uint8_t k = uint8_t(op->k);
+    set_flags(sim, SREG_ARITH, sub_flags(sim, d, k, uint8_t(d - k), false));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_and(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t res = reg(sim)[op->rd] & reg(sim)[op->rr];
+    reg(sim)[op->rd] = res;
+    set_flags(sim, SREG_LOGIC, logic_flags(res));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_or(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t res = reg(sim)[op->rd] | reg(sim)[op->rr];
+    reg(sim)[op->rd] = res;
+    set_flags(sim, SREG_LOGIC, logic_flags(res));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_eor(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t res = reg(sim)[op->rd] ^ reg(sim)[op->rr];
+    reg(sim)[op->rd] = res;
+    set_flags(sim, SREG_LOGIC, logic_flags(res));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_andi(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t res = reg(sim)[op->rd] & uint8_t(op->k);
+    reg(sim)[op->rd] = res;
+    set_flags(sim, SREG_LOGIC, logic_flags(res));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_ori(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t res = reg(sim)[op->rd] | uint8_t(op->k);
+    reg(sim)[op->rd] = res;
+    set_flags(sim, SREG_LOGIC, logic_flags(res));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_mov(SIM_t *sim, const SIM_OP_t *op)
+{
+    reg(sim)[op->rd] = reg(sim)[op->rr];
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_ldi(SIM_t *sim, const SIM_OP_t *op)
+{
+    reg(sim)[op->rd] = uint8_t(op->k);
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_com(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t res = uint8_t(~reg(sim)[op->rd]);
+    reg(sim)[op->rd] = res;
+    set_flags(sim, SREG_LOGIC | SREG_C, logic_flags(res) | SREG_C);
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_neg(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t d = reg(sim)[op->rd];
+    uint8_t res = uint8_t(0 - d);
+    reg(sim)[op->rd] = res;
+    set_flags(sim, SREG_ARITH, sub_flags(sim, 0, d, res, false));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_swap(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t d = reg(sim)[op->rd];
+    reg(sim)[op->rd] = uint8_t((d << 4) | (d >> 4));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_inc(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t res = uint8_t(reg(sim)[op->rd] + 1);
+    reg(sim)[op->rd] = res;
+    uint8_t flags = logic_flags(res) & ~SREG_S;
+    if( res == 0x80 )
+        flags |= SREG_V;
+    set_flags(sim, SREG_LOGIC, flags | sign_flag(flags));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_dec(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t res = uint8_t(reg(sim)[op->rd] - 1);
+    reg(sim)[op->rd] = res;
+    uint8_t flags = logic_flags(res) & ~SREG_S;
+    if( res == 0x7F )
+        flags |= SREG_V;
+    set_flags(sim, SREG_LOGIC, flags | sign_flag(flags));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+// asr, lsr and ror: the bit shifted out goes to C, V = N ^ C
+static inline void shift_right(SIM_t *sim, const SIM_OP_t *op, uint8_t top)
+{
+    uint8_t d = reg(sim)[op->rd];
+    uint8_t res = uint8_t((d >> 1) | top);
+    reg(sim)[op->rd] = res;
+    uint8_t flags = logic_flags(res) & ~SREG_S;
+    if( d & 1 )
+        flags |= SREG_C;
+    if( ((flags & SREG_N) != 0) != ((flags & SREG_C) != 0) )
+        flags |= SREG_V;
+    set_flags(sim, SREG_LOGIC | SREG_C, flags | sign_flag(flags));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_asr(SIM_t *sim, const SIM_OP_t *op)
+{
+    shift_right(sim, op, reg(sim)[op->rd] & 0x80);
+}
+
+//----------------------------------------------------------------------
+static void exec_lsr(SIM_t *sim, const SIM_OP_t *op)
+{
+    shift_right(sim, op, 0);
+}
+
+//----------------------------------------------------------------------
+static void exec_ror(SIM_t *sim, const SIM_OP_t *op)
+{
+    shift_right(sim, op, (sreg(sim) & SREG_C) ? 0x80 : 0);
+}
+
+//----------------------------------------------------------------------
+static void exec_adiw(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint16_t d = get_pair(sim, op->rd);
+    uint16_t res = uint16_t(d + op->k);
+    set_pair(sim, op->rd, res);
+    uint8_t flags = 0;
+    if( !(d & 0x8000) && (res & 0x8000) )
+        flags |= SREG_V;
+    if( (d & 0x8000) && !(res & 0x8000) )
+        flags |= SREG_C;
+    if( res & 0x8000 )
+        flags |= SREG_N;
+    if( res == 0 )
+        flags |= SREG_Z;
+    set_flags(sim, SREG_LOGIC | SREG_C, flags | sign_flag(flags));
+    next(sim, op, 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_sbiw(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint16_t d = get_pair(sim, op->rd);
+    uint16_t res = uint16_t(d - op->k);
+    set_pair(sim, op->rd, res);
+    uint8_t flags = 0;
+    if( (d & 0x8000) && !(res & 0x8000) )
+        flags |= SREG_V;
+    if( !(d & 0x8000) && (res & 0x8000) )
+        flags |= SREG_C;
+    if( res & 0x8000 )
+        flags |= SREG_N;
+    if( res == 0 )
+        flags |= SREG_Z;
+    set_flags(sim, SREG_LOGIC | SREG_C, flags | sign_flag(flags));
+    next(sim, op, 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_mul(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint16_t res = uint16_t(reg(sim)[op->rd] * reg(sim)[op->rr]);
+    set_pair(sim, 0, res);
+    set_flags(sim, SREG_Z | SREG_C, (res == 0 ? SREG_Z : 0) | ((res & 0x8000) ? SREG_C : 0));
+    next(sim, op, 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_bst(SIM_t *sim, const SIM_OP_t *op)
+{
+    set_flags(sim, SREG_T, ((reg(sim)[op->rd] >> op->rr) & 1) ? SREG_T : 0);
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_bld(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t mask = uint8_t(1 << op->rr);
+    if( sreg(sim) & SREG_T )
+        reg(sim)[op->rd] |= mask;
+    else
+        reg(sim)[op->rd] &= uint8_t(~mask);
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_se(SIM_t *sim, const SIM_OP_t *op)
+{
+    sreg(sim) |= uint8_t(1 << op->rr);
+    next(sim, op, 1);
+    if( op->rr == 7 )
+        sim_request_update(sim);
+}
+
+//----------------------------------------------------------------------
+static void exec_cl(SIM_t *sim, const SIM_OP_t *op)
+{
+    sreg(sim) &= uint8_t(~(1 << op->rr));
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+// Pointer register of a PTR_* mode and its pre-decrement/post-increment
+static inline uint32_t pointer_access(SIM_t *sim, uint8_t mode)
+{
+    static const uint8_t ptr_reg[9] = { 26, 26, 26, 28, 28, 28, 30, 30, 30 };
+    uint8_t r = ptr_reg[mode];
+    uint16_t addr = get_pair(sim, r);
+    switch( mode ) {
+    case PTR_X_INC:
+    case PTR_Y_INC:
+    case PTR_Z_INC:
+        set_pair(sim, r, uint16_t(addr + 1));
+        break;
+    case PTR_X_DEC:
+    case PTR_Y_DEC:
+    case PTR_Z_DEC:
+        addr--;
+        set_pair(sim, r, addr);
+        break;
+    }
+    return addr;
+}
+
+//----------------------------------------------------------------------
+static void exec_ld(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint32_t addr = pointer_access(sim, op->rr);
+    reg(sim)[op->rd] = read_data(sim, addr);
+    next(sim, op, (op->rr == PTR_X_DEC || op->rr == PTR_Y_DEC || op->rr == PTR_Z_DEC) ? 3 : 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_st(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint8_t value = reg(sim)[op->rd];
+    write_data(sim, pointer_access(sim, op->rr), value);
+    next(sim, op, 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_ldd(SIM_t *sim, const SIM_OP_t *op)
+{
+    reg(sim)[op->rd] = read_data(sim, get_pair(sim, op->rr == PTR_Y ? 28 : 30) + op->k);
+    next(sim, op, 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_std(SIM_t *sim, const SIM_OP_t *op)
+{
+    write_data(sim, get_pair(sim, op->rr == PTR_Y ? 28 : 30) + op->k, reg(sim)[op->rd]);
+    next(sim, op, 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_lds(SIM_t *sim, const SIM_OP_t *op)
+{
+    reg(sim)[op->rd] = read_data(sim, op->k);
+    next(sim, op, 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_sts(SIM_t *sim, const SIM_OP_t *op)
+{
+    write_data(sim, op->k, reg(sim)[op->rd]);
+    next(sim, op, 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_lpm(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint16_t z = get_pair(sim, 30);
+    reg(sim)[op->rd] = read_flash(sim, z);
+    if( op->rr == PTR_Z_INC )
+        set_pair(sim, 30, uint16_t(z + 1));
+    next(sim, op, 3);
+}
+
+//----------------------------------------------------------------------
+static void exec_elpm(SIM_t *sim, const SIM_OP_t *op)
+{
+    uint32_t z = (uint32_t(sim->data[SIM_RAMPZ]) << 16) | get_pair(sim, 30);
+    reg(sim)[op->rd] = read_flash(sim, z);
+    if( op->rr == PTR_Z_INC )
+    {
+        z++;
+        set_pair(sim, 30, uint16_t(z));
+        sim->data[SIM_RAMPZ] = uint8_t(z >> 16);
+    }
+    next(sim, op, 3);
+}
+
+//----------------------------------------------------------------------
+static void exec_lpm_r0(SIM_t *sim, const SIM_OP_t *op)
+{
+    reg(sim)[0] = read_flash(sim, get_pair(sim, 30));
+    next(sim, op, 3);
+}
+
+//----------------------------------------------------------------------
+static void exec_elpm_r0(SIM_t *sim, const SIM_OP_t *op)
+{
+    reg(sim)[0] = read_flash(sim, (uint32_t(sim->data[SIM_RAMPZ]) << 16) | get_pair(sim, 30));
+    next(sim, op, 3);
+}
+
+//----------------------------------------------------------------------
+static void exec_push(SIM_t *sim, const SIM_OP_t *op)
+{
+    push8(sim, reg(sim)[op->rd]);
+    next(sim, op, 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_pop(SIM_t *sim, const SIM_OP_t *op)
+{
+    reg(sim)[op->rd] = pop8(sim);
+    next(sim, op, 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_in(SIM_t *sim, const SIM_OP_t *op)
+{
+    reg(sim)[op->rd] = read_io(sim, op->rr);
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_out(SIM_t *sim, const SIM_OP_t *op)
+{
+    write_io(sim, op->rr, reg(sim)[op->rd]);
+    next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_cbi(SIM_t *sim, const SIM_OP_t *op)
+{
+    write_io(sim, op->rd, read_io(sim, op->rd) & uint8_t(~(1 << op->rr)));
+    next(sim, op, 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_sbi(SIM_t *sim, const SIM_OP_t *op)
+{
+    write_io(sim, op->rd, read_io(sim, op->rd) | uint8_t(1 << op->rr));
+    next(sim, op, 2);
+}
+
+//----------------------------------------------------------------------
+// Skips take 1 cycle, 2 or 3 when they jump over a 1 or 2 word instruction
+static inline void skip_if(SIM_t *sim, const SIM_OP_t *op, bool cond)
+{
+    if( cond )
+    {
+        sim->pc += op->skip;
+        sim->cycles += op->skip;
+    }
+    else
+        next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_cpse(SIM_t *sim, const SIM_OP_t *op)
+{
+    skip_if(sim, op, reg(sim)[op->rd] == reg(sim)[op->rr]);
+}
+
+//----------------------------------------------------------------------
+static void exec_sbrc(SIM_t *sim, const SIM_OP_t *op)
+{
+    skip_if(sim, op, !((reg(sim)[op->rd] >> op->rr) & 1));
+}
+
+//----------------------------------------------------------------------
+static void exec_sbrs(SIM_t *sim, const SIM_OP_t *op)
+{
+    skip_if(sim, op, (reg(sim)[op->rd] >> op->rr) & 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_sbic(SIM_t *sim, const SIM_OP_t *op)
+{
+    skip_if(sim, op, !((read_io(sim, op->rd) >> op->rr) & 1));
+}
+
+//----------------------------------------------------------------------
+static void exec_sbis(SIM_t *sim, const SIM_OP_t *op)
+{
+    skip_if(sim, op, (read_io(sim, op->rd) >> op->rr) & 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_brbs(SIM_t *sim, const SIM_OP_t *op)
+{
+    if( (sreg(sim) >> op->rr) & 1 )
+        jump(sim, op->k, 2);
+    else
+        next(sim, op, 1);
+}
+
+//----------------------------------------------------------------------
+static void exec_brbc(SIM_t *sim, const SIM_OP_t *op)
+{
+    if( (sreg(sim) >> op->rr) & 1 )
+        next(sim, op, 1);
+    else
+        jump(sim, op->k, 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_rjmp(SIM_t *sim, const SIM_OP_t *op)
+{
+    jump(sim, op->k, 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_jmp(SIM_t *sim, const SIM_OP_t *op)
+{
+    jump(sim, op->k, 3);
+}
+
+//----------------------------------------------------------------------
+static void exec_ijmp(SIM_t *sim, const SIM_OP_t *)
+{
+    jump(sim, get_pair(sim, 30), 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_eijmp(SIM_t *sim, const SIM_OP_t *)
+{
+    jump(sim, (uint32_t(sim->data[SIM_EIND]) << 16) | get_pair(sim, 30), 2);
+}
+
+//----------------------------------------------------------------------
+static void exec_rcall(SIM_t *sim, const SIM_OP_t *op)
+{
+    push_pc(sim, sim->pc + 1);
+    jump(sim, op->k, sim->pc22 ? 4 : 3);
+}
+
+//----------------------------------------------------------------------
+static void exec_call(SIM_t *sim, const SIM_OP_t *op)
+{
+    push_pc(sim, sim->pc + 2);
+    jump(sim, op->k, sim->pc22 ? 5 : 4);
+}
+
+//----------------------------------------------------------------------
+static void exec_icall(SIM_t *sim, const SIM_OP_t *)
+{
+    push_pc(sim, sim->pc + 1);
+    jump(sim, get_pair(sim, 30), sim->pc22 ? 4 : 3);
+}
+
+//----------------------------------------------------------------------
+static void exec_eicall(SIM_t *sim, const SIM_OP_t *)
+{
+    push_pc(sim, sim->pc + 1);
+    jump(sim, (uint32_t(sim->data[SIM_EIND]) << 16) | get_pair(sim, 30), 4);
+}
+
+//----------------------------------------------------------------------
+static void exec_ret(SIM_t *sim, const SIM_OP_t *)
+{
+    jump(sim, pop_pc(sim), sim->pc22 ? 5 : 4);
+    if( get_pair(sim, SIM_SPL) == sim->exit_sp )
+        stop(sim, SIM_RETURNED);
+}
+
+//----------------------------------------------------------------------
+static void exec_reti(SIM_t *sim, const SIM_OP_t *)
+{
+    sreg(sim) |= SREG_I;
+    jump(sim, pop_pc(sim), sim->pc22 ? 5 : 4);
+    if( get_pair(sim, SIM_SPL) == sim->exit_sp )
+        stop(sim, SIM_RETURNED);
+    else
+        sim_request_update(sim);
+}
+
+//----------------------------------------------------------------------
+static void exec_sleep(SIM_t *sim, const SIM_OP_t *op)
+{
+    next(sim, op, 1);
+    stop(sim, SIM_SLEEP);
+}
+
+//----------------------------------------------------------------------
+static void exec_break(SIM_t *sim, const SIM_OP_t *op)
+{
+    next(sim, op, 1);
+    stop(sim, SIM_BREAK);
+}
+
+//----------------------------------------------------------------------
+static SIM_EXEC_t exec_for(uint8_t mnem)
+{
+    if( mnem >= MN_BRLO && mnem <= MN_BRIE )
+        return exec_brbs;
+    if( mnem >= MN_BRSH && mnem <= MN_BRID )
+        return exec_brbc;
+    switch( mnem ) {
+    case MN_NOP:        return exec_nop;
+    case MN_MOVW:       return exec_movw;
+    case MN_CPC:        return exec_cpc;
+    case MN_CP:         return exec_cp;
+    case MN_SBC:        return exec_sbc;
+    case MN_SUB:        return exec_sub;
+    case MN_ADD:        return exec_add;
+    case MN_LSL:        return exec_add;
+    case MN_ADC:        return exec_adc;
+    case MN_ROL:        return exec_adc;
+    case MN_CPSE:       return exec_cpse;
+    case MN_AND:        return exec_and;
+    case MN_EOR:        return exec_eor;
+    case MN_OR:         return exec_or;
+    case MN_MOV:        return exec_mov;
+    case MN_CPI:        return exec_cpi;
+    case MN_SBCI:       return exec_sbci;
+    case MN_SUBI:       return exec_subi;
+    case MN_ORI:        return exec_ori;
+    case MN_ANDI:       return exec_andi;
+    case MN_LDD:        return exec_ldd;
+    case MN_STD:        return exec_std;
+    case MN_LDS:        return exec_lds;
+    case MN_STS:        return exec_sts;
+    case MN_LD:         return exec_ld;
+    case MN_ST:         return exec_st;
+    case MN_LPM:        return exec_lpm;
+    case MN_ELPM:       return exec_elpm;
+    case MN_PUSH:       return exec_push;
+    case MN_POP:        return exec_pop;
+    case MN_COM:        return exec_com;
+    case MN_NEG:        return exec_neg;
+    case MN_SWAP:       return exec_swap;
+    case MN_INC:        return exec_inc;
+    case MN_ASR:        return exec_asr;
+    case MN_LSR:        return exec_lsr;
+    case MN_ROR:        return exec_ror;
+    case MN_SE:         return exec_se;
+    case MN_CL:         return exec_cl;
+    case MN_RET:        return exec_ret;
+    case MN_RETI:       return exec_reti;
+    case MN_SLEEP:      return exec_sleep;
+    case MN_BREAK:      return exec_break;
+    case MN_WDR:        return exec_nop;
+    case MN_LPM_R0:     return exec_lpm_r0;
+    case MN_ELPM_R0:    return exec_elpm_r0;
+    case MN_SPM:        return exec_nop;
+    case MN_SPM_ZP:     return exec_nop;
+    case MN_IJMP:       return exec_ijmp;
+    case MN_ICALL:      return exec_icall;
+    case MN_EIJMP:      return exec_eijmp;
+    case MN_EICALL:     return exec_eicall;
+    case MN_DEC:        return exec_dec;
+    case MN_JMP:        return exec_jmp;
+    case MN_CALL:       return exec_call;
+    case MN_ADIW:       return exec_adiw;
+    case MN_SBIW:       return exec_sbiw;
+    case MN_CBI:        return exec_cbi;
+    case MN_SBI:        return exec_sbi;
+    case MN_SBIC:       return exec_sbic;
+    case MN_SBIS:       return exec_sbis;
+    case MN_MUL:        return exec_mul;
+    case MN_IN:         return exec_in;
+    case MN_OUT:        return exec_out;
+    case MN_RJMP:       return exec_rjmp;
+    case MN_RCALL:      return exec_rcall;
+    case MN_LDI:        return exec_ldi;
+    case MN_BLD:        return exec_bld;
+    case MN_BST:        return exec_bst;
+    case MN_SBRC:       return exec_sbrc;
+    case MN_SBRS:       return exec_sbrs;
+    }
+    return exec_bad;
+}
+
+//----------------------------------------------------------------------
+// Predecodes the loaded image of ctx, which must stay loaded while the
+// simulator runs. spm and wdr run as nop.
+void sim_init(SIM_t *sim, const DISASM_t *ctx)
+{
+    std::vector<INSTR_t> instr;
+    predecode_flash(ctx, instr);
+    uint32_t words = ctx->flash_mask + 1;
+    sim->device = ctx->device;
+    sim->flash = ctx->code;
+    sim->flash_words = ctx->code_words;
+    sim->flash_mask = ctx->flash_mask;
+    sim->pc22 = words > 0x10000;
+    sim->op.resize(words + LINE_GUARD);
+    for( uint32_t addr = 0; addr < words; addr++ )
+    {
+        SIM_OP_t *op = &sim->op[addr];
+        op->exec = exec_for(instr[addr].mnem);
+        op->rd = instr[addr].rd;
+        op->rr = instr[addr].rr;
+        op->words = uint8_t(instr_words(instr[addr].mnem));
+        op->k = instr[addr].k;
+    }
+    for( uint32_t addr = words; addr < words + LINE_GUARD; addr++ )
+    {
+        memset(&sim->op[addr], 0, sizeof(SIM_OP_t));
+        sim->op[addr].exec = exec_wrap;
+    }
+    for( uint32_t addr = 0; addr < words; addr++ )
+        sim->op[addr].skip = uint8_t(1 + (addr + 1 < words ? sim->op[addr + 1].words : 1));
+    sim->data.resize(ctx->device->data_size);
+    sim->eeprom.assign(ctx->device->eeprom_size, 0xFF);
+    sim->dirty.assign(sim_data_pages(sim) + (sim->eeprom.size() + SIM_PAGE_SIZE - 1) / SIM_PAGE_SIZE, 1);
+    sim->synced = 0;
+    sim->snapshots = 0;
+    sim->profile = nullptr;
+    sim->jit = nullptr;
+    periph_init(sim);
+    sim_reset(sim);
+}
+
+//----------------------------------------------------------------------
+// Power-on state: registers, I/O and SRAM cleared, SP at RAMEND
+void sim_reset(SIM_t *sim)
+{
+    std::fill(sim->data.begin(), sim->data.end(), 0);
+    std::fill(sim->dirty.begin(), sim->dirty.begin() + sim_data_pages(sim), 1);
+    set_pair(sim, SIM_SPL, uint16_t(sim->data.size() - 1));
+    periph_reset(sim);
+    sim->pc = 0;
+    sim->cycles = 0;
+    sim->instrs = 0;
+    sim->stop_cycles = 0;
+    sim->exit_sp = SIM_NO_EXIT;
+    sim->status = SIM_RUNNING;
+}
+
+//----------------------------------------------------------------------
+// Interrupt response: return address pushed, I cleared, jump to the vector
+static void enter_vector(SIM_t *sim, uint32_t vector)
+{
+    push_pc(sim, sim->pc);
+    sreg(sim) &= uint8_t(~SREG_I);
+    sim->pc = (vector * sim->device->vector_words) & sim->flash_mask;
+    sim->cycles += sim->pc22 ? 5 : 4;
+}
+
+//----------------------------------------------------------------------
+// Enters the handler of an interrupt vector as if the request had just
+// been accepted. Its final reti ends the run with SIM_RETURNED.
+void sim_start_vector(SIM_t *sim, uint32_t vector)
+{
+    sim->exit_sp = get_pair(sim, SIM_SPL);
+    enter_vector(sim, vector);
+}
+
+//----------------------------------------------------------------------
+// Counts from now on go to profile, nullptr stops counting
+void sim_set_profile(SIM_t *sim, PROFILE_t *profile)
+{
+    sim->profile = profile;
+    if( profile )
+    {
+        profile->count.resize(sim->op.size());
+        profile->cycles.resize(sim->op.size());
+    }
+}
+
+//----------------------------------------------------------------------
+// One stimulus line, buf without its comment
+static bool parse_stimulus(SIM_t *sim, char *p)
+{
+    char *end;
+    if( strncmp(p, "uart", 4) == 0 && (p[4] == ' ' || p[4] == '\t') )
+    {
+        for( p += 4; *(p += strspn(p, " \t")) != 0; p = end )
+        {
+            unsigned long value = strtoul(p, &end, 0);
+            if( end == p || value > 0xFF )
+                return false;
+            sim->periph.rx_data.push_back(uint8_t(value));
+        }
+        return true;
+    }
+    if( strncmp(p, "eeprom", 6) == 0 && (p[6] == ' ' || p[6] == '\t') )
+    {
+        unsigned long addr = strtoul(p + 6, &end, 0);
+        if( end == p + 6 )
+            return false;
+        for( p = end; *(p += strspn(p, " \t")) != 0; p = end, addr++ )
+        {
+            unsigned long value = strtoul(p, &end, 0);
+            if( end == p || value > 0xFF || addr >= sim->eeprom.size() )
+                return false;
+            sim->eeprom[addr] = uint8_t(value);
+            sim_mark_eeprom(sim, uint32_t(addr));
+        }
+        return true;
+    }
+    if( strncmp(p, "adc", 3) == 0 && (p[3] == ' ' || p[3] == '\t') )
+    {
+        p += 3;
+        unsigned long channel = strtoul(p, &end, 0);
+        if( end == p || channel >= 16 )
+            return false;
+        unsigned long value = strtoul(p = end, &end, 0);
+        if( end == p || value > 0x3FF )
+            return false;
+        sim->periph.adc_in[channel] = uint16_t(value);
+        return end[strspn(end, " \t")] == 0;
+    }
+    unsigned long addr = strtoul(p, &end, 0);
+    if( end == p || addr >= sim->data.size() )
+        return false;
+    unsigned long value = strtoul(p = end, &end, 0);
+    if( end == p || value > 0xFF )
+        return false;
+    sim->data[addr] = uint8_t(value);
+    sim_mark_data(sim, uint32_t(addr));
+    return end[strspn(end, " \t")] == 0;
+}
+
+//----------------------------------------------------------------------
+// Stimulus file, one item per line:
+//   address value        preset a data space byte before the run
+//   uart byte...         bytes the USART receives, one frame apart
+//   adc channel value    10-bit result of conversions on that channel
+//   eeprom address byte...  EEPROM contents from address on
+// Numbers in C notation, text after ';' or '#' is a comment. Loaded
+// mid-run, USART bytes queue behind those not received yet.
+bool sim_load_stimulus(SIM_t *sim, const char *file_name, uint32_t *error_line)
+{
+    FILE *f = fopen(file_name, "rt");
+    *error_line = 0;
+    if( f == nullptr )
+        return false;
+    char buf[256];
+    bool ok = true;
+    while( ok && fgets(buf, sizeof(buf), f) )
+    {
+        (*error_line)++;
+        buf[strcspn(buf, ";#\r\n")] = 0;
+        char *p = buf + strspn(buf, " \t");
+        if( *p != 0 )
+            ok = parse_stimulus(sim, p);
+    }
+    fclose(f);
+    periph_stimulus(sim);
+    return ok;
+}
+
+//----------------------------------------------------------------------
+// Executes until cycles reaches stop_cycles or left instructions ran,
+// returns the instructions left
+static uint64_t run_ops(SIM_t *sim, uint64_t left)
+{
+    const SIM_OP_t *ops = sim->op.data();
+    if( sim->profile )
+    {
+        uint64_t *runs = sim->profile->count.data();
+        uint64_t *cycles = sim->profile->cycles.data();
+        while( left && sim->cycles < sim->stop_cycles )
+        {
+            uint32_t pc = sim->pc;
+            uint64_t before = sim->cycles;
+            ops[pc].exec(sim, &ops[pc]);
+            runs[pc]++;
+            cycles[pc] += sim->cycles - before;
+            left--;
+        }
+    }
+    else
+        while( left && sim->cycles < sim->stop_cycles )
+        {
+            const SIM_OP_t *op = &ops[sim->pc];
+            op->exec(sim, op);
+            left--;
+        }
+    return left;
+}
+
+//----------------------------------------------------------------------
+// run_ops() on translated blocks, without an instruction limit. A block
+// that might cross stop_cycles is interpreted instead.
+static void run_translated(SIM_t *sim)
+{
+    while( sim->cycles < sim->stop_cycles )
+    {
+        uint32_t length;
+        if( !jit_step(sim->jit, sim, &length) )
+            sim->instrs += length - run_ops(sim, length);
+    }
+}
+
+//----------------------------------------------------------------------
+// Runs until max_cycles more cycles or max_instrs more instructions have
+// gone by (0 - no limit) or the program stops, returns SIM_*. The inner
+// loop only compares the cycle count against the next peripheral event
+// or the budget; a handler that stops the program sets the limit to 0.
+// Between events the scheduler fires what is due and takes interrupts.
+// Sleep skips straight to the next event while an interrupt can wake the
+// part, a run that ends asleep goes on sleeping when called again. With
+// sim->jit set, no profile and no instruction limit the inner loop runs
+// translated blocks.
+int sim_run(SIM_t *sim, uint64_t max_cycles, uint64_t max_instrs)
+{
+    uint64_t end = max_cycles ? sim->cycles + max_cycles : ~uint64_t(0);
+    uint64_t left = max_instrs ? max_instrs : ~uint64_t(0);
+    uint64_t count = left;
+    if( sim->status != SIM_SLEEP )
+        sim->status = SIM_RUNNING;
+    while( sim->cycles < end )
+    {
+        if( sim->status == SIM_SLEEP )
+        {
+            if( !periph_can_wake(sim) )
+                break;
+            uint64_t wake = sim->periph.wheel.next_due;
+            sim->cycles = std::max(sim->cycles, std::min(wake, end));
+            if( wake > end )
+                break;
+        }
+        else
+        {
+            sim->stop_cycles = std::min(end, sim->periph.wheel.next_due);
+            if( sim->jit && !sim->profile && max_instrs == 0 )
+                run_translated(sim);
+            else
+                left = run_ops(sim, left);
+            if( sim->status != SIM_RUNNING && sim->status != SIM_SLEEP )
+                break;
+            if( left == 0 )
+                break;
+        }
+        uint32_t vector = periph_update(sim);
+        if( vector )
+        {
+            sim->status = SIM_RUNNING;
+            enter_vector(sim, vector);
+        }
+    }
+    sim->instrs += count - left;
+    return sim->status;
+}
+
+//----------------------------------------------------------------------
+const char *sim_status_name(int status)
+{
+    switch( status ) {
+    case SIM_RUNNING:       return "budget reached";
+    case SIM_SLEEP:         return "sleep";
+    case SIM_BREAK:         return "break";
+    case SIM_BAD_OPCODE:    return "bad opcode";
+    case SIM_RETURNED:      return "returned";
+    }
+    return "?";
+}
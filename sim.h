@@ -0,0 +1,128 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <vector>
+#include "disasm.h"
+#include "periph.h"
+
+// Data space addresses
+#define SIM_RAMPZ   0x5B
+#define SIM_EIND    0x5C
+#define SIM_SPL     0x5D
+#define SIM_SPH     0x5E
+#define SIM_SREG    0x5F
+
+// SREG bits
+#define SREG_C      0x01
+#define SREG_Z      0x02
+#define SREG_N      0x04
+#define SREG_V      0x08
+#define SREG_S      0x10
+#define SREG_H      0x20
+#define SREG_T      0x40
+#define SREG_I      0x80
+
+// sim_run() results
+enum {
+    SIM_RUNNING,        // budget used up, can go on
+    SIM_SLEEP,          // sleep, nothing to wake it before the budget ran out
+    SIM_BREAK,          // break
+    SIM_BAD_OPCODE,     // word that is no instruction, pc points at it
+    SIM_RETURNED        // the handler sim_start_vector() entered returned
+};
+
+// No exit_sp, the run never ends by returning
+#define SIM_NO_EXIT 0x10000
+
+// Pages of the dirty map, the unit snapshots share and copy
+#define SIM_PAGE_SHIFT      6
+#define SIM_PAGE_SIZE       (1u << SIM_PAGE_SHIFT)
+// data[] below this, the register file and I/O space, is written in too
+// many places to track and is always compared on a restore
+#define SIM_TRACKED_FROM    0x60
+
+// Per flash word: how often the instruction there ran and the cycles it
+// took, taken branches and skips included
+typedef struct PROFILE {
+    std::vector<uint64_t> count;
+    std::vector<uint64_t> cycles;
+} PROFILE_t;
+
+struct SIM;
+struct SIM_OP;
+struct JIT;
+typedef void (*SIM_EXEC_t)(struct SIM *sim, const struct SIM_OP *op);
+
+// Predecoded flash word: the handler that executes it and its operands
+// as the decoder extracted them, jump targets already absolute
+typedef struct SIM_OP {
+    SIM_EXEC_t exec;
+    uint8_t rd;
+    uint8_t rr;
+    uint8_t words;      // 1 or 2
+    uint8_t skip;       // words a skip jumps over: 1 + size of the next instruction
+    uint32_t k;
+} SIM_OP_t;
+
+// Simulated part. data[] is the whole data space, so the register file,
+// I/O registers, SREG and SP are plain bytes in it and in/out/lds/sts
+// need no special cases. Registers a peripheral model has to see are
+// flagged in hook[]; the model's events sit on a timing wheel and the
+// run loop only leaves the fast path when the next one is due.
+typedef struct SIM {
+    const DEVICE_t *device;
+    const uint16_t *flash;
+    uint32_t flash_words;           // loaded image, the rest reads as erased
+    uint32_t flash_mask;
+    bool pc22;                      // 3 byte return addresses
+    std::vector<SIM_OP_t> op;       // one per flash word, plus a wrap to 0 behind
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> hook;      // HOOK_* per data address
+    std::vector<uint8_t> eeprom;    // kept over sim_reset(), erased at sim_init()
+    uint32_t pc;
+    uint64_t cycles;
+    uint64_t instrs;
+    uint64_t stop_cycles;           // the run loop ends once cycles reaches this
+    uint32_t exit_sp;               // a ret/reti that leaves SP here ends the run
+    int status;
+    PROFILE_t *profile;             // counts per word when set
+    struct JIT *jit;                // translated blocks instead of the interpreter when set
+    PERIPH_t periph;
+    std::vector<uint8_t> dirty;     // per page of data[], then of eeprom[]: written since synced
+    uint32_t synced;                // snapshot memory matched when dirty was cleared, 0 - none
+    uint32_t snapshots;             // ids handed out
+} SIM_t;
+
+inline uint32_t sim_data_pages(const SIM_t *sim)
+{
+    return uint32_t((sim->data.size() + SIM_PAGE_SIZE - 1) >> SIM_PAGE_SHIFT);
+}
+
+inline void sim_mark_data(SIM_t *sim, uint32_t addr)
+{
+    sim->dirty[addr >> SIM_PAGE_SHIFT] = 1;
+}
+
+inline void sim_mark_eeprom(SIM_t *sim, uint32_t addr)
+{
+    sim->dirty[sim_data_pages(sim) + (addr >> SIM_PAGE_SHIFT)] = 1;
+}
+
+// Ends the run loop after the next instruction, so the scheduler looks
+// at interrupts again
+inline void sim_request_update(SIM_t *sim)
+{
+    if( sim->stop_cycles > sim->cycles + 1 )
+        sim->stop_cycles = sim->cycles + 1;
+}
+
+void sim_init(SIM_t *sim, const DISASM_t *ctx);
+void sim_reset(SIM_t *sim);
+void sim_start_vector(SIM_t *sim, uint32_t vector);
+void sim_set_profile(SIM_t *sim, PROFILE_t *profile);
+bool sim_load_stimulus(SIM_t *sim, const char *file_name, uint32_t *error_line);
+int sim_run(SIM_t *sim, uint64_t max_cycles, uint64_t max_instrs);
+const char *sim_status_name(int status);
+
+#endif
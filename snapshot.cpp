@@ -0,0 +1,139 @@
+#include <string.h>
+#include <algorithm>
+#include "snapshot.h"
+
+//----------------------------------------------------------------------
+static uint32_t page_count(size_t bytes)
+{
+    return uint32_t((bytes + SNAP_PAGE_SIZE - 1) / SNAP_PAGE_SIZE);
+}
+
+//----------------------------------------------------------------------
+// Page i of memory, the last one may be short
+static size_t page_bytes(size_t size, uint32_t i)
+{
+    return std::min<size_t>(SNAP_PAGE_SIZE, size - size_t(i) * SNAP_PAGE_SIZE);
+}
+
+//----------------------------------------------------------------------
+// Page i of the snapshot is in the dirty map, the register file and I/O
+// space are not
+static bool tracked(const SNAPSHOT_t *snap, uint32_t i)
+{
+    return i >= snap->data_pages || i >= page_count(SIM_TRACKED_FROM);
+}
+
+//----------------------------------------------------------------------
+// sim memory matches snap but for the pages marked dirty since
+static bool in_sync(const SNAPSHOT_t *snap, const SIM_t *sim)
+{
+    return snap && sim->synced != 0 && sim->synced == snap->id;
+}
+
+//----------------------------------------------------------------------
+static void sync(const SNAPSHOT_t *snap, SIM_t *sim)
+{
+    std::fill(sim->dirty.begin(), sim->dirty.end(), 0);
+    sim->synced = snap->id;
+}
+
+//----------------------------------------------------------------------
+// Takes pages first..first+count of snap from memory. A page base has is
+// shared when the run did not write it or it has the same bytes.
+static void take_pages(SNAPSHOT_t *snap, const SNAPSHOT_t *base, const SIM_t *sim, uint32_t first,
+                       const std::vector<uint8_t> &memory)
+{
+    uint32_t count = page_count(memory.size());
+    bool synced = in_sync(base, sim);
+    for( uint32_t i = 0; i < count; i++ )
+    {
+        const uint8_t *bytes = memory.data() + size_t(i) * SNAP_PAGE_SIZE;
+        size_t n = page_bytes(memory.size(), i);
+        SNAP_PAGE_t *page = base ? base->page[first + i] : nullptr;
+        bool clean = synced && tracked(snap, first + i) && !sim->dirty[first + i];
+        if( page && (clean || memcmp(page->bytes, bytes, n) == 0) )
+            page->refs++;
+        else
+        {
+            page = new SNAP_PAGE_t;
+            page->refs = 1;
+            memset(page->bytes, 0, SNAP_PAGE_SIZE);
+            memcpy(page->bytes, bytes, n);
+            snap->copied++;
+        }
+        snap->page[first + i] = page;
+    }
+}
+
+//----------------------------------------------------------------------
+// Writes back the pages that differ from memory, returns how many. In
+// sync only the written pages and the untracked ones are looked at.
+static uint32_t restore_pages(const SNAPSHOT_t *snap, const SIM_t *sim, uint32_t first,
+                              std::vector<uint8_t> &memory)
+{
+    uint32_t count = page_count(memory.size());
+    uint32_t written = 0;
+    bool synced = in_sync(snap, sim);
+    for( uint32_t i = 0; i < count; i++ )
+    {
+        if( synced && tracked(snap, first + i) && !sim->dirty[first + i] )
+            continue;
+        uint8_t *bytes = memory.data() + size_t(i) * SNAP_PAGE_SIZE;
+        size_t n = page_bytes(memory.size(), i);
+        const SNAP_PAGE_t *page = snap->page[first + i];
+        if( memcmp(bytes, page->bytes, n) != 0 )
+        {
+            memcpy(bytes, page->bytes, n);
+            written++;
+        }
+    }
+    return written;
+}
+
+//----------------------------------------------------------------------
+// Checkpoints sim into an empty snap. base, nullptr or an earlier
+// snapshot of the same sim, lends the pages that did not change since.
+void snapshot_take(SNAPSHOT_t *snap, SIM_t *sim, const SNAPSHOT_t *base)
+{
+    snap->id = ++sim->snapshots;
+    snap->data_pages = page_count(sim->data.size());
+    snap->page.assign(snap->data_pages + page_count(sim->eeprom.size()), nullptr);
+    snap->copied = 0;
+    take_pages(snap, base, sim, 0, sim->data);
+    take_pages(snap, base, sim, snap->data_pages, sim->eeprom);
+    snap->pc = sim->pc;
+    snap->cycles = sim->cycles;
+    snap->instrs = sim->instrs;
+    snap->exit_sp = sim->exit_sp;
+    snap->status = sim->status;
+    snap->periph = sim->periph;
+    sync(snap, sim);
+}
+
+//----------------------------------------------------------------------
+// Puts sim back to the state of snap. Back from a run off snap only the
+// pages it wrote are copied, otherwise every page is compared. The rest
+// of the cost is the peripheral state. Returns the pages written.
+uint32_t snapshot_restore(const SNAPSHOT_t *snap, SIM_t *sim)
+{
+    uint32_t written = restore_pages(snap, sim, 0, sim->data);
+    written += restore_pages(snap, sim, snap->data_pages, sim->eeprom);
+    sim->pc = snap->pc;
+    sim->cycles = snap->cycles;
+    sim->instrs = snap->instrs;
+    sim->exit_sp = snap->exit_sp;
+    sim->status = snap->status;
+    sim->periph = snap->periph;
+    sync(snap, sim);
+    return written;
+}
+
+//----------------------------------------------------------------------
+// Drops the pages no other snapshot shares
+void snapshot_free(SNAPSHOT_t *snap)
+{
+    for( size_t i = 0; i < snap->page.size(); i++ )
+        if( --snap->page[i]->refs == 0 )
+            delete snap->page[i];
+    snap->page.clear();
+}
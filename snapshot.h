@@ -0,0 +1,41 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <vector>
+#include "sim.h"
+
+// Bytes per copy-on-write page of the data space and EEPROM
+#define SNAP_PAGE_SIZE  SIM_PAGE_SIZE
+
+typedef struct SNAP_PAGE {
+    uint32_t refs;              // snapshots holding the page
+    uint8_t bytes[SNAP_PAGE_SIZE];
+} SNAP_PAGE_t;
+
+// Checkpoint of everything a run changes: CPU, data space, EEPROM and
+// the peripheral models. Memory is a table of read-only pages. The
+// simulator marks the pages it writes in its dirty map, so a snapshot
+// taken after the base shares every page the run left alone, and a
+// restore to the snapshot the simulator last synced with copies back only
+// the written pages plus the register and I/O space. Flash, the
+// predecoded ops and translated code belong to the loaded image and are
+// never part of a snapshot.
+typedef struct SNAPSHOT {
+    std::vector<SNAP_PAGE_t *> page;    // data space pages, then EEPROM pages
+    uint32_t id;                        // the sim's synced value while in sync with it
+    uint32_t data_pages;
+    uint32_t pc;
+    uint64_t cycles;
+    uint64_t instrs;
+    uint32_t exit_sp;
+    int status;
+    PERIPH_t periph;
+    uint32_t copied;                    // pages not shared with the base
+} SNAPSHOT_t;
+
+void snapshot_take(SNAPSHOT_t *snap, SIM_t *sim, const SNAPSHOT_t *base);
+uint32_t snapshot_restore(const SNAPSHOT_t *snap, SIM_t *sim);
+void snapshot_free(SNAPSHOT_t *snap);
+
+#endif
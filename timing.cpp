@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <functional>
+#include "timing.h"
+
+#define CYCLES_NONE 0xFFFFFFFFu
+
+//----------------------------------------------------------------------
+// Cycles of the decoded instruction at addr: min and max differ for a
+// branch (not taken, taken) and a skip (no skip, skip over the next
+// instruction of one or two words). Parts with more than 64K words of
+// flash push a 3 byte return address, which costs calls and returns one
+// more cycle. spm depends on the flash operation and counts 1.
+void instr_cycles(const DISASM_t *ctx, uint32_t addr, uint32_t *min, uint32_t *max)
+{
+    const INSTR_t *instr = &ctx->line[addr].instr;
+    uint32_t pc3 = ctx->device->flash_words > 0x10000 ? 1 : 0;
+    uint32_t cycles = 1;
+    switch( instr->mnem ) {
+    case MN_ADIW:
+    case MN_SBIW:
+    case MN_MUL:
+    case MN_LDD:
+    case MN_STD:
+    case MN_LDS:
+    case MN_STS:
+    case MN_ST:
+    case MN_PUSH:
+    case MN_POP:
+    case MN_CBI:
+    case MN_SBI:
+    case MN_RJMP:
+    case MN_IJMP:
+    case MN_EIJMP:
+        cycles = 2;
+        break;
+    case MN_LD:
+        cycles = (instr->rr == PTR_X_DEC || instr->rr == PTR_Y_DEC || instr->rr == PTR_Z_DEC) ? 3 : 2;
+        break;
+    case MN_LPM:
+    case MN_ELPM:
+    case MN_LPM_R0:
+    case MN_ELPM_R0:
+    case MN_JMP:
+        cycles = 3;
+        break;
+    case MN_RCALL:
+    case MN_ICALL:
+        cycles = 3 + pc3;
+        break;
+    case MN_EICALL:
+        cycles = 4;
+        break;
+    case MN_CALL:
+    case MN_RET:
+    case MN_RETI:
+        cycles = 4 + pc3;
+        break;
+    case MN_CPSE:
+    case MN_SBIC:
+    case MN_SBIS:
+    case MN_SBRC:
+    case MN_SBRS:
+    {
+        uint32_t succ[2];
+        *min = 1;
+        *max = instr_successors(ctx, addr, succ) > 1 ? succ[1] - addr : 2;
+        return;
+    }
+    }
+    *min = cycles;
+    *max = cycles;
+    if( instr->mnem >= MN_BRLO && instr->mnem <= MN_BRID )
+        *max = 2;
+}
+
+//----------------------------------------------------------------------
+static bool is_call(uint8_t mnem)
+{
+    return mnem == MN_RCALL || mnem == MN_CALL || mnem == MN_ICALL || mnem == MN_EICALL;
+}
+
+//----------------------------------------------------------------------
+// Adds the cycles of the function called at addr to min/max, the call
+// instruction itself is not included. A callee that state does not
+// have timed yet is recursion.
+static void add_callee(const DISASM_t *ctx, const TIMING_t *timing, const std::vector<uint8_t> *state,
+                       uint32_t addr, uint32_t *min, uint32_t *max, uint8_t *flags)
+{
+    const INSTR_t *instr = &ctx->line[addr].instr;
+    uint32_t target = instr->k;
+    if( instr->mnem == MN_EICALL || (instr->mnem == MN_ICALL && !line_is(ctx, PLANE_RESOLVED, addr)) )
+    {
+        *flags |= TIMING_INDIRECT;
+        return;
+    }
+    if( instr->mnem == MN_ICALL )
+        target = indirect_target(ctx, addr);
+    uint32_t b = cfg_find_block(timing->cfg, target);
+    if( b == CFG_NONE || timing->entry_func[b] == CFG_NONE )
+        return;
+    uint32_t g = timing->entry_func[b];
+    if( state && (*state)[g] != 2 )
+    {
+        *flags |= TIMING_RECURSIVE;
+        return;
+    }
+    *min += timing->func_min[g];
+    *max += timing->func_max[g];
+    *flags |= timing->func_flags[g] & ~TIMING_NO_RETURN;
+}
+
+//----------------------------------------------------------------------
+// Shortest and longest path through function f from the instruction at
+// from to a ret, a tail jump or, with stop, the first instruction stop
+// accepts, that instruction included. Blocks are taken in reverse post
+// order, which is a topological order once the edges that go back in it
+// are dropped. Callees are timed already unless state says otherwise,
+// which is recursion.
+static void walk_paths(const DISASM_t *ctx, const TIMING_t *timing, uint32_t f, uint32_t from,
+                       const std::vector<uint8_t> *state, const std::function<bool(uint32_t)> *stop,
+                       uint32_t *path_min, uint32_t *path_max, uint8_t *path_flags)
+{
+    const CFG_t *cfg = timing->cfg;
+    const uint32_t *own = &cfg->func_block[cfg->func_first[f]];
+    uint32_t n = cfg->func_first[f + 1] - cfg->func_first[f];
+    // own[] is the entry and then the other blocks in address order
+    auto position = [&](uint32_t b) {
+        if( own[0] == b )
+            return uint32_t(0);
+        const uint32_t *it = std::lower_bound(own + 1, own + n, b);
+        return (it != own + n && *it == b) ? uint32_t(it - own) : CFG_NONE;
+    };
+    uint32_t first = position(cfg_find_block(cfg, from));
+
+    std::vector<uint32_t> order;        // post order, reversed below
+    std::vector<uint32_t> rank(n, CFG_NONE);
+    std::vector<uint8_t> seen(n, 0);
+    std::vector<uint32_t> path_pos;
+    std::vector<uint32_t> path_edge;
+    seen[first] = 1;
+    path_pos.push_back(first);
+    path_edge.push_back(cfg->succ_first[own[first]]);
+    while( !path_pos.empty() )
+    {
+        uint32_t p = path_pos.back();
+        uint32_t &e = path_edge.back();
+        if( e == cfg->succ_first[own[p] + 1] )
+        {
+            order.push_back(p);
+            path_pos.pop_back();
+            path_edge.pop_back();
+            continue;
+        }
+        uint32_t q = position(cfg->succ[e++]);
+        if( q != CFG_NONE && !seen[q] )
+        {
+            seen[q] = 1;
+            path_pos.push_back(q);
+            path_edge.push_back(cfg->succ_first[own[q]]);
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    for( uint32_t i = 0; i < order.size(); i++ )
+        rank[order[i]] = i;
+
+    std::vector<uint32_t> dist_min(n, CYCLES_NONE);
+    std::vector<uint32_t> dist_max(n, 0);
+    uint32_t exit_min = CYCLES_NONE;
+    uint32_t exit_max = 0;
+    uint8_t flags = 0;
+    dist_min[first] = 0;
+    // a path that leaves the function before stop ends leaves the region open
+    uint8_t leave = stop ? TIMING_OPEN : 0;
+    auto add_exit = [&](uint32_t lo, uint32_t hi) {
+        exit_min = std::min(exit_min, lo);
+        exit_max = std::max(exit_max, hi);
+    };
+    for( uint32_t i = 0; i < order.size(); i++ )
+    {
+        uint32_t p = order[i];
+        uint32_t b = own[p];
+        uint32_t last = cfg->block_last[b];
+        uint32_t lo = dist_min[p];
+        uint32_t hi = dist_max[p];
+        uint32_t c_min, c_max;
+        bool stopped = false;
+        for( uint32_t addr = p == first ? from : cfg->block_start[b]; addr <= last;
+             addr += instr_words(ctx->line[addr].instr.mnem) )
+        {
+            if( stop && addr != from && (*stop)(addr) )
+            {
+                instr_cycles(ctx, addr, &c_min, &c_max);
+                add_exit(lo + c_min, hi + c_max);
+                stopped = true;
+                break;
+            }
+            if( is_call(ctx->line[addr].instr.mnem) )
+                add_callee(ctx, timing, state, addr, &lo, &hi, &flags);
+            if( addr == last )
+                break;
+            instr_cycles(ctx, addr, &c_min, &c_max);
+            lo += c_min;
+            hi += c_max;
+        }
+        if( stopped )
+            continue;
+        // the last instruction costs what the edge taken out of it does
+        instr_cycles(ctx, last, &c_min, &c_max);
+        uint32_t fall = last + instr_words(ctx->line[last].instr.mnem);
+        if( cfg->block_flags[b] & BLOCK_INDIRECT )
+            flags |= TIMING_INDIRECT;
+        if( cfg->succ_first[b] == cfg->succ_first[b + 1] )
+        {
+            add_exit(lo + c_min, hi + c_max);
+            flags |= leave;
+        }
+        for( uint32_t e = cfg->succ_first[b]; e < cfg->succ_first[b + 1]; e++ )
+        {
+            uint32_t s = cfg->succ[e];
+            uint32_t s_min = lo + (cfg->block_start[s] == fall ? c_min : c_max);
+            uint32_t s_max = hi + (cfg->block_start[s] == fall ? c_min : c_max);
+            uint32_t q = position(s);
+            if( q == CFG_NONE )
+            {
+                // tail jump into another function
+                uint32_t g = timing->entry_func[s];
+                if( g != CFG_NONE && (state == nullptr || (*state)[g] == 2) )
+                {
+                    s_min += timing->func_min[g];
+                    s_max += timing->func_max[g];
+                    flags |= timing->func_flags[g] & ~TIMING_NO_RETURN;
+                }
+                else if( g != CFG_NONE )
+                    flags |= TIMING_RECURSIVE;
+                add_exit(s_min, s_max);
+                flags |= leave;
+            }
+            else if( rank[q] <= i )
+                flags |= TIMING_LOOPS;
+            else
+            {
+                dist_min[q] = std::min(dist_min[q], s_min);
+                dist_max[q] = std::max(dist_max[q], s_max);
+            }
+        }
+    }
+    if( exit_min == CYCLES_NONE )
+    {
+        flags |= TIMING_NO_RETURN;
+        exit_min = 0;
+        exit_max = 0;
+    }
+    *path_min = exit_min;
+    *path_max = exit_max;
+    *path_flags = flags;
+}
+
+//----------------------------------------------------------------------
+// Cycles from the instruction at from, which is in function func, until
+// stop accepts an instruction. Paths that return or jump out of func
+// first end there and set TIMING_OPEN. Needs analyze_timing() done.
+void region_cycles(const DISASM_t *ctx, const TIMING_t *timing, uint32_t func, uint32_t from,
+                   const std::function<bool(uint32_t)> &stop, uint32_t *min, uint32_t *max, uint8_t *flags)
+{
+    walk_paths(ctx, timing, func, from, nullptr, &stop, min, max, flags);
+}
+
+//----------------------------------------------------------------------
+// Block sums in one pass, then the functions callees first: a depth
+// first walk of the call graph times a function once all it calls is
+// timed. A callee still on the walk is recursion.
+void analyze_timing(const DISASM_t *ctx, const CFG_t *cfg, TIMING_t *timing)
+{
+    uint32_t block_count = cfg_block_count(cfg);
+    uint32_t func_count = cfg_func_count(cfg);
+    timing->cfg = cfg;
+    timing->block_min.assign(block_count, 0);
+    timing->block_max.assign(block_count, 0);
+    timing->entry_func.assign(block_count, CFG_NONE);
+    timing->func_min.assign(func_count, 0);
+    timing->func_max.assign(func_count, 0);
+    timing->func_flags.assign(func_count, 0);
+    for( uint32_t b = 0; b < block_count; b++ )
+        for( uint32_t addr = cfg->block_start[b]; addr <= cfg->block_last[b];
+             addr += instr_words(ctx->line[addr].instr.mnem) )
+        {
+            uint32_t c_min, c_max;
+            instr_cycles(ctx, addr, &c_min, &c_max);
+            timing->block_min[b] += c_min;
+            timing->block_max[b] += c_max;
+        }
+    for( uint32_t f = 0; f < func_count; f++ )
+        timing->entry_func[cfg->func_entry[f]] = f;
+
+    std::vector<uint8_t> state(func_count, 0);     // 0 - new, 1 - on the walk, 2 - timed
+    std::vector<uint32_t> path_func;
+    std::vector<uint32_t> path_next;
+    for( uint32_t root = 0; root < func_count; root++ )
+    {
+        if( state[root] )
+            continue;
+        state[root] = 1;
+        path_func.push_back(root);
+        path_next.push_back(cfg->callee_first[root]);
+        while( !path_func.empty() )
+        {
+            uint32_t f = path_func.back();
+            uint32_t &c = path_next.back();
+            if( c < cfg->callee_first[f + 1] )
+            {
+                uint32_t g = cfg->callee[c++];
+                if( state[g] == 0 )
+                {
+                    state[g] = 1;
+                    path_func.push_back(g);
+                    path_next.push_back(cfg->callee_first[g]);
+                }
+                continue;
+            }
+            walk_paths(ctx, timing, f, cfg->block_start[cfg->func_entry[f]], &state, nullptr,
+                       &timing->func_min[f], &timing->func_max[f], &timing->func_flags[f]);
+            state[f] = 2;
+            path_func.pop_back();
+            path_next.pop_back();
+        }
+    }
+}
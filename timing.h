@@ -0,0 +1,35 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include "cfg.h"
+
+// func_flags, why func_max is an estimate rather than a bound
+#define TIMING_LOOPS        0x01    // has loops, every loop body counts once
+#define TIMING_RECURSIVE    0x02    // calls back into itself, that call counts nothing
+#define TIMING_INDIRECT     0x04    // unresolved icall/ijmp, counts nothing
+#define TIMING_NO_RETURN    0x08    // no path reaches a ret, min and max are 0
+#define TIMING_OPEN         0x10    // region_cycles(): a path left the function first
+
+// Cycle counts of the classic megaAVR core over a CFG. A block counts
+// its own instructions only, a call in it is the call instruction. A
+// function counts from its entry to any ret or tail jump, callees
+// included, with loops cut at their back edge.
+typedef struct TIMING {
+    const CFG_t *cfg;
+    std::vector<uint32_t> block_min;
+    std::vector<uint32_t> block_max;
+    std::vector<uint32_t> entry_func;   // per block, the function it is the entry of or CFG_NONE
+    std::vector<uint32_t> func_min;
+    std::vector<uint32_t> func_max;
+    std::vector<uint8_t> func_flags;    // TIMING_* of the function and its callees
+} TIMING_t;
+
+void instr_cycles(const DISASM_t *ctx, uint32_t addr, uint32_t *min, uint32_t *max);
+void analyze_timing(const DISASM_t *ctx, const CFG_t *cfg, TIMING_t *timing);
+void region_cycles(const DISASM_t *ctx, const TIMING_t *timing, uint32_t func, uint32_t from,
+                   const std::function<bool(uint32_t)> &stop, uint32_t *min, uint32_t *max, uint8_t *flags);
+
+#endif
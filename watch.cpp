@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <thread>
+#include "disasm.h"
+#include "loader.h"
+#include "listing.h"
+#include "pointers.h"
+#include "timing.h"
+#include "watch.h"
+
+typedef std::chrono::steady_clock CLOCK_t;
+
+typedef struct FILE_STAMP {
+    bool exists;
+    long long size;
+    long long mtime;
+    long long mtime_ns;
+} FILE_STAMP_t;
+
+//----------------------------------------------------------------------
+static FILE_STAMP_t file_stamp(const char *file_name)
+{
+    FILE_STAMP_t stamp = { false, 0, 0, 0 };
+    struct stat st;
+    if( stat(file_name, &st) != 0 )
+        return stamp;
+    stamp.exists = true;
+    stamp.size = (long long)st.st_size;
+    stamp.mtime = (long long)st.st_mtime;
+#ifdef __linux__
+    stamp.mtime_ns = (long long)st.st_mtim.tv_nsec;
+#endif
+    return stamp;
+}
+
+//----------------------------------------------------------------------
+static bool same_stamp(const FILE_STAMP_t *a, const FILE_STAMP_t *b)
+{
+    return    a->exists == b->exists && a->size == b->size
+           && a->mtime == b->mtime && a->mtime_ns == b->mtime_ns;
+}
+
+//----------------------------------------------------------------------
+// Returns once the file has changed and then held still for one poll,
+// so a build that is still writing it is not picked up half way
+static void wait_for_change(const char *file_name, FILE_STAMP_t *stamp)
+{
+    for(;;)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_POLL_MS));
+        FILE_STAMP_t now = file_stamp(file_name);
+        if( same_stamp(&now, stamp) )
+            continue;
+        *stamp = now;
+        std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_POLL_MS));
+        now = file_stamp(file_name);
+        if( same_stamp(&now, stamp) && now.exists )
+            return;
+        *stamp = now;
+    }
+}
+
+//----------------------------------------------------------------------
+static bool same_labels(const std::vector<LABEL_t> &a, const std::vector<LABEL_t> &b)
+{
+    if( a.size() != b.size() )
+        return false;
+    for( size_t i = 0; i < a.size(); i++ )
+        if( a[i].addr != b[i].addr || a[i].code != b[i].code || a[i].name != b[i].name )
+            return false;
+    return true;
+}
+
+//----------------------------------------------------------------------
+// Disassembles in_file, then again every time it changes. A revision is
+// decoded with redecode_dump() against the previous one and only the
+// listing chunks that changed are rendered. Changed code labels, or a
+// revision that does not decode, fall back to a fresh decode, and so does
+// every revision with pointer tracking, which works on the whole image.
+// Cycle counts are redone on the whole graph and render every chunk.
+// Runs until the process is stopped.
+int watch_image(const char *in_file, const char *asm_file, const DEVICE_t *device, bool sweep, bool pointers,
+                bool cycles)
+{
+    DISASM_t *ctx = disasm_acquire();
+    LISTING_CACHE_t cache;
+    std::vector<uint16_t> prev_code;
+    std::vector<LABEL_t> prev_labels;
+    bool decoded = false;
+    FILE_STAMP_t stamp = file_stamp(in_file);
+    printf("Watching %s, listing goes to %s\n", in_file, asm_file);
+    for(;;)
+    {
+        CLOCK_t::time_point t0 = CLOCK_t::now();
+        uint32_t error_line = 0;
+        int load_status = load_image(ctx, in_file, &error_line);
+        if( load_status == LOAD_NO_FILE )
+            printf("Can't open  %s\n", in_file);
+        else if( load_status != LOAD_OK )
+            printf("%s:%u: %s\n", in_file, error_line, load_status_name(load_status));
+        else
+        {
+            REDECODE_STATS_t stats;
+            bool full = !decoded || pointers || !same_labels(prev_labels, ctx->labels);
+            if( !full )
+                decoded = redecode_dump(ctx, prev_code.data(), uint32_t(prev_code.size()), &stats);
+            if( full || !decoded )
+            {
+                init_vars(ctx, device);
+                decoded = decode_dump(ctx);
+                full = true;
+            }
+            if( decoded && pointers )
+            {
+                POINTER_STATS_t pointer_stats;
+                track_pointers(ctx, 0, &pointer_stats);
+            }
+            if( decoded && sweep )
+                sweep_dump(ctx);
+            CFG_t cfg;
+            TIMING_t timing;
+            if( decoded && cycles )
+            {
+                build_cfg(ctx, &cfg, 0);
+                analyze_timing(ctx, &cfg, &timing);
+            }
+            prev_code.assign(ctx->code, ctx->code + ctx->code_words);
+            prev_labels = ctx->labels;
+            if( !decoded )
+                puts("Decoding failed");
+            else if( !print_code(ctx, asm_file, 0, &cache, cycles ? &timing : nullptr) )
+                printf("Can't write %s\n", asm_file);
+            else
+            {
+                double ms = std::chrono::duration<double, std::milli>(CLOCK_t::now() - t0).count();
+                if( full )
+                    printf("%s: decoded, %.2f ms\n", in_file, ms);
+                else
+                    printf("%s: %u pages changed, %u lines redone, %u dropped, %.2f ms\n", in_file,
+                           stats.dirty_pages, stats.invalidated, stats.collected, ms);
+            }
+        }
+        fflush(stdout);
+        wait_for_change(in_file, &stamp);
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "device.h"
+
+// How often the input file is checked for changes
+#define WATCH_POLL_MS 100
+
+int watch_image(const char *in_file, const char *asm_file, const DEVICE_t *device, bool sweep, bool pointers,
+                bool cycles);
+
+#endif
@@ -0,0 +1,125 @@
+#include "math_utils.h"
+#include "wheel.h"
+
+//----------------------------------------------------------------------
+void wheel_init(EVENT_WHEEL_t *wheel, uint32_t events)
+{
+    WHEEL_EVENT_t idle = { WHEEL_NEVER, WHEEL_NONE, WHEEL_NONE, false };
+    wheel->event.assign(events, idle);
+    for( uint32_t i = 0; i < WHEEL_SLOTS; i++ )
+        wheel->head[i] = WHEEL_NONE;
+    for( uint32_t i = 0; i < WHEEL_SLOTS / 64; i++ )
+        wheel->occupied[i] = 0;
+    wheel->next_due = WHEEL_NEVER;
+    wheel->queued = 0;
+}
+
+//----------------------------------------------------------------------
+// Slots from slot on to the next occupied one, going round the wheel,
+// WHEEL_SLOTS if all are empty
+static uint32_t next_occupied(const EVENT_WHEEL_t *wheel, uint32_t slot)
+{
+    const uint32_t words = WHEEL_SLOTS / 64;
+    for( uint32_t i = 0; i <= words; i++ )
+    {
+        uint32_t w = ((slot >> 6) + i) % words;
+        uint64_t bits = wheel->occupied[w];
+        if( i == 0 )
+            bits &= ~uint64_t(0) << (slot & 63);
+        else if( i == words )
+            bits &= (uint64_t(1) << (slot & 63)) - 1;
+        if( bits )
+            return (w * 64 + uint32_t(ctz64(bits)) - slot) & (WHEEL_SLOTS - 1);
+    }
+    return WHEEL_SLOTS;
+}
+
+//----------------------------------------------------------------------
+// Earliest event at or after from: one turn of the wheel looks for an
+// event due within that turn, past that every queued event is compared
+static uint64_t find_next_due(const EVENT_WHEEL_t *wheel, uint64_t from)
+{
+    if( wheel->queued == 0 )
+        return WHEEL_NEVER;
+    for( uint64_t t = from; t < from + WHEEL_SLOTS; t++ )
+    {
+        t += next_occupied(wheel, uint32_t(t & (WHEEL_SLOTS - 1)));
+        if( t >= from + WHEEL_SLOTS )
+            break;
+        for( uint32_t id = wheel->head[t & (WHEEL_SLOTS - 1)]; id != WHEEL_NONE; id = wheel->event[id].next )
+            if( wheel->event[id].due == t )
+                return t;
+    }
+    uint64_t next = WHEEL_NEVER;
+    for( uint32_t id = 0; id < wheel->event.size(); id++ )
+        if( wheel->event[id].queued && wheel->event[id].due < next )
+            next = wheel->event[id].due;
+    return next;
+}
+
+//----------------------------------------------------------------------
+static void unlink(EVENT_WHEEL_t *wheel, uint32_t id)
+{
+    WHEEL_EVENT_t *ev = &wheel->event[id];
+    if( ev->prev != WHEEL_NONE )
+        wheel->event[ev->prev].next = ev->next;
+    else
+    {
+        uint32_t slot = uint32_t(ev->due & (WHEEL_SLOTS - 1));
+        wheel->head[slot] = ev->next;
+        if( ev->next == WHEEL_NONE )
+            wheel->occupied[slot >> 6] &= ~(uint64_t(1) << (slot & 63));
+    }
+    if( ev->next != WHEEL_NONE )
+        wheel->event[ev->next].prev = ev->prev;
+    ev->queued = false;
+    wheel->queued--;
+}
+
+//----------------------------------------------------------------------
+// Queues event id at cycle due, moving it if it was queued already. Due
+// must not be earlier than the events already popped.
+void wheel_schedule(EVENT_WHEEL_t *wheel, uint32_t id, uint64_t due)
+{
+    wheel_cancel(wheel, id);
+    WHEEL_EVENT_t *ev = &wheel->event[id];
+    uint32_t slot = uint32_t(due & (WHEEL_SLOTS - 1));
+    ev->due = due;
+    ev->prev = WHEEL_NONE;
+    ev->next = wheel->head[slot];
+    if( ev->next != WHEEL_NONE )
+        wheel->event[ev->next].prev = id;
+    wheel->head[slot] = id;
+    wheel->occupied[slot >> 6] |= uint64_t(1) << (slot & 63);
+    ev->queued = true;
+    wheel->queued++;
+    if( due < wheel->next_due )
+        wheel->next_due = due;
+}
+
+//----------------------------------------------------------------------
+void wheel_cancel(EVENT_WHEEL_t *wheel, uint32_t id)
+{
+    if( !wheel->event[id].queued )
+        return;
+    uint64_t due = wheel->event[id].due;
+    unlink(wheel, id);
+    if( due == wheel->next_due )
+        wheel->next_due = find_next_due(wheel, due);
+}
+
+//----------------------------------------------------------------------
+// Takes the next event due at or before now off the wheel, WHEEL_NONE
+// if there is none. Events due at the same cycle come in no set order.
+uint32_t wheel_pop(EVENT_WHEEL_t *wheel, uint64_t now)
+{
+    uint64_t due = wheel->next_due;
+    if( due > now )
+        return WHEEL_NONE;
+    uint32_t id = wheel->head[due & (WHEEL_SLOTS - 1)];
+    while( wheel->event[id].due != due )
+        id = wheel->event[id].next;
+    unlink(wheel, id);
+    wheel->next_due = find_next_due(wheel, due);
+    return id;
+}
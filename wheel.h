@@ -0,0 +1,39 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+#include <vector>
+
+// Slots of the timing wheel, a power of two
+#define WHEEL_SLOTS     256
+#define WHEEL_NONE      0xFFFFFFFFu
+#define WHEEL_NEVER     (~uint64_t(0))
+
+typedef struct WHEEL_EVENT {
+    uint64_t due;
+    uint32_t next;          // slot list links, WHEEL_NONE at the ends
+    uint32_t prev;
+    bool queued;
+} WHEEL_EVENT_t;
+
+// Hashed timing wheel keyed on CPU cycles. Events are a fixed set of ids,
+// each queued at most once; an event due at cycle c hangs in slot
+// c % WHEEL_SLOTS, so scheduling is O(1). Popping, or cancelling the
+// earliest event, looks for the next due one over the occupied slots of
+// one turn with a bit scan; only when nothing is due within that turn
+// are all queued events compared. next_due is what the run loop compares
+// against.
+typedef struct EVENT_WHEEL {
+    std::vector<WHEEL_EVENT_t> event;
+    uint32_t head[WHEEL_SLOTS];
+    uint64_t occupied[WHEEL_SLOTS / 64];    // slots with a non-empty list
+    uint64_t next_due;      // earliest queued event, WHEEL_NEVER if none
+    uint32_t queued;
+} EVENT_WHEEL_t;
+
+void wheel_init(EVENT_WHEEL_t *wheel, uint32_t events);
+void wheel_schedule(EVENT_WHEEL_t *wheel, uint32_t id, uint64_t due);
+void wheel_cancel(EVENT_WHEEL_t *wheel, uint32_t id);
+uint32_t wheel_pop(EVENT_WHEEL_t *wheel, uint64_t now);
+
+#endif
@@ -0,0 +1,82 @@
+#include "word_class.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WORD_CLASS_SSE2
+#endif
+
+//----------------------------------------------------------------------
+static inline bool is_wide(uint16_t word)
+{
+    return    (word & WIDE_MASK_LDS_STS) == WIDE_LDS_STS
+           || (word & WIDE_MASK_JMP_CALL) == WIDE_JMP_CALL;
+}
+
+//----------------------------------------------------------------------
+// Scalar bits for words [from, count) of one 64-word block
+static void classify_tail(const uint16_t *code, uint32_t from, uint32_t count,
+                          uint64_t *erased, uint64_t *wide)
+{
+    for( uint32_t i = from; i < count; i++ )
+    {
+        uint64_t bit = uint64_t(1) << (i & 63);
+        if( code[i] == 0xFFFF )
+            erased[i >> 6] |= bit;
+        if( is_wide(code[i]) )
+            wide[i >> 6] |= bit;
+    }
+}
+
+#ifdef WORD_CLASS_SSE2
+
+//----------------------------------------------------------------------
+// Eight words per step: the compares give 0xFFFF lanes, packing erased
+// and wide lanes into one register yields both 8-bit masks with a
+// single movemask.
+void classify_words(const uint16_t *code, uint32_t count, uint64_t *erased, uint64_t *wide)
+{
+    const __m128i ones = _mm_set1_epi16(-1);
+    const __m128i mask_ls = _mm_set1_epi16(short(WIDE_MASK_LDS_STS));
+    const __m128i val_ls = _mm_set1_epi16(short(WIDE_LDS_STS));
+    const __m128i mask_jc = _mm_set1_epi16(short(WIDE_MASK_JMP_CALL));
+    const __m128i val_jc = _mm_set1_epi16(short(WIDE_JMP_CALL));
+    uint32_t blocks = count / 64;
+    for( uint32_t b = 0; b < blocks; b++ )
+    {
+        uint64_t e = 0, w = 0;
+        const uint16_t *p = code + b * 64;
+        for( int i = 0; i < 8; i++ )
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 8));
+            __m128i ve = _mm_cmpeq_epi16(v, ones);
+            __m128i vw = _mm_or_si128(_mm_cmpeq_epi16(_mm_and_si128(v, mask_ls), val_ls),
+                                      _mm_cmpeq_epi16(_mm_and_si128(v, mask_jc), val_jc));
+            uint32_t bits = uint32_t(_mm_movemask_epi8(_mm_packs_epi16(ve, vw)));
+            e |= uint64_t(bits & 0xFF) << (i * 8);
+            w |= uint64_t(bits >> 8) << (i * 8);
+        }
+        erased[b] = e;
+        wide[b] = w;
+    }
+    if( count & 63 )
+    {
+        erased[blocks] = 0;
+        wide[blocks] = 0;
+        classify_tail(code, blocks * 64, count, erased, wide);
+    }
+}
+
+#else
+
+//----------------------------------------------------------------------
+void classify_words(const uint16_t *code, uint32_t count, uint64_t *erased, uint64_t *wide)
+{
+    for( uint32_t b = 0; b < (count + 63) / 64; b++ )
+    {
+        erased[b] = 0;
+        wide[b] = 0;
+    }
+    classify_tail(code, 0, count, erased, wide);
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef WORD_CLASS_H
+#define WORD_CLASS_H
+
+#include <stdint.h>
+
+// 2-word instruction prefixes: lds/sts and jmp/call
+#define WIDE_MASK_LDS_STS   0xFC0F
+#define WIDE_LDS_STS        0x9000
+#define WIDE_MASK_JMP_CALL  0xFE0C
+#define WIDE_JMP_CALL       0x940C
+
+// Sets bit i of erased[] for 0xFFFF words and of wide[] for words that
+// start a 2-word instruction. Both bitmaps hold (count + 63) / 64 words.
+void classify_words(const uint16_t *code, uint32_t count, uint64_t *erased, uint64_t *wide);
+
+#endif